@@ -0,0 +1,259 @@
+#!/bin/bash
+#
+# netns-bench.sh - End-to-end throughput benchmark of paris-traceroute and
+# paris-ping on an emulated network.
+#
+# The emulated network is made of network namespaces connected by veth pairs.
+# Routers are plain Linux namespaces with forwarding enabled, so they
+# decrement the TTL and send ICMP time exceeded errors quoting the probes
+# (ICMP rate limiting is disabled). The first router balances the traffic
+# over two links (ECMP, hashed on the layer 4 header), hence a diamond at
+# hop 2. A netem delay is added in front of the destination.
+#
+#   ptb_src --- ptb_r1 ===(2 links)=== ptb_r2 --- (delay) --- ptb_dst
+#
+# Each step runs a growing number of concurrent instances of the tool during
+# a fixed duration, and reports:
+#   - pps        : probes sent per second (veth counters of ptb_src);
+#   - match_rate : replies matched by the tool / replies received (veth
+#                  counters). Not available for mda;
+#   - cpu_us     : CPU time (user + system) consumed per probe, including
+#                  the start-up of each process;
+#   - rtt_error  : mean RTT measured to the destination minus the netem delay.
+#
+# Results are written in CSV (see -o). Requires root, iproute2 and tc.
+# Extra options can be passed to the tool with -a (e.g. -a --io-uring).
+#
+# Usage: netns-bench.sh [-b BUILD_DIR] [-t traceroute|mda|ping] [-d SECONDS]
+#                       [-c "1 2 4 8"] [-D DELAY_MS] [-a TOOL_OPTIONS]
+#                       [-o RESULTS.csv] [-k]
+
+set -u
+
+BUILD_DIR=.
+TOOL=traceroute
+DURATION=5
+CONCURRENCY="1 2 4 8 16"
+DELAY_MS=10
+OUTPUT=/dev/stdout
+KEEP=0
+TOOL_OPTIONS=""
+
+NAMESPACES="ptb_src ptb_r1 ptb_r2 ptb_dst"
+DST_IP=10.99.3.2
+
+usage() {
+    log "usage: $0 [-b BUILD_DIR] [-t traceroute|mda|ping] [-d SECONDS]"
+    log "       [-c \"1 2 4 8\"] [-D DELAY_MS] [-a TOOL_OPTIONS] [-o RESULTS.csv] [-k]"
+    exit 1
+}
+
+log() {
+    echo "$@" >&2
+}
+
+in_ns() {
+    local ns=$1
+    shift
+    ip netns exec "$ns" "$@"
+}
+
+#----------------------------------------------------------------------------
+# Emulated network
+#----------------------------------------------------------------------------
+
+teardown() {
+    local ns
+    for ns in $NAMESPACES; do
+        ip netns del "$ns" 2>/dev/null
+    done
+}
+
+# link NS1 IF1 ADDR1 NS2 IF2 ADDR2
+link() {
+    ip link add "$2" netns "$1" type veth peer name "$5" netns "$4" || return 1
+    in_ns "$1" ip addr add "$3/24" dev "$2"
+    in_ns "$4" ip addr add "$6/24" dev "$5"
+    in_ns "$1" ip link set "$2" up
+    in_ns "$4" ip link set "$5" up
+}
+
+setup() {
+    local ns conf
+
+    teardown
+    for ns in $NAMESPACES; do
+        ip netns add "$ns" || return 1
+        in_ns "$ns" ip link set lo up
+    done
+
+    link ptb_src s0 10.99.0.1 ptb_r1 r0 10.99.0.2 || return 1
+    link ptb_r1  a0 10.99.1.1 ptb_r2 a1 10.99.1.2 || return 1
+    link ptb_r1  b0 10.99.2.1 ptb_r2 b1 10.99.2.2 || return 1
+    link ptb_r2  c0 10.99.3.1 ptb_dst d0 10.99.3.2 || return 1
+
+    in_ns ptb_src ip route add default via 10.99.0.2
+    in_ns ptb_r1  ip route add 10.99.3.0/24 nexthop via 10.99.1.2 nexthop via 10.99.2.2
+    in_ns ptb_r2  ip route add 10.99.0.0/24 via 10.99.1.1
+    in_ns ptb_dst ip route add default via 10.99.3.1
+
+    for ns in $NAMESPACES; do
+        in_ns "$ns" sysctl -q -w \
+            net.ipv4.ip_forward=1 \
+            net.ipv4.icmp_ratelimit=0 \
+            net.ipv4.icmp_msgs_per_sec=10000000 \
+            net.ipv4.icmp_msgs_burst=10000000 \
+            net.ipv4.fib_multipath_hash_policy=1 \
+            net.ipv4.icmp_errors_use_inbound_ifaddr=1 >/dev/null
+        # Asymmetric routing: ptb_r2 answers through a single link.
+        for conf in $(in_ns "$ns" sh -c 'echo /proc/sys/net/ipv4/conf/*/rp_filter'); do
+            in_ns "$ns" sh -c "echo 0 > $conf"
+        done
+    done
+
+    if ! in_ns ptb_r2 tc qdisc add dev c0 root netem delay "${DELAY_MS}ms" limit 100000 2>/dev/null; then
+        log "W: netem is not available, RTT errors are computed without delay"
+        DELAY_MS=0
+    fi
+}
+
+#----------------------------------------------------------------------------
+# Workload
+#----------------------------------------------------------------------------
+
+run_tool() {
+    case "$TOOL" in
+        traceroute) in_ns ptb_src "$PARIS_TRACEROUTE" -n -m 4 $TOOL_OPTIONS "$DST_IP" ;;
+        mda)        in_ns ptb_src "$PARIS_TRACEROUTE" -n -m 4 -a mda $TOOL_OPTIONS "$DST_IP" ;;
+        ping)       in_ns ptb_src "$PARIS_PING" -c 1 $TOOL_OPTIONS "$DST_IP" ;;
+    esac
+}
+
+# worker OUTPUT_FILE: run the tool back to back during $DURATION seconds.
+worker() {
+    local end=$((SECONDS + DURATION))
+    while [ $SECONDS -lt $end ]; do
+        run_tool >> "$1" 2>/dev/null
+    done
+}
+
+counter() {
+    in_ns ptb_src cat "/sys/class/net/s0/statistics/$1"
+}
+
+# Number of replies matched by the tool and RTTs (in ms) measured to the
+# destination, extracted from its output.
+matched_replies() {
+    case "$TOOL" in
+        traceroute) grep -o '[0-9.]*ms' "$@" | wc -l ;;
+        ping)       cat "$@" | grep -c 'time=' ;;
+        mda)        echo "" ;;
+    esac
+}
+
+destination_rtts() {
+    case "$TOOL" in
+        traceroute) grep -h " $DST_IP " "$@" | grep -o '[0-9.]*ms' | tr -d 'ms' ;;
+        ping)       grep -ho 'time=[0-9.]*' "$@" | cut -d= -f2 ;;
+        mda)        ;;
+    esac
+}
+
+# children_cpu_time FILE: total CPU time (in seconds) consumed by the
+# terminated children, according to the output of "times" saved in FILE.
+# ("times" must be run by the main shell, not in a command substitution.)
+children_cpu_time() {
+    tail -n 1 "$1" | awk '{
+        n = split($1 " " $2, t, " ");
+        s = 0;
+        for (i = 1; i <= n; i++) {
+            split(t[i], ms, "m");
+            s += ms[1] * 60 + ms[2];
+        }
+        print s;
+    }'
+}
+
+# step CONCURRENCY: print a CSV line.
+step() {
+    local concurrency=$1 i tx0 rx0 tx rx cpu matched rtt_mean dir
+    dir=$(mktemp -d)
+
+    tx0=$(counter tx_packets)
+    rx0=$(counter rx_packets)
+    times > "$dir/times0"
+
+    for i in $(seq "$concurrency"); do
+        worker "$dir/$i.out" &
+    done
+    wait
+    times > "$dir/times1"
+
+    cpu=$(awk -v t1="$(children_cpu_time "$dir/times1")" -v t0="$(children_cpu_time "$dir/times0")" 'BEGIN { print t1 - t0 }')
+    tx=$(($(counter tx_packets) - tx0))
+    rx=$(($(counter rx_packets) - rx0))
+    matched=$(matched_replies "$dir"/*.out)
+    rtt_mean=$(destination_rtts "$dir"/*.out | awk '{ s += $1; n++ } END { if (n) printf "%.3f", s / n }')
+    rm -rf "$dir"
+
+    awk -v tool="$TOOL" -v c="$concurrency" -v d="$DURATION" -v tx="$tx" -v rx="$rx" \
+        -v matched="$matched" -v cpu="$cpu" -v rtt="$rtt_mean" -v delay="$DELAY_MS" 'BEGIN {
+        printf "%s,%d,%d,%d,%d,%s,%.1f,%s,%s,%s,%s\n",
+            tool, c, d, tx, rx, matched,
+            tx / d,
+            (matched != "" && rx) ? sprintf("%.3f", matched / rx) : "",
+            tx ? sprintf("%.1f", 1e6 * cpu / tx) : "",
+            rtt,
+            rtt != "" ? sprintf("%.3f", rtt - delay) : "";
+    }'
+}
+
+#----------------------------------------------------------------------------
+# Main program
+#----------------------------------------------------------------------------
+
+while getopts "b:t:d:c:D:a:o:kh" opt; do
+    case "$opt" in
+        b) BUILD_DIR=$OPTARG ;;
+        t) TOOL=$OPTARG ;;
+        d) DURATION=$OPTARG ;;
+        c) CONCURRENCY=$OPTARG ;;
+        D) DELAY_MS=$OPTARG ;;
+        a) TOOL_OPTIONS=$OPTARG ;;
+        o) OUTPUT=$OPTARG ;;
+        k) KEEP=1 ;;
+        *) usage ;;
+    esac
+done
+
+case "$TOOL" in
+    traceroute|mda|ping) ;;
+    *) usage ;;
+esac
+
+PARIS_TRACEROUTE=$(readlink -f "$BUILD_DIR/paris-traceroute/paris-traceroute")
+PARIS_PING=$(readlink -f "$BUILD_DIR/paris-ping/paris-ping")
+if [ ! -x "$PARIS_TRACEROUTE" ] || [ ! -x "$PARIS_PING" ]; then
+    log "E: paris-traceroute and paris-ping not found in $BUILD_DIR (see -b)"
+    exit 1
+fi
+
+if [ "$(id -u)" -ne 0 ]; then
+    log "E: this benchmark must be run as root"
+    exit 1
+fi
+
+if [ $KEEP -eq 0 ]; then
+    trap teardown EXIT
+fi
+
+if ! setup; then
+    log "E: cannot set up the emulated network"
+    exit 1
+fi
+
+echo "tool,concurrency,duration_s,probes,replies,matched,pps,match_rate,cpu_us_per_probe,rtt_ms,rtt_error_ms" > "$OUTPUT"
+for c in $CONCURRENCY; do
+    log "Running $c instance(s) of $TOOL during $DURATION s..."
+    step "$c" >> "$OUTPUT"
+done
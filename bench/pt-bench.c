@@ -0,0 +1,996 @@
+/**
+ * \file pt-bench.c
+ * \brief Microbenchmarks of the hot paths of libparistraceroute.
+ *
+ * Each benchmark drives a function of the library with synthetic probes and
+ * replies (no packet is sent) and reports the average time (ns/op) and the
+ * average number of heap allocations (allocs/op) per call.
+ *
+ * Results may be saved (-o) and compared to a previous run (-b): the program
+ * then fails if a benchmark has become slower than the baseline (beyond the
+ * tolerance set with -T) or performs more allocations. Run it thanks to
+ * "make bench" (see BENCH_FLAGS in bench/Makefile.am).
+ */
+
+#include "config.h"
+
+#include <stdlib.h>                      // malloc, calloc, realloc, EXIT_*
+#include <stdio.h>                       // printf, fopen
+#include <stdbool.h>                     // bool
+#include <stdint.h>                      // uint*_t
+#include <string.h>                      // memcpy, strncmp
+#include <limits.h>                      // INT_MAX
+#include <float.h>                       // DBL_MAX
+#include <time.h>                        // clock_gettime
+#include <arpa/inet.h>                   // htons
+
+#include "address.h"                     // address_t
+#include "algorithms/mda.h"              // mda_handler_reply
+#include "algorithms/mda/data.h"         // mda_data_t
+#include "algorithms/mda/interface.h"    // mda_interface_t
+#include "algorithms/mda/ttl_flow.h"     // mda_ttl_flow_t
+#include "bits.h"                        // bits_extract, bits_write
+#include "common.h"                      // get_timestamp
+#include "dynarray.h"                    // dynarray_t
+#include "lattice.h"                     // lattice_add_element
+#include "network.h"                     // network_t
+#include "options.h"                     // options_*
+#include "packet.h"                      // packet_t
+#include "probe.h"                       // probe_t
+#include "protocol.h"                    // csum
+
+//---------------------------------------------------------------------------
+// Command line stuff
+//---------------------------------------------------------------------------
+
+#define TEXT          "pt-bench - microbenchmarks of libparistraceroute."
+#define TEXT_OPTIONS  "Options:"
+
+#define BENCH_HELP_n  "Number of calls per benchmark (default: 200000)."
+#define BENCH_HELP_o  "Save the results in FILE (see -b)."
+#define BENCH_HELP_b  "Compare the results with those saved in FILE and fail in case of regression."
+#define BENCH_HELP_T  "Tolerated slowdown (in percent) with respect to the baseline (default: 10)."
+#define BENCH_HELP_r  "Run each benchmark NUM times and keep the fastest run (default: 3)."
+
+//                                    def     min  max
+static int    num_iterations[3]    = {200000, 1,   INT_MAX};
+static int    num_runs[3]          = {3,      1,   INT_MAX};
+static double tolerance[3]         = {10,     0,   DBL_MAX};
+
+static struct opt_str output_path   = {NULL, 0};
+static struct opt_str baseline_path = {NULL, 0};
+
+struct opt_spec runnable_options[] = {
+    // action               short      long            metavar         help          data
+    {opt_text,              OPT_NO_SF, OPT_NO_LF,      OPT_NO_METAVAR, TEXT,         OPT_NO_DATA},
+    {opt_text,              OPT_NO_SF, OPT_NO_LF,      OPT_NO_METAVAR, TEXT_OPTIONS, OPT_NO_DATA},
+    {opt_store_int_lim,     "n",       "--iterations", " NUM",         BENCH_HELP_n, num_iterations},
+    {opt_store_str,         "o",       "--output",     " FILE",        BENCH_HELP_o, &output_path},
+    {opt_store_str,         "b",       "--baseline",   " FILE",        BENCH_HELP_b, &baseline_path},
+    {opt_store_double_lim,  "T",       "--tolerance",  " PERCENT",     BENCH_HELP_T, tolerance},
+    {opt_store_int_lim,     "r",       "--runs",       " NUM",         BENCH_HELP_r, num_runs},
+    END_OPT_SPECS
+};
+
+//---------------------------------------------------------------------------
+// Allocation counter
+//---------------------------------------------------------------------------
+
+// Every allocation performed by the process (including those of the
+// library, which is dynamically linked) goes through these wrappers.
+
+static size_t num_allocs = 0;
+
+#ifdef __GLIBC__
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t num_elements, size_t size);
+extern void * __libc_realloc(void * ptr, size_t size);
+
+void * malloc(size_t size) {
+    num_allocs++;
+    return __libc_malloc(size);
+}
+
+void * calloc(size_t num_elements, size_t size) {
+    num_allocs++;
+    return __libc_calloc(num_elements, size);
+}
+
+void * realloc(void * ptr, size_t size) {
+    num_allocs++;
+    return __libc_realloc(ptr, size);
+}
+#    define HAVE_ALLOCATION_COUNTER
+#endif
+
+//---------------------------------------------------------------------------
+// Benchmark framework
+//---------------------------------------------------------------------------
+
+#define BENCH_NAME_MAX 64
+
+typedef struct {
+    char   name[BENCH_NAME_MAX]; /**< Name of the benchmark */
+    double ns_per_op;            /**< Average duration of a call (in nanoseconds) */
+    double allocs_per_op;        /**< Average number of allocations per call */
+} bench_result_t;
+
+typedef struct {
+    struct timespec start;      /**< Beginning of the measurement */
+    size_t          num_allocs; /**< Number of allocations at the beginning of the measurement */
+} bench_clock_t;
+
+static inline void bench_clock_start(bench_clock_t * clock) {
+    clock->num_allocs = num_allocs;
+    clock_gettime(CLOCK_MONOTONIC, &clock->start);
+}
+
+static void bench_clock_stop(const bench_clock_t * clock, size_t num_ops, bench_result_t * result) {
+    struct timespec stop;
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    result->ns_per_op = (1e9 * (stop.tv_sec - clock->start.tv_sec) + (stop.tv_nsec - clock->start.tv_nsec)) / num_ops;
+    result->allocs_per_op = (double) (num_allocs - clock->num_allocs) / num_ops;
+}
+
+/**
+ * \brief Check that a benchmark did not allocate anything. Used by the
+ *    benchmarks covering the send path, which must not touch the heap.
+ * \param result The result of the benchmark.
+ * \return true iif no allocation has been counted.
+ */
+
+static bool bench_check_no_allocation(const bench_result_t * result) {
+#ifdef HAVE_ALLOCATION_COUNTER
+    if (result->allocs_per_op > 0) {
+        fprintf(stderr, "E: %.2f allocations per call on the send path\n", result->allocs_per_op);
+        return false;
+    }
+#endif
+    return true;
+}
+
+// Prevents the compiler from optimizing out the benchmarked calls.
+static volatile uintmax_t sink;
+
+//---------------------------------------------------------------------------
+// Fixtures
+//---------------------------------------------------------------------------
+
+#define BENCH_DST_IP      "127.0.0.1"
+#define BENCH_SRC_PORT    33456
+#define BENCH_DST_PORT    33457
+
+/**
+ * \brief Craft an IPv4 probe similar to those sent by paris-traceroute.
+ * \param protocol The transport protocol ("udp" or "tcp").
+ * \return The probe, NULL in case of failure.
+ */
+
+static probe_t * bench_probe_create(const char * protocol) {
+    probe_t   * probe;
+    address_t   dst_ip;
+
+    if (address_from_string(AF_INET, BENCH_DST_IP, &dst_ip) != 0) goto ERR_ADDRESS_FROM_STRING;
+    if (!(probe = probe_create()))                                 goto ERR_PROBE_CREATE;
+    if (!probe_set_protocols(probe, "ipv4", protocol, NULL))       goto ERR_SET_PROTOCOLS;
+    if (!probe_payload_resize(probe, 2))                           goto ERR_PAYLOAD_RESIZE;
+    if (!probe_set_fields(
+        probe,
+        ADDRESS("dst_ip", &dst_ip),
+        I8("ttl", 1),
+        I16("src_port", BENCH_SRC_PORT),
+        I16("dst_port", BENCH_DST_PORT),
+        NULL
+    )) {
+        goto ERR_SET_FIELDS;
+    }
+    return probe;
+
+ERR_SET_FIELDS:
+ERR_PAYLOAD_RESIZE:
+ERR_SET_PROTOCOLS:
+    probe_free(probe);
+ERR_PROBE_CREATE:
+ERR_ADDRESS_FROM_STRING:
+    return NULL;
+}
+
+/**
+ * \brief Craft the IPv4/ICMP time exceeded packet that a router would send
+ *    in response to a probe.
+ * \param probe The probe.
+ * \return The packet, NULL in case of failure.
+ */
+
+static packet_t * bench_reply_packet_create(const probe_t * probe) {
+    uint8_t   bytes[20 + 8 + 28];
+    uint16_t  total_length = htons(sizeof(bytes));
+
+    if (packet_get_size(probe->packet) < 28) return NULL;
+
+    memset(bytes, 0, 28);
+    bytes[0] = 0x45;                                // IPv4, IHL = 5
+    memcpy(bytes + 2, &total_length, 2);
+    bytes[8] = 64;                                  // TTL
+    bytes[9] = 1;                                   // IPPROTO_ICMP
+    bytes[12] = 192; bytes[13] = 0; bytes[14] = 2; bytes[15] = 1;
+    bytes[16] = 127; bytes[19] = 1;
+    bytes[20] = 11;                                 // ICMP time exceeded
+    memcpy(bytes + 28, packet_get_bytes(probe->packet), 28);
+
+    return packet_create_from_bytes(bytes, sizeof(bytes));
+}
+
+/**
+ * \brief Build the probe_t instance corresponding to a reply.
+ * \param probe The probe which provokes the reply.
+ * \return The reply, NULL in case of failure.
+ */
+
+static probe_t * bench_reply_create(const probe_t * probe) {
+    packet_t * packet;
+    probe_t  * reply;
+
+    if (!(packet = bench_reply_packet_create(probe))) return NULL;
+    if (!(reply = probe_wrap_packet(packet))) packet_free(packet);
+    return reply;
+}
+
+/**
+ * \brief Craft the IPv4/TCP SYN-ACK (open port) or RST (closed port) that
+ *    the destination would send in response to a TCP probe.
+ * \param probe The probe.
+ * \param is_rst Pass true to craft a RST, which also acknowledges the
+ *    payload of the probe.
+ * \return The reply, NULL in case of failure.
+ */
+
+static probe_t * bench_tcp_reply_create(const probe_t * probe, bool is_rst) {
+    const uint8_t * probe_bytes = packet_get_bytes(probe->packet);
+    uint8_t         bytes[20 + 20];
+    uint16_t        total_length = htons(sizeof(bytes));
+    uint32_t        ack_num;
+    packet_t      * packet;
+    probe_t       * reply;
+
+    if (packet_get_size(probe->packet) < 28) return NULL;
+
+    memset(bytes, 0, sizeof(bytes));
+    bytes[0] = 0x45;                                // IPv4, IHL = 5
+    memcpy(bytes + 2, &total_length, 2);
+    bytes[8] = 64;                                  // TTL
+    bytes[9] = 6;                                   // IPPROTO_TCP
+    memcpy(bytes + 12, probe_bytes + 16, 4);        // Addresses and ports are swapped
+    memcpy(bytes + 16, probe_bytes + 12, 4);
+    memcpy(bytes + 20, probe_bytes + 22, 2);
+    memcpy(bytes + 22, probe_bytes + 20, 2);
+    memcpy(&ack_num, probe_bytes + 24, 4);          // Acknowledge the sequence number
+    ack_num = htonl(ntohl(ack_num) + 1 + (is_rst ? probe_get_payload_size(probe) : 0));
+    memcpy(bytes + 28, &ack_num, 4);
+    bytes[32] = 5 << 4;                             // Data offset
+    bytes[33] = is_rst ? 0x14 : 0x12;               // RST, ACK or SYN, ACK
+
+    if (!(packet = packet_create_from_bytes(bytes, sizeof(bytes)))) return NULL;
+    if (!(reply = probe_wrap_packet(packet))) packet_free(packet);
+    return reply;
+}
+
+//---------------------------------------------------------------------------
+// Benchmarks
+//---------------------------------------------------------------------------
+
+static bool bench_csum(bench_result_t * result, size_t n) {
+    uint16_t      bytes[14] = {0x4500, 0x001e, 0x0000, 0x0000, 0x0111};
+    bench_clock_t clock;
+    size_t        i;
+
+    bench_clock_start(&clock);
+    for (i = 0; i < n; i++) {
+        bytes[2] = i;
+        sink += csum(bytes, sizeof(bytes));
+    }
+    bench_clock_stop(&clock, n, result);
+    return true;
+}
+
+static bool bench_probe_dup(bench_result_t * result, size_t n) {
+    probe_t     * skel, * probe;
+    bench_clock_t clock;
+    size_t        i;
+
+    if (!(skel = bench_probe_create("udp"))) return false;
+
+    bench_clock_start(&clock);
+    for (i = 0; i < n; i++) {
+        if (!(probe = probe_dup(skel))) break;
+        probe_free(probe);
+    }
+    bench_clock_stop(&clock, n, result);
+
+    probe_free(skel);
+    return i == n;
+}
+
+static bool bench_probe_wrap_packet(bench_result_t * result, size_t n) {
+    probe_t     * probe, * reply;
+    packet_t    * packet;
+    bench_clock_t clock;
+    size_t        i = 0;
+
+    if (!(probe = bench_probe_create("udp"))) return false;
+    if (!(packet = bench_reply_packet_create(probe))) goto ERR_REPLY_PACKET_CREATE;
+
+    // The packet is copied since probe_wrap_packet takes its ownership.
+    bench_clock_start(&clock);
+    for (i = 0; i < n; i++) {
+        if (!(reply = probe_wrap_packet(packet_dup(packet)))) break;
+        probe_free(reply);
+    }
+    bench_clock_stop(&clock, n, result);
+
+    packet_free(packet);
+ERR_REPLY_PACKET_CREATE:
+    probe_free(probe);
+    return i == n;
+}
+
+static bool bench_probe_update_checksum(bench_result_t * result, size_t n) {
+    probe_t     * probe;
+    bench_clock_t clock;
+    size_t        i;
+
+    if (!(probe = bench_probe_create("udp"))) return false;
+
+    bench_clock_start(&clock);
+    for (i = 0; i < n; i++) {
+        if (!probe_update_checksum(probe)) break;
+    }
+    bench_clock_stop(&clock, n, result);
+
+    probe_free(probe);
+    return i == n && bench_check_no_allocation(result);
+}
+
+static bool bench_probe_set_fields(bench_result_t * result, size_t n) {
+    probe_t     * probe;
+    bench_clock_t clock;
+    size_t        i;
+
+    if (!(probe = bench_probe_create("udp"))) return false;
+
+    // What an algorithm does before sending each probe (see mda, traceroute)
+    bench_clock_start(&clock);
+    for (i = 0; i < n; i++) {
+        if (!probe_set_fields(probe, I8("ttl", 1 + i % 32), I16("flow_id", 1 + i % 16), NULL)) break;
+    }
+    bench_clock_stop(&clock, n, result);
+
+    probe_free(probe);
+    return i == n && bench_check_no_allocation(result);
+}
+
+static bool bench_probe_extract_impl(bench_result_t * result, size_t n, const char * name) {
+    probe_t     * probe;
+    bench_clock_t clock;
+    address_t     address;
+    uintmax_t     value;
+    size_t        i;
+    bool          is_address = !strcmp(name, "dst_ip") || !strcmp(name, "src_ip");
+    bool          ret = true;
+
+    if (!(probe = bench_probe_create("udp"))) return false;
+
+    bench_clock_start(&clock);
+    for (i = 0; i < n && ret; i++) {
+        value = 0;
+        ret = probe_extract(probe, name, is_address ? (void *) &address : (void *) &value);
+        sink += value;
+    }
+    bench_clock_stop(&clock, n, result);
+
+    probe_free(probe);
+    return ret;
+}
+
+static bool bench_probe_extract_ttl(bench_result_t * result, size_t n) {
+    return bench_probe_extract_impl(result, n, "ttl");
+}
+
+static bool bench_probe_extract_dst_ip(bench_result_t * result, size_t n) {
+    return bench_probe_extract_impl(result, n, "dst_ip");
+}
+
+static bool bench_probe_extract_flow_id(bench_result_t * result, size_t n) {
+    return bench_probe_extract_impl(result, n, "flow_id");
+}
+
+//---------------------------------------------------------------------------
+// Bit-level operations
+//---------------------------------------------------------------------------
+
+#define BITS_CHECK_NUM_CASES   100000
+#define BITS_CHECK_MAX_OFFSET  24
+#define BITS_CHECK_MAX_LENGTH  130
+#define BITS_CHECK_BUFFER_SIZE 32 // > (BITS_CHECK_MAX_OFFSET + BITS_CHECK_MAX_LENGTH) / 8
+#define BITS_CHECK_GUARD       0xa5
+
+static inline bool bit_get(const uint8_t * bytes, size_t i) {
+    return bytes[i >> 3] & (0x80 >> (i & 7));
+}
+
+static inline void bit_set(uint8_t * bytes, size_t i, bool value) {
+    if (value) bytes[i >> 3] |=  (0x80 >> (i & 7));
+    else       bytes[i >> 3] &= ~(0x80 >> (i & 7));
+}
+
+/**
+ * \brief Reference implementation of bits_write, copying one bit at a time.
+ */
+
+static void bits_write_ref(uint8_t * out, size_t offset_out, const uint8_t * in, size_t offset_in, size_t num_bits) {
+    size_t i;
+
+    for (i = 0; i < num_bits; i++) {
+        bit_set(out, offset_out + i, bit_get(in, offset_in + i));
+    }
+}
+
+/**
+ * \brief Reference implementation of bits_extract (the value is
+ *    right-aligned in ceil(num_bits / 8) bytes).
+ */
+
+static void bits_extract_ref(const uint8_t * in, size_t offset_in, size_t num_bits, uint8_t * out) {
+    size_t size = (num_bits + 7) / 8;
+
+    memset(out, 0, size);
+    bits_write_ref(out, 8 * size - num_bits, in, offset_in, num_bits);
+}
+
+static inline uint32_t xorshift32(uint32_t * state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/**
+ * \brief Check bits_extract and bits_write against their reference
+ *    implementation on random inputs, offsets and lengths. The bytes
+ *    located around the written bits must be left unchanged.
+ * \return true iif both implementations always agree.
+ */
+
+static bool bits_check() {
+    // Example of bits.h
+    const uint8_t example[]  = {0x3a, 0xfa, 0xc0, 0x00};
+    const uint8_t expected[] = {0x1d, 0x7d, 0x60};
+    uint8_t       in[BITS_CHECK_BUFFER_SIZE],
+                  out[BITS_CHECK_BUFFER_SIZE],
+                  out_ref[BITS_CHECK_BUFFER_SIZE];
+    uint32_t      state = 0x2545f491;
+    size_t        i, j, offset_in, offset_out, num_bits;
+
+    if (!bits_extract(example, 2, 21, out) || memcmp(out, expected, sizeof(expected))) {
+        fprintf(stderr, "bits_check: bits_extract does not match the example of bits.h\n");
+        return false;
+    }
+
+    for (i = 0; i < BITS_CHECK_NUM_CASES; i++) {
+        for (j = 0; j < BITS_CHECK_BUFFER_SIZE; j++) in[j] = xorshift32(&state);
+        offset_in  = xorshift32(&state) % BITS_CHECK_MAX_OFFSET;
+        offset_out = xorshift32(&state) % BITS_CHECK_MAX_OFFSET;
+        num_bits   = xorshift32(&state) % (BITS_CHECK_MAX_LENGTH + 1);
+
+        memset(out,     BITS_CHECK_GUARD, sizeof(out));
+        memset(out_ref, BITS_CHECK_GUARD, sizeof(out_ref));
+        bits_extract(in, offset_in, num_bits, out);
+        bits_extract_ref(in, offset_in, num_bits, out_ref);
+        if (memcmp(out, out_ref, sizeof(out))) {
+            fprintf(stderr, "bits_check: bits_extract(offset_in = %zu, num_bits = %zu) differs\n", offset_in, num_bits);
+            return false;
+        }
+
+        memset(out,     BITS_CHECK_GUARD, sizeof(out));
+        memset(out_ref, BITS_CHECK_GUARD, sizeof(out_ref));
+        bits_write(out, offset_out, in, offset_in, num_bits);
+        bits_write_ref(out_ref, offset_out, in, offset_in, num_bits);
+        if (memcmp(out, out_ref, sizeof(out))) {
+            fprintf(stderr, "bits_check: bits_write(offset_out = %zu, offset_in = %zu, num_bits = %zu) differs\n", offset_out, offset_in, num_bits);
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief Extract or write a field of a given size and offset, e.g. the
+ *    IHL of an IPv4 header or the flow label of an IPv6 header. The
+ *    implementation is checked first (see bits_check).
+ */
+
+static bool bench_bits_impl(bench_result_t * result, size_t n, bool do_write, size_t offset_in_bits, size_t num_bits) {
+    static bool   is_checked = false;
+    uint8_t       bytes[BITS_CHECK_BUFFER_SIZE] = {0x60, 0x0a, 0xbc, 0xde, 0x45, 0x00},
+                  value[BITS_CHECK_BUFFER_SIZE] = {0};
+    bench_clock_t clock;
+    size_t        i;
+
+    if (!is_checked && !(is_checked = bits_check())) return false;
+
+    bench_clock_start(&clock);
+    for (i = 0; i < n; i++) {
+        if (do_write) {
+            value[0] = i;
+            bits_write(bytes + offset_in_bits / 8, offset_in_bits % 8, value, 0, num_bits);
+            sink += bytes[1];
+        } else {
+            bytes[1] = i;
+            bits_extract(bytes + offset_in_bits / 8, offset_in_bits % 8, num_bits, value);
+            sink += value[0];
+        }
+    }
+    bench_clock_stop(&clock, n, result);
+    return true;
+}
+
+static bool bench_bits_extract_4(bench_result_t * result, size_t n) {
+    return bench_bits_impl(result, n, false, 4, 4);
+}
+
+static bool bench_bits_extract_20(bench_result_t * result, size_t n) {
+    return bench_bits_impl(result, n, false, 12, 20);
+}
+
+static bool bench_bits_extract_32(bench_result_t * result, size_t n) {
+    return bench_bits_impl(result, n, false, 0, 32);
+}
+
+static bool bench_bits_write_4(bench_result_t * result, size_t n) {
+    return bench_bits_impl(result, n, true, 4, 4);
+}
+
+static bool bench_bits_write_20(bench_result_t * result, size_t n) {
+    return bench_bits_impl(result, n, true, 12, 20);
+}
+
+static bool bench_network_tag_probe(bench_result_t * result, size_t n) {
+    network_t   * network;
+    probe_t     * probe;
+    bench_clock_t clock;
+    size_t        i;
+    bool          ret = false;
+
+    if (!(network = network_create()))        goto ERR_NETWORK_CREATE;
+    if (!(probe = bench_probe_create("udp"))) goto ERR_PROBE_CREATE;
+
+    bench_clock_start(&clock);
+    for (i = 0; i < n; i++) {
+        if (!network_tag_probe(network, probe)) break;
+    }
+    bench_clock_stop(&clock, n, result);
+    ret = (i == n) && bench_check_no_allocation(result);
+
+    probe_free(probe);
+ERR_PROBE_CREATE:
+    network_free(network);
+ERR_NETWORK_CREATE:
+    return ret;
+}
+
+/**
+ * \brief Match replies against a given number of flying probes. Each
+ *    matched probe is put back in the flying probes, so that the window
+ *    size remains constant.
+ */
+
+static bool bench_network_get_matching_probe_impl(bench_result_t * result, size_t n, size_t window, bool use_tcp) {
+    network_t   * network;
+    probe_t     * skel, * probe, ** replies;
+    bench_clock_t clock;
+    size_t        i;
+    bool          ret = false;
+
+    if (!(network = network_create()))                         goto ERR_NETWORK_CREATE;
+    if (!(skel = bench_probe_create(use_tcp ? "tcp" : "udp"))) goto ERR_PROBE_CREATE;
+    if (!(replies = calloc(window, sizeof(probe_t *))))        goto ERR_CALLOC;
+
+    for (i = 0; i < window; i++) {
+        if (!(probe = probe_dup(skel)))                                        goto ERR_FILL;
+        probe_set_sending_time(probe, get_timestamp());
+        if (!network_tag_probe(network, probe)
+        ||  !(replies[i] = use_tcp ? bench_tcp_reply_create(probe, false) : bench_reply_create(probe))
+        ||  !dynarray_push_element(network->probes, probe)
+        ) {
+            probe_free(probe);
+            goto ERR_FILL;
+        }
+    }
+
+    // Replies are matched in a pseudo-random order
+    bench_clock_start(&clock);
+    for (i = 0; i < n; i++) {
+        if (!(probe = network_get_matching_probe(network, replies[(i * 7919) % window]))) break;
+        dynarray_push_element(network->probes, probe);
+    }
+    bench_clock_stop(&clock, n, result);
+    ret = (i == n);
+
+ERR_FILL:
+    for (i = 0; i < window; i++) {
+        if (replies[i]) probe_free(replies[i]);
+    }
+    free(replies);
+ERR_CALLOC:
+    probe_free(skel);
+ERR_PROBE_CREATE:
+    network_free(network);
+ERR_NETWORK_CREATE:
+    return ret;
+}
+
+static bool bench_network_get_matching_probe_1(bench_result_t * result, size_t n) {
+    return bench_network_get_matching_probe_impl(result, n, 1, false);
+}
+
+static bool bench_network_get_matching_probe_64(bench_result_t * result, size_t n) {
+    return bench_network_get_matching_probe_impl(result, n, 64, false);
+}
+
+static bool bench_network_get_matching_probe_1024(bench_result_t * result, size_t n) {
+    return bench_network_get_matching_probe_impl(result, n, 1024, false);
+}
+
+#define TRANSPORT_CHECK_NUM_TTLS 4
+
+/**
+ * \brief Check that the SYN-ACK or RST sent by the destination is paired
+ *    with the probe it answers, while several probes of the same flow (with
+ *    different TTLs) are flying. Replies are matched in the reverse order.
+ * \return true iif each reply is paired with its own probe.
+ */
+
+static bool transport_check() {
+    network_t * network;
+    probe_t   * skel,
+              * probes[TRANSPORT_CHECK_NUM_TTLS] = {NULL},
+              * replies[TRANSPORT_CHECK_NUM_TTLS] = {NULL};
+    size_t      i;
+    bool        ret = false;
+
+    if (!(network = network_create()))       goto ERR_NETWORK_CREATE;
+    if (!(skel = bench_probe_create("tcp"))) goto ERR_PROBE_CREATE;
+
+    for (i = 0; i < TRANSPORT_CHECK_NUM_TTLS; i++) {
+        if (!(probes[i] = probe_dup(skel)))                          goto ERR_FILL;
+        probe_set_sending_time(probes[i], get_timestamp());
+        if (!probe_set_field(probes[i], I8("ttl", i + 1))
+        ||  !network_tag_probe(network, probes[i])
+        ||  !(replies[i] = bench_tcp_reply_create(probes[i], i % 2))
+        ||  !dynarray_push_element(network->probes, probes[i])
+        ) {
+            probe_free(probes[i]);
+            goto ERR_FILL;
+        }
+    }
+
+    for (i = TRANSPORT_CHECK_NUM_TTLS; i > 0; i--) {
+        if (network_get_matching_probe(network, replies[i - 1]) != probes[i - 1]) {
+            fprintf(stderr, "transport_check: the %s answering TTL %zu is not paired with its probe\n", (i - 1) % 2 ? "RST" : "SYN-ACK", i);
+            goto ERR_FILL;
+        }
+        probe_free(probes[i - 1]);
+    }
+    ret = true;
+
+ERR_FILL:
+    for (i = 0; i < TRANSPORT_CHECK_NUM_TTLS; i++) {
+        if (replies[i]) probe_free(replies[i]);
+    }
+    probe_free(skel);
+ERR_PROBE_CREATE:
+    network_free(network);
+ERR_NETWORK_CREATE:
+    return ret;
+}
+
+/**
+ * \brief Match the SYN-ACK sent by the destination against 64 flying
+ *    probes of the same flow. The implementation is checked first (see
+ *    transport_check).
+ */
+
+static bool bench_network_get_matching_probe_tcp(bench_result_t * result, size_t n) {
+    static bool is_checked = false;
+
+    if (!is_checked && !(is_checked = transport_check())) return false;
+    return bench_network_get_matching_probe_impl(result, n, 64, true);
+}
+
+#define BENCH_MDA_NUM_TTLS  8
+#define BENCH_MDA_NUM_FLOWS 16
+#define BENCH_MDA_WIDTH     2
+
+/**
+ * \brief Feed mda with the replies of BENCH_MDA_NUM_FLOWS flows over
+ *    BENCH_MDA_NUM_TTLS hops, each hop being made of BENCH_MDA_WIDTH load
+ *    balanced interfaces. The lattice is rebuilt from scratch once every
+ *    reply has been processed.
+ */
+
+static bool bench_mda_handler_reply(bench_result_t * result, size_t n) {
+    probe_t         * skel,
+                    * probes[BENCH_MDA_NUM_TTLS][BENCH_MDA_NUM_FLOWS] = {{NULL}},
+                    * replies[BENCH_MDA_NUM_TTLS][BENCH_MDA_NUM_FLOWS] = {{NULL}};
+    probe_reply_t     probe_reply;
+    event_t           event;
+    mda_options_t     options = mda_get_default_options();
+    mda_data_t      * data;
+    mda_interface_t * root;
+    mda_flow_t      * mda_flow;
+    mda_ttl_flow_t  * mda_ttl_flow;
+    address_t         address;
+    char              address_str[INET_ADDRSTRLEN];
+    bench_clock_t     clock;
+    size_t            i, ttl, flow;
+    bool              ret = false;
+
+    if (!(skel = bench_probe_create("udp"))) return false;
+
+    for (ttl = 0; ttl < BENCH_MDA_NUM_TTLS; ttl++) {
+        for (flow = 0; flow < BENCH_MDA_NUM_FLOWS; flow++) {
+            snprintf(address_str, sizeof(address_str), "10.0.%zu.%zu", ttl + 1, flow % BENCH_MDA_WIDTH);
+            if (address_from_string(AF_INET, address_str, &address) != 0)   goto ERR_FIXTURE;
+            if (!(probes[ttl][flow] = probe_dup(skel)))                      goto ERR_FIXTURE;
+            if (!probe_set_fields(probes[ttl][flow], I8("ttl", ttl + 1), I16("flow_id", flow + 1), NULL)) goto ERR_FIXTURE;
+            if (!(replies[ttl][flow] = probe_create()))                      goto ERR_FIXTURE;
+            if (!probe_set_protocols(replies[ttl][flow], "ipv4", "icmpv4", NULL)) goto ERR_FIXTURE;
+            if (!probe_set_field(replies[ttl][flow], ADDRESS("src_ip", &address))) goto ERR_FIXTURE;
+        }
+    }
+
+    memset(&event, 0, sizeof(event_t));
+    event.type = PROBE_REPLY;
+    event.data = &probe_reply;
+
+    bench_clock_start(&clock);
+    for (i = 0; i < n; ) {
+        if (!(data = mda_data_create()))                              goto ERR_RUN;
+        if (!(root = mda_interface_create(NULL)))                     goto ERR_RUN_DATA;
+        if (!lattice_add_element(data->lattice, NULL, root))          goto ERR_RUN_DATA;
+
+        // Flows leaving the source, as if they had been sent by mda
+        for (flow = 0; flow < BENCH_MDA_NUM_FLOWS; flow++) {
+            if (!(mda_flow = mda_flow_create(flow + 1, MDA_FLOW_AVAILABLE)))   goto ERR_RUN_DATA;
+            if (!(mda_ttl_flow = mda_ttl_flow_create(0, mda_flow)))         goto ERR_RUN_DATA;
+            if (!dynarray_push_element(root->ttl_flows, mda_ttl_flow))      goto ERR_RUN_DATA;
+        }
+
+        for (ttl = 0; ttl < BENCH_MDA_NUM_TTLS && i < n; ttl++) {
+            for (flow = 0; flow < BENCH_MDA_NUM_FLOWS && i < n; flow++, i++) {
+                probe_reply.probe = probes[ttl][flow];
+                probe_reply.reply = replies[ttl][flow];
+                mda_handler_reply(NULL, &event, data, skel, &options);
+            }
+        }
+        mda_data_free(data);
+    }
+    bench_clock_stop(&clock, n, result);
+    ret = true;
+    goto ERR_FIXTURE;
+
+ERR_RUN_DATA:
+    mda_data_free(data);
+ERR_RUN:
+ERR_FIXTURE:
+    for (ttl = 0; ttl < BENCH_MDA_NUM_TTLS; ttl++) {
+        for (flow = 0; flow < BENCH_MDA_NUM_FLOWS; flow++) {
+            if (probes[ttl][flow])  probe_free(probes[ttl][flow]);
+            if (replies[ttl][flow]) probe_free(replies[ttl][flow]);
+        }
+    }
+    probe_free(skel);
+    return ret;
+}
+
+typedef struct {
+    const char * name;                                                /**< Name of the benchmark */
+    bool      (* run)(bench_result_t * result, size_t num_iterations); /**< Callback running the benchmark */
+    size_t       cost;                                                /**< The number of iterations is divided by this value */
+} bench_t;
+
+static const bench_t benches[] = {
+    {"csum",                            bench_csum,                            1},
+    {"probe_dup",                       bench_probe_dup,                       1},
+    {"probe_wrap_packet",               bench_probe_wrap_packet,               1},
+    {"probe_update_checksum",           bench_probe_update_checksum,           1},
+    {"probe_set_fields",                bench_probe_set_fields,                1},
+    {"probe_extract/ttl",               bench_probe_extract_ttl,               1},
+    {"probe_extract/dst_ip",            bench_probe_extract_dst_ip,            1},
+    {"probe_extract/flow_id",           bench_probe_extract_flow_id,           1},
+    {"bits_extract/4",                  bench_bits_extract_4,                  1},
+    {"bits_extract/20",                 bench_bits_extract_20,                 1},
+    {"bits_extract/32",                 bench_bits_extract_32,                 1},
+    {"bits_write/4",                    bench_bits_write_4,                    1},
+    {"bits_write/20",                   bench_bits_write_20,                   1},
+    {"network_tag_probe",               bench_network_tag_probe,               1},
+    {"network_get_matching_probe/1",    bench_network_get_matching_probe_1,    1},
+    {"network_get_matching_probe/64",   bench_network_get_matching_probe_64,   1},
+    {"network_get_matching_probe/1024", bench_network_get_matching_probe_1024, 4},
+    {"network_get_matching_probe/tcp",  bench_network_get_matching_probe_tcp,  1},
+    {"mda_handler_reply",               bench_mda_handler_reply,               256},
+    {NULL,                              NULL,                                  0}
+};
+
+/**
+ * \brief Run a benchmark several times and keep the fastest run, which is
+ *    the least disturbed by the rest of the system.
+ * \param bench The benchmark.
+ * \param num_iterations The number of iterations (divided by bench->cost).
+ * \param num_runs The number of runs.
+ * \param result The bench_result_t instance where the result is written.
+ * \return true iif successful.
+ */
+
+static bool bench_run(const bench_t * bench, size_t num_iterations, size_t num_runs, bench_result_t * result) {
+    bench_result_t current;
+    size_t         i;
+
+    num_iterations = num_iterations / bench->cost ? num_iterations / bench->cost : 1;
+    memset(result, 0, sizeof(bench_result_t));
+    snprintf(result->name, BENCH_NAME_MAX, "%s", bench->name);
+
+    for (i = 0; i < num_runs; i++) {
+        if (!bench->run(&current, num_iterations)) return false;
+        if (i == 0 || current.ns_per_op < result->ns_per_op) {
+            result->ns_per_op     = current.ns_per_op;
+            result->allocs_per_op = current.allocs_per_op;
+        }
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------
+// Baseline
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Load the results saved by a previous run.
+ * \param path The path of the file.
+ * \param presults The address where the array of results is written.
+ * \return The number of results, or -1 in case of failure.
+ */
+
+static int baseline_load(const char * path, bench_result_t ** presults) {
+    FILE           * file;
+    bench_result_t   result, * results = NULL, * tmp;
+    int              num_results = 0;
+
+    if (!(file = fopen(path, "r"))) {
+        perror(path);
+        return -1;
+    }
+
+    while (fscanf(file, "%63s %lf %lf", result.name, &result.ns_per_op, &result.allocs_per_op) == 3) {
+        if (!(tmp = realloc(results, (num_results + 1) * sizeof(bench_result_t)))) {
+            free(results);
+            num_results = -1;
+            break;
+        }
+        results = tmp;
+        results[num_results++] = result;
+    }
+
+    fclose(file);
+    *presults = results;
+    return num_results;
+}
+
+static const bench_result_t * baseline_find(const bench_result_t * results, int num_results, const char * name) {
+    int i;
+
+    for (i = 0; i < num_results; i++) {
+        if (!strcmp(results[i].name, name)) return &results[i];
+    }
+    return NULL;
+}
+
+//---------------------------------------------------------------------------
+// Main program
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Check whether a benchmark has been selected in the command-line.
+ * \param name The name of the benchmark.
+ * \param filters The prefixes passed in the command-line.
+ * \param num_filters The number of prefixes (0 selects every benchmark).
+ * \return true iif the benchmark must be run.
+ */
+
+static bool bench_is_selected(const char * name, char ** filters, int num_filters) {
+    int i;
+
+    if (num_filters == 0) return true;
+    for (i = 0; i < num_filters; i++) {
+        if (!strncmp(name, filters[i], strlen(filters[i]))) return true;
+    }
+    return false;
+}
+
+int main(int argc, char ** argv)
+{
+    int                    exit_code = EXIT_FAILURE;
+    const char           * usage = "usage: %s [options] [benchmark ...]\n";
+    char                 * version = strdup("version 1.0");
+    options_t            * options;
+    FILE                 * output = NULL;
+    bench_result_t         result, * baseline = NULL;
+    const bench_result_t * reference;
+    const bench_t        * bench;
+    int                    num_filters, num_baseline = 0;
+    bool                   has_regressed = false,
+                           has_failed = false;
+    double                 delta;
+
+    if (!(options = options_create(NULL))) {
+        fprintf(stderr, "E: Can't initialize options\n");
+        goto ERR_OPTIONS_CREATE;
+    }
+    options_add_optspecs(options, runnable_options);
+    options_add_common(options, version);
+
+    if ((num_filters = options_parse(options, usage, argv)) < 0) {
+        goto ERR_OPT_PARSE;
+    }
+
+    if (baseline_path.s && (num_baseline = baseline_load(baseline_path.s, &baseline)) < 0) {
+        goto ERR_BASELINE_LOAD;
+    }
+
+    if (output_path.s && !(output = fopen(output_path.s, "w"))) {
+        perror(output_path.s);
+        goto ERR_FOPEN;
+    }
+
+#ifndef HAVE_ALLOCATION_COUNTER
+    fprintf(stderr, "W: allocations are not counted on this platform\n");
+#endif
+
+    printf("%-32s %12s %12s %10s\n", "benchmark", "ns/op", "allocs/op", "baseline");
+    for (bench = benches; bench->name; bench++) {
+        if (!bench_is_selected(bench->name, argv + argc - num_filters, num_filters)) continue;
+
+        if (!bench_run(bench, num_iterations[0], num_runs[0], &result)) {
+            printf("%-32s %12s\n", bench->name, "failed");
+            has_failed = true;
+            continue;
+        }
+
+        printf("%-32s %12.1f %12.2f", result.name, result.ns_per_op, result.allocs_per_op);
+        if ((reference = baseline_find(baseline, num_baseline, result.name))) {
+            delta = 100 * (result.ns_per_op - reference->ns_per_op) / reference->ns_per_op;
+            printf(" %+9.1f%%", delta);
+            if (delta > tolerance[0] || result.allocs_per_op > reference->allocs_per_op + 0.005) {
+                printf(" REGRESSION");
+                has_regressed = true;
+            }
+        }
+        printf("\n");
+
+        if (output) {
+            fprintf(output, "%s %.3f %.3f\n", result.name, result.ns_per_op, result.allocs_per_op);
+        }
+    }
+
+    exit_code = has_regressed || has_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    if (output) fclose(output);
+ERR_FOPEN:
+    free(baseline);
+ERR_BASELINE_LOAD:
+ERR_OPT_PARSE:
+ERR_OPTIONS_CREATE:
+    free(version);
+    exit(exit_code);
+}
@@ -17,9 +17,17 @@
 #include "address.h"
 
 #ifdef USE_CACHE
+#    include <pthread.h>     // pthread_rwlock_*
 #    include "containers/map.h"
 
-static map_t * cache_ip_hostname = NULL;
+// The cache is shared by every pt_loop_t of the process, and thus may be
+// accessed concurrently by several threads.
+static map_t            * cache_ip_hostname = NULL;
+static pthread_rwlock_t   cache_ip_hostname_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Updated while only holding the read lock, hence atomic increments.
+static size_t             cache_ip_hostname_hits   = 0;
+static size_t             cache_ip_hostname_misses = 0;
 
 static void __cache_ip_hostname_create() __attribute__((constructor));
 static void __cache_ip_hostname_free()   __attribute__((destructor));
@@ -221,51 +229,58 @@ int address_compare(const address_t * x, const address_t * y) {
     return *--px - *--py;
 }
 
-int address_to_string(const address_t * address, char ** pbuffer)
+/**
+ * \brief Convert an address_t instance into the corresponding sockaddr.
+ * \param address An address_t instance.
+ * \param ss The sockaddr_storage that will be filled.
+ * \param psocket_size The address where the size of the sockaddr is written.
+ * \return true iif successful.
+ */
+
+static bool address_to_sockaddr(const address_t * address, struct sockaddr_storage * ss, socklen_t * psocket_size)
 {
-    struct sockaddr     * sa;
-#ifdef USE_IPV4
-    struct sockaddr_in    sa4;
-#endif
-#ifdef USE_IPV6
-    struct sockaddr_in6   sa6;
-#endif
-    socklen_t             socket_size;
-    int                   ret = -1;
-    size_t                buffer_size;
+    memset(ss, 0, sizeof(struct sockaddr_storage));
 
     switch (address->family) {
 #ifdef USE_IPV4
         case AF_INET:
-            sa = (struct sockaddr *) &sa4;
-            memset(sa, 0, sizeof(struct sockaddr_in));
-            sa4.sin_family = address->family;
-            socket_size    = sizeof(struct sockaddr_in);
-            sa4.sin_addr   = address->ip.ipv4;
-            buffer_size    = INET_ADDRSTRLEN;
+            ((struct sockaddr_in *) ss)->sin_family = AF_INET;
+            ((struct sockaddr_in *) ss)->sin_addr   = address->ip.ipv4;
+            *psocket_size = sizeof(struct sockaddr_in);
             break;
 #endif
 #ifdef USE_IPV6
         case AF_INET6:
-            sa = (struct sockaddr *) &sa6;
-            memset(sa, 0, sizeof(struct sockaddr_in6));
-            sa6.sin6_family = address->family;
-            socket_size     = sizeof(struct sockaddr_in6);
-            memcpy(&sa6.sin6_addr, &address->ip.ipv6, sizeof(ipv6_t));
-            buffer_size     = INET6_ADDRSTRLEN;
+            ((struct sockaddr_in6 *) ss)->sin6_family = AF_INET6;
+            memcpy(&((struct sockaddr_in6 *) ss)->sin6_addr, &address->ip.ipv6, sizeof(ipv6_t));
+            *psocket_size = sizeof(struct sockaddr_in6);
             break;
 #endif
         default:
-            *pbuffer = NULL;
-            fprintf(stderr, "address_to_string: Family not supported (family = %d)\n", address->family);
-            goto ERR_INVALID_FAMILY;
+            return false;
+    }
+    return true;
+}
+
+int address_to_string(const address_t * address, char ** pbuffer)
+{
+    struct sockaddr_storage ss;
+    socklen_t               socket_size;
+    int                     ret = -1;
+    size_t                  buffer_size;
+
+    if (!address_to_sockaddr(address, &ss, &socket_size)) {
+        *pbuffer = NULL;
+        fprintf(stderr, "address_to_string: Family not supported (family = %d)\n", address->family);
+        goto ERR_INVALID_FAMILY;
     }
+    buffer_size = address->family == AF_INET6 ? INET6_ADDRSTRLEN : INET_ADDRSTRLEN;
 
     if (!(*pbuffer = malloc(buffer_size))) {
         goto ERR_MALLOC;
     }
 
-    if ((ret = getnameinfo(sa, socket_size, *pbuffer, buffer_size, NULL, 0, NI_NUMERICHOST)) != 0) {
+    if ((ret = getnameinfo((struct sockaddr *) &ss, socket_size, *pbuffer, buffer_size, NULL, 0, NI_NUMERICHOST)) != 0) {
         fprintf(stderr, "address_to_string: %s", gai_strerror(ret));
         goto ERR_GETNAMEINFO;
     }
@@ -296,40 +311,53 @@ size_t address_get_size(const address_t * address) {
 
 bool address_resolv(const address_t * address, char ** phostname, int mask_cache)
 {
-    struct hostent * hp;
-    bool             found = false;
-    const void     * data;
+    struct sockaddr_storage ss;
+    socklen_t               socket_size;
+    char                    hostname[NI_MAXHOST];
+    bool                    found = false;
+#ifdef USE_CACHE
+    const void            * data;
+#endif
 
     if (!address) goto ERR_INVALID_PARAMETER;
 
 #ifdef USE_CACHE
     if (cache_ip_hostname && (mask_cache & CACHE_READ)) {
-        found = map_find(cache_ip_hostname, address, &data); //phostname);
+        pthread_rwlock_rdlock(&cache_ip_hostname_lock);
+        found = map_find(cache_ip_hostname, address, &data);
         if (found) {
             // We've to strdup the cached value, otherwise the function
             // calling address_resolv will erase this cached value.
+            // This must be done before releasing the lock, since
+            // another thread may update this entry.
             *phostname = strdup(data);
         }
+        pthread_rwlock_unlock(&cache_ip_hostname_lock);
+        __sync_fetch_and_add(found ? &cache_ip_hostname_hits : &cache_ip_hostname_misses, 1);
+        if (found && !*phostname) goto ERR_STRDUP;
     }
 #endif
 
-#ifdef USE_CACHE
     if (!found) {
-#endif
-        if (!(hp = gethostbyaddr(&address->ip, address_get_size(address), address->family))) {
-            // see h_error
+        // Unlike gethostbyaddr, getnameinfo is reentrant. The DNS lookup
+        // is performed without holding the cache lock.
+        if (!address_to_sockaddr(address, &ss, &socket_size)
+        ||  getnameinfo((struct sockaddr *) &ss, socket_size, hostname, sizeof(hostname), NULL, 0, NI_NAMEREQD) != 0
+        ) {
             goto ERR_GETHOSTBYADDR;
         }
 
-        if (!(*phostname = strdup(hp->h_name))) {
+        if (!(*phostname = strdup(hostname))) {
             goto ERR_STRDUP;
         }
 #ifdef USE_CACHE
-        if (mask_cache & CACHE_WRITE) {
+        if (cache_ip_hostname && (mask_cache & CACHE_WRITE)) {
+            pthread_rwlock_wrlock(&cache_ip_hostname_lock);
             map_update(cache_ip_hostname, address, *phostname);
+            pthread_rwlock_unlock(&cache_ip_hostname_lock);
         }
-    }
 #endif
+    }
 
     return true;
 
@@ -340,3 +368,13 @@ ERR_STRDUP:
 ERR_INVALID_PARAMETER:
     return false;
 }
+
+bool address_cache_get_stats(size_t * pnum_hits, size_t * pnum_misses) {
+#ifdef USE_CACHE
+    *pnum_hits   = __sync_fetch_and_add(&cache_ip_hostname_hits,   0);
+    *pnum_misses = __sync_fetch_and_add(&cache_ip_hostname_misses, 0);
+    return true;
+#else
+    return false;
+#endif
+}
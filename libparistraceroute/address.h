@@ -182,7 +182,7 @@ int address_to_string(const address_t * addr, char ** pbuffer);
  * \brief Converts an IP stored in a string into its corresponding hostname.
  *    DNS lookups may be cached to improve the overall performance. This
  *    cache is shared between all running algorithm instance using
- *    libparistraceroute.
+ *    libparistraceroute. This function is thread-safe.
  * \param address An address_t instance
  * \param phostname Pass a pointer initialized to NULL.
  *    *phostname is automatically allocated if it is required.
@@ -203,4 +203,16 @@ int address_to_string(const address_t * addr, char ** pbuffer);
 
 bool address_resolv(const address_t * address, char ** phostname, int mask_cache);
 
+/**
+ * \brief Retrieve the statistics of the DNS cache shared by every
+ *    address_resolv() call of the process.
+ * \param pnum_hits Address of a size_t in which we write the number of
+ *    lookups served by the cache.
+ * \param pnum_misses Address of a size_t in which we write the number of
+ *    lookups not found in the cache.
+ * \return true iif successful, false if the cache is disabled (see USE_CACHE).
+ */
+
+bool address_cache_get_stats(size_t * pnum_hits, size_t * pnum_misses);
+
 #endif // LIBPT_ADDRESS_H
@@ -3,14 +3,17 @@
 #include <errno.h>          // errno
 #include "os/sys/eventfd.h" // eventfd_*
 #include <search.h>         // tsearch
+#include <stdint.h>         // SIZE_MAX
 #include <stdlib.h>         // malloc, free
 #include <stdio.h>          // fprintf
 #include <string.h>         // strcmp
 #include <unistd.h>
 
 #include "algorithm.h"
+#include "common.h"             // get_timestamp, MIN, MAX
 #include "dynarray.h"
 #include "event.h"
+#include "network.h"            // update_timer
 #include "pt_loop.h"
 
 static void * algorithms_root = NULL;
@@ -72,6 +75,12 @@ algorithm_instance_t * algorithm_instance_create(
     instance->events     = dynarray_create();
     instance->caller     = NULL;
     instance->loop       = loop;
+    instance->num_probes_sent = 0;
+    instance->max_probes      = SIZE_MAX;
+    instance->is_quota_reached = false;
+    instance->num_replies     = 0;
+    instance->wakeup_time     = 0;
+    instance->is_deleted      = false;
     return instance;
 }
 
@@ -82,7 +91,7 @@ algorithm_instance_t * algorithm_instance_create(
 
 void algorithm_instance_free(algorithm_instance_t * instance) {
     if (instance) {
-        algorithm_instance_clear_events(instance);
+        dynarray_free(instance->events, (ELEMENT_FREE) event_free);
         free(instance);
     }
 }
@@ -136,17 +145,21 @@ void pt_throw(
     algorithm_instance_t * instance,
     event_t              * event
 ) {
+    bool was_idle;
+
     if (event) {
-        if (instance) {
-            // Enqueue an algorithm event
-            dynarray_push_element(instance->events, event);
-            eventfd_write(instance->loop->eventfd_algorithm, 1);
-        } else if (loop) {
+        was_idle = instance && dynarray_get_size(instance->events) == 0;
+        if (instance && dynarray_push_element(instance->events, event)) {
+            // Enqueue an algorithm event. The loop is only notified once
+            // per batch: the events pending for an instance are processed
+            // at once (see pt_process_instance).
+            if (was_idle) eventfd_write(instance->loop->eventfd_algorithm, 1);
+        } else if (!instance && loop && dynarray_push_element(loop->events_user, event)) {
             // Enqueue an user event
-            dynarray_push_element(loop->events_user, event);
             eventfd_write(loop->eventfd_user, 1);
         } else {
             fprintf(stderr, "pt_algorithm_throw: event ignored\n");
+            event_free(event);
         }
     }
 }
@@ -155,6 +168,11 @@ void pt_stop_instance(
     struct pt_loop_s     * loop,
     algorithm_instance_t * instance
 ) {
+    // The network layer and the timer must no more notify this instance,
+    // which is about to release its data.
+    network_forget_caller(loop->network, instance);
+    pt_set_timer(loop, instance, 0);
+
     // Notify the caller that this instance will be freed
     pt_throw(NULL, instance, event_create(ALGORITHM_TERM, NULL, NULL, NULL));
 
@@ -170,11 +188,16 @@ static inline algorithm_instance_t * pt_algorithm_instance_add(
     struct pt_loop_s     * loop,
     algorithm_instance_t * instance
 ) {
-    return tsearch(
+    algorithm_instance_t ** node;
+
+    if ((node = tsearch(
         instance,
         &loop->algorithm_instances_root,
         (ELEMENT_COMPARE) algorithm_instance_compare
-    );
+    ))) {
+        loop->num_algorithm_instances++;
+    }
+    return node ? *node : NULL;
 }
 
 algorithm_instance_t * pt_add_instance(
@@ -203,13 +226,31 @@ algorithm_instance_t * pt_add_instance(
         goto ERR_INSTANCE;
     }
 
+    // An instance added by an algorithm notifies this algorithm
+    instance->caller = loop->cur_instance;
+
+    if (algorithm->is_priority
+    && !pt_set_instance_class(loop, instance, FAIR_QUEUE_DEFAULT_WEIGHT, true)) {
+        goto ERR_SET_INSTANCE_CLASS;
+    }
+
     // We need to queue a new event for the algorithm: it has been started
     pt_throw(NULL, instance, event_create(ALGORITHM_INIT, NULL, NULL, NULL));
 
-    // Add this algorithms to the list of handled algorithms
-    pt_algorithm_instance_add(loop, instance);
+    // Add this algorithms to the list of handled algorithms. The tree of
+    // instances cannot be altered while the loop is walking it to dispatch
+    // the events: the instance is inserted once done.
+    if (loop->cur_instance) {
+        if (!dynarray_push_element(loop->added_instances, instance)) goto ERR_ADD_INSTANCE;
+    } else {
+        if (!pt_algorithm_instance_add(loop, instance)) goto ERR_ADD_INSTANCE;
+    }
     return instance;
 
+ERR_ADD_INSTANCE:
+    network_forget_caller(loop->network, instance);
+ERR_SET_INSTANCE_CLASS:
+    algorithm_instance_free(instance);
 ERR_INSTANCE:
 ERR_PROBE_SKEL:
     if (probe_allocated) probe_free(probe_skel);
@@ -217,6 +258,27 @@ ERR_ALGORITHM_NOT_FOUND:
     return NULL;
 }
 
+bool pt_set_instance_class(
+    struct pt_loop_s     * loop,
+    algorithm_instance_t * instance,
+    size_t                 weight,
+    bool                   is_priority
+) {
+    return network_set_caller_class(loop->network, instance, weight, is_priority);
+}
+
+void pt_set_instance_quota(
+    struct pt_loop_s     * loop,
+    algorithm_instance_t * instance,
+    size_t                 max_probes
+) {
+    instance->max_probes = max_probes;
+    if (instance->is_quota_reached && instance->num_probes_sent < max_probes) {
+        instance->is_quota_reached = false;
+        pt_throw(loop, instance, event_create(NETWORK_WRITABLE, NULL, NULL, NULL));
+    }
+}
+
 /**
  * \brief Unregister an algorithm instance in the main loop.
  *    Its data must be previously freed by using algorithm_instance_free
@@ -227,19 +289,139 @@ static inline algorithm_instance_t * pt_algorithm_instance_del(
     struct pt_loop_s     * loop,
     algorithm_instance_t * instance
 ) {
-    return tdelete(
+    if (!tdelete(
         instance,
         &loop->algorithm_instances_root,
         (ELEMENT_COMPARE) algorithm_instance_compare
-    );
+    )) {
+        return NULL;
+    }
+    loop->num_algorithm_instances--;
+    return instance;
 }
 
 void pt_del_instance(
     struct pt_loop_s * loop,
     algorithm_instance_t * instance
 ) {
+    pt_set_timer(loop, instance, 0);
+    network_forget_caller(loop->network, instance);
+
+    // The tree of instances cannot be altered while the loop is walking it
+    // to dispatch the events (see pt_loop): the instance is released once
+    // done, and meanwhile it ignores its events (see pt_process_instance).
+    if (loop->cur_instance) {
+        if (!instance->is_deleted) {
+            instance->is_deleted = true;
+            if (!dynarray_push_element(loop->deleted_instances, instance)) {
+                fprintf(stderr, "pt_del_instance: cannot release instance %u\n", instance->id);
+            }
+        }
+        return;
+    }
+
     pt_algorithm_instance_del(loop, instance);
     algorithm_instance_free(instance);
 }
 
+void pt_add_pending_instances(struct pt_loop_s * loop) {
+    size_t                 i, num_instances = dynarray_get_size(loop->added_instances);
+    algorithm_instance_t * instance;
+
+    for (i = 0; i < num_instances; i++) {
+        instance = dynarray_get_ith_element(loop->added_instances, i);
+        if (!pt_algorithm_instance_add(loop, instance)) {
+            fprintf(stderr, "pt_add_pending_instances: cannot register instance %u\n", instance->id);
+        }
+    }
+    dynarray_clear(loop->added_instances, NULL);
+}
+
+void pt_free_deleted_instances(struct pt_loop_s * loop) {
+    size_t i, num_instances = dynarray_get_size(loop->deleted_instances);
+
+    for (i = 0; i < num_instances; i++) {
+        pt_del_instance(loop, dynarray_get_ith_element(loop->deleted_instances, i));
+    }
+    dynarray_clear(loop->deleted_instances, NULL);
+}
+
+//--------------------------------------------------------------------
+// Timers
+//--------------------------------------------------------------------
+
+/**
+ * \brief Rearm loop->timerfd_algorithm according to the next timer
+ *    which expires.
+ * \param loop The libparistraceroute loop.
+ * \return true iif successful.
+ */
+
+static bool pt_update_timer(struct pt_loop_s * loop) {
+    const algorithm_instance_t * instance;
+    size_t                       i, num_timers = dynarray_get_size(loop->timers);
+    double                       next_time = 0;
+
+    for (i = 0; i < num_timers; i++) {
+        instance = dynarray_get_ith_element(loop->timers, i);
+        next_time = i ? MIN(next_time, instance->wakeup_time) : instance->wakeup_time;
+    }
+
+    // A timer which has already expired must fire as soon as possible,
+    // while a null delay would disarm loop->timerfd_algorithm.
+    return update_timer(
+        loop->timerfd_algorithm,
+        num_timers ? MAX(next_time - get_timestamp(), 1e-6) : 0
+    );
+}
+
+bool pt_set_timer(
+    struct pt_loop_s     * loop,
+    algorithm_instance_t * instance,
+    double                 delay
+) {
+    size_t i, num_timers = dynarray_get_size(loop->timers);
+
+    if (delay < 0) {
+        errno = EINVAL;
+        return false;
+    }
+
+    if (instance->wakeup_time) {
+        for (i = 0; i < num_timers; i++) {
+            if (dynarray_get_ith_element(loop->timers, i) == instance) {
+                dynarray_del_ith_element(loop->timers, i, NULL);
+                break;
+            }
+        }
+        instance->wakeup_time = 0;
+    }
+
+    if (delay) {
+        if (!dynarray_push_element(loop->timers, instance)) return false;
+        instance->wakeup_time = get_timestamp() + delay;
+    }
+
+    return pt_update_timer(loop);
+}
+
+void pt_process_timers(struct pt_loop_s * loop) {
+    algorithm_instance_t * instance;
+    size_t                 i;
+    double                 now = get_timestamp();
+
+    for (i = 0; i < dynarray_get_size(loop->timers);) {
+        instance = dynarray_get_ith_element(loop->timers, i);
+        if (instance->wakeup_time <= now) {
+            dynarray_del_ith_element(loop->timers, i, NULL);
+            instance->wakeup_time = 0;
+            pt_throw(NULL, instance, event_create(ALGORITHM_TIMER, NULL, NULL, NULL));
+        } else i++;
+    }
+
+    if (!pt_update_timer(loop)) {
+        perror("pt_process_timers: cannot rearm the timer");
+    }
+}
+
 
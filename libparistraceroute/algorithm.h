@@ -29,6 +29,11 @@ typedef enum {
  * \struct algorithm_t
  * \brief Structure representing an algorithm.
  * The handler is called everytime an event concerning this instance is raised.
+ * The event is released by the loop once handled (see event_ref).
+ * If the algorithm provides a reply_handler, consecutive PROBE_REPLY events
+ * are passed to it at once instead, so that it can amortize its processing
+ * (e.g. walking its data structures once per batch). The handler must still
+ * handle PROBE_REPLY: a reply which cannot be batched is passed to it.
  */
 
 typedef struct algorithm_s {
@@ -40,7 +45,16 @@ typedef struct algorithm_s {
         probe_t   *  skel,
         void      *  poptions
     );                                        /**< Main handler function */
+    int (*reply_handler)(
+        pt_loop_t      *  loop,
+        probe_reply_t ** replies,
+        size_t            num_replies,
+        void          ** pdata,
+        probe_t        *  skel,
+        void           *  poptions
+    );                                        /**< Handles a batch of replies (optional). The replies are released by the loop once handled (see probe_reply_ref) */
     const struct opt_spec * options;          /**< Options supported by this algorithm */
+    bool is_priority;                         /**< The probes of its instances are sent before the other ones (see pt_set_instance_class) */
 } algorithm_t;
 
 /**
@@ -58,6 +72,12 @@ typedef struct algorithm_instance_s {
     dynarray_t                  * events;     /**< An array of events received by the algorithm */
     struct algorithm_instance_s * caller;     /**< Reference to the entity that called the algorithm (NULL if called by user program) */
     struct pt_loop_s            * loop;       /**< Pointer to a library context */
+    size_t                        num_probes_sent; /**< Number of probes sent so far by this instance (see pt_send_probe) */
+    size_t                        max_probes;      /**< Maximum value of num_probes_sent (SIZE_MAX if unbounded, see pt_set_instance_quota) */
+    bool                          is_quota_reached; /**< true iif a probe has been rejected because of max_probes */
+    size_t                        num_replies;     /**< Number of replies dispatched so far to this instance */
+    double                        wakeup_time;     /**< Time at which this instance receives an ALGORITHM_TIMER event (0 if none, see pt_set_timer) */
+    bool                          is_deleted;      /**< true iif this instance is unregistered once the pending events are processed (see pt_del_instance) */
 } algorithm_instance_t;
 
 //--------------------------------------------------------------------
@@ -74,6 +94,9 @@ algorithm_t * algorithm_search(const char * name);
 
 /**
  * \brief Register an algorithm to be used by the library.
+ *    Like every registry of the library, this one is filled by
+ *    constructors (see ALGORITHM_REGISTER) before main() and is
+ *    read-only afterwards, so algorithm_search() needs no lock.
  * \param algorithm Pointer to a structure representing the algorithm
  */
 
@@ -146,7 +169,9 @@ void       algorithm_instance_clear_events  (algorithm_instance_t * instance);
  *    Pass NULL if this event is raised for an instance.
  * \param instance The instance that must receives the event.
  *    Pass NULL if this event has to be sent to the user program.
- * \param event The event that must be raised
+ * \param event The event that must be raised. The queue of the instance
+ *    (resp. of the user program) takes over the reference passed by the
+ *    caller, and releases it once the event has been handled.
  */
 
 void pt_throw(
@@ -158,6 +183,7 @@ void pt_throw(
 /**
  * \brief Send a TERM event to the algorithm (to make it release its data from the
  *    memory and unregister this algorithm from the pt_loop_t.
+ *    Its pending and flying probes are dropped, and its timer is disarmed.
  * \param loop The main loop
  * \param instance The instance we are freeing
  */
@@ -174,7 +200,12 @@ void pt_stop_instance(
  * \param options Options passed to this instance.
  * \param probe_skel Probe skeleton that constrains the way the packets
  *   produced by this instance will be forged.
- * \return A pointer to the instance, NULL otherwise.
+ * \return A pointer to the instance, NULL otherwise. If an algorithm
+ *   instance adds it, this instance becomes its caller: it receives the
+ *   events raised by the new instance (see pt_raise_event) instead of the
+ *   user program, and must unregister it once terminated. The new
+ *   instance is then registered once the loop has dispatched the pending
+ *   events (see pt_add_pending_instances).
  */
 
 algorithm_instance_t * pt_add_instance(
@@ -184,9 +215,50 @@ algorithm_instance_t * pt_add_instance(
     probe_t          * probe_skel
 );
 
+/**
+ * \brief Set the share of the network granted to an algorithm instance.
+ *    By default, every instance has the same weight, and only the
+ *    instances of a prioritary algorithm (see algorithm_t) are prioritary.
+ * \param loop The libparistraceroute loop.
+ * \param instance The algorithm instance.
+ * \param weight The number of probes sent in a row for this instance
+ *    when several instances are sending probes.
+ * \param is_priority Pass true if the probes of this instance must be
+ *    sent before the probes of the other instances.
+ * \return true iif successful.
+ */
+
+bool pt_set_instance_class(
+    struct pt_loop_s     * loop,
+    algorithm_instance_t * instance,
+    size_t                 weight,
+    bool                   is_priority
+);
+
+/**
+ * \brief Bound the number of probes sent by an algorithm instance, e.g.
+ *    to charge them on the budget of its caller. Once the quota is
+ *    reached, pt_send_probe fails with EAGAIN, and the caller receives an
+ *    ALGORITHM_QUOTA_REACHED event. The instance receives a
+ *    NETWORK_WRITABLE event once its quota is raised.
+ * \param loop The libparistraceroute loop.
+ * \param instance The algorithm instance.
+ * \param max_probes The maximum number of probes sent by this instance
+ *    since it has been added (SIZE_MAX if unbounded, default).
+ */
+
+void pt_set_instance_quota(
+    struct pt_loop_s     * loop,
+    algorithm_instance_t * instance,
+    size_t                 max_probes
+);
+
 /**
  * \brief Unregister an algorithm instance from the pt_loop.
  *    Data related to the instance is NOT freed.
+ *    If an algorithm instance unregisters another one, the latter no more
+ *    processes events and is released once the loop has dispatched the
+ *    pending events (see pt_free_deleted_instances).
  * \param loop The libparistraceroute loop.
  * \param instance The algorithm instance.
  */
@@ -196,4 +268,45 @@ void pt_del_instance(
     algorithm_instance_t * instance
 );
 
+/**
+ * \brief (Internal usage) Register the instances added while the loop
+ *    was dispatching the events (see pt_add_instance).
+ * \param loop The libparistraceroute loop.
+ */
+
+void pt_add_pending_instances(struct pt_loop_s * loop);
+
+/**
+ * \brief (Internal usage) Release the instances unregistered while the
+ *    loop was dispatching the events (see pt_del_instance).
+ * \param loop The libparistraceroute loop.
+ */
+
+void pt_free_deleted_instances(struct pt_loop_s * loop);
+
+/**
+ * \brief Arm the timer of an algorithm instance: it receives an
+ *    ALGORITHM_TIMER event once the delay has elapsed (e.g. to pace its
+ *    probes). An instance has a single timer, so arming it again replaces
+ *    the previous delay.
+ * \param loop The libparistraceroute loop.
+ * \param instance The algorithm instance.
+ * \param delay The delay in seconds. Pass 0 to disarm the timer.
+ * \return true iif successful.
+ */
+
+bool pt_set_timer(
+    struct pt_loop_s     * loop,
+    algorithm_instance_t * instance,
+    double                 delay
+);
+
+/**
+ * \brief (Internal usage) Throw an ALGORITHM_TIMER event to the instances
+ *    whose timer has expired, and rearm loop->timerfd_algorithm.
+ * \param loop The libparistraceroute loop.
+ */
+
+void pt_process_timers(struct pt_loop_s * loop);
+
 #endif // LIBPT_ALGORITHM_H
@@ -235,12 +235,20 @@ static lattice_return_t mda_enumerate(lattice_elt_t * elt, mda_data_t * mda_data
                  * flight for each interface ? or multiply the number of probes in
                  * flight by the number of interface (might overestimate ?)*/
                 ttl = interface->ttl_set[i % interface->num_ttls]; // Vary ttl over all possible
-                probe = probe_dup(mda_data->skel);
-                flow_id = ++mda_data->last_flow_id;
-                mda_interface_add_flow_id(interface, ttl, flow_id, MDA_FLOW_TESTING); // TODO control returned value
+                if (!(probe = probe_dup(mda_data->skel))) {
+                    goto ERR_PROBE_DUP;
+                }
+                flow_id = mda_data->last_flow_id + 1;
                 // I16 casts flow_id into a uint16_t before memcpy
-                probe_set_fields(probe, I8("ttl", ttl), I16("flow_id", flow_id), NULL); // TODO control returned value, free fields
-                pt_send_probe(mda_data->loop, probe); // TODO control returned value
+                probe_set_fields(probe, I8("ttl", ttl), I16("flow_id", flow_id), NULL); // TODO control returned value
+                if (!pt_send_probe(mda_data->loop, probe)) {
+                    // The sendq is full: the missing flows will be sent
+                    // once the lattice is walked again (see NETWORK_WRITABLE)
+                    probe_free(probe);
+                    return LATTICE_INTERRUPT_NEXT;
+                }
+                mda_data->last_flow_id = flow_id;
+                mda_interface_add_flow_id(interface, ttl, flow_id, MDA_FLOW_TESTING); // TODO control returned value
             }
         }
     } else {
@@ -273,8 +281,14 @@ static lattice_return_t mda_enumerate(lattice_elt_t * elt, mda_data_t * mda_data
         if (!(probe = probe_dup(mda_data->skel))) {
             goto ERR_PROBE_DUP;
         }
-        probe_set_fields(probe, I16("flow_id", flow_id), I8("ttl", ttl + 1), NULL); // TODO control returned value, free fields
-        pt_send_probe(mda_data->loop, probe);
+        probe_set_fields(probe, I16("flow_id", flow_id), I8("ttl", ttl + 1), NULL); // TODO control returned value
+        if (!pt_send_probe(mda_data->loop, probe)) {
+            // The sendq is full: give the flow back, it will be used once
+            // the lattice is walked again (see NETWORK_WRITABLE)
+            mda_ttl_flow->mda_flow->state = MDA_FLOW_AVAILABLE;
+            probe_free(probe);
+            break;
+        }
         interface->sent++;
     }
 
@@ -537,14 +551,14 @@ ERR_MDA_DATA_CREATE:
 }
 
 /**
- * \brief Process PROBE_REPLY nested events handled by an mda algorithm instance
+ * \brief Process a reply received by an mda algorithm instance
  * \param loop The main loop
- * \param event The nested event
+ * \param probe_reply The probe and its reply
  * \param skel The probe skeleton
  * \param options The options passed to mda
  */
 
-static void mda_handler_reply(pt_loop_t * loop, event_t * event, mda_data_t * data, probe_t * skel, const mda_options_t * options)
+static void mda_process_reply(pt_loop_t * loop, const probe_reply_t * probe_reply, mda_data_t * data, probe_t * skel, const mda_options_t * options)
 {
     // manage this XXX
     const probe_t    * probe,
@@ -563,8 +577,8 @@ static void mda_handler_reply(pt_loop_t * loop, event_t * event, mda_data_t * da
     int                ret;
     size_t             i, j;
 
-    probe = ((const probe_reply_t *) event->data)->probe;
-    reply = ((const probe_reply_t *) event->data)->reply;
+    probe = probe_reply->probe;
+    reply = probe_reply->reply;
 
     if (!(probe_extract(probe, "ttl",     &ttl)))         goto ERR_EXTRACT_TTL;
     if (!(probe_extract(probe, "flow_id", &flow_id_u16))) goto ERR_EXTRACT_FLOW_ID;
@@ -696,6 +710,10 @@ ERR_EXTRACT_TTL:
     return;
 }
 
+void mda_handler_reply(pt_loop_t * loop, event_t * event, mda_data_t * data, probe_t * skel, const mda_options_t * options) {
+    mda_process_reply(loop, event->data, data, skel, options);
+}
+
 static void mda_handler_timeout(pt_loop_t *loop, event_t *event, mda_data_t * data, probe_t *skel, const mda_options_t * options)
 {
     probe_t               * probe;
@@ -794,6 +812,29 @@ ERR_EXTRACT_TTL:
  * \return 0 iif successful
  */
 
+/**
+ * \brief Send the probes required by the available interfaces, or
+ *    terminate once the whole lattice has been discovered.
+ * \param loop The main loop
+ * \param data Data attached to the mda algorithm instance
+ * \return 0 iif successful
+ */
+
+static int mda_process_lattice(pt_loop_t * loop, mda_data_t * data)
+{
+    // Process available interfaces
+    switch (lattice_walk(data->lattice, mda_process_interface, data, LATTICE_WALK_DFS)) {
+        case LATTICE_ERROR:
+            fprintf(stderr, "mda_handler: LATTICE_ERROR\n");
+            return -1;
+        case LATTICE_DONE:  break;
+        default:            return 0;
+    }
+
+    pt_raise_terminated(loop);
+    return 0;
+}
+
 int mda_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * skel, void * opts)
 {
     mda_data_t          * data = (mda_data_t *) *pdata;
@@ -812,33 +853,45 @@ int mda_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * skel
             data = *pdata;
             mda_handler_timeout(loop, event, data, skel, options);
             break;
+        case PROBE_LATE_REPLY:
+        case PROBE_DUPLICATE:
+            // The corresponding probe has already been handled
+            return 0;
+        case NETWORK_WRITABLE:
+            // Send the probes rejected so far by walking the lattice again
+            break;
         case ALGORITHM_TERM:
-            fprintf(stderr, "event not yet handled\n");
-            // We should release the memory here
+            // The caller allows us to free mda's data
+            mda_data_free(data);
+            *pdata = NULL;
             pt_raise_terminated(loop);
-            break;
+            return 0;
         default:
             fprintf(stderr, "mda_handler: ignoring unhandled event (type = %d)\n", event->type);
             return 0;
     }
 
-    // Process available interfaces
-    switch (lattice_walk(data->lattice, mda_process_interface, data, LATTICE_WALK_DFS)) {
-        case LATTICE_ERROR:
-            fprintf(stderr, "mda_handler: LATTICE_ERROR\n");
-            return -1;
-        case LATTICE_DONE:  break;
-        default:            return 0;
+    return mda_process_lattice(loop, data);
+}
+
+int mda_reply_handler(pt_loop_t * loop, probe_reply_t ** replies, size_t num_replies, void ** pdata, probe_t * skel, void * opts)
+{
+    mda_data_t * data = (mda_data_t *) *pdata;
+    size_t       i;
+
+    for (i = 0; i < num_replies; i++) {
+        mda_process_reply(loop, replies[i], data, skel, opts);
     }
 
-    pt_raise_terminated(loop);
-    return 0;
+    // The lattice is walked once for the whole batch
+    return mda_process_lattice(loop, data);
 }
 
 static algorithm_t mda = {
-    .name     = "mda",
-    .handler  = mda_handler,
-    .options  = (const struct opt_spec *) &mda_opt_specs
+    .name          = "mda",
+    .handler       = mda_handler,
+    .reply_handler = mda_reply_handler,
+    .options       = (const struct opt_spec *) &mda_opt_specs
 };
 
 ALGORITHM_REGISTER(mda);
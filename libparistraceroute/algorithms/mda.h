@@ -30,6 +30,7 @@ typedef struct {
     void           * data;
     void          (* data_free)(void *); /**< Called in event_free to release data. Ignored if NULL. */
     void           * zero;
+    size_t           refcount;
 } mda_event_t;
 
 unsigned options_mda_get_bound();
@@ -63,4 +64,31 @@ void options_mda_init(mda_options_t * mda_options);
 
 int mda_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * skel, void * options);
 
+/**
+ * \brief Handle a batch of replies received by an mda algorithm instance.
+ *    The lattice is updated according to each reply, and then walked once
+ *    to send the next probes.
+ * \param loop The main loop.
+ * \param replies The probes and their replies.
+ * \param num_replies The number of replies.
+ * \param pdata Data attached to the current mda algorithm instance.
+ * \param skel The probe skeleton used to craft probe packets.
+ * \param options The options passed to the current mda algorithm instance.
+ * \return 0 iif successful
+ */
+
+int mda_reply_handler(pt_loop_t * loop, probe_reply_t ** replies, size_t num_replies, void ** pdata, probe_t * skel, void * options);
+
+/**
+ * \brief Update the lattice of discovered interfaces according to a
+ *    PROBE_REPLY event. Unlike mda_handler, no probe is sent.
+ * \param loop The main loop.
+ * \param event The PROBE_REPLY event.
+ * \param data Data attached to the current mda algorithm instance.
+ * \param skel The probe skeleton used to craft probe packets.
+ * \param options The options passed to the current mda algorithm instance.
+ */
+
+void mda_handler_reply(pt_loop_t * loop, event_t * event, mda_data_t * data, probe_t * skel, const mda_options_t * options);
+
 #endif // LIBPT_ALGORITHMS_MDA_H
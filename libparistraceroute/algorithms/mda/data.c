@@ -53,6 +53,7 @@ void mda_data_free(mda_data_t * data)
     if (data) {
         lattice_free(data->lattice, (ELEMENT_FREE) mda_interface_free);
         address_free(data->dst_ip);
+        bound_free(data->bound);
         free(data);
     }
 }
@@ -0,0 +1,806 @@
+#include "config.h"
+
+#include "monitor.h"
+
+#include <errno.h>          // errno, EINVAL, EAGAIN
+#include <stdlib.h>         // malloc, calloc, realloc, free, qsort
+#include <stdio.h>          // fprintf
+#include <string.h>         // memcpy
+
+#include "../os/search.h"   // tsearch, tfind, tdestroy
+#include "../common.h"      // get_timestamp, MIN, MAX, ELEMENT_COMPARE
+#include "../event.h"
+#include "../journal.h"     // journal_hop_t
+#include "../lattice.h"     // lattice_walk
+#include "../pt_loop.h"
+
+//-----------------------------------------------------------------
+// Monitor options
+//-----------------------------------------------------------------
+
+inline monitor_options_t monitor_get_default_options() {
+    monitor_options_t monitor_options = {
+        .mda_options = mda_get_default_options(),
+        .targets     = NULL,
+        .budget      = MONITOR_DEFAULT_BUDGET,
+        .max_remaps  = MONITOR_DEFAULT_MAX_REMAPS
+    };
+    return monitor_options;
+}
+
+//-----------------------------------------------------------------
+// Maps
+//-----------------------------------------------------------------
+
+static int monitor_hop_compare(const monitor_hop_t * hop1, const monitor_hop_t * hop2) {
+    return (int) hop1->ttl - (int) hop2->ttl;
+}
+
+/**
+ * \brief Add an interface to a map, unless it is already known at this TTL.
+ * \param map The map.
+ * \param ttl The TTL of the interface.
+ * \param flow_id A flow ID reaching this interface at this TTL.
+ * \param address The interface.
+ * \return true iif successful.
+ */
+
+static bool monitor_map_add_hop(monitor_map_t * map, uint8_t ttl, uint16_t flow_id, const address_t * address) {
+    monitor_hop_t * hops;
+    size_t          i;
+
+    for (i = 0; i < map->num_hops; i++) {
+        if (map->hops[i].ttl == ttl && address_compare(&map->hops[i].address, address) == 0) return true;
+    }
+
+    if (!(hops = realloc(map->hops, (map->num_hops + 1) * sizeof(monitor_hop_t)))) return false;
+    map->hops = hops;
+    map->hops[map->num_hops].ttl     = ttl;
+    map->hops[map->num_hops].flow_id = flow_id;
+    map->hops[map->num_hops].address = *address;
+    map->num_hops++;
+    return true;
+}
+
+/**
+ * \brief Load the interfaces discovered by a previous traceroute in a map.
+ *    The hops beyond the destination are ignored.
+ * \param map The map.
+ * \param previous_hops The outcome of the probes of the previous
+ *    traceroute (journal_hop_t instances).
+ * \return true iif successful.
+ */
+
+static bool monitor_map_load(monitor_map_t * map, const dynarray_t * previous_hops) {
+    const journal_hop_t * hop;
+    size_t                i, num_hops = dynarray_get_size(previous_hops);
+    uint8_t               dst_ttl = 0;
+
+    for (i = 0; i < num_hops; i++) {
+        hop = dynarray_get_ith_element(previous_hops, i);
+        if (!hop->is_star && address_compare(&hop->address, &map->dst_addr) == 0) {
+            dst_ttl = dst_ttl ? MIN(dst_ttl, hop->ttl) : hop->ttl;
+        }
+    }
+
+    for (i = 0; i < num_hops; i++) {
+        hop = dynarray_get_ith_element(previous_hops, i);
+        if (hop->is_star || (dst_ttl && hop->ttl > dst_ttl)) continue;
+        if (!monitor_map_add_hop(map, hop->ttl, hop->flow_id, &hop->address)) return false;
+    }
+
+    qsort(map->hops, map->num_hops, sizeof(monitor_hop_t), (ELEMENT_COMPARE) monitor_hop_compare);
+    return true;
+}
+
+/**
+ * \brief Add the interfaces of a lattice built by mda in a map
+ *    (see lattice_walk).
+ * \param elt The current node of the lattice.
+ * \param map The map.
+ * \return LATTICE_CONTINUE or LATTICE_INTERRUPT_NEXT if successful,
+ *    LATTICE_ERROR otherwise.
+ */
+
+static lattice_return_t monitor_map_add_interface(lattice_elt_t * elt, void * map) {
+    const mda_interface_t * interface = lattice_elt_get_data(elt);
+    const mda_ttl_flow_t  * ttl_flow;
+    size_t                  i, num_ttl_flows, num_hops = ((monitor_map_t *) map)->num_hops;
+
+    // The root of the lattice is a dummy interface
+    if (!interface->address) return LATTICE_CONTINUE;
+
+    // Each flow which has reached this interface at a given TTL is suitable
+    // to check it. Only the first one of each TTL is kept.
+    num_ttl_flows = dynarray_get_size(interface->ttl_flows);
+    for (i = 0; i < num_ttl_flows; i++) {
+        ttl_flow = dynarray_get_ith_element(interface->ttl_flows, i);
+        if (!monitor_map_add_hop(map, ttl_flow->ttl, ttl_flow->mda_flow->flow_id, interface->address)) {
+            return LATTICE_ERROR;
+        }
+    }
+
+    // An interface reached through several predecessors is visited once
+    return num_ttl_flows && ((monitor_map_t *) map)->num_hops == num_hops ?
+        LATTICE_INTERRUPT_NEXT :
+        LATTICE_CONTINUE;
+}
+
+/**
+ * \brief Duplicate a map.
+ * \param map The map.
+ * \return The newly allocated monitor_map_t instance, NULL in case of failure.
+ */
+
+static monitor_map_t * monitor_map_dup(const monitor_map_t * map) {
+    monitor_map_t * map_dup;
+
+    if (!(map_dup = malloc(sizeof(monitor_map_t))))                               goto ERR_MALLOC;
+    *map_dup = *map;
+    if (!(map_dup->hops = malloc(MAX(map->num_hops, 1) * sizeof(monitor_hop_t)))) goto ERR_HOPS;
+    if (map->num_hops) memcpy(map_dup->hops, map->hops, map->num_hops * sizeof(monitor_hop_t));
+    return map_dup;
+
+ERR_HOPS:
+    free(map_dup);
+ERR_MALLOC:
+    return NULL;
+}
+
+void monitor_map_free(monitor_map_t * map) {
+    if (map) {
+        free(map->hops);
+        free(map);
+    }
+}
+
+//-----------------------------------------------------------------
+// Monitor data
+//-----------------------------------------------------------------
+
+static int monitor_path_compare(const monitor_path_t * path1, const monitor_path_t * path2) {
+    return address_compare(&path1->map.dst_addr, &path2->map.dst_addr);
+}
+
+static void monitor_nothing_to_free(void * element) {}
+
+static void monitor_data_free(monitor_data_t * data) {
+    size_t i;
+
+    if (data) {
+        if (data->paths) {
+            for (i = 0; i < data->num_paths; i++) {
+                free(data->paths[i].map.hops);
+            }
+            free(data->paths);
+        }
+        tdestroy(data->paths_root, monitor_nothing_to_free);
+        free(data->heap);
+        dynarray_free(data->unmapped_paths, NULL);
+        dynarray_free(data->remapped_paths, NULL);
+        free(data);
+    }
+}
+
+/**
+ * \brief Allocate a monitor_data_t instance storing a path per target.
+ *    Duplicated targets are ignored.
+ * \param options The options of the instance.
+ * \return The newly allocated monitor_data_t instance, NULL in case of failure.
+ */
+
+static monitor_data_t * monitor_data_create(const monitor_options_t * options) {
+    monitor_data_t         * data;
+    monitor_path_t         * path, ** node;
+    const monitor_target_t * target;
+    size_t                   i, num_targets = dynarray_get_size(options->targets);
+
+    if (!(data = calloc(1, sizeof(monitor_data_t))))                           goto ERR_CALLOC;
+    if (!(data->paths = calloc(MAX(num_targets, 1), sizeof(monitor_path_t))))  goto ERR_DATA;
+    if (!(data->heap = calloc(MAX(num_targets, 1), sizeof(monitor_path_t *)))) goto ERR_DATA;
+    if (!(data->unmapped_paths = dynarray_create()))                           goto ERR_DATA;
+    if (!(data->remapped_paths = dynarray_create()))                           goto ERR_DATA;
+
+    for (i = 0; i < num_targets; i++) {
+        target = dynarray_get_ith_element(options->targets, i);
+        path = &data->paths[data->num_paths];
+        path->map.dst_addr = target->dst_addr;
+        path->probe_skel   = target->probe_skel;
+
+        if (!(node = tsearch(path, &data->paths_root, (ELEMENT_COMPARE) monitor_path_compare))) goto ERR_DATA;
+        if (*node != path) continue;
+        data->num_paths++;
+
+        if (target->previous_hops && !monitor_map_load(&path->map, target->previous_hops)) goto ERR_DATA;
+    }
+
+    data->last_refill = get_timestamp();
+    return data;
+
+ERR_DATA:
+    monitor_data_free(data);
+ERR_CALLOC:
+    return NULL;
+}
+
+//-----------------------------------------------------------------
+// Scheduling
+//-----------------------------------------------------------------
+
+/**
+ * \brief Push an idle path in the heap of the paths to check.
+ * \param data Data attached to this instance.
+ * \param path The path.
+ */
+
+static void monitor_heap_push(monitor_data_t * data, monitor_path_t * path) {
+    size_t i, parent;
+
+    for (i = data->heap_size++; i > 0; i = parent) {
+        parent = (i - 1) / 2;
+        if (data->heap[parent]->pass <= path->pass) break;
+        data->heap[i] = data->heap[parent];
+    }
+    data->heap[i] = path;
+}
+
+/**
+ * \brief Pop the path having the lowest pass from the heap.
+ * \param data Data attached to this instance.
+ * \return The corresponding path, NULL if the heap is empty.
+ */
+
+static monitor_path_t * monitor_heap_pop(monitor_data_t * data) {
+    monitor_path_t * path, * last;
+    size_t           i, child;
+
+    if (!data->heap_size) return NULL;
+    path = data->heap[0];
+    last = data->heap[--data->heap_size];
+
+    for (i = 0; (child = 2 * i + 1) < data->heap_size; i = child) {
+        if (child + 1 < data->heap_size && data->heap[child + 1]->pass < data->heap[child]->pass) child++;
+        if (last->pass <= data->heap[child]->pass) break;
+        data->heap[i] = data->heap[child];
+    }
+    data->heap[i] = last;
+    return path;
+}
+
+/**
+ * \brief Estimate the change rate of a path.
+ * \param path The path.
+ * \param now The current time.
+ * \return The number of changes expected per second.
+ */
+
+static double monitor_path_get_change_rate(const monitor_path_t * path, double now) {
+    return (path->num_changes + MONITOR_PRIOR_CHANGES)
+         / (path->observed_time + now - path->mapped_time + MONITOR_PRIOR_TIME);
+}
+
+/**
+ * \brief Wait for the next check of a path. A path which was not idle
+ *    (checking, remapping) does not catch up the checks it has missed.
+ * \param data Data attached to this instance.
+ * \param path The path.
+ */
+
+static void monitor_path_schedule(monitor_data_t * data, monitor_path_t * path) {
+    path->state = MONITOR_PATH_IDLE;
+    path->pass  = MAX(path->pass, data->pass);
+    monitor_heap_push(data, path);
+}
+
+/**
+ * \brief Count the probes sent by the mda instance remapping a path.
+ * \param data Data attached to this instance.
+ * \param path The path.
+ */
+
+static void monitor_count_remap(monitor_data_t * data, monitor_path_t * path) {
+    size_t num_probes = path->remap->num_probes_sent - path->num_counted;
+
+    data->num_probes_sent += num_probes;
+    path->num_counted     += num_probes;
+}
+
+/**
+ * \brief Update the number of probes which may be sent right now.
+ * \param data Data attached to this instance.
+ * \param options The options of this instance.
+ * \param now The current time.
+ */
+
+static void monitor_refill(monitor_data_t * data, const monitor_options_t * options, double now) {
+    size_t i, num_remaps = dynarray_get_size(data->remapped_paths);
+
+    data->tokens = MIN(
+        data->tokens + (now - data->last_refill) * options->budget,
+        MAX(1, options->budget * MONITOR_BURST_TIME)
+    );
+    data->last_refill = now;
+
+    for (i = 0; i < num_remaps; i++) {
+        monitor_count_remap(data, dynarray_get_ith_element(data->remapped_paths, i));
+    }
+}
+
+/**
+ * \brief Share the tokens among the mda instances which have sent every
+ *    probe granted so far (see ALGORITHM_QUOTA_REACHED).
+ * \param loop The main loop.
+ * \param data Data attached to this instance.
+ * \return true iif an mda instance still waits for tokens.
+ */
+
+static bool monitor_grant_remaps(pt_loop_t * loop, monitor_data_t * data) {
+    monitor_path_t * path;
+    size_t           i, num_grants, num_waiting = 0,
+                     num_remaps = dynarray_get_size(data->remapped_paths);
+
+    for (i = 0; i < num_remaps; i++) {
+        path = dynarray_get_ith_element(data->remapped_paths, i);
+        if (path->state == MONITOR_PATH_REMAPPING && path->remap->is_quota_reached) num_waiting++;
+    }
+
+    for (i = 0; i < num_remaps && num_waiting && data->tokens >= 1; i++) {
+        path = dynarray_get_ith_element(data->remapped_paths, i);
+        if (path->state != MONITOR_PATH_REMAPPING || !path->remap->is_quota_reached) continue;
+
+        num_grants = MAX(1, (size_t) (data->tokens / num_waiting));
+        data->tokens     -= num_grants;
+        path->num_granted += num_grants;
+        pt_set_instance_quota(loop, path->remap, path->num_granted);
+        num_waiting--;
+    }
+    return num_waiting > 0;
+}
+
+//-----------------------------------------------------------------
+// Probing
+//-----------------------------------------------------------------
+
+/**
+ * \brief Send a check probe toward the next hop of a path.
+ * \param loop The main loop.
+ * \param path The path.
+ * \return true iif successful. If the sendq is full, errno is set to EAGAIN.
+ */
+
+static bool monitor_send_check(pt_loop_t * loop, monitor_path_t * path) {
+    const monitor_hop_t * hop = &path->map.hops[path->next_hop];
+    probe_t             * probe;
+
+    if (!(probe = probe_dup(path->probe_skel)))                                            goto ERR_PROBE_DUP;
+    if (!probe_set_fields(probe, I8("ttl", hop->ttl), I16("flow_id", hop->flow_id), NULL)) goto ERR_PROBE_SET_FIELDS;
+    if (!pt_send_probe(loop, probe))                                                       goto ERR_PT_SEND_PROBE;
+    return true;
+
+ERR_PT_SEND_PROBE:
+    // errno is left untouched, so that the caller can tell whether the
+    // sendq was full (EAGAIN).
+ERR_PROBE_SET_FIELDS:
+    probe_free(probe);
+ERR_PROBE_DUP:
+    return false;
+}
+
+/**
+ * \brief Start an mda instance remapping a path.
+ * \param loop The main loop.
+ * \param data Data attached to this instance.
+ * \param options The options of this instance.
+ * \param path The path.
+ * \return true iif successful.
+ */
+
+static bool monitor_start_remap(
+    pt_loop_t               * loop,
+    monitor_data_t          * data,
+    const monitor_options_t * options,
+    monitor_path_t          * path
+) {
+    path->mda_options = options->mda_options;
+    path->mda_options.traceroute_options.dst_addr = &path->map.dst_addr;
+    path->num_granted = 0;
+    path->num_counted = 0;
+
+    if (!dynarray_push_element(data->remapped_paths, path))                                  goto ERR_PUSH_ELEMENT;
+    if (!(path->remap = pt_add_instance(loop, "mda", &path->mda_options, path->probe_skel))) goto ERR_ADD_INSTANCE;
+
+    // mda waits for the tokens granted by monitor_grant_remaps
+    pt_set_instance_quota(loop, path->remap, 0);
+    path->state = MONITOR_PATH_REMAPPING;
+    return true;
+
+ERR_ADD_INSTANCE:
+    dynarray_del_ith_element(data->remapped_paths, dynarray_get_size(data->remapped_paths) - 1, NULL);
+ERR_PUSH_ELEMENT:
+    fprintf(stderr, "Error in monitor_start_remap\n");
+    return false;
+}
+
+/**
+ * \brief Spend the budget earned so far: start the pending remappings,
+ *    grant probes to the mda instances, then send the check probes of the
+ *    paths whose turn has come. The instance is woken up once the next
+ *    probe is earned.
+ * \param loop The main loop.
+ * \param data Data attached to this instance.
+ * \param options The options of this instance.
+ * \return true iif successful.
+ */
+
+static bool monitor_schedule(pt_loop_t * loop, monitor_data_t * data, const monitor_options_t * options) {
+    monitor_path_t * path;
+    double           stride, now = get_timestamp();
+    bool             is_waiting;
+
+    // The instance is waiting for its mda instances (see ALGORITHM_TERM)
+    if (data->is_stopping) return true;
+
+    monitor_refill(data, options, now);
+
+    // The probes of a remapping are granted once it asks for them
+    while (dynarray_get_size(data->unmapped_paths)
+    &&     dynarray_get_size(data->remapped_paths) < options->max_remaps
+    ) {
+        path = dynarray_get_ith_element(data->unmapped_paths, 0);
+        dynarray_del_ith_element(data->unmapped_paths, 0, NULL);
+        if (!monitor_start_remap(loop, data, options, path)) return false;
+    }
+    is_waiting = monitor_grant_remaps(loop, data);
+
+    while (!data->is_blocked && data->tokens >= 1 && (path = monitor_heap_pop(data))) {
+        if (!monitor_send_check(loop, path)) {
+            monitor_heap_push(data, path);
+            if (errno != EAGAIN) return false;
+
+            // Wait for NETWORK_WRITABLE
+            data->is_blocked = true;
+            break;
+        }
+
+        // The share of a path grows with its change rate and its length
+        stride = 1 / (monitor_path_get_change_rate(path, now) * path->map.num_hops);
+        data->pass = path->pass;
+        path->pass += stride;
+        path->state = MONITOR_PATH_CHECKING;
+        path->num_checks++;
+        data->tokens--;
+        data->num_probes_sent++;
+    }
+
+    if (is_waiting || (!data->is_blocked && data->heap_size)) {
+        return pt_set_timer(loop, loop->cur_instance, MAX(1 - data->tokens, 0.01) / options->budget);
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------
+// Path changes
+//-----------------------------------------------------------------
+
+/**
+ * \brief Find the path probed by a check probe.
+ * \param data Data attached to this instance.
+ * \param probe The check probe.
+ * \return The corresponding path if it is being checked, NULL otherwise.
+ */
+
+static monitor_path_t * monitor_find_checked_path(monitor_data_t * data, const probe_t * probe) {
+    monitor_path_t search, ** node;
+
+    if (!probe_extract(probe, "dst_ip", &search.map.dst_addr)) return NULL;
+    if (!(node = tfind(&search, &data->paths_root, (ELEMENT_COMPARE) monitor_path_compare))) return NULL;
+    return (*node)->state == MONITOR_PATH_CHECKING ? *node : NULL;
+}
+
+/**
+ * \brief Find the path remapped by an mda instance.
+ * \param data Data attached to this instance.
+ * \param instance The mda instance.
+ * \param pi Pointer to the index of the path in data->remapped_paths.
+ * \return The corresponding path if any, NULL otherwise.
+ */
+
+static monitor_path_t * monitor_find_remapped_path(monitor_data_t * data, const algorithm_instance_t * instance, size_t * pi) {
+    monitor_path_t * path;
+    size_t           i, num_remaps = dynarray_get_size(data->remapped_paths);
+
+    for (i = 0; i < num_remaps; i++) {
+        path = dynarray_get_ith_element(data->remapped_paths, i);
+        if (path->remap == instance) {
+            *pi = i;
+            return path;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * \brief Notify the caller that a path has been mapped, and wait for
+ *    its first check.
+ * \param loop The main loop.
+ * \param data Data attached to this instance.
+ * \param path The path.
+ * \return true iif successful.
+ */
+
+static bool monitor_path_mapped(pt_loop_t * loop, monitor_data_t * data, monitor_path_t * path) {
+    monitor_map_t * map;
+
+    path->mapped_time = get_timestamp();
+    path->next_hop    = 0;
+    path->num_stars   = 0;
+
+    if (!(map = monitor_map_dup(&path->map))) return false;
+    pt_raise_event(loop, event_create(MONITOR_PATH_MAPPED, map, NULL, (ELEMENT_FREE) monitor_map_free));
+
+    if (path->map.num_hops) {
+        monitor_path_schedule(data, path);
+    } else {
+        path->state = MONITOR_PATH_UNREACHABLE;
+    }
+    return true;
+}
+
+/**
+ * \brief Notify the caller that a path has changed, and queue its remapping.
+ * \param loop The main loop.
+ * \param data Data attached to this instance.
+ * \param path The path.
+ * \param address The interface which has replied to the check probe
+ *    (NULL if the last probes have been lost).
+ * \return true iif successful.
+ */
+
+static bool monitor_path_changed(pt_loop_t * loop, monitor_data_t * data, monitor_path_t * path, const address_t * address) {
+    monitor_change_t * change;
+
+    if (!(change = calloc(1, sizeof(monitor_change_t)))) return false;
+    change->dst_addr = path->map.dst_addr;
+    change->expected = path->map.hops[path->next_hop];
+    change->is_star  = !address;
+    if (address) change->address = *address;
+    pt_raise_event(loop, event_create(MONITOR_PATH_CHANGED, change, NULL, free));
+
+    path->num_changes++;
+    path->observed_time += get_timestamp() - path->mapped_time;
+    path->state = MONITOR_PATH_UNMAPPED;
+    return dynarray_push_element(data->unmapped_paths, path);
+}
+
+/**
+ * \brief Handle the outcome of a check probe.
+ * \param loop The main loop.
+ * \param data Data attached to this instance.
+ * \param path The path.
+ * \param reply The reply (NULL if the probe has been lost).
+ * \return true iif successful.
+ */
+
+static bool monitor_check_done(pt_loop_t * loop, monitor_data_t * data, monitor_path_t * path, const probe_t * reply) {
+    const monitor_hop_t * hop = &path->map.hops[path->next_hop];
+    address_t             address;
+    size_t                i;
+
+    if (reply) {
+        if (!probe_extract(reply, "src_ip", &address)) return false;
+
+        // The reply may come from any interface of the map at this TTL
+        for (i = 0; i < path->map.num_hops; i++) {
+            if (path->map.hops[i].ttl == hop->ttl && address_compare(&path->map.hops[i].address, &address) == 0) {
+                path->num_stars = 0;
+                path->next_hop  = (path->next_hop + 1) % path->map.num_hops;
+                monitor_path_schedule(data, path);
+                return true;
+            }
+        }
+    } else if (++(path->num_stars) < MONITOR_MAX_STARS) {
+        // A loss alone does not reveal a change (e.g. rate limiting):
+        // the same hop is checked again.
+        monitor_path_schedule(data, path);
+        return true;
+    }
+
+    return monitor_path_changed(loop, data, path, reply ? &address : NULL);
+}
+
+/**
+ * \brief Release the data of an instance once its mda instances are
+ *    unregistered, and notify the caller.
+ * \param loop The main loop.
+ * \param pdata Points to the data attached to this instance.
+ */
+
+static void monitor_terminate(pt_loop_t * loop, monitor_data_t ** pdata) {
+    if (dynarray_get_size((*pdata)->remapped_paths)) return;
+
+    monitor_data_free(*pdata);
+    *pdata = NULL;
+    pt_raise_terminated(loop);
+}
+
+/**
+ * \brief Handle the events raised by the mda instances remapping the paths.
+ *    Like a user program, the monitor reads the lattice of an instance once
+ *    it has terminated, stops it and unregisters it once its data is released.
+ * \param loop The main loop.
+ * \param event The raised event.
+ * \param data Data attached to this instance.
+ * \return true iif successful.
+ */
+
+static bool monitor_handle_remap_event(pt_loop_t * loop, const event_t * event, monitor_data_t * data) {
+    monitor_path_t   * path;
+    const mda_data_t * mda_data;
+    size_t             i;
+
+    // Compare the issuer before dereferencing it: an instance which has
+    // been unregistered is released once its events have been dispatched.
+    if (!(path = monitor_find_remapped_path(data, event->issuer, &i))) return true;
+
+    switch (event->type) {
+        case ALGORITHM_HAS_TERMINATED:
+            if (path->remap->data) {
+                // mda may notify its termination several times before
+                // releasing its data.
+                if (path->state != MONITOR_PATH_REMAPPING) return true;
+
+                monitor_count_remap(data, path);
+                mda_data = path->remap->data;
+                path->map.num_hops = 0;
+                if (lattice_walk(mda_data->lattice, monitor_map_add_interface, &path->map, LATTICE_WALK_DFS) == LATTICE_ERROR) {
+                    return false;
+                }
+                qsort(path->map.hops, path->map.num_hops, sizeof(monitor_hop_t), (ELEMENT_COMPARE) monitor_hop_compare);
+                path->map.num_probes = path->num_counted;
+                path->state = MONITOR_PATH_STOPPING;
+                pt_stop_instance(loop, path->remap);
+                return true;
+            }
+
+            // The mda instance has released its data
+            // The probes granted but not sent are given back
+            dynarray_del_ith_element(data->remapped_paths, i, NULL);
+            monitor_count_remap(data, path);
+            data->tokens += path->num_granted - path->remap->num_probes_sent;
+            pt_del_instance(loop, path->remap);
+            path->remap = NULL;
+
+            if (data->is_stopping) return true;
+            if (path->state == MONITOR_PATH_STOPPING) return monitor_path_mapped(loop, data, path);
+
+            // mda has been interrupted: the path is remapped again
+            path->state = MONITOR_PATH_UNMAPPED;
+            return dynarray_push_element(data->unmapped_paths, path);
+
+        case ALGORITHM_ERROR:
+            if (path->state == MONITOR_PATH_REMAPPING) pt_stop_instance(loop, path->remap);
+            return true;
+
+        default:
+            // The links discovered by mda are read once it has terminated.
+            // ALGORITHM_QUOTA_REACHED: mda waits for monitor_grant_remaps.
+            return true;
+    }
+}
+
+//-----------------------------------------------------------------
+// Monitor algorithm
+//-----------------------------------------------------------------
+
+/**
+ * \brief Handle events to a monitor algorithm instance
+ * \param loop The main loop
+ * \param event The raised event
+ * \param pdata Points to a (void *) address that may be altered by monitor_loop_handler in order
+ *   to manage data related to this instance.
+ * \param probe_skel The probe skeleton (unused, each target has its own one)
+ * \param opts Points to the option related to this instance (== loop->cur_instance->options)
+ */
+
+static int monitor_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * probe_skel, void * opts)
+{
+    monitor_data_t          * data = *pdata;
+    const monitor_options_t * options = opts;
+    monitor_path_t          * path;
+    probe_reply_t           * probe_reply;
+    size_t                    i;
+
+    if (!options || !options->targets || options->budget <= 0) {
+        fprintf(stderr, "Invalid monitor options\n");
+        errno = EINVAL;
+        goto FAILURE;
+    }
+
+    // The data has been released (see ALGORITHM_TERM)
+    if (!data && event->type != ALGORITHM_INIT) return 0;
+
+    switch (event->type) {
+        case ALGORITHM_INIT:
+            if (!(data = monitor_data_create(options))) goto FAILURE;
+            *pdata = data;
+
+            // The paths of a previous traceroute are checked right away
+            for (i = 0; i < data->num_paths; i++) {
+                path = &data->paths[i];
+                if (path->map.num_hops) {
+                    if (!monitor_path_mapped(loop, data, path)) goto FAILURE;
+                } else {
+                    path->state = MONITOR_PATH_UNMAPPED;
+                    if (!dynarray_push_element(data->unmapped_paths, path)) goto FAILURE;
+                }
+            }
+            break;
+
+        case PROBE_REPLY:
+            probe_reply = (probe_reply_t *) event->data;
+            if ((path = monitor_find_checked_path(data, probe_reply->probe))) {
+                if (!monitor_check_done(loop, data, path, probe_reply->reply)) goto FAILURE;
+            }
+            break;
+
+        case PROBE_TIMEOUT:
+            if ((path = monitor_find_checked_path(data, event->data))) {
+                if (!monitor_check_done(loop, data, path, NULL)) goto FAILURE;
+            }
+            break;
+
+        case NETWORK_WRITABLE:
+            data->is_blocked = false;
+            break;
+
+        case ALGORITHM_TIMER:
+            break;
+
+        case ALGORITHM_EVENT:
+        case ALGORITHM_HAS_TERMINATED:
+        case ALGORITHM_ERROR:
+        case ALGORITHM_QUOTA_REACHED:
+            if (!monitor_handle_remap_event(loop, event, data)) goto FAILURE;
+            if (data->is_stopping) {
+                monitor_terminate(loop, (monitor_data_t **) pdata);
+                return 0;
+            }
+            break;
+
+        case ALGORITHM_TERM:
+            if (data->is_stopping) return 0;
+
+            // The mda instances release their data before ours. They are
+            // stopped even if they already are, since the events following
+            // ALGORITHM_TERM (e.g. their termination) are dropped.
+            data->is_stopping = true;
+            pt_set_timer(loop, loop->cur_instance, 0);
+            for (i = 0; i < dynarray_get_size(data->remapped_paths); i++) {
+                path = dynarray_get_ith_element(data->remapped_paths, i);
+                path->state = MONITOR_PATH_STOPPING;
+                pt_stop_instance(loop, path->remap);
+            }
+            monitor_terminate(loop, (monitor_data_t **) pdata);
+            return 0;
+
+        default:
+            // PROBE_LATE_REPLY, PROBE_DUPLICATE: the corresponding check
+            // probe has already been handled.
+            return 0;
+    }
+
+    if (!monitor_schedule(loop, data, options)) goto FAILURE;
+    return 0;
+
+FAILURE:
+    pt_raise_error(loop);
+    return EINVAL;
+}
+
+static algorithm_t monitor = {
+    .name    = "monitor",
+    .handler = monitor_loop_handler,
+    .options = NULL
+};
+
+ALGORITHM_REGISTER(monitor);
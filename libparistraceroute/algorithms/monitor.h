@@ -0,0 +1,173 @@
+#ifndef LIBPT_ALGORITHMS_MONITOR_H
+#define LIBPT_ALGORITHMS_MONITOR_H
+
+#include <stdbool.h>      // bool
+#include <stdint.h>       // uint*_t
+#include <stddef.h>       // size_t
+
+#include "mda.h"          // mda_options_t
+#include "../address.h"   // address_t
+#include "../algorithm.h" // algorithm_instance_t
+#include "../dynarray.h"  // dynarray_t
+#include "../probe.h"     // probe_t
+
+/*
+ * Principle:
+ *
+ * monitor - track the changes of many paths with a fixed probing budget
+ * (see DTrack, Cunha et al., SIGCOMM 2011).
+ *
+ * Each path is mapped once by mda (or loaded from a previous traceroute).
+ * The map stores, for each interface discovered at a TTL, a flow ID which
+ * has reached it. Afterwards, the path is checked by sending a single
+ * probe at a time, with the TTL and the flow ID of one of its interfaces:
+ * as long as the path is stable, the reply comes from an interface of the
+ * map at this TTL. Otherwise, the path has changed and is remapped by mda.
+ *
+ * Algorithm:
+ *
+ *     Every 1 / budget seconds:
+ *         if a changed path is waiting for its remapping and less than
+ *         max_remaps paths are being remapped, start mda toward it
+ *         else send a check probe toward the path whose turn has come
+ *
+ *     CHECK_REPLY / CHECK_TIMEOUT:
+ *         if an interface of the map replies, check the next interface
+ *         later on
+ *         else if MONITOR_MAX_STARS consecutive probes are lost, or if
+ *         another interface replies, the path has changed
+ *
+ * The probes of mda are charged on the budget as well: an mda instance may
+ * only send the probes granted by the monitor (see pt_set_instance_quota),
+ * which are taken from the tokens earned for the check probes. The probes
+ * granted but not sent are given back once mda terminates.
+ *
+ * The turn of each path is given by stride scheduling: a path receives a
+ * share of the check probes proportional to the number of interfaces of its
+ * map and to its change rate. The change rate is learnt from the changes
+ * detected so far: (num_changes + MONITOR_PRIOR_CHANGES) / (time observed +
+ * MONITOR_PRIOR_TIME). The paths which change often are checked more
+ * often, while the stable ones still receive a share of the budget.
+ *
+ * A path is checked interface by interface: a change which does not alter
+ * the set of interfaces reached at each TTL (e.g. a load balancer
+ * forwarding a flow to another of its next hops) is not detected.
+ *
+ * monitor never terminates by itself: it runs until the caller stops it
+ * (see pt_stop_instance), e.g. when the loop times out.
+ */
+
+#define MONITOR_DEFAULT_BUDGET     10      /**< Probes per second */
+#define MONITOR_DEFAULT_MAX_REMAPS 4       /**< Paths remapped simultaneously */
+#define MONITOR_MAX_STARS          3       /**< Consecutive losses at a hop revealing a change */
+#define MONITOR_PRIOR_CHANGES      1.0     /**< Changes assumed before observing a path... */
+#define MONITOR_PRIOR_TIME         86400.0 /**< ... during this time (in seconds) */
+#define MONITOR_BURST_TIME         0.1     /**< The probes earned during this time (in seconds) may be sent in a row */
+
+//--------------------------------------------------------------------
+// Options
+//--------------------------------------------------------------------
+
+typedef struct {
+    address_t          dst_addr;      /**< Destination of the path */
+    probe_t          * probe_skel;    /**< Skeleton of the probes sent toward dst_addr */
+    const dynarray_t * previous_hops; /**< Outcome of the probes of a previous traceroute (journal_hop_t instances), used as first map. May be NULL. */
+} monitor_target_t;
+
+typedef struct {
+    mda_options_t      mda_options; /**< Options of the mda instances remapping the paths (inherits traceroute_options_t, whose dst_addr is ignored) */
+    const dynarray_t * targets;     /**< Paths to monitor (monitor_target_t instances) */
+    double             budget;      /**< Number of probes sent per second, remappings included */
+    size_t             max_remaps;  /**< Maximum number of paths remapped simultaneously */
+} monitor_options_t;
+
+/**
+ * \brief Retrieve the default options of monitor.
+ * \return The corresponding monitor_options_t structure.
+ */
+
+monitor_options_t monitor_get_default_options();
+
+//--------------------------------------------------------------------
+// Events
+//--------------------------------------------------------------------
+
+typedef enum {
+    MONITOR_PATH_MAPPED,  /**< A path has been (re)mapped. data: monitor_map_t */
+    MONITOR_PATH_CHANGED  /**< A check probe has revealed a change. data: monitor_change_t */
+} monitor_event_type_t;
+
+typedef struct {
+    uint8_t   ttl;     /**< TTL of the interface */
+    uint16_t  flow_id; /**< A flow ID whose probes reach this interface at this TTL */
+    address_t address; /**< The interface */
+} monitor_hop_t;
+
+typedef struct {
+    address_t       dst_addr;   /**< Destination of the path */
+    monitor_hop_t * hops;       /**< Interfaces of the path, sorted by TTL */
+    size_t          num_hops;   /**< Number of interfaces stored in hops */
+    size_t          num_probes; /**< Number of probes sent to map the path (0 if loaded from a previous traceroute) */
+} monitor_map_t;
+
+typedef struct {
+    address_t       dst_addr;   /**< Destination of the path */
+    monitor_hop_t   expected;   /**< The hop checked by the probe */
+    bool            is_star;    /**< true iif the last probes have been lost */
+    address_t       address;    /**< The interface which has replied instead (unless is_star) */
+} monitor_change_t;
+
+/**
+ * \brief Release a monitor_map_t instance (see MONITOR_PATH_MAPPED).
+ * \param map The monitor_map_t instance.
+ */
+
+void monitor_map_free(monitor_map_t * map);
+
+//--------------------------------------------------------------------
+// Data
+//--------------------------------------------------------------------
+
+typedef enum {
+    MONITOR_PATH_IDLE,          /**< The path is waiting for its next check */
+    MONITOR_PATH_CHECKING,      /**< A check probe is flying */
+    MONITOR_PATH_UNMAPPED,      /**< The path is waiting for its remapping */
+    MONITOR_PATH_REMAPPING,     /**< mda is remapping the path */
+    MONITOR_PATH_STOPPING,      /**< mda has remapped the path and releases its data */
+    MONITOR_PATH_UNREACHABLE    /**< Nothing has replied while mapping the path */
+} monitor_path_state_t;
+
+typedef struct {
+    monitor_path_state_t   state;         /**< Progress of this path */
+    monitor_map_t          map;           /**< Current map of the path */
+    probe_t              * probe_skel;    /**< Skeleton of the probes sent toward this path */
+    size_t                 next_hop;      /**< Index in map.hops of the next hop to check */
+    size_t                 num_stars;     /**< Number of consecutive probes lost at this hop */
+    size_t                 num_checks;    /**< Number of check probes sent */
+    size_t                 num_changes;   /**< Number of changes detected */
+    double                 mapped_time;   /**< Time at which the current map has been discovered */
+    double                 observed_time; /**< Time during which the previous maps have been observed */
+    double                 pass;          /**< Virtual time of its next check (see stride scheduling) */
+    mda_options_t          mda_options;   /**< Options of the mda instance remapping this path */
+    algorithm_instance_t * remap;         /**< The mda instance remapping this path (NULL if none) */
+    size_t                 num_granted;   /**< Number of probes this mda instance may send, charged on the budget */
+    size_t                 num_counted;   /**< Number of probes of this mda instance already counted in num_probes_sent */
+} monitor_path_t;
+
+typedef struct {
+    monitor_path_t  * paths;           /**< Monitored paths */
+    size_t            num_paths;       /**< Number of paths stored in paths */
+    void            * paths_root;      /**< Paths indexed by destination (see tsearch) */
+    monitor_path_t ** heap;            /**< Idle paths, sorted by pass (binary heap) */
+    size_t            heap_size;       /**< Number of paths stored in heap */
+    double            pass;            /**< Virtual time of the last check */
+    dynarray_t      * unmapped_paths;  /**< Paths waiting for their remapping (monitor_path_t instances) */
+    dynarray_t      * remapped_paths;  /**< Paths being remapped (monitor_path_t instances) */
+    double            tokens;          /**< Number of probes which may be sent right now */
+    double            last_refill;     /**< Time at which tokens has been updated */
+    bool              is_blocked;      /**< true iif the sendq is full (see NETWORK_WRITABLE) */
+    bool              is_stopping;     /**< true iif the instance waits for its mda instances before releasing its data */
+    size_t            num_probes_sent; /**< Number of probes sent, remappings included */
+} monitor_data_t;
+
+#endif // LIBPT_ALGORITHMS_MONITOR_H
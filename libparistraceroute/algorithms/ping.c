@@ -1,6 +1,6 @@
 #include "ping.h"
 
-#include <errno.h>              // errno, EINVAL
+#include <errno.h>              // errno, EINVAL, EAGAIN
 #include <stdlib.h>             // malloc
 #include <stdio.h>              // fprintf
 #include <string.h>             // memset()
@@ -13,7 +13,7 @@
 #include "../algorithm.h"
 #include "../address.h"         // address_resolv
 #include "../common.h"          // get_timestamp
-#include "../network.h"         // options_network_get_timeout
+#include "../network.h"         // network_get_timeout
 
 //-----------------------------------------------------------------
 // Ping options
@@ -189,9 +189,13 @@ void ping_dump_statistics(ping_data_t * ping_data) {
         avg  = compute_mean(ping_data->rtt_results);
         mdev = compute_mean_deviation(ping_data->rtt_results);
 
-        printf("%zu packets transmitted, %zu received, %u%% packet loss, time %zums\n",
+        printf("%zu packets transmitted, %zu received, ",
             ping_data->num_replies,
-            ping_data->num_replies - ping_data->num_losses,
+            ping_data->num_replies - ping_data->num_losses
+        );
+        if (ping_data->num_late_replies) printf("+%zu late, ", ping_data->num_late_replies);
+        if (ping_data->num_duplicates)   printf("+%zu duplicates, ", ping_data->num_duplicates);
+        printf("%u%% packet loss, time %zums\n",
             ping_data->num_replies ? (unsigned) (100 * ((float) ping_data->num_losses / ping_data->num_replies)) : 0,
             (size_t) (1000 * (ping_data->last_time - ping_data->start_time))
         );
@@ -492,7 +496,10 @@ static ping_data_t * ping_data_dup(ping_data_t * ping_data) {
     new_ping_data->num_replies = ping_data->num_replies;
     new_ping_data->num_sent = ping_data->num_sent;
     new_ping_data->num_losses = ping_data->num_losses;
+    new_ping_data->num_late_replies = ping_data->num_late_replies;
+    new_ping_data->num_duplicates = ping_data->num_duplicates;
     new_ping_data->num_probes_in_flight = ping_data->num_probes_in_flight;
+    new_ping_data->num_pending_probes = ping_data->num_pending_probes;
     new_ping_data->start_time = ping_data->start_time;
     new_ping_data->last_time = ping_data->last_time;
 
@@ -680,8 +687,8 @@ static bool send_ping_probe(
     probe_t * probe;
     double    delay;
 
-    // a probe must never be altered, otherwise the network layer may
-    // manage corrupted probes.
+    // The skeleton is shared by the probes, which copy its packet before
+    // altering it (see probe_dup).
     if (!(probe = probe_dup(probe_skel))) goto ERR_PROBE_DUP;
     if (probe_get_delay(probe) != DELAY_BEST_EFFORT) {
         delay = i * probe_get_delay(probe_skel);
@@ -690,35 +697,42 @@ static bool send_ping_probe(
 
     probe_set_fields(probe, NULL); // set source ip
 
+    if (!pt_send_probe(loop, probe)) goto ERR_PT_SEND_PROBE;
     ++(*pnum_sent);
-    return pt_send_probe(loop, probe);
+    return true;
 
+ERR_PT_SEND_PROBE:
+    // errno is left untouched, so that the caller can tell whether the
+    // sendq was full (EAGAIN).
+    probe_free(probe);
+    return false;
 ERR_PROBE_DUP:
     fprintf(stderr, "Error in send_ping_probe\n");
     return false;
 }
 
 /**
- * \brief Send n ping probes toward a destination with a given TTL
+ * \brief Send the pending ping probes toward a destination
  * \param loop The paris traceroute loop
- * \param pnum_sent The address of the current the sequence number
- *    ping measurements.
+ * \param data The data of the algorithm. data->num_pending_probes probes
+ *    are sent.
  * \param probe_skel The probe skeleton used to craft the probe packet
- * \param num_probes The amount of probe to send
- * \return true if successful
+ * \return true if successful, even if some probes are still pending because
+ *    the sendq is full. They are then sent on NETWORK_WRITABLE.
  */
 
 bool send_ping_probes(
     pt_loop_t     * loop,
-    size_t        * pnum_sent,
-    probe_t       * probe_skel,
-    size_t          num_probes
+    ping_data_t   * data,
+    probe_t       * probe_skel
 ) {
     size_t i;
-    for (i = 0; i < num_probes; ++i) {
-        if (!(send_ping_probe(loop, pnum_sent, probe_skel, i + 1))) {
-            return false;
+    for (i = 0; data->num_pending_probes > 0; ++i) {
+        if (!(send_ping_probe(loop, &data->num_sent, probe_skel, i + 1))) {
+            return errno == EAGAIN;
         }
+        --(data->num_pending_probes);
+        ++(data->num_probes_in_flight);
     }
     return true;
 }
@@ -760,7 +774,7 @@ int ping_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t
             }
             *pdata = data;
             // We have to make sure not to send too many probes
-            num_max_probes_to_schedule = ceil(options_network_get_timeout() / options->interval);
+            num_max_probes_to_schedule = ceil(network_get_timeout(loop->network) / options->interval);
             num_probes_to_send = MIN(num_max_probes_to_schedule, options->count);
             break;
 
@@ -776,31 +790,31 @@ int ping_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t
 
             // Notify the caller we've got a response
             if (destination_reached(options->dst_addr, reply)) {
-                pt_raise_event(loop, event_create(PING_PROBE_REPLY, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
+                pt_raise_event(loop, event_create(PING_PROBE_REPLY, probe_reply_ref(probe_reply), NULL, (ELEMENT_FREE) probe_reply_free));
             } else {
                 ++(data->num_losses);
                 if (destination_network_unreachable(reply)) {
-                    pt_raise_event(loop, event_create(PING_DST_NET_UNREACHABLE, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
+                    pt_raise_event(loop, event_create(PING_DST_NET_UNREACHABLE, probe_reply_ref(probe_reply), NULL, (ELEMENT_FREE) probe_reply_free));
                 } else if (destination_host_unreachable(reply)) {
-                    pt_raise_event(loop, event_create(PING_DST_HOST_UNREACHABLE, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
+                    pt_raise_event(loop, event_create(PING_DST_HOST_UNREACHABLE, probe_reply_ref(probe_reply), NULL, (ELEMENT_FREE) probe_reply_free));
                 } else if (destination_protocol_unreachable(reply)) {
-                    pt_raise_event(loop, event_create(PING_DST_PROT_UNREACHABLE, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
+                    pt_raise_event(loop, event_create(PING_DST_PROT_UNREACHABLE, probe_reply_ref(probe_reply), NULL, (ELEMENT_FREE) probe_reply_free));
                 } else if (destination_port_unreachable(reply)) {
-                    pt_raise_event(loop, event_create(PING_DST_PORT_UNREACHABLE, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
+                    pt_raise_event(loop, event_create(PING_DST_PORT_UNREACHABLE, probe_reply_ref(probe_reply), NULL, (ELEMENT_FREE) probe_reply_free));
                 } else if (ttl_exceeded(reply)) {
-                    pt_raise_event(loop, event_create(PING_TTL_EXCEEDED_TRANSIT, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
+                    pt_raise_event(loop, event_create(PING_TTL_EXCEEDED_TRANSIT, probe_reply_ref(probe_reply), NULL, (ELEMENT_FREE) probe_reply_free));
                 } else if (fragment_reassembly_time_exceeded(reply)) {
-                    pt_raise_event(loop, event_create(PING_TIME_EXCEEDED_REASSEMBLY, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
+                    pt_raise_event(loop, event_create(PING_TIME_EXCEEDED_REASSEMBLY, probe_reply_ref(probe_reply), NULL, (ELEMENT_FREE) probe_reply_free));
                 } else if (redirect(reply)) {
-                    pt_raise_event(loop, event_create(PING_REDIRECT, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
+                    pt_raise_event(loop, event_create(PING_REDIRECT, probe_reply_ref(probe_reply), NULL, (ELEMENT_FREE) probe_reply_free));
                 } else if (parameter_problem(reply)) {
-                    pt_raise_event(loop, event_create(PING_PARAMETER_PROBLEM, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
+                    pt_raise_event(loop, event_create(PING_PARAMETER_PROBLEM, probe_reply_ref(probe_reply), NULL, (ELEMENT_FREE) probe_reply_free));
                 } else {
-                    pt_raise_event(loop, event_create(PING_GEN_ERROR, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
+                    pt_raise_event(loop, event_create(PING_GEN_ERROR, probe_reply_ref(probe_reply), NULL, (ELEMENT_FREE) probe_reply_free));
                 }
             }
 
-            num_probes_to_send = data->num_sent != options->count; // we should send only 1 or 0 probes
+            num_probes_to_send = data->num_sent + data->num_pending_probes != options->count; // we should send only 1 or 0 probes
             break;
 
         case PROBE_TIMEOUT:
@@ -813,9 +827,26 @@ int ping_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t
             data->last_time = probe->sending_time + network_get_timeout(loop->network);
 
             // Notify the caller we've got a probe timeout
-            pt_raise_event(loop, event_create(PING_TIMEOUT, probe, NULL, (ELEMENT_FREE) probe_free));
+            pt_raise_event(loop, event_create(PING_TIMEOUT, probe_ref(probe), NULL, (ELEMENT_FREE) probe_free));
 
-            num_probes_to_send = data->num_sent != options->count;
+            num_probes_to_send = data->num_sent + data->num_pending_probes != options->count;
+            break;
+
+        case PROBE_LATE_REPLY:
+        case PROBE_DUPLICATE:
+            // The corresponding probe has already been handled as a
+            // loss (resp. a reply): only update the statistics.
+            data = *pdata;
+            if (event->type == PROBE_LATE_REPLY) {
+                ++(data->num_late_replies);
+            } else {
+                ++(data->num_duplicates);
+            }
+            return 0;
+
+        case NETWORK_WRITABLE:
+            // Send the probes rejected so far (see send_ping_probes)
+            data = *pdata;
             break;
 
         case ALGORITHM_TERM:
@@ -845,18 +876,15 @@ int ping_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t
     }
 
     // check if we can send another probe or if we have already sent the maximum number of probes
-    if (num_probes_to_send > 0) {
-        send_ping_probes(loop, &data->num_sent, probe_skel, num_probes_to_send);
-        data->num_probes_in_flight += num_probes_to_send;
+    data->num_pending_probes += num_probes_to_send;
+    if (data->num_pending_probes > 0) {
+        send_ping_probes(loop, data, probe_skel);
     } else {
         if (data->num_probes_in_flight == 0) { // we've recieved a response from all the probes we sent
             pt_raise_event(loop, event_create(PING_ALL_PROBES_SENT, NULL, NULL, NULL));
             pt_raise_terminated(loop);
         }
     }
-
-    // Handled event must always been freed when leaving the handler
-    event_free(event);
     return 0;
 
 HAS_TERMINATED:
@@ -866,15 +894,9 @@ HAS_TERMINATED:
     if (has_terminated) {
         pt_raise_terminated(loop);
     }
-
-    // Handled event must always been freed when leaving the handler
-    event_free(event);
     return 0;
 
 FAILURE:
-    // Handled event must always been freed when leaving the handler
-    event_free(event);
-
     // Sent to the current instance a ALGORITHM_FAILURE notification.
     // The caller has to free the data allocated by the algorithm.
     pt_raise_error(loop);
@@ -884,7 +906,8 @@ FAILURE:
 static algorithm_t ping = {
     .name    = "ping",
     .handler = ping_loop_handler,
-    .options = (const option_t *) &ping_options
+    .options = (const option_t *) &ping_options,
+    .is_priority = true // Delaying the probes would distort the RTTs
 };
 
 ALGORITHM_REGISTER(ping);
@@ -88,12 +88,16 @@ typedef struct {
     void                  * data;
     void                 (* data_free)(void *); /**< Called in event_free to release data. Ignored if NULL. */
     void                  * zero;
+    size_t                  refcount;
 } ping_event_t;
 
 typedef struct {
     size_t       num_replies;          /**< Total of probe sent for this instance */
     size_t       num_losses;           /**< Number of packets lost */
+    size_t       num_late_replies;     /**< Number of replies received after the timeout of their probe */
+    size_t       num_duplicates;       /**< Number of duplicated replies */
     size_t       num_probes_in_flight; /**< The number of probes which haven't provoked a reply so far */
+    size_t       num_pending_probes;   /**< The number of probes not sent yet because the sendq was full */
     dynarray_t * rtt_results;          /**< RTTs in order to be able to compute statistics */
     size_t       num_sent;             /**< The number of probes sent (== the sequence number of the next probe packet) */
     double       start_time;           /**< The date at which ping starts measurement (in microsecond) */
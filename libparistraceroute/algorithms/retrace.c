@@ -0,0 +1,530 @@
+#include "retrace.h"
+
+#include <errno.h>       // errno, EINVAL, EAGAIN
+#include <stdlib.h>      // malloc, calloc, free
+#include <stdio.h>       // fprintf, printf
+#include <string.h>      // memset
+
+#include "../probe.h"
+#include "../event.h"
+#include "../algorithm.h"
+
+//-----------------------------------------------------------------
+// Retrace options
+//-----------------------------------------------------------------
+
+inline retrace_options_t retrace_get_default_options() {
+    retrace_options_t retrace_options = {
+        .traceroute_options = traceroute_get_default_options(),
+        .previous_hops      = NULL
+    };
+    return retrace_options;
+}
+
+//-----------------------------------------------------------------
+// Retrace data
+//-----------------------------------------------------------------
+
+static void retrace_data_free(retrace_data_t * retrace_data, uint8_t max_ttl) {
+    size_t ttl;
+
+    if (retrace_data) {
+        if (retrace_data->hops) {
+            for (ttl = 0; ttl <= max_ttl; ttl++) {
+                dynarray_free(retrace_data->hops[ttl].outcomes, free);
+            }
+            free(retrace_data->hops);
+        }
+        dynarray_free(retrace_data->pending_probes, (ELEMENT_FREE) probe_free);
+        free(retrace_data);
+    }
+}
+
+/**
+ * \brief Allocate a retrace_data_t instance and load the previous path.
+ * \param options The options of the instance.
+ * \return The newly allocated retrace_data_t instance, NULL in case of failure.
+ */
+
+static retrace_data_t * retrace_data_create(const retrace_options_t * options) {
+    const traceroute_options_t * traceroute_options = &options->traceroute_options;
+    retrace_data_t             * retrace_data;
+    retrace_hop_t              * hop;
+    const journal_hop_t        * previous_hop;
+    size_t                       i, ttl, num_previous_hops;
+
+    if (!(retrace_data = calloc(1, sizeof(retrace_data_t))))                                   goto ERR_CALLOC;
+    if (!(retrace_data->pending_probes = dynarray_create()))                                   goto ERR_DATA;
+    if (!(retrace_data->hops = calloc(traceroute_options->max_ttl + 1, sizeof(retrace_hop_t)))) goto ERR_DATA;
+    for (ttl = 0; ttl <= traceroute_options->max_ttl; ttl++) {
+        if (!(retrace_data->hops[ttl].outcomes = dynarray_create())) goto ERR_DATA;
+    }
+
+    // Each TTL is verified with the first interface which has replied.
+    // The previous path ends where the destination has replied.
+    num_previous_hops = options->previous_hops ? dynarray_get_size(options->previous_hops) : 0;
+    for (i = 0; i < num_previous_hops; i++) {
+        previous_hop = dynarray_get_ith_element(options->previous_hops, i);
+        if (previous_hop->ttl < traceroute_options->min_ttl
+        ||  previous_hop->ttl > traceroute_options->max_ttl
+        ||  previous_hop->is_star
+        ) {
+            continue;
+        }
+
+        hop = &retrace_data->hops[previous_hop->ttl];
+        if (!hop->is_known) {
+            hop->is_known = true;
+            hop->address  = previous_hop->address;
+            hop->flow_id  = previous_hop->flow_id;
+        }
+        if (previous_hop->ttl > retrace_data->path_end) {
+            retrace_data->path_end = previous_hop->ttl;
+        }
+        if (address_compare(&previous_hop->address, traceroute_options->dst_addr) == 0) {
+            break;
+        }
+    }
+
+    retrace_data->next_ttl = retrace_data->path_end ? retrace_data->path_end + 1 : traceroute_options->min_ttl;
+    return retrace_data;
+
+ERR_DATA:
+    retrace_data_free(retrace_data, traceroute_options->max_ttl);
+ERR_CALLOC:
+    return NULL;
+}
+
+//-----------------------------------------------------------------
+// Probing
+//-----------------------------------------------------------------
+
+/**
+ * \brief Send the probes rejected so far because the sendq was full.
+ * \param loop The main loop.
+ * \param retrace_data Data attached to this instance.
+ * \return true iif successful, even if some probes are still pending
+ *    because the sendq is full. They are then sent on NETWORK_WRITABLE.
+ */
+
+static bool send_pending_retrace_probes(pt_loop_t * loop, retrace_data_t * retrace_data) {
+    probe_t * probe;
+
+    while (dynarray_get_size(retrace_data->pending_probes)) {
+        probe = dynarray_get_ith_element(retrace_data->pending_probes, 0);
+        if (!pt_send_probe(loop, probe)) return errno == EAGAIN;
+
+        // The network layer now holds the reference of this probe
+        dynarray_del_ith_element(retrace_data->pending_probes, 0, NULL);
+    }
+    return true;
+}
+
+/**
+ * \brief Send a retrace probe.
+ * \param loop The main loop.
+ * \param retrace_data Data attached to this instance.
+ * \param probe_skel The probe skeleton used to craft the probe packet.
+ * \param ttl The TTL of the probe.
+ * \param hop If not NULL, the probe belongs to the flow recorded for this hop.
+ * \return true iif successful.
+ */
+
+static bool send_retrace_probe(
+    pt_loop_t           * loop,
+    retrace_data_t      * retrace_data,
+    const probe_t       * probe_skel,
+    uint8_t               ttl,
+    const retrace_hop_t * hop
+) {
+    probe_t * probe;
+
+    if (!(probe = probe_dup(probe_skel)))                                    goto ERR_PROBE_DUP;
+    if (!probe_set_fields(probe, I8("ttl", ttl), NULL))                      goto ERR_PROBE_SET_FIELDS;
+    if (hop && !probe_set_fields(probe, I16("flow_id", hop->flow_id), NULL)) goto ERR_PROBE_SET_FIELDS;
+
+    // The probes of an instance are sent in order
+    if (!dynarray_push_element(retrace_data->pending_probes, probe))         goto ERR_PROBE_PUSH_ELEMENT;
+    retrace_data->hops[ttl].num_flying++;
+    retrace_data->num_flying++;
+    retrace_data->num_probes_sent++;
+    return send_pending_retrace_probes(loop, retrace_data);
+
+ERR_PROBE_PUSH_ELEMENT:
+ERR_PROBE_SET_FIELDS:
+    probe_free(probe);
+ERR_PROBE_DUP:
+    fprintf(stderr, "Error in send_retrace_probe\n");
+    return false;
+}
+
+/**
+ * \brief Send num_probes probes at a given TTL, like traceroute does.
+ * \param loop The main loop.
+ * \param retrace_data Data attached to this instance.
+ * \param probe_skel The probe skeleton used to craft the probe packet.
+ * \param options The options of this instance.
+ * \param ttl The enumerated TTL.
+ * \return true iif successful.
+ */
+
+static bool retrace_enumerate_hop(
+    pt_loop_t                  * loop,
+    retrace_data_t             * retrace_data,
+    const probe_t              * probe_skel,
+    const traceroute_options_t * options,
+    uint8_t                      ttl
+) {
+    size_t i;
+
+    retrace_data->hops[ttl].state = RETRACE_HOP_ENUMERATING;
+    for (i = 0; i < options->num_probes; i++) {
+        if (!send_retrace_probe(loop, retrace_data, probe_skel, ttl, NULL)) return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Send the first probes: one per known hop of the previous path,
+ *    num_probes per unknown hop.
+ * \param loop The main loop.
+ * \param retrace_data Data attached to this instance.
+ * \param probe_skel The probe skeleton used to craft the probe packet.
+ * \param options The options of this instance.
+ * \return true iif successful.
+ */
+
+static bool retrace_start(
+    pt_loop_t                  * loop,
+    retrace_data_t             * retrace_data,
+    const probe_t              * probe_skel,
+    const traceroute_options_t * options
+) {
+    retrace_hop_t * hop;
+    size_t          ttl;
+
+    for (ttl = options->min_ttl; ttl <= retrace_data->path_end; ttl++) {
+        hop = &retrace_data->hops[ttl];
+        if (hop->is_known) {
+            hop->state = RETRACE_HOP_VERIFYING;
+            if (!send_retrace_probe(loop, retrace_data, probe_skel, ttl, hop)) return false;
+        } else if (!retrace_enumerate_hop(loop, retrace_data, probe_skel, options, ttl)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * \brief Record the outcome of a probe.
+ * \param retrace_data Data attached to this instance.
+ * \param options The options of this instance.
+ * \param probe The probe.
+ * \param reply Its reply, NULL if it has been lost.
+ * \return The hop of this probe, NULL in case of failure.
+ */
+
+static retrace_hop_t * retrace_add_outcome(
+    retrace_data_t             * retrace_data,
+    const traceroute_options_t * options,
+    const probe_t              * probe,
+    const probe_t              * reply
+) {
+    retrace_hop_t * hop;
+    journal_hop_t * outcome;
+
+    if (!(outcome = calloc(1, sizeof(journal_hop_t))))  goto ERR_CALLOC;
+    if (!probe_extract(probe, "ttl", &outcome->ttl))    goto ERR_EXTRACT;
+    if (outcome->ttl > options->max_ttl)                goto ERR_EXTRACT;
+    if (!probe_extract(probe, "flow_id", &outcome->flow_id)) outcome->flow_id = 0;
+
+    outcome->is_star = !(reply && probe_extract(reply, "src_ip", &outcome->address));
+    if (!outcome->is_star) {
+        outcome->rtt = 1000 * (probe_get_recv_time(reply) - probe_get_sending_time(probe));
+    }
+
+    hop = &retrace_data->hops[outcome->ttl];
+    if (!dynarray_push_element(hop->outcomes, outcome)) goto ERR_PUSH_ELEMENT;
+
+    if (hop->num_flying) hop->num_flying--;
+    if (retrace_data->num_flying) retrace_data->num_flying--;
+    if (outcome->is_star) hop->num_stars++;
+    return hop;
+
+ERR_PUSH_ELEMENT:
+ERR_EXTRACT:
+    free(outcome);
+ERR_CALLOC:
+    return NULL;
+}
+
+/**
+ * \brief Check whether an interface has replied to a probe sent at a hop.
+ * \param hop The hop.
+ * \param address The address of the interface.
+ * \return true iif this interface has replied.
+ */
+
+static bool retrace_hop_has_replied(const retrace_hop_t * hop, const address_t * address) {
+    size_t                i, num_outcomes = dynarray_get_size(hop->outcomes);
+    const journal_hop_t * outcome;
+
+    for (i = 0; i < num_outcomes; i++) {
+        outcome = dynarray_get_ith_element(hop->outcomes, i);
+        if (!outcome->is_star && address_compare(&outcome->address, address) == 0) return true;
+    }
+    return false;
+}
+
+/**
+ * \brief Update a hop once one of its probes has been answered or lost.
+ * \param loop The main loop.
+ * \param retrace_data Data attached to this instance.
+ * \param probe_skel The probe skeleton used to craft the probe packet.
+ * \param options The options of this instance.
+ * \param hop The hop of the probe.
+ * \return true iif successful.
+ */
+
+static bool retrace_update_hop(
+    pt_loop_t                  * loop,
+    retrace_data_t             * retrace_data,
+    const probe_t              * probe_skel,
+    const traceroute_options_t * options,
+    retrace_hop_t              * hop
+) {
+    const journal_hop_t * outcome = dynarray_get_ith_element(hop->outcomes, dynarray_get_size(hop->outcomes) - 1);
+    bool                  is_destination = !outcome->is_star && address_compare(&outcome->address, options->dst_addr) == 0;
+
+    if (is_destination && (!retrace_data->dst_ttl || outcome->ttl < retrace_data->dst_ttl)) {
+        retrace_data->dst_ttl = outcome->ttl;
+    }
+
+    switch (hop->state) {
+        case RETRACE_HOP_VERIFYING:
+            if (!outcome->is_star) {
+                if (address_compare(&outcome->address, &hop->address) == 0) {
+                    // The path has not changed at this hop
+                    hop->state = RETRACE_HOP_DONE;
+                    return true;
+                }
+
+                // Another interface replies at this hop
+                hop->is_changed = true;
+            }
+
+            if (is_destination || (retrace_data->dst_ttl && outcome->ttl > retrace_data->dst_ttl)) {
+                // The path is now shorter, this hop is beyond the destination
+                hop->is_changed = true;
+                hop->state = RETRACE_HOP_DONE;
+                return true;
+            }
+
+            // Enumerate this hop like traceroute. A lost probe (e.g. because
+            // of ICMP rate limiting) does not mean that the path has changed:
+            // this is decided once the hop has been enumerated.
+            return retrace_enumerate_hop(loop, retrace_data, probe_skel, options, outcome->ttl);
+
+        case RETRACE_HOP_ENUMERATING:
+            if (!hop->num_flying) {
+                hop->state = RETRACE_HOP_DONE;
+
+                // The interface previously discovered does not reply anymore
+                if (hop->is_known && !retrace_hop_has_replied(hop, &hop->address)) {
+                    hop->is_changed = true;
+                }
+            }
+            return true;
+
+        default:
+            return true;
+    }
+}
+
+/**
+ * \brief Enumerate the next hop beyond the previous path, or terminate once
+ *    every probe has been answered or lost.
+ * \param loop The main loop.
+ * \param retrace_data Data attached to this instance.
+ * \param probe_skel The probe skeleton used to craft the probe packet.
+ * \param options The options of this instance.
+ * \return true iif successful.
+ */
+
+static bool retrace_progress(
+    pt_loop_t                  * loop,
+    retrace_data_t             * retrace_data,
+    const probe_t              * probe_skel,
+    const traceroute_options_t * options
+) {
+    const retrace_hop_t * last_hop;
+
+    if (retrace_data->num_flying) return true;
+
+    if (retrace_data->dst_ttl) {
+        pt_raise_event(loop, event_create(TRACEROUTE_DESTINATION_REACHED, NULL, NULL, NULL));
+        pt_raise_terminated(loop);
+        return true;
+    }
+
+    // The destination has not replied: the path is now longer than the
+    // previous one (or it was incomplete). Continue like traceroute.
+    if (retrace_data->next_ttl > options->min_ttl && retrace_data->next_ttl > retrace_data->path_end + 1u) {
+        last_hop = &retrace_data->hops[retrace_data->next_ttl - 1];
+        if (last_hop->num_stars == dynarray_get_size(last_hop->outcomes)) {
+            if (++(retrace_data->num_undiscovered) == options->max_undiscovered) {
+                pt_raise_event(loop, event_create(TRACEROUTE_TOO_MANY_STARS, NULL, NULL, NULL));
+                pt_raise_terminated(loop);
+                return true;
+            }
+        } else {
+            retrace_data->num_undiscovered = 0;
+        }
+    }
+
+    if (retrace_data->next_ttl > options->max_ttl) {
+        pt_raise_event(loop, event_create(TRACEROUTE_MAX_TTL_REACHED, NULL, NULL, NULL));
+        pt_raise_terminated(loop);
+        return true;
+    }
+
+    return retrace_enumerate_hop(loop, retrace_data, probe_skel, options, retrace_data->next_ttl++);
+}
+
+//-----------------------------------------------------------------
+// Retrace algorithm
+//-----------------------------------------------------------------
+
+/**
+ * \brief Handle events to a retrace algorithm instance
+ * \param loop The main loop
+ * \param event The raised event
+ * \param pdata Points to a (void *) address that may be altered by retrace_loop_handler in order
+ *   to manage data related to this instance.
+ * \param probe_skel The probe skeleton used to craft the probe packet
+ * \param opts Points to the option related to this instance (== loop->cur_instance->options)
+ */
+
+static int retrace_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, probe_t * probe_skel, void * opts)
+{
+    retrace_data_t             * data = *pdata;
+    const retrace_options_t    * retrace_options = opts;
+    const traceroute_options_t * options;
+    probe_reply_t              * probe_reply;
+    probe_t                    * probe;
+    retrace_hop_t              * hop;
+
+    if (!retrace_options) {
+        fprintf(stderr, "Invalid retrace options\n");
+        errno = EINVAL;
+        goto FAILURE;
+    }
+    options = &retrace_options->traceroute_options;
+
+    switch (event->type) {
+        case ALGORITHM_INIT:
+            if (options->min_ttl > options->max_ttl) {
+                fprintf(stderr, "Invalid retrace options\n");
+                errno = EINVAL;
+                goto FAILURE;
+            }
+            if (!(data = retrace_data_create(retrace_options))) goto FAILURE;
+            *pdata = data;
+            if (!retrace_start(loop, data, probe_skel, options)) goto FAILURE;
+            break;
+
+        case PROBE_REPLY:
+            probe_reply = (probe_reply_t *) event->data;
+            if (!(hop = retrace_add_outcome(data, options, probe_reply->probe, probe_reply->reply))) goto FAILURE;
+            pt_raise_event(loop, event_create(TRACEROUTE_PROBE_REPLY, probe_reply_ref(probe_reply), NULL, (ELEMENT_FREE) probe_reply_free));
+            if (!retrace_update_hop(loop, data, probe_skel, options, hop)) goto FAILURE;
+            break;
+
+        case PROBE_TIMEOUT:
+            probe = (probe_t *) event->data;
+            if (!(hop = retrace_add_outcome(data, options, probe, NULL))) goto FAILURE;
+            pt_raise_event(loop, event_create(TRACEROUTE_STAR, probe_ref(probe), NULL, (ELEMENT_FREE) probe_free));
+            if (!retrace_update_hop(loop, data, probe_skel, options, hop)) goto FAILURE;
+            break;
+
+        case NETWORK_WRITABLE:
+            if (!send_pending_retrace_probes(loop, data)) goto FAILURE;
+            return 0;
+
+        case ALGORITHM_TERM:
+            // The caller allows us to free retrace's data
+            retrace_data_free(data, options->max_ttl);
+            *pdata = NULL;
+            pt_raise_terminated(loop);
+            return 0;
+
+        default:
+            // PROBE_LATE_REPLY, PROBE_DUPLICATE: the corresponding probe
+            // has already been handled.
+            return 0;
+    }
+
+    if (!retrace_progress(loop, data, probe_skel, options)) goto FAILURE;
+    return 0;
+
+FAILURE:
+    pt_raise_error(loop);
+    return EINVAL;
+}
+
+void retrace_data_dump(const retrace_data_t * retrace_data, const retrace_options_t * retrace_options) {
+    const traceroute_options_t * options = &retrace_options->traceroute_options;
+    const retrace_hop_t        * hop;
+    const journal_hop_t        * outcome;
+    const address_t            * address;
+    size_t                       ttl, last_ttl, i, num_outcomes, num_verified = 0, num_enumerated = 0;
+
+    last_ttl = retrace_data->dst_ttl ? retrace_data->dst_ttl : retrace_data->next_ttl - 1;
+    for (ttl = options->min_ttl; ttl <= last_ttl && ttl <= options->max_ttl; ttl++) {
+        hop = &retrace_data->hops[ttl];
+        num_outcomes = dynarray_get_size(hop->outcomes);
+        if (!num_outcomes) continue;
+
+        // Like traceroute_handler, only print the address of a hop when it changes
+        printf("%2zu ", ttl);
+        for (i = 0, address = NULL; i < num_outcomes; i++) {
+            outcome = dynarray_get_ith_element(hop->outcomes, i);
+            if (outcome->is_star) {
+                printf(" *");
+            } else {
+                if (!address || address_compare(address, &outcome->address) != 0) {
+                    address = &outcome->address;
+                    printf(" ");
+                    address_dump(address);
+                }
+                printf("  %-5.3lfms  ", outcome->rtt);
+            }
+        }
+        if (hop->is_changed) {
+            printf(" (changed, was ");
+            address_dump(&hop->address);
+            printf(")");
+        }
+        printf("\n");
+
+        if (hop->is_known && !hop->is_changed) {
+            num_verified++;
+        } else if (num_outcomes > 1 || !hop->is_known) {
+            num_enumerated++;
+        }
+    }
+
+    printf("%zu hops verified, %zu hops enumerated, %zu probes sent\n",
+        num_verified,
+        num_enumerated,
+        retrace_data->num_probes_sent
+    );
+}
+
+static algorithm_t retrace = {
+    .name    = "retrace",
+    .handler = retrace_loop_handler,
+    .options = NULL
+};
+
+ALGORITHM_REGISTER(retrace);
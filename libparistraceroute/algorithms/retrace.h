@@ -0,0 +1,114 @@
+#ifndef LIBPT_ALGORITHMS_RETRACE_H
+#define LIBPT_ALGORITHMS_RETRACE_H
+
+#include <stdbool.h>     // bool
+#include <stdint.h>      // uint*_t
+#include <stddef.h>      // size_t
+
+#include "traceroute.h"  // traceroute_options_t, traceroute_event_t
+#include "../address.h"  // address_t
+#include "../dynarray.h" // dynarray_t
+#include "../journal.h"  // journal_hop_t
+#include "../pt_loop.h"  // pt_loop_t
+
+/*
+ * Principle:
+ *
+ * retrace - check whether the path toward a host has changed since a
+ * previous traceroute, at a fraction of the cost of a new traceroute.
+ *
+ * The previous traceroute (e.g. loaded from a journal, see journal.h)
+ * provides, for each TTL, the interface which replied and the flow ID
+ * of its probe. Re-sending a probe of this flow must elicit a reply from
+ * the same interface, unless the path has changed.
+ *
+ * Algorithm:
+ *
+ *     INIT:
+ *         for each TTL of the previous path
+ *             if an interface was discovered at this TTL
+ *                 send 1 probe with this TTL and the recorded flow ID
+ *             else
+ *                 ENUMERATE(TTL)
+ *
+ *     PROBE_REPLY / PROBE_TIMEOUT (verification probe):
+ *         if the reply comes from the recorded interface
+ *             the hop is verified
+ *         else if the reply comes from the destination
+ *             the path is now shorter
+ *         else (star or another interface)
+ *             ENUMERATE(TTL)
+ *         the hop has changed if another interface has replied, or if
+ *         the recorded interface does not reply to ENUMERATE(TTL) (a
+ *         single lost probe may be due to ICMP rate limiting)
+ *
+ *     ENUMERATE(TTL):
+ *         send num_probes probes with this TTL, like traceroute
+ *
+ *     Once every probe is answered or lost, if the destination has not
+ *     replied, the next TTLs are enumerated like traceroute does.
+ *
+ * retrace raises the same events as traceroute (TRACEROUTE_PROBE_REPLY,
+ * TRACEROUTE_STAR...), but probes several TTLs simultaneously, so the
+ * outcome of each TTL is only complete once the instance has terminated
+ * (see retrace_data_t).
+ */
+
+//--------------------------------------------------------------------
+// Options
+//--------------------------------------------------------------------
+
+typedef struct {
+    traceroute_options_t traceroute_options; /**< Options inherited from traceroute */
+    const dynarray_t   * previous_hops;      /**< Outcome of the probes of the previous traceroute (journal_hop_t instances). May be NULL. */
+} retrace_options_t;
+
+/**
+ * \brief Retrieve the default options of retrace.
+ * \return The corresponding retrace_options_t structure.
+ */
+
+retrace_options_t retrace_get_default_options();
+
+//--------------------------------------------------------------------
+// Data
+//--------------------------------------------------------------------
+
+typedef enum {
+    RETRACE_HOP_IDLE,        /**< No probe has been sent at this TTL */
+    RETRACE_HOP_VERIFYING,   /**< The verification probe has been sent */
+    RETRACE_HOP_ENUMERATING, /**< num_probes probes have been sent */
+    RETRACE_HOP_DONE         /**< Every probe sent at this TTL has been answered or lost */
+} retrace_hop_state_t;
+
+typedef struct {
+    retrace_hop_state_t state;      /**< Progress of this hop */
+    bool                is_known;   /**< true iif the previous traceroute has discovered an interface at this TTL */
+    address_t           address;    /**< The interface discovered by the previous traceroute */
+    uint16_t            flow_id;    /**< The flow ID of the probe which has discovered it */
+    bool                is_changed; /**< true iif another interface replies at this hop, or if its interface no more replies */
+    size_t              num_flying; /**< Number of probes sent at this TTL and not yet answered or lost */
+    size_t              num_stars;  /**< Number of probes sent at this TTL and lost */
+    dynarray_t        * outcomes;   /**< Outcome of the probes sent at this TTL (journal_hop_t instances) */
+} retrace_hop_t;
+
+typedef struct {
+    retrace_hop_t * hops;             /**< Hops indexed by TTL (from 0 to max_ttl) */
+    uint8_t         path_end;         /**< Last TTL of the previous path (0 if unknown) */
+    size_t          next_ttl;         /**< Next TTL to enumerate beyond the previous path */
+    uint8_t         dst_ttl;          /**< Lowest TTL at which the destination has replied (0 if none) */
+    size_t          num_flying;       /**< Number of probes not yet answered or lost */
+    size_t          num_undiscovered; /**< Number of consecutive undiscovered hops beyond the previous path */
+    size_t          num_probes_sent;  /**< Number of probes sent */
+    dynarray_t    * pending_probes;   /**< Probes not sent yet because the sendq was full */
+} retrace_data_t;
+
+/**
+ * \brief Print the outcome of a retrace instance.
+ * \param retrace_data The data of an instance which has terminated.
+ * \param retrace_options The options of this instance.
+ */
+
+void retrace_data_dump(const retrace_data_t * retrace_data, const retrace_options_t * retrace_options);
+
+#endif // LIBPT_ALGORITHMS_RETRACE_H
@@ -1,6 +1,6 @@
 #include "traceroute.h"
 
-#include <errno.h>       // errno, EINVAL
+#include <errno.h>       // errno, EINVAL, EAGAIN
 #include <stdlib.h>      // malloc
 #include <stdio.h>       // fprintf
 #include <string.h>      // memset()
@@ -125,8 +125,7 @@ ERR_MALLOC:
 static void traceroute_data_free(traceroute_data_t * traceroute_data) {
     if (traceroute_data) {
         if (traceroute_data->probes) {
-            // TODO this will provoke a double free
-            // dynarray_free(traceroute_data->probes, (ELEMENT_FREE) probe_free);
+            dynarray_free(traceroute_data->probes, (ELEMENT_FREE) probe_free);
         }
         free(traceroute_data);
     }
@@ -278,18 +277,26 @@ static bool send_traceroute_probe(
 ) {
     probe_t * probe;
     double    delay;
-    // a probe must never be altered, otherwise the network layer may
-    // manage corrupted probes.
+
+    // The skeleton is shared by the probes, which copy its packet before
+    // altering it (see probe_dup).
     if (!(probe = probe_dup(probe_skel)))                       goto ERR_PROBE_DUP;
     if (probe_get_delay(probe) != DELAY_BEST_EFFORT) {
         delay = i * probe_get_delay(probe_skel);
         probe_set_delay(probe, DOUBLE("delay", delay));
     }
     if (!probe_set_fields(probe, I8("ttl", ttl), NULL))         goto ERR_PROBE_SET_FIELDS;
-    if (!dynarray_push_element(traceroute_data->probes, probe)) goto ERR_PROBE_PUSH_ELEMENT;
+    if (!pt_send_probe(loop, probe))                            goto ERR_PT_SEND_PROBE;
 
-    return pt_send_probe(loop, probe);
+    // traceroute_data->probes and the network layer both reference the probe
+    if (!dynarray_push_element(traceroute_data->probes, probe_ref(probe))) goto ERR_PROBE_PUSH_ELEMENT;
+    return true;
 
+ERR_PT_SEND_PROBE:
+    // errno is left untouched, so that the caller can tell whether the
+    // sendq was full (EAGAIN).
+    probe_free(probe);
+    return false;
 ERR_PROBE_PUSH_ELEMENT:
 ERR_PROBE_SET_FIELDS:
     probe_free(probe);
@@ -324,15 +331,18 @@ ERR_PROBE_DUP:
 */
 
 /**
- * \brief Send n traceroute probes toward a destination with a given TTL
+ * \brief Send the probes of the current hop which have not been sent yet
+ *    (see traceroute_data->num_pending_probes).
  * \param pt_loop The paris traceroute loop
+ * \param traceroute_data Data attached to this instance of traceroute algorithm
  * \param probe_skel The probe skeleton used to craft the probe packet
- * \param num_probes The amount of probe to send
+ * \param num_probes The amount of probe to send for this hop
  * \param ttl Time To Live related to our probe
- * \return true if successful
+ * \return true if successful, even if some probes are still pending because
+ *    the sendq is full. They are then sent on NETWORK_WRITABLE.
  */
 
-bool send_traceroute_probes(
+static bool send_pending_traceroute_probes(
     pt_loop_t         * loop,
     traceroute_data_t * traceroute_data,
     probe_t           * probe_skel,
@@ -341,14 +351,36 @@ bool send_traceroute_probes(
 ) {
     size_t i;
 
-    for (i = 0; i < num_probes; ++i) {
-        if (!(send_traceroute_probe(loop, traceroute_data, probe_skel, ttl, i + 1))) {
-            return false;
+    while (traceroute_data->num_pending_probes) {
+        i = num_probes - traceroute_data->num_pending_probes + 1;
+        if (!(send_traceroute_probe(loop, traceroute_data, probe_skel, ttl, i))) {
+            return errno == EAGAIN;
         }
+        traceroute_data->num_pending_probes--;
     }
     return true;
 }
 
+/**
+ * \brief Send n traceroute probes toward a destination with a given TTL
+ * \param pt_loop The paris traceroute loop
+ * \param probe_skel The probe skeleton used to craft the probe packet
+ * \param num_probes The amount of probe to send
+ * \param ttl Time To Live related to our probe
+ * \return true if successful
+ */
+
+bool send_traceroute_probes(
+    pt_loop_t         * loop,
+    traceroute_data_t * traceroute_data,
+    probe_t           * probe_skel,
+    size_t              num_probes,
+    uint8_t             ttl
+) {
+    traceroute_data->num_pending_probes = num_probes;
+    return send_pending_traceroute_probes(loop, traceroute_data, probe_skel, num_probes, ttl);
+}
+
 /**
  * \brief Handle events to a traceroute algorithm instance
  * \param loop The main loop
@@ -400,7 +432,7 @@ int traceroute_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, pr
             data->destination_reached |= destination_reached(options->dst_addr, reply);
 
             // Notify the caller we've discovered an IP address
-            pt_raise_event(loop, event_create(TRACEROUTE_PROBE_REPLY, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
+            pt_raise_event(loop, event_create(TRACEROUTE_PROBE_REPLY, probe_reply_ref(probe_reply), NULL, (ELEMENT_FREE) probe_reply_free));
             break;
 
         case PROBE_TIMEOUT:
@@ -412,9 +444,24 @@ int traceroute_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, pr
             ++(data->num_replies);
 
             // Notify the caller we've got a probe timeout
-            pt_raise_event(loop, event_create(TRACEROUTE_STAR, probe, NULL, (ELEMENT_FREE) probe_free));
+            pt_raise_event(loop, event_create(TRACEROUTE_STAR, probe_ref(probe), NULL, (ELEMENT_FREE) probe_free));
             break;
 
+        case PROBE_LATE_REPLY:
+        case PROBE_DUPLICATE:
+            // The corresponding probe has already been handled: this reply
+            // does not alter the progress of the traceroute.
+            return 0;
+
+        case NETWORK_WRITABLE:
+            // Send the probes of the current hop rejected so far. data->ttl
+            // has already been incremented when this hop has been started.
+            data = *pdata;
+            if (!send_pending_traceroute_probes(loop, data, probe_skel, options->num_probes, data->ttl - 1)) {
+                goto FAILURE;
+            }
+            return 0;
+
         case ALGORITHM_TERM:
 
             // The caller allows us to free traceroute's data
@@ -431,7 +478,7 @@ int traceroute_loop_handler(pt_loop_t * loop, event_t * event, void ** pdata, pr
     }
 
     // Forward event to the caller
-    pt_throw(loop, loop->cur_instance->caller, event);
+    pt_throw(loop, loop->cur_instance->caller, event_ref(event));
 
     // Explore next hop
     if ((data->num_replies % options->num_probes) == 0) {
@@ -475,15 +522,9 @@ HAS_TERMINATED:
     if (has_terminated) {
         pt_raise_terminated(loop);
     }
-
-    // Handled event must always been free when leaving the handler
-    event_free(event);
     return 0;
 
 FAILURE:
-    // Handled event must always been free when leaving the handler
-    event_free(event);
-
     // Sent to the current instance a ALGORITHM_FAILURE notification.
     // The caller has to free the data allocated by the algorithm.
     pt_raise_error(loop);
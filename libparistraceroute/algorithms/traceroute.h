@@ -111,6 +111,7 @@ typedef struct {
     void                  * data;
     void                 (* data_free)(void *); /**< Called in event_free to release data. Ignored if NULL. */
     void                  * zero;
+    size_t                  refcount;
 } traceroute_event_t;
 
 typedef struct {
@@ -119,6 +120,7 @@ typedef struct {
     size_t        num_replies;         /**< Total of probe sent for this instance    */
     size_t        num_undiscovered;    /**< Number of consecutive undiscovered hops  */
     size_t        num_stars;           /**< Number of probe lost for the current hop */
+    size_t        num_pending_probes;  /**< Number of probes of the current hop not sent yet because the sendq was full */
     dynarray_t  * probes;              /**< Probe instances allocated by traceroute  */
 } traceroute_data_t;
 
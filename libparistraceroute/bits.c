@@ -1,58 +1,23 @@
 #include "config.h"
 
-#include <assert.h> // assert
 #include <stdlib.h> // malloc, free
 #include <stdio.h>  // FILE *
 #include <string.h> // memcpy
 
+#include "os/os.h"  // LINUX
+#ifdef LINUX
+#  include <endian.h>     // be64toh, htobe64
+#else
+#  include <sys/endian.h> // be64toh, htobe64
+#endif
+
 #include "bits.h"
-#include "common.h" // MIN, MAX
+#include "common.h" // MIN
 
 //---------------------------------------------------------------------------
 // Bit-level operations on a single byte
 //---------------------------------------------------------------------------
 
-/**
- * \brief Make a uint8_t mask made of 'num_bits' bits set to 1, the
- * following ones are set to 0.
- * \param num_bits The number of bits set to 1.
- * \return The corresponding mask.
- */
-
-static inline uint8_t make_msb_mask(size_t num_bits) {
-    return num_bits > 7 ? 0xff : 0xff << (8 - num_bits);
-}
-
-/**
- * \brief Make a uint8_t mask made of 8 - 'num_bits' bits set to 0, the
- * following ones are set to 1.
- * \param num_bits The number of bits set to 1.
- * \return The corresponding mask.
- */
-
-static inline uint8_t make_lsb_mask(size_t num_bits) {
-    return num_bits > 7 ? 0xff : ~(0xff << num_bits);
-}
-
-/**
- * \brief Make a uint8_t mask having num_bits bits set to 1 starting to the
- *    offset_in_bits-th bit. The other bits are set to 0.
- * \param offset_in_bits The first bit set to 1.
- * \param num_bits The number of bits set to 1.
- * \return The corresponding mask.
- */
-
-static uint8_t byte_make_mask_impl(size_t offset_in_bits, size_t num_bits) {
-    uint8_t mask;
-    size_t  j;
-
-    mask = 0;
-    for (j = 0; j < 8 && j < num_bits; ++j) {
-        mask |= 1 << (7 - j - offset_in_bits);
-    }
-    return mask;
-}
-
 uint8_t byte_extract(uint8_t byte, size_t offset_in_bits, size_t num_bits, size_t offset_in_bits_out) {
     int     offset = offset_in_bits_out - offset_in_bits;
     uint8_t ret;
@@ -71,19 +36,8 @@ uint8_t byte_extract(uint8_t byte, size_t offset_in_bits, size_t num_bits, size_
 //---------------------------------------------------------------------------
 
 uint8_t byte_make_mask(size_t offset_in_bits, size_t num_bits) {
-    uint8_t mask;
-
-    if (offset_in_bits == 0) {
-        // Optimization: write "num_bits" 1, then the missing 0.
-        mask = make_msb_mask(num_bits);
-    } else if (offset_in_bits + num_bits == 8) {
-        // Optimization: write some 0, then "num_bits" 1.
-        mask = make_lsb_mask(num_bits);
-    } else {
-        // Craft the mask by hand.
-        mask = byte_make_mask_impl(offset_in_bits, num_bits);
-    }
-    return mask;
+    // Bits from offset_in_bits to the end, minus the bits after the last one.
+    return (0xff >> offset_in_bits) & ~(0xff >> MIN(offset_in_bits + num_bits, 8));
 }
 
 bool byte_write_bits(
@@ -131,6 +85,136 @@ void byte_dump(uint8_t byte) {
     bits_dump(&byte, 8, 0);
 }
 
+//---------------------------------------------------------------------------
+// Word-level helpers
+//---------------------------------------------------------------------------
+
+// Number of bits processed by a single step of bits_copy. Reading or writing
+// this many bits from any offset in a byte touches at most 8 bytes.
+#define BITS_STEP 56
+
+/**
+ * \brief Read up to 8 bytes as a big-endian 64-bit word. The first byte
+ *    ends up in the most significant bits of the word.
+ * \param bytes The bytes to read.
+ * \param num_bytes The number of bytes to read (<= 8). The missing bytes
+ *    are set to 0.
+ * \return The corresponding word.
+ */
+
+static inline uint64_t bits_load(const uint8_t * bytes, size_t num_bytes) {
+    uint64_t word = 0;
+    uint32_t word32;
+    uint16_t word16;
+    size_t   i;
+
+    // Use a single unaligned load whenever possible. memcpy compiles to
+    // such a load when its size is constant, and never reads beyond the
+    // num_bytes bytes.
+    switch (num_bytes) {
+        case 8:
+            memcpy(&word, bytes, sizeof(word));
+            return be64toh(word);
+        case 4:
+            memcpy(&word32, bytes, sizeof(word32));
+            return (uint64_t) be32toh(word32) << 32;
+        case 2:
+            memcpy(&word16, bytes, sizeof(word16));
+            return (uint64_t) be16toh(word16) << 48;
+        default:
+            for (i = 0; i < num_bytes; i++) {
+                word |= (uint64_t) bytes[i] << (56 - 8 * i);
+            }
+            return word;
+    }
+}
+
+/**
+ * \brief Write the most significant bytes of a 64-bit word (see bits_load).
+ * \param bytes The bytes to write.
+ * \param word The word.
+ * \param num_bytes The number of bytes to write (<= 8).
+ */
+
+static inline void bits_store(uint8_t * bytes, uint64_t word, size_t num_bytes) {
+    uint32_t word32;
+    uint16_t word16;
+    size_t   i;
+
+    switch (num_bytes) {
+        case 8:
+            word = htobe64(word);
+            memcpy(bytes, &word, sizeof(word));
+            break;
+        case 4:
+            word32 = htobe32(word >> 32);
+            memcpy(bytes, &word32, sizeof(word32));
+            break;
+        case 2:
+            word16 = htobe16(word >> 48);
+            memcpy(bytes, &word16, sizeof(word16));
+            break;
+        default:
+            for (i = 0; i < num_bytes; i++) {
+                bytes[i] = word >> (56 - 8 * i);
+            }
+            break;
+    }
+}
+
+/**
+ * \brief Copy a sequence of bits. The bits of out which are not
+ *    overwritten are left unchanged.
+ * \param out The output bytes.
+ * \param offset_out The offset of the first bit written in out (< 8).
+ * \param in The input bytes.
+ * \param offset_in The offset of the first bit read in in (< 8).
+ * \param num_bits The number of copied bits.
+ */
+
+static void bits_copy(uint8_t * out, size_t offset_out, const uint8_t * in, size_t offset_in, size_t num_bits) {
+    uint64_t value, word, mask;
+    size_t   n, shift;
+
+    // Bits located in a single input and output byte (e.g. IPv4 IHL).
+    if (offset_in + num_bits <= 8 && offset_out + num_bits <= 8) {
+        if (num_bits) {
+            mask = byte_make_mask(offset_out, num_bits);
+            *out = (*out & ~mask) | ((((*in << offset_in) & 0xff) >> offset_out) & mask);
+        }
+        return;
+    }
+
+    // Byte-aligned sequences: copy the whole bytes at once.
+    if (offset_in == 0 && offset_out == 0) {
+        n = num_bits >> 3;
+        memcpy(out, in, n);
+        out += n;
+        in  += n;
+        num_bits -= n << 3;
+    }
+
+    // Copy at most BITS_STEP bits at a time.
+    for (; num_bits; num_bits -= n) {
+        n = MIN(num_bits, BITS_STEP);
+
+        // Right-align the n bits read in the input bytes.
+        value = (bits_load(in, (offset_in + n + 7) >> 3) << offset_in) >> (64 - n);
+
+        // Replace the corresponding bits in the output bytes.
+        shift = 64 - offset_out - n;
+        mask  = ((UINT64_C(1) << n) - 1) << shift;
+        word  = bits_load(out, (offset_out + n + 7) >> 3);
+        word  = (word & ~mask) | (value << shift);
+        bits_store(out, word, (offset_out + n + 7) >> 3);
+
+        in  += (offset_in  + n) >> 3;
+        out += (offset_out + n) >> 3;
+        offset_in  = (offset_in  + n) & 7;
+        offset_out = (offset_out + n) & 7;
+    }
+}
+
 //---------------------------------------------------------------------------
 // Bit-level operations on one or more bytes
 //---------------------------------------------------------------------------
@@ -141,52 +225,27 @@ uint8_t * bits_extract(
     size_t          length_in_bits,
     uint8_t       * dest
 ) {
-    size_t  i          = offset_in_bits >> 3,
-            idest      = 0,
-            j,
-            num_bits   = length_in_bits % 8,  // Number of bits extracted from the first byte
-            num_bytes  = length_in_bits >> 3, // Number of complete byte to extract
-            offset     = (offset_in_bits + num_bits) % 8,
-            size       = num_bytes + (num_bits ? 1 : 0);
-    uint8_t msb, lsb;
-    bool    is_aligned = ((offset_in_bits + length_in_bits % 8) == 0);
+    size_t size = (length_in_bits + 7) >> 3;
 
     // Allocate the destination buffer
     if (!dest) {
         if (!(dest = calloc(1, size))) goto ERR_CALLOC;
     }
 
-    // Grab the n first bits from the first relevant byte (i)
-    // and store them in the 1st destination byte.
-    if (num_bits) {
-        dest[idest++] = byte_extract(bytes[i++], offset_in_bits, num_bits, 8 - num_bits);
-    }
-
-    // Retrieve the num_bytes remaining bytes to duplicate
-    // into dest.
-    for (j = 0; j < num_bytes; ++j, ++idest, ++i) {
-        if (is_aligned) {
-            dest[idest] = bytes[i];
-        } else {
-            // Fetch the 'idest'-th byte of 'dest'
-            // - its 'offset' most significant bits are in bytes[i-1]
-            // - its remaining less significant bits are in bytes[i]
-            msb = byte_extract(bytes[i - 1], offset, 8 - offset, 0);
-            lsb = byte_extract(bytes[i], 0, offset, 8 - offset);
-            dest[idest] = msb | lsb;
-        }
-    }
-
+    // The extracted bits are right-aligned in dest: the first byte
+    // starts with (8 * size - length_in_bits) bits set to 0.
+    if (size) dest[0] = 0;
+    bits_copy(
+        dest, 8 * size - length_in_bits,
+        bytes + (offset_in_bits >> 3), offset_in_bits & 7,
+        length_in_bits
+    );
     return dest;
 
 ERR_CALLOC:
     return NULL;
 }
 
-#define BITS_MOVE(p, offset, num_bits) \
-  p     += (offset + num_bits) >> 3; \
-  offset = (offset + num_bits) % 8
-
 bool bits_write(
     uint8_t       * out,
     const size_t    offset_in_bits_out,
@@ -194,120 +253,12 @@ bool bits_write(
     const size_t    offset_in_bits_in,
     size_t          length_in_bits
 ) {
-    bool success = true;
-
-    // Notations:
-    //   . bit not modified
-    //   X bit being updated (same for Y) at this step.
-    //   * bit to be update, but not in this step.
-    //   | corresponds to byte bounds in the output.
-    // Principle:
-    //   Writting .....**|********|** is achieved in three steps.
-    // Steps:
-    //   1) Write .....XX|********|**.....
-    //   2) Write .....**|XXXXXXXX|**....
-    //   3) Write .....**|********|XX....
-
-    size_t num_remaining_bits = length_in_bits;
-    size_t n;
-    size_t offset_out = offset_in_bits_out;
-    size_t offset_in  = offset_in_bits_in;
-
-    if (offset_in  >= 8) {
-        fprintf(stderr, "bits_write: offset_in (%zu) must be < 8\n", offset_in);
-        return false;
-    }
-    if (offset_out  >= 8) {
-        fprintf(stderr, "bits_write: offset_out (%zu) must be < 8\n", offset_out);
-        return false;
-    }
-
-    // 1st output (incomplete) byte:
-    if (offset_out) {
-
-        // Case 1:
-        //     in: |.....XXX|YY******|
-        //    out: |...XXXYY|********|
-        // Case 2:
-        //     in: |...XXX**|********|
-        //    out: |.....XXX|********|
-        // Case 3:
-        //     in: |XXX*****|
-        //    out: |.....XXX|
-
-        // Cases 1, 2, 3: Write XXX
-        n = MIN(8 - MAX(offset_in, offset_out), num_remaining_bits);
-        success &= byte_write_bits(out, offset_out, *in, offset_in, n);
-        num_remaining_bits -= n;
-        assert(success);
-        BITS_MOVE(out, offset_out, n);
-        BITS_MOVE(in,  offset_in,  n);
-
-        // If case 1: Write YY|
-        if (offset_out) {
-            n = MIN(8 - n - offset_out, num_remaining_bits);
-            success &= byte_write_bits(out, offset_out, *in, offset_in, n);
-            num_remaining_bits -= n;
-            assert(success);
-            BITS_MOVE(out, offset_out, n);
-            BITS_MOVE(in,  offset_in,  n);
-        }
-    }
-
-    // Full output bytes
-    assert(!offset_out);
-    if (!offset_in) {
-        n = num_remaining_bits >> 3;
-        memcpy(out, in, n);
-        num_remaining_bits -= n << 3;
-    } else {
-        for (; num_remaining_bits >= 8; num_remaining_bits -= 8) {
-            //  in: |***XXXXX|YYY.....
-            // out: |XXXXXYYY|
-
-            // Write |XXXXX***|
-            n = MIN(8 - offset_in, num_remaining_bits);
-            success &= byte_write_bits(out, offset_out, *in, offset_in, n);
-            assert(success);
-            BITS_MOVE(out, offset_out, n);
-            BITS_MOVE(in,  offset_in,  n);
-
-            // Write |*****YYY|
-            n = MIN(8 - n, num_remaining_bits);
-            success &= byte_write_bits(out, offset_out, *in, offset_in, n);
-            assert(success);
-            BITS_MOVE(out, offset_out, n);
-            BITS_MOVE(in,  offset_in,  n);
-        }
-    }
-
-    // Last byte
-    n = num_remaining_bits;
-    assert(n < 8);
-    assert(offset_out == 0);
-    if (n) {
-        // Case1:
-        //    in: |**XXX...|
-        //   out: |XXX.....|
-        // Case2:
-        //    in: |*****XXX|YY......
-        //   out: |XXXYY...|
-
-        // Case 1, 2: Write XXX
-        n = MIN(8 - offset_in, num_remaining_bits);
-        success &= byte_write_bits(out, offset_out, *in, offset_in, n);
-        num_remaining_bits -= n;
-        assert(success);
-
-        // Case 2: Write YY (if any)
-        if (num_remaining_bits) {
-            n = num_remaining_bits;
-            success &= byte_write_bits(out, 0, *in, offset_in, n);
-            assert(success);
-        }
-    }
-
-    return success;
+    bits_copy(
+        out + (offset_in_bits_out >> 3), offset_in_bits_out & 7,
+        in  + (offset_in_bits_in  >> 3), offset_in_bits_in  & 7,
+        length_in_bits
+    );
+    return true;
 }
 
 void bits_fprintf(FILE * out, const uint8_t * bytes, size_t num_bits, size_t offset_in_bits) {
@@ -346,7 +297,8 @@ void bits_fprintf(FILE * out, const uint8_t * bytes, size_t num_bits, size_t off
                 );
                 break;
         }
-        BITS_MOVE(bytes, offset_in_bits, n);
+        bytes += (offset_in_bits + n) >> 3;
+        offset_in_bits = (offset_in_bits + n) % 8;
         num_bits -= n;
 
         if (offset_in_bits % 8 == 0 && num_bits) fprintf(out, " ");
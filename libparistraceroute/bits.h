@@ -75,13 +75,16 @@ void byte_dump(uint8_t byte);
  * \brief Extract 'num_bits' bits from a sequence of bytes starting from its
  *    'offset_in_bits'-th bit and but the result in an output sequence of bytes
  *    with the an offset of 'offset_in_bits_out' bits.
+ *    The bits are processed by 64-bit words, and only the bytes holding the
+ *    extracted bits are read.
  * \param bytes The queried bytes.
- * \param offset_in_bits The first extracted bit of 'bytes'.
+ * \param offset_in_bits The first extracted bit of 'bytes'. It may
+ *    exceed 7.
  * \param num_bits The number of extracted bits.
- * \param offset_in_bits_out The starting bit where we write in the *pdest.
  * \param dest The uint8_t * which will store the output value. Pass NULL if
  *    bits_extract must allocate automatically this buffer. This buffer must
- *    be at least of size (offset_in_bits + num_bits % 8)
+ *    be at least of size ceil(num_bits / 8). Its first byte starts with
+ *    the bits set to 0 needed to right-align the value.
  * \return The corresponding output buffer, NULL in case of failure.
  *
  * Example:
@@ -90,7 +93,7 @@ void byte_dump(uint8_t byte);
  *   21 bits are extract from x (starting from the 2nd bit of x)
  *   They are copied and right-aligned in y.
  *
- * This example is detailed in bits.c (see function bits_test).
+ * This example is checked by the "bits" benchmarks (see bench/pt-bench.c).
  */
 
 // TODO change parameter order (first output parameters, then input parameters)
@@ -103,14 +106,16 @@ uint8_t * bits_extract(
 
 /**
  * \brief Write a sequence of bits according to a given sequence
- *    of input bits.
+ *    of input bits. The bits of out which are not overwritten are left
+ *    unchanged. The bits are processed by 64-bit words, and only the
+ *    bytes holding the copied bits are read or written.
  * \param out The address of the output sequence of bits
  * \param offset_in_bits_out The offset of the first bit we
- *    write in out.
+ *    write in out. It may exceed 7.
  * \param in The sequence of bits we read to update out.
- * \param offset_in_bits_out The offset of the first bit we
- *    read in the input bits.
- * \param size_in_bits The number of bits copied from
+ * \param offset_in_bits_in The offset of the first bit we
+ *    read in the input bits. It may exceed 7.
+ * \param length_in_bits The number of bits copied from
  *    in to out.
  * \return true iif successful
  */
@@ -12,6 +12,7 @@ buffer_t * buffer_create() {
     if ((buffer = malloc(sizeof(buffer_t)))) {
         buffer->data = NULL;
         buffer->size = 0;
+        buffer->capacity = 0;
     }
     return buffer;
 }
@@ -21,10 +22,11 @@ buffer_t * buffer_dup(const buffer_t * buffer) {
 
     if (!buffer)                                goto ERR_INVALID_PARAMETER;
     if (!(ret = buffer_create()))               goto ERR_BUFFER_CREATE;
-    if (!(ret->data = calloc(1, buffer->size))) goto ERR_BUFFER_DATA;
+    if (!(ret->data = malloc(buffer->capacity))) goto ERR_BUFFER_DATA;
 
     memcpy(ret->data, buffer->data, buffer->size);
     ret->size = buffer->size;
+    ret->capacity = buffer->capacity;
     return ret;
 
 ERR_BUFFER_DATA:
@@ -43,27 +45,28 @@ void buffer_free(buffer_t * buffer) {
     }
 }
 
-bool buffer_resize(buffer_t * buffer, size_t size) {
+bool buffer_reserve(buffer_t * buffer, size_t capacity) {
     uint8_t * data2;
-    bool      ret = true;
-    size_t    old_size = buffer->size;
 
-    if (old_size != size) {
-        if (buffer->data) {
-            data2 = realloc(buffer->data, size * sizeof(uint8_t));
-            if (data2 && size > old_size) {
-                memset(data2 + old_size, 0, size - old_size);
-            }
-        } else {
-            data2 = calloc(size, sizeof(uint8_t));
-        }
-        if (data2) {
-            buffer->data = data2;
-            buffer->size = size;
+    if (capacity > buffer->capacity) {
+        if (!(data2 = realloc(buffer->data, capacity * sizeof(uint8_t)))) {
+            return false;
         }
-        ret = (data2 != NULL);
+        buffer->data = data2;
+        buffer->capacity = capacity;
     }
-    return ret;
+    return true;
+}
+
+bool buffer_resize(buffer_t * buffer, size_t size) {
+    size_t old_size = buffer->size;
+
+    if (!buffer_reserve(buffer, size)) return false;
+    if (size > old_size) {
+        memset(buffer->data + old_size, 0, size - old_size);
+    }
+    buffer->size = size;
+    return true;
 }
 
 inline uint8_t * buffer_get_data(const buffer_t * buffer) {
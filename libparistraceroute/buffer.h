@@ -12,8 +12,9 @@
  */
 
 typedef struct {
-    uint8_t * data; /**< Data stored in the buffer   */
-    size_t    size; /**< Size of the data (in bytes) */
+    uint8_t * data;     /**< Data stored in the buffer   */
+    size_t    size;     /**< Size of the data (in bytes) */
+    size_t    capacity; /**< Size of the memory allocated for data (in bytes) */
 } buffer_t;
 
 //-----------------------------------------------------------------
@@ -30,7 +31,9 @@ typedef struct {
 buffer_t * buffer_create();
 
 /**
- * \brief Duplicate a buffer instance
+ * \brief Duplicate a buffer instance. The capacity of the buffer is
+ *    preserved, so that the copy can grow as much as the original one
+ *    without being reallocated.
  * \param buffer The buffer to duplicate
  * \return The address of the newly created buffer, NULL
  *    if the memory allocation has failed.
@@ -68,7 +71,9 @@ uint8_t * buffer_get_data(const buffer_t * buffer);
 size_t buffer_get_size(const buffer_t * buffer);
 
 /**
- * \brief (Re)allocate the buffer to a specified size.
+ * \brief (Re)allocate the buffer to a specified size. The memory is only
+ *    reallocated if the buffer capacity is exceeded. Bytes appended to
+ *    the buffer are set to 0.
  * \param buffer Pointer to a buffer_t structure to (re)allocate
  * \param size new size of the buffer
  * \return true iif successfull
@@ -76,6 +81,16 @@ size_t buffer_get_size(const buffer_t * buffer);
 
 bool buffer_resize(buffer_t * buffer, size_t size);
 
+/**
+ * \brief Make sure that a buffer can grow up to a given size without
+ *    being reallocated. Its size and its data are left unchanged.
+ * \param buffer Pointer to a buffer_t structure.
+ * \param capacity The minimal capacity of the buffer (in bytes).
+ * \return true iif successfull
+ */
+
+bool buffer_reserve(buffer_t * buffer, size_t capacity);
+
 /**
  * \brief Change the address of the memory managed by the buffer.
  *   The old address but be freed before if not more used.
@@ -0,0 +1,892 @@
+#include "use.h"
+#include "config.h"
+
+#include <stdlib.h>             // malloc, free
+#include <stdio.h>              // perror
+#include <string.h>             // memset, memcpy, strcmp
+#include <errno.h>              // errno
+#include <unistd.h>             // close
+#include <fcntl.h>              // fcntl
+#include <time.h>               // struct timespec
+#include <sys/socket.h>         // socket, connect, recvmmsg
+#include <arpa/inet.h>          // htons
+
+#include "os/os.h"              // LINUX
+#include "os/search.h"          // tfind, tsearch, tdelete, tdestroy
+#include "os/sys/epoll.h"       // epoll_*
+#include "os/netinet/ip.h"      // iphdr
+#include "os/netinet/ip_icmp.h" // ICMP_ECHO
+#include "os/netinet/udp.h"     // udphdr
+#ifdef USE_IPV6
+#  include "os/netinet/ip6.h"   // ip6_hdr
+#  include "os/netinet/icmp6.h" // icmp6_hdr
+#endif
+
+#ifdef LINUX
+#  include <linux/errqueue.h>   // sock_extended_err
+#endif
+
+#include "dgrampool.h"
+#include "common.h"             // ELEMENT_FREE, ELEMENT_COMPARE
+#include "field.h"              // ADDRESS, I16
+#include "layer.h"              // layer_get_segment
+
+#define BUFLEN               4096
+#define CONTROLLEN           512
+#define DGRAMPOOL_MAX_EVENTS 64
+#define DGRAMPOOL_BATCH_SIZE 8   // Maximum number of messages fetched by recvmmsg
+
+//---------------------------------------------------------------------------
+// dgram_socket_t
+//---------------------------------------------------------------------------
+
+static void dgram_socket_free(dgram_socket_t * dgram_socket) {
+    if (dgram_socket) {
+        close(dgram_socket->sockfd);
+        free(dgram_socket);
+    }
+}
+
+#ifdef LINUX
+
+/**
+ * \brief Compare the flows of two sockets.
+ * \param x A dgram_socket_t instance.
+ * \param y A dgram_socket_t instance.
+ * \return A value less than, equal to or greater than 0 if x is
+ *    respectively less than, equal to or greater than y. The source port is
+ *    ignored for ICMP sockets, since it is chosen by the kernel.
+ */
+
+static int dgram_socket_compare(const dgram_socket_t * x, const dgram_socket_t * y)
+{
+    if (x->protocol != y->protocol) {
+        return x->protocol - y->protocol;
+    }
+    if (x->protocol == IPPROTO_UDP && x->src_port != y->src_port) {
+        return x->src_port - y->src_port;
+    }
+    if (x->dst_port != y->dst_port) {
+        return x->dst_port - y->dst_port;
+    }
+    return address_compare(&x->dst_ip, &y->dst_ip);
+}
+
+/**
+ * \brief Retrieve the flow of a probe.
+ * \param flow The dgram_socket_t instance where the flow is written
+ *    (protocol, dst_ip, src_port and dst_port).
+ * \param probe An IP/UDP probe or an IP/ICMP echo request.
+ * \return true iif successful.
+ */
+
+static bool dgram_socket_set_flow(dgram_socket_t * flow, const probe_t * probe)
+{
+    const char * protocol_name;
+    uint8_t      type;
+
+    if (!(protocol_name = probe_get_protocol_name(probe, 1))) return false;
+
+    memset(flow, 0, sizeof(dgram_socket_t));
+    if (strcmp(protocol_name, "udp") == 0) {
+        flow->protocol = IPPROTO_UDP;
+        if (!probe_extract(probe, "src_port", &flow->src_port)
+        ||  !probe_extract(probe, "dst_port", &flow->dst_port)
+        ) {
+            return false;
+        }
+    } else if (strcmp(protocol_name, "icmpv4") == 0) {
+        flow->protocol = IPPROTO_ICMP;
+        if (!probe_extract(probe, "type", &type) || type != ICMP_ECHO) return false;
+#ifdef USE_IPV6
+    } else if (strcmp(protocol_name, "icmpv6") == 0) {
+        flow->protocol = IPPROTO_ICMPV6;
+        if (!probe_extract(probe, "type", &type) || type != ICMP6_ECHO_REQUEST) return false;
+#endif
+    } else {
+        return false;
+    }
+
+    return probe_extract(probe, "dst_ip", &flow->dst_ip);
+}
+
+/**
+ * \brief Create a datagram socket connected to the destination of a flow,
+ *    whose ICMP errors are stored in its error queue.
+ * \param dst_ip The destination of the flow.
+ * \param protocol IPPROTO_UDP, IPPROTO_ICMP or IPPROTO_ICMPV6.
+ * \param src_port The source port of the flow (ignored for ICMP, the
+ *    kernel then binds an echo identifier to the socket).
+ * \param dst_port The destination port of the flow (ignored for ICMP).
+ * \return The newly created dgram_socket_t instance, NULL otherwise.
+ */
+
+static dgram_socket_t * dgram_socket_create(const address_t * dst_ip, uint8_t protocol, uint16_t src_port, uint16_t dst_port)
+{
+    dgram_socket_t          * dgram_socket;
+    struct sockaddr_storage   addr;
+    socklen_t                 addrlen;
+    int                       on = 1;
+    bool                      is_udp = (protocol == IPPROTO_UDP);
+
+    if (!(dgram_socket = malloc(sizeof(dgram_socket_t)))) goto ERR_MALLOC;
+
+    if ((dgram_socket->sockfd = socket(dst_ip->family, SOCK_DGRAM, protocol)) == -1) {
+        perror(is_udp ?
+            "dgram_socket_create: error while creating socket" :
+            "dgram_socket_create: error while creating socket (see net.ipv4.ping_group_range)"
+        );
+        goto ERR_SOCKET;
+    }
+
+    if (fcntl(dgram_socket->sockfd, F_SETFL, O_NONBLOCK) == -1) {
+        goto ERR_FCNTL;
+    }
+
+    // Several flows may share the same source port
+    if (setsockopt(dgram_socket->sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1
+    ||  setsockopt(dgram_socket->sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == -1
+    ) {
+        perror("dgram_socket_create: error in setsockopt");
+        goto ERR_SETSOCKOPT;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    switch (dst_ip->family) {
+#ifdef USE_IPV4
+        case AF_INET:
+            if (setsockopt(dgram_socket->sockfd, SOL_IP, IP_RECVERR, &on, sizeof(on)) == -1) {
+                perror("dgram_socket_create: error in setsockopt");
+                goto ERR_SETSOCKOPT;
+            }
+            ((struct sockaddr_in *) &addr)->sin_family = AF_INET;
+            ((struct sockaddr_in *) &addr)->sin_port   = htons(src_port);
+            addrlen = sizeof(struct sockaddr_in);
+            break;
+#endif
+#ifdef USE_IPV6
+        case AF_INET6:
+            if (setsockopt(dgram_socket->sockfd, SOL_IPV6, IPV6_RECVERR, &on, sizeof(on)) == -1) {
+                perror("dgram_socket_create: error in setsockopt");
+                goto ERR_SETSOCKOPT;
+            }
+            ((struct sockaddr_in6 *) &addr)->sin6_family = AF_INET6;
+            ((struct sockaddr_in6 *) &addr)->sin6_port   = htons(src_port);
+            addrlen = sizeof(struct sockaddr_in6);
+            break;
+#endif
+        default:
+            fprintf(stderr, "dgram_socket_create: Address family not supported\n");
+            goto ERR_INVALID_FAMILY;
+    }
+
+    // ICMP sockets are bound to an echo identifier by connect()
+    if (is_udp && bind(dgram_socket->sockfd, (struct sockaddr *) &addr, addrlen) == -1) {
+        perror("dgram_socket_create: error while binding the socket");
+        goto ERR_BIND;
+    }
+
+    // Connect the socket
+    switch (dst_ip->family) {
+#ifdef USE_IPV4
+        case AF_INET:
+            ((struct sockaddr_in *) &addr)->sin_addr = dst_ip->ip.ipv4;
+            ((struct sockaddr_in *) &addr)->sin_port = is_udp ? htons(dst_port) : 0;
+            break;
+#endif
+#ifdef USE_IPV6
+        case AF_INET6:
+            memcpy(&((struct sockaddr_in6 *) &addr)->sin6_addr, &dst_ip->ip.ipv6, sizeof(ipv6_t));
+            ((struct sockaddr_in6 *) &addr)->sin6_port = is_udp ? htons(dst_port) : 0;
+            break;
+#endif
+    }
+
+    if (connect(dgram_socket->sockfd, (struct sockaddr *) &addr, addrlen) == -1) {
+        perror("dgram_socket_create: error while connecting the socket");
+        goto ERR_CONNECT;
+    }
+
+    // Retrieve the source IP (and the echo identifier) chosen by the kernel
+    if (getsockname(dgram_socket->sockfd, (struct sockaddr *) &addr, &addrlen) == -1) {
+        perror("dgram_socket_create: error in getsockname");
+        goto ERR_GETSOCKNAME;
+    }
+
+    memset(&dgram_socket->src_ip, 0, sizeof(address_t));
+    dgram_socket->src_ip.family = dst_ip->family;
+    switch (dst_ip->family) {
+#ifdef USE_IPV4
+        case AF_INET:
+            dgram_socket->src_ip.ip.ipv4 = ((struct sockaddr_in *) &addr)->sin_addr;
+            dgram_socket->src_port = ntohs(((struct sockaddr_in *) &addr)->sin_port);
+            break;
+#endif
+#ifdef USE_IPV6
+        case AF_INET6:
+            memcpy(&dgram_socket->src_ip.ip.ipv6, &((struct sockaddr_in6 *) &addr)->sin6_addr, sizeof(ipv6_t));
+            dgram_socket->src_port = ntohs(((struct sockaddr_in6 *) &addr)->sin6_port);
+            break;
+#endif
+    }
+
+    memcpy(&dgram_socket->dst_ip, dst_ip, sizeof(address_t));
+    dgram_socket->protocol   = protocol;
+    dgram_socket->dst_port   = is_udp ? dst_port : 0;
+    dgram_socket->num_flying = 0;
+    dgram_socket->prev_idle  = NULL;
+    dgram_socket->next_idle  = NULL;
+    return dgram_socket;
+
+ERR_GETSOCKNAME:
+ERR_CONNECT:
+ERR_BIND:
+ERR_INVALID_FAMILY:
+ERR_SETSOCKOPT:
+ERR_FCNTL:
+    close(dgram_socket->sockfd);
+ERR_SOCKET:
+    free(dgram_socket);
+ERR_MALLOC:
+    return NULL;
+}
+
+/**
+ * \brief Write an IP header (without option nor extension header).
+ * \param bytes The buffer where the header is written.
+ * \param size The size of the buffer.
+ * \param protocol The protocol carried by this IP packet.
+ * \param src_ip The source of the packet.
+ * \param dst_ip The destination of the packet.
+ * \param payload_size The size of the IP payload.
+ * \return The size of the written header, 0 if the IP packet does not fit
+ *    in the buffer.
+ */
+
+static size_t write_ip_header(
+    uint8_t         * bytes,
+    size_t            size,
+    uint8_t           protocol,
+    const address_t * src_ip,
+    const address_t * dst_ip,
+    size_t            payload_size
+) {
+    switch (dst_ip->family) {
+#ifdef USE_IPV4
+        case AF_INET:
+            {
+                struct iphdr * iph = (struct iphdr *) bytes;
+
+                if (sizeof(struct iphdr) + payload_size > size) break;
+                memset(iph, 0, sizeof(struct iphdr));
+                iph->version  = 4;
+                iph->ihl      = sizeof(struct iphdr) >> 2;
+                iph->tot_len  = htons(sizeof(struct iphdr) + payload_size);
+                iph->ttl      = 0; // Unknown
+                iph->protocol = protocol;
+                iph->saddr    = src_ip->ip.ipv4.s_addr;
+                iph->daddr    = dst_ip->ip.ipv4.s_addr;
+                return sizeof(struct iphdr);
+            }
+#endif
+#ifdef USE_IPV6
+        case AF_INET6:
+            {
+                struct ip6_hdr * ip6h = (struct ip6_hdr *) bytes;
+
+                if (sizeof(struct ip6_hdr) + payload_size > size) break;
+                memset(ip6h, 0, sizeof(struct ip6_hdr));
+                ip6h->ip6_flow = htonl(0x60000000);
+                ip6h->ip6_plen = htons(payload_size);
+                ip6h->ip6_nxt  = protocol;
+                ip6h->ip6_hlim = 0; // Unknown
+                memcpy(&ip6h->ip6_src, &src_ip->ip.ipv6, sizeof(struct in6_addr));
+                memcpy(&ip6h->ip6_dst, &dst_ip->ip.ipv6, sizeof(struct in6_addr));
+                return sizeof(struct ip6_hdr);
+            }
+#endif
+        default:
+            break;
+    }
+    return 0;
+}
+
+/**
+ * \brief Rebuild the IP/UDP/payload packet that a UDP socket has sent.
+ * \param dgram_socket A dgram_socket_t instance.
+ * \param payload The payload of the sent packet.
+ * \param payload_size The size of the payload.
+ * \param bytes The buffer where the packet is written.
+ * \param size The size of the buffer.
+ * \return The size of the packet, 0 in case of failure. Its checksums
+ *   are the ones computed by the kernel, in particular the UDP checksum which
+ *   stores the tag of the probe (see network_tag_probe).
+ */
+
+static size_t dgram_socket_make_udp_probe(
+    const dgram_socket_t * dgram_socket,
+    const uint8_t        * payload,
+    size_t                 payload_size,
+    uint8_t              * bytes,
+    size_t                 size
+) {
+    probe_t * probe;
+    size_t    ret = 0;
+
+    if (!(probe = probe_create())) goto ERR_PROBE_CREATE;
+    if (!probe_set_protocols(probe, dgram_socket->dst_ip.family == AF_INET6 ? "ipv6" : "ipv4", "udp", NULL)) {
+        goto ERR_PROBE_SET_PROTOCOLS;
+    }
+    if (!probe_payload_resize(probe, payload_size))         goto ERR_PROBE_PAYLOAD_RESIZE;
+    if (!probe_write_payload(probe, payload, payload_size)) goto ERR_PROBE_WRITE_PAYLOAD;
+
+    // Update checksums, src_ip (see ipv*_finalize) and so on
+    if (!probe_set_fields(
+        probe,
+        ADDRESS("dst_ip",  &dgram_socket->dst_ip),
+        I16("src_port", dgram_socket->src_port),
+        I16("dst_port", dgram_socket->dst_port),
+        NULL
+    )) {
+        goto ERR_PROBE_SET_FIELDS;
+    }
+
+    if (packet_get_size(probe->packet) <= size) {
+        ret = packet_get_size(probe->packet);
+        memcpy(bytes, packet_get_bytes(probe->packet), ret);
+    }
+
+ERR_PROBE_SET_FIELDS:
+ERR_PROBE_WRITE_PAYLOAD:
+ERR_PROBE_PAYLOAD_RESIZE:
+ERR_PROBE_SET_PROTOCOLS:
+    probe_free(probe);
+ERR_PROBE_CREATE:
+    return ret;
+}
+
+/**
+ * \brief Rebuild the packet that a socket has sent.
+ * \param dgram_socket A dgram_socket_t instance.
+ * \param data The data returned along the error (the UDP payload for UDP
+ *    sockets, the whole ICMP message for ICMP sockets).
+ * \param data_size The size of the data.
+ * \param bytes The buffer where the packet is written.
+ * \param size The size of the buffer.
+ * \return The size of the packet, 0 in case of failure.
+ */
+
+static size_t dgram_socket_make_probe(
+    const dgram_socket_t * dgram_socket,
+    const uint8_t        * data,
+    size_t                 data_size,
+    uint8_t              * bytes,
+    size_t                 size
+) {
+    size_t header_size;
+
+    if (dgram_socket->protocol == IPPROTO_UDP) {
+        return dgram_socket_make_udp_probe(dgram_socket, data, data_size, bytes, size);
+    }
+
+    if (!(header_size = write_ip_header(bytes, size, dgram_socket->protocol, &dgram_socket->src_ip, &dgram_socket->dst_ip, data_size))) {
+        return 0;
+    }
+    memcpy(bytes + header_size, data, data_size);
+    return header_size + data_size;
+}
+
+/**
+ * \brief Build the packet that a raw socket would have sniffed when
+ *    receiving an ICMP error related to this socket.
+ * \param dgram_socket A dgram_socket_t instance.
+ * \param ee The extended error fetched from the error queue.
+ * \param data The data returned along the error.
+ * \param data_size The size of the data.
+ * \return The corresponding packet_t instance, NULL otherwise.
+ */
+
+static packet_t * dgram_socket_make_icmp_error(
+    const dgram_socket_t           * dgram_socket,
+    const struct sock_extended_err * ee,
+    const uint8_t                  * data,
+    size_t                           data_size
+) {
+    uint8_t                 bytes[BUFLEN];
+    size_t                  header_size, icmp_header_size, quoted_size;
+    uint8_t                 icmp_protocol;
+    const struct sockaddr * offender = SO_EE_OFFENDER(ee);
+    address_t               offender_ip;
+
+    memset(&offender_ip, 0, sizeof(address_t));
+    offender_ip.family = dgram_socket->dst_ip.family;
+    switch (offender_ip.family) {
+#ifdef USE_IPV4
+        case AF_INET:
+            offender_ip.ip.ipv4 = ((const struct sockaddr_in *) offender)->sin_addr;
+            icmp_protocol       = IPPROTO_ICMP;
+            icmp_header_size    = sizeof(struct icmphdr);
+            break;
+#endif
+#ifdef USE_IPV6
+        case AF_INET6:
+            memcpy(&offender_ip.ip.ipv6, &((const struct sockaddr_in6 *) offender)->sin6_addr, sizeof(ipv6_t));
+            icmp_protocol       = IPPROTO_ICMPV6;
+            icmp_header_size    = sizeof(struct icmp6_hdr);
+            break;
+#endif
+        default:
+            return NULL;
+    }
+
+    // Outer IP header, then ICMP header (checksum left to 0), then quoted probe
+    if (!(header_size = write_ip_header(bytes, BUFLEN, icmp_protocol, &offender_ip, &dgram_socket->src_ip, icmp_header_size))) {
+        return NULL;
+    }
+    memset(bytes + header_size, 0, icmp_header_size);
+    bytes[header_size]     = ee->ee_type;
+    bytes[header_size + 1] = ee->ee_code;
+
+    if (!(quoted_size = dgram_socket_make_probe(
+        dgram_socket, data, data_size,
+        bytes + header_size + icmp_header_size,
+        BUFLEN - header_size - icmp_header_size
+    ))) {
+        return NULL;
+    }
+
+    // Fix the length of the outer IP packet
+    write_ip_header(bytes, BUFLEN, icmp_protocol, &offender_ip, &dgram_socket->src_ip, icmp_header_size + quoted_size);
+    return packet_create_from_bytes(bytes, header_size + icmp_header_size + quoted_size);
+}
+
+/**
+ * \brief Build the packet that a raw socket would have sniffed when
+ *    receiving a datagram (or an echo reply) sent by the destination of
+ *    this socket.
+ * \param dgram_socket A dgram_socket_t instance.
+ * \param data The received data (the UDP payload for UDP sockets, the
+ *    whole ICMP message for ICMP sockets).
+ * \param data_size The size of the data.
+ * \return The corresponding packet_t instance, NULL otherwise.
+ */
+
+static packet_t * dgram_socket_make_reply(const dgram_socket_t * dgram_socket, const uint8_t * data, size_t data_size)
+{
+    uint8_t         bytes[BUFLEN];
+    size_t          header_size,
+                    transport_size = (dgram_socket->protocol == IPPROTO_UDP) ? sizeof(struct udphdr) : 0;
+    struct udphdr * udph;
+
+    if (!(header_size = write_ip_header(
+        bytes, BUFLEN, dgram_socket->protocol,
+        &dgram_socket->dst_ip, &dgram_socket->src_ip,
+        transport_size + data_size
+    ))) {
+        return NULL;
+    }
+
+    if (transport_size) {
+        udph = (struct udphdr *) (bytes + header_size);
+        memset(udph, 0, sizeof(struct udphdr));
+        udph->source = htons(dgram_socket->dst_port);
+        udph->dest   = htons(dgram_socket->src_port);
+        udph->len    = htons(sizeof(struct udphdr) + data_size);
+    }
+
+    memcpy(bytes + header_size + transport_size, data, data_size);
+    return packet_create_from_bytes(bytes, header_size + transport_size + data_size);
+}
+
+/**
+ * \brief Fetch a batch of messages from a socket and pass the corresponding
+ *    packets to the callback of the dgrampool.
+ * \param dgrampool A dgrampool_t instance.
+ * \param dgram_socket A dgram_socket_t instance belonging to dgrampool.
+ * \param from_errqueue Pass true to read the error queue of the socket,
+ *    false to read the datagrams it has received.
+ * \return The number of fetched messages.
+ */
+
+static size_t dgram_socket_recv_batch(dgrampool_t * dgrampool, const dgram_socket_t * dgram_socket, bool from_errqueue)
+{
+    uint8_t                          data[DGRAMPOOL_BATCH_SIZE][BUFLEN];
+    char                             control[DGRAMPOOL_BATCH_SIZE][CONTROLLEN];
+    struct iovec                     iovs[DGRAMPOOL_BATCH_SIZE];
+    struct mmsghdr                   msgs[DGRAMPOOL_BATCH_SIZE];
+    struct cmsghdr                 * cmsg;
+    const struct sock_extended_err * ee;
+    const struct timespec          * ts;
+    packet_t                       * packet;
+    double                           recv_time;
+    int                              i, n;
+
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < DGRAMPOOL_BATCH_SIZE; i++) {
+        iovs[i].iov_base               = data[i];
+        iovs[i].iov_len                = BUFLEN;
+        msgs[i].msg_hdr.msg_iov        = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen     = 1;
+        msgs[i].msg_hdr.msg_control    = control[i];
+        msgs[i].msg_hdr.msg_controllen = CONTROLLEN;
+    }
+
+    // When reading datagrams, a pending ICMP error may also be reported
+    // (e.g. ECONNREFUSED), but it is fetched from the error queue anyway.
+    if ((n = recvmmsg(dgram_socket->sockfd, msgs, DGRAMPOOL_BATCH_SIZE, MSG_DONTWAIT | (from_errqueue ? MSG_ERRQUEUE : 0), NULL)) <= 0) {
+        return 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        ee = NULL;
+        recv_time = 0;
+        for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+            if ((cmsg->cmsg_level == SOL_IP   && cmsg->cmsg_type == IP_RECVERR)
+            ||  (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                ee = (const struct sock_extended_err *) CMSG_DATA(cmsg);
+            } else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+                ts = (const struct timespec *) CMSG_DATA(cmsg);
+                recv_time = ts->tv_sec + ts->tv_nsec / 1000000000.0;
+            }
+        }
+
+        if (from_errqueue) {
+            // Ignore local errors (e.g. EMSGSIZE)
+            if (!ee || (ee->ee_origin != SO_EE_ORIGIN_ICMP && ee->ee_origin != SO_EE_ORIGIN_ICMP6)) {
+                continue;
+            }
+            packet = dgram_socket_make_icmp_error(dgram_socket, ee, data[i], msgs[i].msg_len);
+        } else {
+            packet = dgram_socket_make_reply(dgram_socket, data[i], msgs[i].msg_len);
+        }
+
+        if (packet) {
+            packet->recv_time = recv_time;
+            if (!dgrampool->recv_callback(packet, dgrampool->recv_param)) {
+                fprintf(stderr, "Error in dgrampool's callback\n");
+            }
+        }
+    }
+
+    return n;
+}
+
+/**
+ * \brief Send an ICMP echo request through an ICMP socket.
+ * \param dgram_socket A dgram_socket_t instance (IPPROTO_ICMP or IPPROTO_ICMPV6).
+ * \param probe The probe to send.
+ * \return true iif successful.
+ */
+
+static bool dgram_socket_send_echo_request(const dgram_socket_t * dgram_socket, const probe_t * probe)
+{
+    uint8_t         bytes[BUFLEN];
+    const layer_t * layer;
+    const uint8_t * segment;
+    size_t          size;
+    uint32_t        sum;
+    uint16_t        identifier, sequence;
+
+    if (!(layer = probe_get_layer(probe, 1))) return false;
+    segment = layer_get_segment(layer);
+    size = packet_get_size(probe->packet) - (segment - packet_get_bytes(probe->packet));
+    if (size < 8 || size > BUFLEN) return false;
+    memcpy(bytes, segment, size);
+
+    // The kernel replaces the identifier (bytes 4-5) by the one bound to the
+    // socket and recomputes the checksum. Compensate in the sequence number
+    // (bytes 6-7) so that the checksum (i.e. the tag) remains the same:
+    // sequence' = sequence + identifier - identifier' (one's complement sum).
+    memcpy(&identifier, bytes + 4, sizeof(uint16_t));
+    memcpy(&sequence,   bytes + 6, sizeof(uint16_t));
+    sum = ntohs(sequence) + ntohs(identifier) + (uint16_t) ~dgram_socket->src_port;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    identifier = htons(dgram_socket->src_port);
+    sequence   = htons(sum);
+    memcpy(bytes + 4, &identifier, sizeof(uint16_t));
+    memcpy(bytes + 6, &sequence,   sizeof(uint16_t));
+
+    return send(dgram_socket->sockfd, bytes, size, 0) != -1;
+}
+
+#endif // LINUX
+
+//---------------------------------------------------------------------------
+// dgrampool_t
+//---------------------------------------------------------------------------
+
+dgrampool_t * dgrampool_create(void * recv_param, bool (*recv_callback)(packet_t *, void *))
+{
+#ifdef LINUX
+    dgrampool_t * dgrampool;
+
+    if (!(dgrampool = malloc(sizeof(dgrampool_t)))) goto ERR_MALLOC;
+    if ((dgrampool->efd = epoll_create1(0)) == -1) {
+        perror("dgrampool_create: error in epoll_create1");
+        goto ERR_EPOLL_CREATE;
+    }
+    dgrampool->sockets       = NULL;
+    dgrampool->num_sockets   = 0;
+    dgrampool->max_sockets   = DGRAMPOOL_DEFAULT_MAX_SOCKETS;
+    dgrampool->oldest_idle   = NULL;
+    dgrampool->newest_idle   = NULL;
+    dgrampool->recv_param    = recv_param;
+    dgrampool->recv_callback = recv_callback;
+    return dgrampool;
+
+ERR_EPOLL_CREATE:
+    free(dgrampool);
+ERR_MALLOC:
+#endif
+    return NULL;
+}
+
+void dgrampool_free(dgrampool_t * dgrampool) {
+    if (dgrampool) {
+        tdestroy(dgrampool->sockets, (ELEMENT_FREE) dgram_socket_free);
+        close(dgrampool->efd);
+        free(dgrampool);
+    }
+}
+
+int dgrampool_get_fd(const dgrampool_t * dgrampool) {
+    return dgrampool->efd;
+}
+
+#ifdef LINUX
+
+/**
+ * \brief Append a socket to the idle sockets (it becomes the most recently
+ *    used one).
+ * \param dgrampool A dgrampool_t instance.
+ * \param dgram_socket A socket of the pool, which is not idle.
+ */
+
+static void dgrampool_push_idle(dgrampool_t * dgrampool, dgram_socket_t * dgram_socket)
+{
+    dgram_socket->prev_idle = dgrampool->newest_idle;
+    dgram_socket->next_idle = NULL;
+    if (dgrampool->newest_idle) {
+        dgrampool->newest_idle->next_idle = dgram_socket;
+    } else {
+        dgrampool->oldest_idle = dgram_socket;
+    }
+    dgrampool->newest_idle = dgram_socket;
+}
+
+/**
+ * \brief Remove a socket from the idle sockets.
+ * \param dgrampool A dgrampool_t instance.
+ * \param dgram_socket An idle socket of the pool.
+ */
+
+static void dgrampool_remove_idle(dgrampool_t * dgrampool, dgram_socket_t * dgram_socket)
+{
+    if (dgram_socket->prev_idle) {
+        dgram_socket->prev_idle->next_idle = dgram_socket->next_idle;
+    } else {
+        dgrampool->oldest_idle = dgram_socket->next_idle;
+    }
+    if (dgram_socket->next_idle) {
+        dgram_socket->next_idle->prev_idle = dgram_socket->prev_idle;
+    } else {
+        dgrampool->newest_idle = dgram_socket->prev_idle;
+    }
+    dgram_socket->prev_idle = NULL;
+    dgram_socket->next_idle = NULL;
+}
+
+/**
+ * \brief Close an idle socket and remove it from the pool. Closing its file
+ *    descriptor removes it from the epoll instance.
+ * \param dgrampool A dgrampool_t instance.
+ * \param dgram_socket An idle socket of the pool.
+ */
+
+static void dgrampool_close_socket(dgrampool_t * dgrampool, dgram_socket_t * dgram_socket)
+{
+    dgrampool_remove_idle(dgrampool, dgram_socket);
+    tdelete(dgram_socket, &dgrampool->sockets, (ELEMENT_COMPARE) dgram_socket_compare);
+    dgrampool->num_sockets--;
+    dgram_socket_free(dgram_socket);
+}
+
+/**
+ * \brief Retrieve the socket related to a flow, create it if needed.
+ * \param dgrampool A dgrampool_t instance.
+ * \param flow The flow (see dgram_socket_set_flow).
+ * \return The corresponding dgram_socket_t instance, NULL in case of failure
+ *    (errno is set to EAGAIN if the pool is full and none of its sockets is
+ *    idle). A newly created socket is idle.
+ */
+
+static dgram_socket_t * dgrampool_get_socket(dgrampool_t * dgrampool, const dgram_socket_t * flow)
+{
+    dgram_socket_t    ** node;
+    dgram_socket_t     * dgram_socket;
+    struct epoll_event   event;
+
+    if ((node = tfind(flow, &dgrampool->sockets, (ELEMENT_COMPARE) dgram_socket_compare))) {
+        return *node;
+    }
+
+    // Make room for this flow by closing the least recently used idle socket
+    if (dgrampool->max_sockets && dgrampool->num_sockets >= dgrampool->max_sockets) {
+        if (!dgrampool->oldest_idle) {
+            errno = EAGAIN;
+            goto ERR_POOL_FULL;
+        }
+        dgrampool_close_socket(dgrampool, dgrampool->oldest_idle);
+    }
+
+    if (!(dgram_socket = dgram_socket_create(&flow->dst_ip, flow->protocol, flow->src_port, flow->dst_port))) {
+        goto ERR_SOCKET_CREATE;
+    }
+
+    memset(&event, 0, sizeof(struct epoll_event));
+    event.data.ptr = dgram_socket;
+    event.events   = EPOLLIN; // EPOLLERR is always reported
+    if (epoll_ctl(dgrampool->efd, EPOLL_CTL_ADD, dgram_socket->sockfd, &event) == -1) {
+        perror("dgrampool_get_socket: error in epoll_ctl");
+        goto ERR_EPOLL_CTL;
+    }
+
+    if (!tsearch(dgram_socket, &dgrampool->sockets, (ELEMENT_COMPARE) dgram_socket_compare)) {
+        goto ERR_TSEARCH;
+    }
+    dgrampool->num_sockets++;
+    dgrampool_push_idle(dgrampool, dgram_socket);
+    return dgram_socket;
+
+ERR_TSEARCH:
+ERR_EPOLL_CTL:
+    dgram_socket_free(dgram_socket);
+ERR_SOCKET_CREATE:
+ERR_POOL_FULL:
+    return NULL;
+}
+
+#endif // LINUX
+
+void dgrampool_set_max_sockets(dgrampool_t * dgrampool, size_t max_sockets)
+{
+    dgrampool->max_sockets = max_sockets;
+#ifdef LINUX
+    while (max_sockets && dgrampool->num_sockets > max_sockets && dgrampool->oldest_idle) {
+        dgrampool_close_socket(dgrampool, dgrampool->oldest_idle);
+    }
+#endif
+}
+
+bool dgrampool_send_probe(dgrampool_t * dgrampool, const probe_t * probe)
+{
+#ifdef LINUX
+    dgram_socket_t   flow,
+                   * dgram_socket;
+    uint8_t          ttl;
+    int              hops;
+    bool             sent;
+
+    if (!dgram_socket_set_flow(&flow, probe)
+    ||  !probe_extract(probe, "ttl", &ttl)
+    ) {
+        goto ERR_INVALID_PROBE;
+    }
+
+    if (!(dgram_socket = dgrampool_get_socket(dgrampool, &flow))) {
+        goto ERR_GET_SOCKET;
+    }
+
+    hops = ttl;
+    if (setsockopt(
+        dgram_socket->sockfd,
+        flow.dst_ip.family == AF_INET6 ? SOL_IPV6 : SOL_IP,
+        flow.dst_ip.family == AF_INET6 ? IPV6_UNICAST_HOPS : IP_TTL,
+        &hops, sizeof(hops)
+    ) == -1) {
+        perror("dgrampool_send_probe: error in setsockopt");
+        goto ERR_SETSOCKOPT;
+    }
+
+    // A connected socket reports once a pending ICMP error on the next send()
+    // (e.g. ECONNREFUSED), in which case nothing has been sent: retry.
+    if (flow.protocol == IPPROTO_UDP) {
+        sent = send(dgram_socket->sockfd, probe_get_payload(probe), probe_get_payload_size(probe), 0) != -1
+            || send(dgram_socket->sockfd, probe_get_payload(probe), probe_get_payload_size(probe), 0) != -1;
+    } else {
+        sent = dgram_socket_send_echo_request(dgram_socket, probe)
+            || dgram_socket_send_echo_request(dgram_socket, probe);
+    }
+
+    if (!sent) {
+        perror("dgrampool_send_probe: Sending error");
+        goto ERR_SEND;
+    }
+
+    // The socket is no longer idle
+    if (dgram_socket->num_flying++ == 0) {
+        dgrampool_remove_idle(dgrampool, dgram_socket);
+    }
+    return true;
+
+ERR_SEND:
+ERR_SETSOCKOPT:
+ERR_GET_SOCKET:
+    return false;
+ERR_INVALID_PROBE:
+    fprintf(stderr, "dgrampool_send_probe: Only IP/UDP probes and IP/ICMP echo requests are supported\n");
+#endif
+    return false;
+}
+
+bool dgrampool_release_probe(dgrampool_t * dgrampool, const probe_t * probe)
+{
+#ifdef LINUX
+    dgram_socket_t    flow,
+                   ** node,
+                    * dgram_socket;
+
+    if (!dgram_socket_set_flow(&flow, probe)
+    || !(node = tfind(&flow, &dgrampool->sockets, (ELEMENT_COMPARE) dgram_socket_compare))
+    || (dgram_socket = *node)->num_flying == 0
+    || --dgram_socket->num_flying > 0
+    ) {
+        return false;
+    }
+
+    dgrampool_push_idle(dgrampool, dgram_socket);
+
+    // The limit may have been lowered in the meantime
+    if (dgrampool->max_sockets && dgrampool->num_sockets > dgrampool->max_sockets) {
+        dgrampool_close_socket(dgrampool, dgram_socket);
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void dgrampool_process_packets(dgrampool_t * dgrampool)
+{
+#ifdef LINUX
+    struct epoll_event   events[DGRAMPOOL_MAX_EVENTS];
+    dgram_socket_t     * dgram_socket;
+    int                  i, n;
+
+    if ((n = epoll_wait(dgrampool->efd, events, DGRAMPOOL_MAX_EVENTS, 0)) == -1) {
+        perror("dgrampool_process_packets: error in epoll_wait");
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        dgram_socket = events[i].data.ptr;
+
+        // ICMP errors
+        while (dgram_socket_recv_batch(dgrampool, dgram_socket, true) == DGRAMPOOL_BATCH_SIZE);
+
+        // Datagrams (or echo replies) sent by the destination
+        while (dgram_socket_recv_batch(dgrampool, dgram_socket, false) == DGRAMPOOL_BATCH_SIZE);
+    }
+#endif
+}
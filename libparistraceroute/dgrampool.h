@@ -0,0 +1,152 @@
+#ifndef LIBPT_DGRAMPOOL_H
+#define LIBPT_DGRAMPOOL_H
+
+/**
+ * \file dgrampool.h
+ * \brief Unprivileged backend.
+ *
+ * Raw sockets (see socketpool.h and sniffer.h) require root privileges and
+ * make every instance copy every ICMP packet reaching the host. A
+ * dgrampool_t sends probes thanks to connected SOCK_DGRAM sockets (one per
+ * flow) and retrieves the ICMP errors they provoke from the error queue of
+ * each socket (IP_RECVERR / IPV6_RECVERR, MSG_ERRQUEUE). Replies are then
+ * demultiplexed by the kernel and no privilege is required (Linux only).
+ *
+ * Two kinds of probes are supported:
+ * - IP/UDP probes, sent through SOCK_DGRAM/IPPROTO_UDP sockets. A flow is
+ *   identified by (dst_ip, src_port, dst_port).
+ * - IP/ICMP echo requests, sent through SOCK_DGRAM/IPPROTO_ICMP(V6) sockets
+ *   (see net.ipv4.ping_group_range). A flow is identified by dst_ip. The
+ *   kernel overwrites the echo identifier with the one bound to the socket,
+ *   so the sequence number is adjusted to keep the checksum (i.e. the tag of
+ *   the probe, see network_tag_probe) unchanged.
+ *
+ * Since the rest of the library expects sniffed packets, each error is
+ * turned into the IP/ICMP/IP/... packet that a raw socket would have
+ * sniffed, and each datagram (resp. echo reply) sent back by the destination
+ * into an IP/UDP (resp. IP/ICMP) packet. These packets are passed to
+ * recv_callback, exactly like a sniffer_t does. Sockets are read by batches
+ * (recvmmsg) and the reception time of each packet is provided by the kernel
+ * (SO_TIMESTAMPNS).
+ *
+ * Every socket is watched by an epoll instance private to the dgrampool_t.
+ * Its file descriptor is the only one that has to be watched by pt_loop.
+ *
+ * Sockets are indexed by flow. A socket without any probe in flight is
+ * idle: once the pool holds max_sockets sockets, the least recently used
+ * idle socket is closed to make room for a new flow. If every socket has a
+ * probe in flight, the probe cannot be sent (EAGAIN) until one of them is
+ * released (see dgrampool_release_probe).
+ */
+
+#include <stdbool.h>     // bool
+#include <stddef.h>      // size_t
+
+#include "address.h"     // address_t
+#include "packet.h"      // packet_t
+#include "probe.h"       // probe_t
+
+// Default maximum number of sockets opened by a dgrampool_t
+#define DGRAMPOOL_DEFAULT_MAX_SOCKETS 256
+
+/**
+ * \struct dgram_socket_t
+ * \brief A connected datagram socket related to a given flow.
+ */
+
+typedef struct dgram_socket_s {
+    int                     sockfd;      /**< Socket file descriptor */
+    uint8_t                 protocol;    /**< IPPROTO_UDP, IPPROTO_ICMP or IPPROTO_ICMPV6 */
+    address_t               src_ip;      /**< Local address (set once the socket is connected) */
+    address_t               dst_ip;      /**< Destination of the flow */
+    uint16_t                src_port;    /**< Source port of the flow (UDP), echo identifier bound by the kernel (ICMP) */
+    uint16_t                dst_port;    /**< Destination port of the flow (UDP), 0 (ICMP) */
+    size_t                  num_flying;  /**< Number of probes sent through this socket and not yet released */
+    struct dgram_socket_s * prev_idle;   /**< Previous idle socket (less recently used), if idle */
+    struct dgram_socket_s * next_idle;   /**< Next idle socket (more recently used), if idle */
+} dgram_socket_t;
+
+/**
+ * \struct dgrampool_t
+ * \brief A pool of datagram sockets.
+ */
+
+typedef struct {
+    int              efd;           /**< epoll instance watching every socket of the pool */
+    void           * sockets;       /**< Sockets of the pool, indexed by flow (tsearch tree of dgram_socket_t *) */
+    size_t           num_sockets;   /**< Number of sockets in the pool */
+    size_t           max_sockets;   /**< Maximum number of sockets (0 if unbounded) */
+    dgram_socket_t * oldest_idle;   /**< Least recently used idle socket, closed first (NULL if none) */
+    dgram_socket_t * newest_idle;   /**< Most recently used idle socket (NULL if none) */
+    void           * recv_param;    /**< This pointer is passed whenever recv_callback is called */
+    bool          (* recv_callback)(packet_t * packet, void * recv_param); /**< Callback for received packets */
+} dgrampool_t;
+
+/**
+ * \brief Create a dgrampool_t instance.
+ * \param recv_param This pointer is passed whenever recv_callback is called.
+ * \param recv_callback This function is called whenever a reply is received.
+ * \return The newly created dgrampool_t instance, NULL in case of failure
+ *    (or if the underlying OS does not support this backend).
+ */
+
+dgrampool_t * dgrampool_create(void * recv_param, bool (*recv_callback)(packet_t *, void *));
+
+/**
+ * \brief Release a dgrampool_t instance and close its sockets.
+ * \param dgrampool A dgrampool_t instance.
+ */
+
+void dgrampool_free(dgrampool_t * dgrampool);
+
+/**
+ * \brief Retrieve the file descriptor activated whenever one of the
+ *    sockets of the pool has received something.
+ * \param dgrampool A dgrampool_t instance.
+ * \return The corresponding file descriptor.
+ */
+
+int dgrampool_get_fd(const dgrampool_t * dgrampool);
+
+/**
+ * \brief Set the maximum number of sockets opened by a dgrampool_t.
+ * \param dgrampool A dgrampool_t instance.
+ * \param max_sockets The maximum number of sockets (0 if unbounded).
+ *    Sockets already opened beyond this limit are closed once idle.
+ */
+
+void dgrampool_set_max_sockets(dgrampool_t * dgrampool, size_t max_sockets);
+
+/**
+ * \brief Send a probe. Only IP/UDP probes and IP/ICMP echo requests are
+ *    supported. The IP header (and the UDP header) is built by the kernel.
+ *    Once sent, the probe holds the socket of its flow until it is released
+ *    by dgrampool_release_probe.
+ * \param dgrampool A dgrampool_t instance.
+ * \param probe The probe to send.
+ * \return true iif successful. If the pool is full and none of its sockets
+ *    is idle, errno is set to EAGAIN.
+ */
+
+bool dgrampool_send_probe(dgrampool_t * dgrampool, const probe_t * probe);
+
+/**
+ * \brief Release the socket held by a probe sent by dgrampool_send_probe
+ *    (i.e. the probe has been answered or has expired).
+ * \param dgrampool A dgrampool_t instance.
+ * \param probe The probe.
+ * \return true iif its socket has become idle, i.e. a probe that could not
+ *    be sent (EAGAIN) may now be sent.
+ */
+
+bool dgrampool_release_probe(dgrampool_t * dgrampool, const probe_t * probe);
+
+/**
+ * \brief Fetch every error and datagram received by the sockets of the pool
+ *    and pass the corresponding packets to recv_callback.
+ * \param dgrampool A dgrampool_t instance.
+ */
+
+void dgrampool_process_packets(dgrampool_t * dgrampool);
+
+#endif // LIBPT_DGRAMPOOL_H
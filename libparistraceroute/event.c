@@ -16,17 +16,22 @@ event_t * event_create(
         event->data = data;
         event->issuer = issuer;
         event->data_free = data_free;
+        event->refcount = 1;
     }
     return event;
 }
 
+event_t * event_ref(event_t * event) {
+    event->refcount++;
+    return event;
+}
+
 void event_free(event_t * event)
 {
-    if (event) {
+    if (event && --event->refcount == 0) {
         if (event->data && event->data_free) {
             event->data_free(event->data);
         }
-        // TODO: trigger a double free. Ex: paris-traceroute -n 8.8.8.8
-        // free(event);
+        free(event);
     }
 }
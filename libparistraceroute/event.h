@@ -3,6 +3,8 @@
 
 // Do not include "algorithm.h" to avoid mutual inclusion
 
+#include <stddef.h> // size_t
+
 /**
  * \file event.h
  * \brief
@@ -15,6 +17,13 @@
  *   does the algorithm.
  *
  *   Specific-algorithm event are nested in a ALGORITHM_ANSWER event.
+ *
+ *   Events are reference-counted. The queue in which an event is thrown
+ *   (see pt_throw) owns a reference, released once the event has been
+ *   handled, so a handler must not release the event it handles. A
+ *   handler forwarding an event, or keeping it, takes its own reference
+ *   (see event_ref). The data carried by an event is released along with
+ *   the event thanks to data_free.
  */
 
 /**
@@ -27,15 +36,20 @@ typedef enum {
     // Such events are dispatched to the appropriate algorithm instances
     PROBE_REPLY,               /**< A reply has been sniffed           */
     PROBE_TIMEOUT,             /**< No reply sniffed for a given probe */
+    PROBE_LATE_REPLY,          /**< A reply has been sniffed for a probe which has expired (see probe_archive.h) */
+    PROBE_DUPLICATE,           /**< A reply has been sniffed for a probe already answered (see probe_archive.h) */
+    NETWORK_WRITABLE,          /**< The sendq has been drained after rejecting a probe (see network_send_probe) */
 
     // Events handled the algorithm layer
     ALGORITHM_INIT,            /**< An algorithm can start             */
     ALGORITHM_TERM,            /**< An algorithm must terminate        */
+    ALGORITHM_TIMER,           /**< The timer of an algorithm instance has expired (see pt_set_timer) */
 
     // Events raised by the algorithm layer
     ALGORITHM_EVENT,           /**< An algorithm has raised an event   */
     ALGORITHM_HAS_TERMINATED,  /**< An algorithm must terminate        */
-    ALGORITHM_ERROR            /**< An error has occured               */
+    ALGORITHM_ERROR,           /**< An error has occured               */
+    ALGORITHM_QUOTA_REACHED    /**< An algorithm has sent as many probes as allowed by its caller (see pt_set_instance_quota) */
 } event_type_t;
 
 /**
@@ -48,6 +62,7 @@ typedef struct {
     void                        * data;               /**< Data carried by the event */
     void                       (* data_free)(void *); /**< Called in event_free to release data. Ignored if NULL. */
     struct algorithm_instance_s * issuer;             /**< Instance which has raised the event. NULL if raised by pt_loop. */
+    size_t                        refcount;           /**< Number of references to this event (see event_ref) */
 } event_t;
 
 /**
@@ -66,7 +81,16 @@ event_t * event_create(
 );
 
 /**
- * \brief Release an event when done
+ * \brief Take a new reference to an event.
+ * \param event An event_t instance.
+ * \return The event.
+ */
+
+event_t * event_ref(event_t * event);
+
+/**
+ * \brief Release a reference to an event. The event and its data are
+ *    released once its last reference is released.
  * \param event The event to destroy
  */
 
@@ -0,0 +1,293 @@
+#include "config.h"
+
+#include <errno.h>          // errno, EAGAIN
+#include <stdio.h>          // perror
+#include <stdint.h>         // uintptr_t
+#include <stdlib.h>         // malloc, calloc, free
+#include <unistd.h>         // read, close
+#include "os/sys/eventfd.h" // eventfd
+
+#include "fair_queue.h"
+
+//---------------------------------------------------------------------------
+// fair_queue_flow_t
+//---------------------------------------------------------------------------
+
+static fair_queue_flow_t * fair_queue_flow_create(const void * key, void (*element_free)(void * element)) {
+    fair_queue_flow_t * flow;
+
+    if (!(flow = malloc(sizeof(fair_queue_flow_t))))               goto ERR_MALLOC;
+    if (!(flow->elements = list_create(element_free, NULL)))       goto ERR_ELEMENTS;
+    flow->key = key;
+    flow->size = 0;
+    flow->weight = FAIR_QUEUE_DEFAULT_WEIGHT;
+    flow->deficit = 0;
+    flow->is_priority = false;
+    flow->next = flow->prev_active = flow->next_active = NULL;
+    return flow;
+
+ERR_ELEMENTS:
+    free(flow);
+ERR_MALLOC:
+    return NULL;
+}
+
+static void fair_queue_flow_free(fair_queue_flow_t * flow) {
+    if (flow) {
+        list_free(flow->elements);
+        free(flow);
+    }
+}
+
+//---------------------------------------------------------------------------
+// fair_queue_t
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Retrieve the bucket storing the flow of a producer.
+ * \param fair_queue A fair_queue_t instance.
+ * \param key Identifies the producer.
+ * \return The address of the head of the corresponding bucket.
+ */
+
+static fair_queue_flow_t ** fair_queue_get_bucket(const fair_queue_t * fair_queue, const void * key) {
+    size_t hash = (size_t) (uintptr_t) key;
+
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+    return &fair_queue->buckets[hash & (fair_queue->num_buckets - 1)];
+}
+
+/**
+ * \brief Retrieve the flow of a producer.
+ * \param fair_queue A fair_queue_t instance.
+ * \param key Identifies the producer.
+ * \return The corresponding flow, NULL if not found.
+ */
+
+static fair_queue_flow_t * fair_queue_find_flow(const fair_queue_t * fair_queue, const void * key) {
+    fair_queue_flow_t * flow;
+
+    for (flow = *fair_queue_get_bucket(fair_queue, key); flow; flow = flow->next) {
+        if (flow->key == key) return flow;
+    }
+    return NULL;
+}
+
+/**
+ * \brief Double the number of buckets of a fair_queue_t instance.
+ *    If it fails, the flows are kept in the current buckets.
+ * \param fair_queue A fair_queue_t instance.
+ */
+
+static void fair_queue_grow(fair_queue_t * fair_queue) {
+    fair_queue_flow_t ** buckets = fair_queue->buckets,
+                       * flow;
+    size_t               i, num_buckets = fair_queue->num_buckets;
+
+    if (!(fair_queue->buckets = calloc(2 * num_buckets, sizeof(fair_queue_flow_t *)))) {
+        fair_queue->buckets = buckets;
+        return;
+    }
+    fair_queue->num_buckets = 2 * num_buckets;
+
+    for (i = 0; i < num_buckets; i++) {
+        while ((flow = buckets[i])) {
+            buckets[i] = flow->next;
+            flow->next = *fair_queue_get_bucket(fair_queue, flow->key);
+            *fair_queue_get_bucket(fair_queue, flow->key) = flow;
+        }
+    }
+    free(buckets);
+}
+
+/**
+ * \brief Retrieve the flow of a producer, and create it if needed.
+ * \param fair_queue A fair_queue_t instance.
+ * \param key Identifies the producer.
+ * \return The corresponding flow, NULL in case of failure.
+ */
+
+static fair_queue_flow_t * fair_queue_get_flow(fair_queue_t * fair_queue, const void * key) {
+    fair_queue_flow_t  * flow,
+                      ** bucket;
+
+    if (!(flow = fair_queue_find_flow(fair_queue, key))) {
+        if (!(flow = fair_queue_flow_create(key, fair_queue->element_free))) return NULL;
+        if (++fair_queue->num_flows > fair_queue->num_buckets) fair_queue_grow(fair_queue);
+        bucket = fair_queue_get_bucket(fair_queue, key);
+        flow->next = *bucket;
+        *bucket = flow;
+    }
+    return flow;
+}
+
+/**
+ * \brief Append a flow which has become non-empty to the flows of its
+ *    class. Its turn starts once the flows preceding it have been served.
+ * \param fair_queue A fair_queue_t instance.
+ * \param flow The appended flow.
+ */
+
+static void fair_queue_activate_flow(fair_queue_t * fair_queue, fair_queue_flow_t * flow) {
+    fair_queue_flow_t ** ptail = &fair_queue->tails[flow->is_priority];
+
+    flow->deficit = flow->weight;
+    flow->prev_active = *ptail;
+    flow->next_active = NULL;
+    if (*ptail) (*ptail)->next_active = flow;
+    else        fair_queue->heads[flow->is_priority] = flow;
+    *ptail = flow;
+}
+
+/**
+ * \brief Remove a flow from the non-empty flows of its class.
+ * \param fair_queue A fair_queue_t instance.
+ * \param flow The removed flow.
+ */
+
+static void fair_queue_deactivate_flow(fair_queue_t * fair_queue, fair_queue_flow_t * flow) {
+    if (flow->prev_active) flow->prev_active->next_active = flow->next_active;
+    else                   fair_queue->heads[flow->is_priority] = flow->next_active;
+    if (flow->next_active) flow->next_active->prev_active = flow->prev_active;
+    else                   fair_queue->tails[flow->is_priority] = flow->prev_active;
+    flow->prev_active = flow->next_active = NULL;
+    flow->deficit = 0;
+}
+
+/**
+ * \brief Clear the notification of a fair_queue_t instance once it has
+ *    been emptied.
+ * \param fair_queue A fair_queue_t instance.
+ */
+
+static void fair_queue_clear_fd(fair_queue_t * fair_queue) {
+    eventfd_t value;
+
+    // EAGAIN: already cleared
+    if (fair_queue_get_size(fair_queue) == 0
+    &&  read(fair_queue->eventfd, &value, sizeof(value)) == -1
+    &&  errno != EAGAIN) {
+        perror("fair_queue_clear_fd");
+    }
+}
+
+fair_queue_t * fair_queue_create(void (*element_free)(void * element)) {
+    fair_queue_t * fair_queue;
+
+    if (!(fair_queue = calloc(1, sizeof(fair_queue_t))))                   goto ERR_CALLOC;
+    // The eventfd is readable as long as the queue is not empty, so that
+    // a burst of elements can be popped without reading it each time.
+    // Non-blocking: it is cleared once the queue has been emptied, even if
+    // this has already been reported by epoll.
+    if ((fair_queue->eventfd = eventfd(0, EFD_NONBLOCK)) == -1) goto ERR_EVENTFD;
+    if (!(fair_queue->buckets = calloc(FAIR_QUEUE_MIN_BUCKETS, sizeof(fair_queue_flow_t *)))) goto ERR_BUCKETS;
+    fair_queue->num_buckets = FAIR_QUEUE_MIN_BUCKETS;
+    fair_queue->element_free = element_free;
+    return fair_queue;
+
+ERR_BUCKETS:
+    close(fair_queue->eventfd);
+ERR_EVENTFD:
+    free(fair_queue);
+ERR_CALLOC:
+    return NULL;
+}
+
+void fair_queue_free(fair_queue_t * fair_queue) {
+    fair_queue_flow_t * flow;
+    size_t              i;
+
+    if (fair_queue) {
+        for (i = 0; i < fair_queue->num_buckets; i++) {
+            while ((flow = fair_queue->buckets[i])) {
+                fair_queue->buckets[i] = flow->next;
+                fair_queue_flow_free(flow);
+            }
+        }
+        free(fair_queue->buckets);
+        close(fair_queue->eventfd);
+        free(fair_queue);
+    }
+}
+
+bool fair_queue_set_class(fair_queue_t * fair_queue, const void * key, size_t weight, bool is_priority) {
+    fair_queue_flow_t * flow;
+
+    if (!(flow = fair_queue_get_flow(fair_queue, key))) return false;
+
+    // Move the pending elements to their new class
+    if (flow->size) fair_queue_deactivate_flow(fair_queue, flow);
+    fair_queue->sizes[flow->is_priority] -= flow->size;
+    fair_queue->sizes[is_priority] += flow->size;
+
+    flow->weight = weight ? weight : 1;
+    flow->is_priority = is_priority;
+    if (flow->size) fair_queue_activate_flow(fair_queue, flow);
+    return true;
+}
+
+bool fair_queue_push_element(fair_queue_t * fair_queue, const void * key, void * element) {
+    fair_queue_flow_t * flow;
+
+    if (!(flow = fair_queue_get_flow(fair_queue, key)))  return false;
+    if (!list_push_element(flow->elements, element))    return false;
+    if (flow->size++ == 0) fair_queue_activate_flow(fair_queue, flow);
+    fair_queue->sizes[flow->is_priority]++;
+
+    // Only the first element of a burst has to be notified
+    if (fair_queue_get_size(fair_queue) > 1) return true;
+    return eventfd_write(fair_queue->eventfd, 1) != -1;
+}
+
+void * fair_queue_pop_element(fair_queue_t * fair_queue) {
+    fair_queue_flow_t * flow;
+    void              * element;
+
+    // The prioritary flows are served first. The first flow of the class
+    // is being served, until it is empty or its deficit is exhausted.
+    if (!(flow = fair_queue->heads[fair_queue->sizes[true] > 0])) return NULL;
+
+    element = list_pop_element(flow->elements, NULL);
+    fair_queue->sizes[flow->is_priority]--;
+    if (--flow->size == 0) {
+        fair_queue_deactivate_flow(fair_queue, flow);
+    } else if (--flow->deficit == 0) {
+        fair_queue_deactivate_flow(fair_queue, flow);
+        fair_queue_activate_flow(fair_queue, flow);
+    }
+    fair_queue_clear_fd(fair_queue);
+    return element;
+}
+
+size_t fair_queue_forget_key(fair_queue_t * fair_queue, const void * key) {
+    fair_queue_flow_t  * flow,
+                      ** pnext;
+    size_t               num_elements;
+
+    for (pnext = fair_queue_get_bucket(fair_queue, key); (flow = *pnext); pnext = &flow->next) {
+        if (flow->key == key) break;
+    }
+    if (!flow) return 0;
+
+    num_elements = flow->size;
+    if (num_elements) {
+        fair_queue_deactivate_flow(fair_queue, flow);
+        fair_queue->sizes[flow->is_priority] -= num_elements;
+        fair_queue_clear_fd(fair_queue);
+    }
+
+    *pnext = flow->next;
+    fair_queue->num_flows--;
+    fair_queue_flow_free(flow);
+    return num_elements;
+}
+
+inline int fair_queue_get_fd(const fair_queue_t * fair_queue) {
+    return fair_queue->eventfd;
+}
+
+size_t fair_queue_get_size(const fair_queue_t * fair_queue) {
+    return fair_queue->sizes[false] + fair_queue->sizes[true];
+}
@@ -0,0 +1,142 @@
+#ifndef LIBPT_FAIR_QUEUE_H
+#define LIBPT_FAIR_QUEUE_H
+
+/**
+ * \file fair_queue.h
+ * \brief Queue shared by several producers, drained fairly.
+ *
+ * A fair_queue_t stores the elements of each producer (identified by an
+ * opaque key, e.g. an algorithm instance) in a dedicated FIFO, called a
+ * flow. Flows are drained by deficit round robin: each flow is served in
+ * turn, and may pop up to "weight" elements per turn. Hence a producer
+ * pushing many elements cannot starve the other ones, and a producer
+ * whose weight is w gets w times the share of a producer whose weight is 1.
+ *
+ * Flows marked as prioritary (e.g. latency-sensitive pings) are always
+ * served before the other ones, and share their class in the same way.
+ *
+ * Unlike a queue_t, a fair_queue_t does not notify each pushed element:
+ * its eventfd is readable as long as it is not empty (see fair_queue_get_fd),
+ * so that a burst of elements can be popped at once.
+ */
+
+#include <stdbool.h>          // bool
+#include <stddef.h>           // size_t
+
+#include "containers/list.h"  // list_t
+
+#define FAIR_QUEUE_DEFAULT_WEIGHT 1
+#define FAIR_QUEUE_MIN_BUCKETS    16 // A power of 2
+
+/**
+ * \struct fair_queue_flow_t
+ * \brief The elements pushed by a given producer.
+ */
+
+typedef struct fair_queue_flow_s {
+    const void               * key;         /**< Identifies the producer */
+    list_t                   * elements;    /**< Elements waiting to be popped */
+    size_t                     size;        /**< Number of elements stored in elements */
+    size_t                     weight;      /**< Maximum number of elements popped per turn */
+    size_t                     deficit;     /**< Number of elements which can still be popped during the current turn */
+    bool                       is_priority; /**< Served before the flows which are not prioritary */
+    struct fair_queue_flow_s * next;        /**< Next flow of the same bucket */
+    struct fair_queue_flow_s * prev_active; /**< Previous non-empty flow of the same class */
+    struct fair_queue_flow_s * next_active; /**< Next non-empty flow of the same class */
+} fair_queue_flow_t;
+
+/**
+ * \struct fair_queue_t
+ * \brief A set of flows drained by deficit round robin.
+ *
+ * Flows are retrieved by key thanks to a hash table. The non-empty flows
+ * of each class are chained in round robin order: the first one is being
+ * served, and goes to the end of the chain once its turn is over.
+ */
+
+typedef struct {
+    fair_queue_flow_t ** buckets;     /**< Hash table of the flows, chained by bucket */
+    size_t               num_buckets; /**< Number of buckets, a power of 2 */
+    size_t               num_flows;   /**< Number of flows */
+    fair_queue_flow_t  * heads[2];    /**< First non-empty flow of each class (regular, prioritary) */
+    fair_queue_flow_t  * tails[2];    /**< Last non-empty flow of each class (regular, prioritary) */
+    size_t               sizes[2];    /**< Number of elements stored in each class (regular, prioritary) */
+    int                  eventfd;     /**< File descriptor notifying an update in the queue */
+    void              (* element_free)(void * element); /**< Callback used to free the elements */
+} fair_queue_t;
+
+/**
+ * \brief Create a fair_queue_t instance.
+ * \param element_free Callback used to free elements.
+ * \return The newly created instance, NULL in case of failure.
+ */
+
+fair_queue_t * fair_queue_create(void (*element_free)(void * element));
+
+/**
+ * \brief Release a fair_queue_t instance and the elements it stores.
+ * \param fair_queue A fair_queue_t instance.
+ */
+
+void fair_queue_free(fair_queue_t * fair_queue);
+
+/**
+ * \brief Set the weight and the class of a producer. Its flow is created
+ *    if needed. By default, a producer has a weight equal to
+ *    FAIR_QUEUE_DEFAULT_WEIGHT and is not prioritary.
+ * \param fair_queue A fair_queue_t instance.
+ * \param key Identifies the producer.
+ * \param weight Maximum number of elements popped per turn (at least 1).
+ * \param is_priority Pass true if this producer must be served before
+ *    the other ones.
+ * \return true iif successful.
+ */
+
+bool fair_queue_set_class(fair_queue_t * fair_queue, const void * key, size_t weight, bool is_priority);
+
+/**
+ * \brief Push an element in the flow of a producer.
+ * \param fair_queue A fair_queue_t instance.
+ * \param key Identifies the producer.
+ * \param element The pushed element.
+ * \return true iif successful.
+ */
+
+bool fair_queue_push_element(fair_queue_t * fair_queue, const void * key, void * element);
+
+/**
+ * \brief Pop the next element according to the deficit round robin.
+ * \param fair_queue A fair_queue_t instance.
+ * \return The popped element, NULL if the queue is empty.
+ */
+
+void * fair_queue_pop_element(fair_queue_t * fair_queue);
+
+/**
+ * \brief Forget a producer, e.g. because it is about to be freed.
+ *    The elements it has pushed are released.
+ * \param fair_queue A fair_queue_t instance.
+ * \param key Identifies the producer.
+ * \return The number of released elements.
+ */
+
+size_t fair_queue_forget_key(fair_queue_t * fair_queue, const void * key);
+
+/**
+ * \brief Retrieve the file descriptor activated as long as a
+ *    fair_queue_t instance is not empty.
+ * \param fair_queue A fair_queue_t instance.
+ * \return The corresponding file descriptor.
+ */
+
+int fair_queue_get_fd(const fair_queue_t * fair_queue);
+
+/**
+ * \brief Retrieve the number of elements stored in a fair_queue_t instance.
+ * \param fair_queue A fair_queue_t instance.
+ * \return The corresponding number of elements.
+ */
+
+size_t fair_queue_get_size(const fair_queue_t * fair_queue);
+
+#endif // LIBPT_FAIR_QUEUE_H
@@ -19,6 +19,7 @@ field_t * field_create(fieldtype_t type, const char * key, const void * value) {
     if (!(field = malloc(sizeof(field_t)))) goto ERR_MALLOC;
     field->key  = key;
     field->type = type;
+    field->is_allocated = true;
 
     if (value) {
         switch (type) {
@@ -51,7 +52,7 @@ ERR_MALLOC:
 
 void field_free(field_t * field)
 {
-    if (field) {
+    if (field && field->is_allocated) {
         switch (field->type) {
             case TYPE_STRING:
                 free(field->value.string);
@@ -114,6 +115,7 @@ field_t * field_create_bits(const char * key, const void * value, size_t offset_
     if (!(field = malloc(sizeof(field_t)))) goto ERR_MALLOC;
     field->key  = key;
     field->type = TYPE_BITS;
+    field->is_allocated = true;
 
     num_bytes = (size_in_bits / 8) + (size_in_bits % 8 ? 1 : 0);
     if (!(field->value.bits.bits = malloc(num_bytes))) goto ERR_MALLOC2;
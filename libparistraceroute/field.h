@@ -121,6 +121,10 @@ typedef struct {
                           * memory is freed if it's a string or
                           * generator, when the field is freed */
     fieldtype_t   type;  /**< Type of data stored in the field */
+    bool          is_allocated; /**< true iif the field has been allocated
+                          * by field_create*() and must be released by
+                          * field_free(), false if it is a scalar field
+                          * built on the stack (see I8, I16, ...) */
 } field_t;
 
 /**
@@ -259,7 +263,8 @@ field_t * field_create(fieldtype_t type, const char * key, const void * value);
 
 /**
  * \brief Delete a field structure
- * \param field Pointer to the field structure to delete
+ * \param field Pointer to the field structure to delete. Nothing is
+ *    done if it has not been allocated by field_create*() (see I8, I16, ...)
  */
 
 void field_free(field_t * field);
@@ -308,67 +313,84 @@ field_t * field_dup(const field_t * field);
 #endif
 
 /**
- * \brief Macro shorthand for field_create_uint8
- * \param x Pointer to a char * key to identify the field
+ * \brief Build a scalar field on the stack. Unlike the fields returned
+ *    by field_create*(), such a field is not allocated: it lives until the
+ *    end of the enclosing block, and field_free() ignores it. It may thus
+ *    be passed to probe_set_field(), probe_set_fields() and so on without
+ *    any heap allocation, but it must not be returned or stored; use
+ *    field_create*() or field_dup() instead.
+ * \param t The field type (e.g. TYPE_UINT8).
+ * \param m The member of value_t storing the value (e.g. int8).
+ * \param x Pointer to a char * key to identify the field. It must
+ *    outlive the field (e.g. a string literal).
  * \param y Value to store in the field
- * \return Structure containing the newly created field
+ * \return The address of the field
  */
 
-#define I8(x, y)  field_create_uint8(x, (uint8_t) y)
+#define FIELD_SCALAR(t, m, x, y) (&(field_t) { .key = (x), .value.m = (y), .type = (t), .is_allocated = false })
 
 /**
- * \brief Macro shorthand for field_create_uint16
+ * \brief Build an 8 bit integer field on the stack (see FIELD_SCALAR)
  * \param x Pointer to a char * key to identify the field
  * \param y Value to store in the field
- * \return Structure containing the newly created field
+ * \return The address of the field
  */
 
-#define I16(x, y) field_create_uint16(x, (uint16_t) y)
+#define I8(x, y)  FIELD_SCALAR(TYPE_UINT8, int8, x, (uint8_t) (y))
 
 /**
- * \brief Macro shorthand for field_create_uint32
+ * \brief Build a 16 bit integer field on the stack (see FIELD_SCALAR)
  * \param x Pointer to a char * key to identify the field
  * \param y Value to store in the field
- * \return Structure containing the newly created field
+ * \return The address of the field
  */
 
-#define I32(x, y) field_create_uint32(x, (uint32_t) y)
+#define I16(x, y) FIELD_SCALAR(TYPE_UINT16, int16, x, (uint16_t) (y))
 
 /**
- * \brief Macro shorthand for field_create_uint64
+ * \brief Build a 32 bit integer field on the stack (see FIELD_SCALAR)
  * \param x Pointer to a char * key to identify the field
  * \param y Value to store in the field
- * \return Structure containing the newly created field
+ * \return The address of the field
  */
 
-#define I64(x, y) field_create_uint64(x, (uint64_t) y)
+#define I32(x, y) FIELD_SCALAR(TYPE_UINT32, int32, x, (uint32_t) (y))
 
 /**
- * \brief Macro shorthand for field_create_uint128
+ * \brief Build a 64 bit integer field on the stack (see FIELD_SCALAR)
  * \param x Pointer to a char * key to identify the field
  * \param y Value to store in the field
- * \return Structure containing the newly created field
+ * \return The address of the field
  */
 
-#define I128(x, y) field_create_uint64(x, (uint128_t) y)
+#define I64(x, y) FIELD_SCALAR(TYPE_UINT64, int64, x, (uint64_t) (y))
 
 /**
- * \brief Macro shorthand for field_create_double
+ * \brief Build a 128 bit integer field on the stack (see FIELD_SCALAR)
+ * \param x Pointer to a char * key to identify the field
+ * \param y Value (uint128_t) to store in the field
+ * \return The address of the field
+ */
+
+#define I128(x, y) FIELD_SCALAR(TYPE_UINT128, int128, x, y)
+
+/**
+ * \brief Build a double field on the stack (see FIELD_SCALAR)
  * \param x Pointer to a char * key to identify the field
  * \param y Value to store in the field
- * \return Structure containing the newly created field
+ * \return The address of the field
  */
 
-#define DOUBLE(x, y) field_create_double(x, (double) y)
+#define DOUBLE(x, y) FIELD_SCALAR(TYPE_DOUBLE, dbl, x, (double) (y))
 
 /**
- * \brief Macro shorthand for field_create_intmax
+ * \brief Build a uintmax_t field on the stack (see FIELD_SCALAR)
  * \param x Pointer to a char * key to identify the field
  * \param y Value to store in the field
- * \return Structure containing the newly created field
+ * \return The address of the field
  */
 
-#define IMAX(x, y) field_create_uintmax(x, (uintmax_t) y)
+#define IMAX(x, y) FIELD_SCALAR(TYPE_UINTMAX, intmax, x, (uintmax_t) (y))
 
 /**
  * \brief Macro shorthand for field_create_string
@@ -105,7 +105,8 @@ bool generator_set_field(generator_t * generator, field_t * field);
 const generator_t * generator_search(const char * name);
 
 /**
- * \brief Register a generator in the library.
+ * \brief Register a generator in the library. Not thread-safe: only call
+ *    it from a constructor (see GENERATOR_REGISTER).
  * \param generator A generator_t instance describing the generator to register.
  */
 
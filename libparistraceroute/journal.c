@@ -0,0 +1,319 @@
+#include "use.h"
+#include "config.h"
+
+#include <stdlib.h>         // malloc, calloc, free
+#include <string.h>         // strcmp, strdup, strtok_r
+#include <unistd.h>         // fdatasync, truncate
+
+#include "journal.h"
+#include "common.h"         // get_timestamp, ELEMENT_FREE
+
+#define JOURNAL_SEPARATORS " \t\n"
+
+//---------------------------------------------------------------------------
+// journal_target_t
+//---------------------------------------------------------------------------
+
+static journal_target_t * journal_target_create(const char * target) {
+    journal_target_t * journal_target;
+
+    if (!(journal_target = malloc(sizeof(journal_target_t)))) goto ERR_MALLOC;
+    if (!(journal_target->target = strdup(target)))          goto ERR_STRDUP;
+    if (!(journal_target->hops = dynarray_create()))         goto ERR_HOPS;
+    journal_target->is_done = false;
+    return journal_target;
+
+ERR_HOPS:
+    free(journal_target->target);
+ERR_STRDUP:
+    free(journal_target);
+ERR_MALLOC:
+    return NULL;
+}
+
+static void journal_target_free(journal_target_t * journal_target) {
+    if (journal_target) {
+        dynarray_free(journal_target->hops, free);
+        free(journal_target->target);
+        free(journal_target);
+    }
+}
+
+/**
+ * \brief Discard the hops recorded for a target from a given TTL.
+ * \param journal_target A journal_target_t instance.
+ * \param first_ttl The first TTL to discard.
+ */
+
+static void journal_target_restart(journal_target_t * journal_target, uint8_t first_ttl) {
+    size_t                i;
+    const journal_hop_t * hop;
+
+    for (i = dynarray_get_size(journal_target->hops); i > 0; i--) {
+        hop = dynarray_get_ith_element(journal_target->hops, i - 1);
+        if (hop->ttl >= first_ttl) {
+            dynarray_del_ith_element(journal_target->hops, i - 1, free);
+        }
+    }
+    journal_target->is_done = false;
+}
+
+//---------------------------------------------------------------------------
+// Loading
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Retrieve a loaded target, and create it if needed.
+ * \param targets The loaded targets.
+ * \param target The target.
+ * \param do_create Pass true to create the target if it is not found.
+ * \return The corresponding journal_target_t instance, NULL if not found.
+ */
+
+static journal_target_t * journal_find_target(const dynarray_t * targets, const char * target, bool do_create) {
+    size_t             i, num_targets = dynarray_get_size(targets);
+    journal_target_t * journal_target;
+
+    // Records related to a target are usually contiguous, so start from the
+    // most recent target.
+    for (i = num_targets; i > 0; i--) {
+        journal_target = dynarray_get_ith_element(targets, i - 1);
+        if (strcmp(journal_target->target, target) == 0) return journal_target;
+    }
+
+    if (!do_create) return NULL;
+    if (!(journal_target = journal_target_create(target))) return NULL;
+    if (!dynarray_push_element((dynarray_t *) targets, journal_target)) {
+        journal_target_free(journal_target);
+        return NULL;
+    }
+    return journal_target;
+}
+
+/**
+ * \brief Parse the outcome of a probe.
+ * \param saveptr The state of strtok_r, pointing after the target.
+ * \param hop The journal_hop_t instance to fill.
+ * \return true iif successful.
+ */
+
+static bool journal_parse_hop(char ** saveptr, journal_hop_t * hop) {
+    char * token[4];
+    int    family;
+    size_t i;
+
+    for (i = 0; i < 4; i++) {
+        if (!(token[i] = strtok_r(NULL, JOURNAL_SEPARATORS, saveptr))) {
+            // A lost probe has neither address nor RTT
+            if (i == 3 && strcmp(token[2], "*") == 0) break;
+            return false;
+        }
+    }
+
+    hop->ttl     = strtoul(token[0], NULL, 10);
+    hop->flow_id = strtoul(token[1], NULL, 10);
+    hop->is_star = (strcmp(token[2], "*") == 0);
+    hop->rtt     = 0;
+    memset(&hop->address, 0, sizeof(address_t));
+
+    if (!hop->is_star) {
+        if (!address_guess_family(token[2], &family))                return false;
+        if (address_from_string(family, token[2], &hop->address) != 0) return false;
+        hop->rtt = strtod(token[3], NULL);
+    }
+    return true;
+}
+
+/**
+ * \brief Load the records of a journal file.
+ * \param file The journal file, opened for reading.
+ * \param targets The dynarray_t instance where the loaded targets are stored.
+ * \param poffset Pointer to the size of the complete lines (in bytes).
+ *    It is lower than the size of the file if the last line is truncated.
+ * \return true iif successful.
+ */
+
+static bool journal_load(FILE * file, dynarray_t * targets, off_t * poffset) {
+    char             * line = NULL, * type, * target, * saveptr;
+    size_t             size = 0;
+    ssize_t            len;
+    journal_target_t * journal_target;
+    journal_hop_t      hop, * phop;
+    bool               ret = true;
+
+    while (ret && (len = getline(&line, &size, file)) != -1) {
+        // A truncated line has been interrupted by a crash
+        if (len == 0 || line[len - 1] != '\n') break;
+        *poffset += len;
+
+        if (!(type = strtok_r(line, JOURNAL_SEPARATORS, &saveptr)))    continue;
+        if (!(target = strtok_r(NULL, JOURNAL_SEPARATORS, &saveptr))) continue;
+        if (!(journal_target = journal_find_target(targets, target, true))) {
+            ret = false;
+            break;
+        }
+
+        switch (type[0]) {
+            case 'T':
+                type = strtok_r(NULL, JOURNAL_SEPARATORS, &saveptr);
+                journal_target_restart(journal_target, type ? strtoul(type, NULL, 10) : 0);
+                break;
+            case 'H':
+                if (!journal_parse_hop(&saveptr, &hop)) {
+                    fprintf(stderr, "journal_load: ignoring invalid hop (%s)\n", target);
+                    break;
+                }
+                if (!(phop = malloc(sizeof(journal_hop_t)))) {
+                    ret = false;
+                    break;
+                }
+                *phop = hop;
+                if (!dynarray_push_element(journal_target->hops, phop)) {
+                    free(phop);
+                    ret = false;
+                }
+                break;
+            case 'D':
+                journal_target->is_done = true;
+                break;
+            default:
+                fprintf(stderr, "journal_load: ignoring unknown record '%s'\n", type);
+                break;
+        }
+    }
+
+    free(line);
+    return ret;
+}
+
+//---------------------------------------------------------------------------
+// journal_t
+//---------------------------------------------------------------------------
+
+journal_t * journal_open(const char * path, bool do_resume, double sync_interval) {
+    journal_t * journal;
+    FILE      * file;
+    off_t       offset = 0;
+    bool        is_loaded;
+
+    if (!(journal = malloc(sizeof(journal_t))))     goto ERR_MALLOC;
+    if (!(journal->targets = dynarray_create()))    goto ERR_TARGETS;
+
+    // A journal which does not exist yet is simply started
+    if (do_resume && (file = fopen(path, "r"))) {
+        is_loaded = journal_load(file, journal->targets, &offset);
+        fclose(file);
+        if (!is_loaded) goto ERR_LOAD;
+
+        // Drop the truncated line (if any), so that the next record
+        // starts on a new line.
+        if (truncate(path, offset) != 0) {
+            perror(path);
+            goto ERR_TRUNCATE;
+        }
+    }
+
+    if (!(journal->file = fopen(path, do_resume ? "a" : "w"))) {
+        perror(path);
+        goto ERR_FOPEN;
+    }
+
+    // Do not keep the last records in the stdio buffer while the campaign
+    // is waiting for its probes: they would be lost if the process crashes.
+    setvbuf(journal->file, NULL, _IOLBF, 0);
+    journal->sync_interval = sync_interval;
+    journal->last_sync = get_timestamp();
+    return journal;
+
+ERR_FOPEN:
+ERR_TRUNCATE:
+ERR_LOAD:
+    dynarray_free(journal->targets, (ELEMENT_FREE) journal_target_free);
+ERR_TARGETS:
+    free(journal);
+ERR_MALLOC:
+    return NULL;
+}
+
+journal_t * journal_read(const char * path) {
+    journal_t * journal;
+    FILE      * file;
+    off_t       offset = 0;
+
+    if (!(file = fopen(path, "r"))) {
+        perror(path);
+        goto ERR_FOPEN;
+    }
+    if (!(journal = calloc(1, sizeof(journal_t))))                   goto ERR_CALLOC;
+    if (!(journal->targets = dynarray_create()))                     goto ERR_TARGETS;
+    if (!journal_load(file, journal->targets, &offset))              goto ERR_LOAD;
+    fclose(file);
+    return journal;
+
+ERR_LOAD:
+    dynarray_free(journal->targets, (ELEMENT_FREE) journal_target_free);
+ERR_TARGETS:
+    free(journal);
+ERR_CALLOC:
+    fclose(file);
+ERR_FOPEN:
+    return NULL;
+}
+
+void journal_close(journal_t * journal) {
+    if (journal) {
+        if (journal->file) {
+            journal_sync(journal);
+            fclose(journal->file);
+        }
+        dynarray_free(journal->targets, (ELEMENT_FREE) journal_target_free);
+        free(journal);
+    }
+}
+
+const journal_target_t * journal_get_target(const journal_t * journal, const char * target) {
+    return journal_find_target(journal->targets, target, false);
+}
+
+bool journal_sync(journal_t * journal) {
+    journal->last_sync = get_timestamp();
+    return fflush(journal->file) == 0
+        && fdatasync(fileno(journal->file)) == 0;
+}
+
+/**
+ * \brief Sync a journal if its last sync is older than its sync interval.
+ * \param journal A journal_t instance.
+ * \param ret The result of the write which precedes this call.
+ * \return true iif ret is true and the sync (if any) is successful.
+ */
+
+static bool journal_checkpoint(journal_t * journal, bool ret) {
+    if (ret && get_timestamp() - journal->last_sync >= journal->sync_interval) {
+        ret = journal_sync(journal);
+    }
+    return ret;
+}
+
+bool journal_start_target(journal_t * journal, const char * target, uint8_t first_ttl) {
+    return journal_checkpoint(journal, fprintf(journal->file, "T %s %hhu\n", target, first_ttl) > 0);
+}
+
+bool journal_add_hop(journal_t * journal, const char * target, const journal_hop_t * hop) {
+    FILE * file = journal->file;
+    bool   ret;
+
+    ret = fprintf(file, "H %s %hhu %hu ", target, hop->ttl, hop->flow_id) > 0;
+    if (hop->is_star) {
+        ret &= fputs("*\n", file) != EOF;
+    } else {
+        address_fprintf(file, &hop->address);
+        ret &= fprintf(file, " %.3lf\n", hop->rtt) > 0;
+    }
+    return journal_checkpoint(journal, ret);
+}
+
+bool journal_finish_target(journal_t * journal, const char * target) {
+    return fprintf(journal->file, "D %s\n", target) > 0
+        && journal_sync(journal);
+}
@@ -0,0 +1,160 @@
+#ifndef LIBPT_JOURNAL_H
+#define LIBPT_JOURNAL_H
+
+/**
+ * \file journal.h
+ * \brief Append-only journal checkpointing the progress of a campaign.
+ *
+ * A campaign runs an algorithm (traceroute, mda...) toward each target of
+ * a list. Its results only live in memory, so a campaign killed after
+ * hours of probing would have to start over. A journal_t appends a line
+ * to a file whenever a target is started, a hop is discovered, or a
+ * target is completed:
+ *
+ *   T <target> <first_ttl>                           Target (re)started from <first_ttl>
+ *   H <target> <ttl> <flow_id> <address> <rtt>       Probe answered by <address> after <rtt> ms
+ *   H <target> <ttl> <flow_id> *                     Probe lost
+ *   D <target>                                       Target completed
+ *
+ * The file is line buffered, so each record reaches the kernel as soon as
+ * it is written and survives a crash of the process, even if the campaign
+ * then waits for a while (e.g. for the last hops of a slow target). The
+ * file is synced on disk whenever a target is completed, when the journal
+ * is closed, and otherwise at most once every sync_interval seconds, so
+ * checkpointing costs almost nothing. After a crash of the system, at most
+ * the records of the current target are lost, and a truncated last line
+ * is ignored.
+ *
+ * A journal opened in resume mode first loads the existing records (see
+ * journal_get_target), so that a campaign can skip its completed targets
+ * and resume the partial ones, and then appends the new records. A
+ * journal can also be loaded read-only (see journal_read), e.g. to verify
+ * the paths discovered by a previous campaign (see algorithms/retrace.h).
+ */
+
+#include <stdbool.h>    // bool
+#include <stdint.h>     // uint*_t
+#include <stdio.h>      // FILE
+
+#include "address.h"    // address_t
+#include "dynarray.h"   // dynarray_t
+
+#define JOURNAL_DEFAULT_SYNC_INTERVAL 1.0 /**< Default delay between two syncs of a journal (in seconds) */
+
+/**
+ * \struct journal_hop_t
+ * \brief The outcome of a probe sent toward a target.
+ */
+
+typedef struct {
+    uint8_t   ttl;      /**< TTL of the probe */
+    uint16_t  flow_id;  /**< Flow identifier of the probe */
+    bool      is_star;  /**< true iif the probe has been lost */
+    address_t address;  /**< Address of the replying interface (meaningless if is_star) */
+    double    rtt;      /**< Round-trip time (in milliseconds, meaningless if is_star) */
+} journal_hop_t;
+
+/**
+ * \struct journal_target_t
+ * \brief What a journal has recorded about a target.
+ */
+
+typedef struct {
+    char       * target;  /**< The target, as passed by the user */
+    bool         is_done; /**< true iif the target has been completed */
+    dynarray_t * hops;    /**< Outcome of its probes (journal_hop_t instances), in order of arrival */
+} journal_target_t;
+
+/**
+ * \struct journal_t
+ * \brief An append-only journal.
+ */
+
+typedef struct {
+    FILE       * file;          /**< The journal file, opened in append mode (NULL if read-only) */
+    double       sync_interval; /**< Minimum delay between two syncs (in seconds) */
+    double       last_sync;     /**< Timestamp of the last sync */
+    dynarray_t * targets;       /**< Targets loaded in resume mode (journal_target_t instances) */
+} journal_t;
+
+/**
+ * \brief Open a journal.
+ * \param path Path of the journal file.
+ * \param do_resume Pass true to load the records of an existing journal
+ *    and to append the new ones after them, false to start a new journal.
+ * \param sync_interval Minimum delay between two syncs (in seconds).
+ * \return The newly created instance, NULL in case of failure.
+ */
+
+journal_t * journal_open(const char * path, bool do_resume, double sync_interval);
+
+/**
+ * \brief Load a journal without appending to it, e.g. to compare a new
+ *    campaign with a previous one. Its records are retrieved by
+ *    journal_get_target.
+ * \param path Path of the journal file.
+ * \return The newly created instance, NULL in case of failure. It must
+ *    be released by journal_close.
+ */
+
+journal_t * journal_read(const char * path);
+
+/**
+ * \brief Sync and close a journal.
+ * \param journal A journal_t instance.
+ */
+
+void journal_close(journal_t * journal);
+
+/**
+ * \brief Retrieve what a journal opened in resume mode has recorded
+ *    about a target.
+ * \param journal A journal_t instance.
+ * \param target The target.
+ * \return The corresponding journal_target_t instance, NULL if the
+ *    target has never been started.
+ */
+
+const journal_target_t * journal_get_target(const journal_t * journal, const char * target);
+
+/**
+ * \brief Record that a target has been started. When the journal is
+ *    loaded, the hops previously recorded for this target from this TTL
+ *    are discarded, since they are about to be discovered again.
+ * \param journal A journal_t instance.
+ * \param target The target.
+ * \param first_ttl The first TTL probed (e.g. 1 if the target is started
+ *    from scratch).
+ * \return true iif successful.
+ */
+
+bool journal_start_target(journal_t * journal, const char * target, uint8_t first_ttl);
+
+/**
+ * \brief Record the outcome of a probe sent toward a target.
+ * \param journal A journal_t instance.
+ * \param target The target.
+ * \param hop The outcome of the probe.
+ * \return true iif successful.
+ */
+
+bool journal_add_hop(journal_t * journal, const char * target, const journal_hop_t * hop);
+
+/**
+ * \brief Record that a target has been completed, and sync the journal.
+ * \param journal A journal_t instance.
+ * \param target The target.
+ * \return true iif successful.
+ */
+
+bool journal_finish_target(journal_t * journal, const char * target);
+
+/**
+ * \brief Flush the pending records and sync the journal file.
+ * \param journal A journal_t instance.
+ * \return true iif successful.
+ */
+
+bool journal_sync(journal_t * journal);
+
+#endif // LIBPT_JOURNAL_H
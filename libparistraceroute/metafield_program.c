@@ -0,0 +1,133 @@
+#include "config.h"
+#include "use.h"               // USE_*
+
+#include <string.h>            // memset
+
+#include "metafield_program.h"
+
+void metafield_program_clear(metafield_program_t * program) {
+    memset(program, 0, sizeof(metafield_program_t));
+}
+
+bool metafield_program_push_op(metafield_program_t * program, size_t offset_in_bits, size_t num_bits) {
+    size_t           i;
+    metafield_op_t * op;
+
+    if (num_bits == 0
+    ||  program->num_ops == METAFIELD_PROGRAM_MAX_OPS
+    ||  program->num_bits + num_bits > 8 * sizeof(uintmax_t)
+    ) {
+        return false;
+    }
+
+    // Previous ranges become more significant
+    for (i = 0; i < program->num_ops; i++) {
+        program->ops[i].shift += num_bits;
+    }
+
+    op = &program->ops[program->num_ops++];
+    op->offset_in_bits = offset_in_bits;
+    op->num_bits       = num_bits;
+    op->shift          = 0;
+
+    program->num_bits += num_bits;
+    if (program->min_packet_size < (offset_in_bits + num_bits + 7) / 8) {
+        program->min_packet_size = (offset_in_bits + num_bits + 7) / 8;
+    }
+    return true;
+}
+
+bool metafield_program_push_field(
+    metafield_program_t    * program,
+    const uint8_t          * packet_bytes,
+    const layer_t          * layer,
+    const protocol_field_t * protocol_field
+) {
+    size_t offset_in_bits;
+
+    // Fields having dedicated accessors are not plain bit ranges
+    if (protocol_field->get || protocol_field->set) return false;
+
+    offset_in_bits = 8 * (layer_get_segment(layer) - packet_bytes + protocol_field->offset);
+#ifdef USE_BITS
+    offset_in_bits += protocol_field->offset_in_bits;
+#endif
+
+    return metafield_program_push_op(
+        program,
+        offset_in_bits,
+        protocol_field_get_size_in_bits(protocol_field)
+    );
+}
+
+/**
+ * \brief Read a bit range from a packet (network byte order).
+ * \param op The bit range.
+ * \param bytes The beginning of the packet.
+ * \return The corresponding value.
+ */
+
+static inline uintmax_t metafield_op_read(const metafield_op_t * op, const uint8_t * bytes) {
+    const uint8_t * byte      = bytes + op->offset_in_bits / 8;
+    size_t          skip      = op->offset_in_bits % 8,
+                    remaining = op->num_bits,
+                    n;
+    uintmax_t       value = 0;
+
+    for (; remaining; remaining -= n, skip = 0, byte++) {
+        n = 8 - skip < remaining ? 8 - skip : remaining;
+        value = (value << n) | ((*byte >> (8 - skip - n)) & ((1u << n) - 1));
+    }
+    return value;
+}
+
+/**
+ * \brief Write a bit range in a packet (network byte order).
+ * \param op The bit range.
+ * \param bytes The beginning of the packet.
+ * \param value The value to write. Only its op->num_bits
+ *    least significant bits are considered.
+ */
+
+static inline void metafield_op_write(const metafield_op_t * op, uint8_t * bytes, uintmax_t value) {
+    uint8_t * byte      = bytes + op->offset_in_bits / 8;
+    size_t    skip      = op->offset_in_bits % 8,
+              remaining = op->num_bits,
+              n, shift;
+    uint8_t   mask;
+
+    for (; remaining; remaining -= n, skip = 0, byte++) {
+        n = 8 - skip < remaining ? 8 - skip : remaining;
+        shift = 8 - skip - n;
+        mask = ((1u << n) - 1) << shift;
+        *byte = (*byte & ~mask) | (((value >> (remaining - n)) << shift) & mask);
+    }
+}
+
+bool metafield_program_read(const metafield_program_t * program, const uint8_t * bytes, size_t size, uintmax_t * value) {
+    size_t    i;
+    uintmax_t ret = 0;
+
+    if (!program->is_compiled || !program->num_ops || size < program->min_packet_size) {
+        return false;
+    }
+
+    for (i = 0; i < program->num_ops; i++) {
+        ret |= metafield_op_read(&program->ops[i], bytes) << program->ops[i].shift;
+    }
+    *value = ret;
+    return true;
+}
+
+bool metafield_program_write(const metafield_program_t * program, uint8_t * bytes, size_t size, uintmax_t value) {
+    size_t i;
+
+    if (!program->is_compiled || !program->num_ops || size < program->min_packet_size) {
+        return false;
+    }
+
+    for (i = 0; i < program->num_ops; i++) {
+        metafield_op_write(&program->ops[i], bytes, value >> program->ops[i].shift);
+    }
+    return true;
+}
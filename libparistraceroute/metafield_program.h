@@ -0,0 +1,115 @@
+#ifndef LIBPT_METAFIELD_PROGRAM_H
+#define LIBPT_METAFIELD_PROGRAM_H
+
+/**
+ * \file metafield_program.h
+ * \brief A metafield_program_t is the compiled form of a metafield for a given
+ *   probe layout (i.e. a given sequence of layers).
+ *
+ * Resolving a metafield (see metafield.h) requires to walk through the layers
+ * of a probe and to look up each "protocol.field" name. Since the offset of
+ * these fields only depends on the layout of the probe, this lookup can be
+ * done once, and summarized by a flat list of bit ranges. Reading (resp.
+ * writing) the metafield then consists in gathering (resp. scattering) these
+ * bit ranges from (resp. to) the packet.
+ *
+ * A program must be recompiled whenever the layers of the probe it has been
+ * compiled for are altered.
+ */
+
+#include <stdbool.h>        // bool
+#include <stddef.h>         // size_t
+#include <stdint.h>         // uint*_t
+
+#include "layer.h"          // layer_t
+#include "protocol_field.h" // protocol_field_t
+
+// Maximum number of bit ranges involved in a metafield_program_t
+#define METAFIELD_PROGRAM_MAX_OPS 8
+
+/**
+ * \struct metafield_op_t
+ * \brief A contiguous bit range of a packet involved in a metafield.
+ */
+
+typedef struct {
+    size_t  offset_in_bits; /**< Offset (in bits) from the beginning of the packet */
+    uint8_t num_bits;       /**< Number of bits of this range */
+    uint8_t shift;          /**< Position of the least significant bit of this range in the metafield value */
+} metafield_op_t;
+
+/**
+ * \struct metafield_program_t
+ * \brief A compiled metafield.
+ */
+
+typedef struct {
+    metafield_op_t ops[METAFIELD_PROGRAM_MAX_OPS]; /**< Bit ranges, from the most significant to the least significant one */
+    size_t         num_ops;                        /**< Number of bit ranges stored in ops */
+    size_t         num_bits;                       /**< Size (in bits) of the metafield value */
+    size_t         min_packet_size;                /**< Minimal packet size (in bytes) required to run this program */
+    bool           is_compiled;                    /**< Set to true once the program has been compiled */
+} metafield_program_t;
+
+/**
+ * \brief Reset a metafield_program_t instance. The program is then
+ *    considered as not compiled.
+ * \param program A metafield_program_t instance.
+ */
+
+void metafield_program_clear(metafield_program_t * program);
+
+/**
+ * \brief Append a bit range to a metafield_program_t instance. The
+ *    bits previously pushed become more significant.
+ * \param program A metafield_program_t instance.
+ * \param offset_in_bits The offset (in bits) of the range in the packet.
+ * \param num_bits The size (in bits) of the range.
+ * \return true iif successful (the value of a metafield can't exceed
+ *    the size of an uintmax_t).
+ */
+
+bool metafield_program_push_op(metafield_program_t * program, size_t offset_in_bits, size_t num_bits);
+
+/**
+ * \brief Append to a metafield_program_t instance the bit range
+ *    corresponding to a field of a layer.
+ * \param program A metafield_program_t instance.
+ * \param packet_bytes The beginning of the packet containing the layer.
+ * \param layer The layer carrying the field.
+ * \param protocol_field The field.
+ * \return true iif successful.
+ */
+
+bool metafield_program_push_field(
+    metafield_program_t    * program,
+    const uint8_t          * packet_bytes,
+    const layer_t          * layer,
+    const protocol_field_t * protocol_field
+);
+
+/**
+ * \brief Read a metafield value from a packet.
+ * \param program A compiled metafield_program_t instance.
+ * \param bytes The beginning of the packet.
+ * \param size The size of the packet (in bytes).
+ * \param value The address where the value will be written.
+ * \return true iif successful.
+ */
+
+bool metafield_program_read(const metafield_program_t * program, const uint8_t * bytes, size_t size, uintmax_t * value);
+
+/**
+ * \brief Write a metafield value in a packet. Checksums are
+ *    not updated.
+ * \param program A compiled metafield_program_t instance.
+ * \param bytes The beginning of the packet.
+ * \param size The size of the packet (in bytes).
+ * \param value The value to write. Only its program->num_bits
+ *    least significant bits are considered.
+ * \return true iif successful.
+ */
+
+bool metafield_program_write(const metafield_program_t * program, uint8_t * bytes, size_t size, uintmax_t value);
+
+#endif // LIBPT_METAFIELD_PROGRAM_H
@@ -0,0 +1,144 @@
+#include "config.h"
+
+#include <string.h>     // memset
+
+#include "metrics.h"
+
+static const char * metrics_counter_names[METRICS_NUM_COUNTERS] = {
+    "probes_sent",
+    "replies_matched",
+    "replies_unmatched",
+    "replies_late",
+    "replies_duplicate",
+    "probes_expired",
+    "probes_retransmitted",
+    "send_errors",
+    "sniffer_truncated"
+};
+
+static const char * metrics_histogram_names[METRICS_NUM_HISTOGRAMS] = {
+    "sendq_wait",
+    "dispatch_latency",
+    "rtt"
+};
+
+void metrics_clear(metrics_t * metrics) {
+    memset(metrics, 0, sizeof(metrics_t));
+}
+
+void metrics_increment(metrics_t * metrics, metrics_counter_t counter) {
+    metrics->counters[counter]++;
+}
+
+/**
+ * \brief Compute the bucket in which a duration is stored.
+ * \param duration The duration (in seconds).
+ * \return The index of the bucket.
+ */
+
+static inline size_t histogram_get_bucket(double duration) {
+    uint64_t us;
+    size_t   i;
+
+    if (duration < 1e-6) return 0;
+    us = (uint64_t) (duration * 1e6);
+    for (i = 1; us > 1 && i < HISTOGRAM_NUM_BUCKETS - 1; i++) {
+        us >>= 1;
+    }
+    return i;
+}
+
+void metrics_observe(metrics_t * metrics, metrics_histogram_t histogram, double duration) {
+    histogram_t * h = &metrics->histograms[histogram];
+
+    if (duration < 0) duration = 0;
+    h->buckets[histogram_get_bucket(duration)]++;
+    h->count++;
+    h->sum += duration;
+    if (duration > h->max) h->max = duration;
+}
+
+uint64_t metrics_get_counter(const metrics_t * metrics, metrics_counter_t counter) {
+    return metrics->counters[counter];
+}
+
+const histogram_t * metrics_get_histogram(const metrics_t * metrics, metrics_histogram_t histogram) {
+    return &metrics->histograms[histogram];
+}
+
+const char * metrics_counter_get_name(metrics_counter_t counter) {
+    return metrics_counter_names[counter];
+}
+
+const char * metrics_histogram_get_name(metrics_histogram_t histogram) {
+    return metrics_histogram_names[histogram];
+}
+
+double histogram_get_bucket_upper_bound(size_t i) {
+    return (double) ((uint64_t) 1 << i) * 1e-6;
+}
+
+double histogram_get_quantile(const histogram_t * histogram, double q) {
+    uint64_t rank, seen = 0;
+    size_t   i;
+
+    if (!histogram->count) return 0;
+
+    rank = (uint64_t) (q * histogram->count);
+    if (rank >= histogram->count) rank = histogram->count - 1;
+
+    for (i = 0; i < HISTOGRAM_NUM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen > rank) break;
+    }
+    return i == HISTOGRAM_NUM_BUCKETS - 1 ? histogram->max : histogram_get_bucket_upper_bound(i);
+}
+
+void metrics_fprintf(FILE * out, const metrics_t * metrics) {
+    size_t              i;
+    const histogram_t * h;
+
+    for (i = 0; i < METRICS_NUM_COUNTERS; i++) {
+        fprintf(out, "%-20s %ju\n", metrics_counter_names[i], (uintmax_t) metrics->counters[i]);
+    }
+
+    for (i = 0; i < METRICS_NUM_HISTOGRAMS; i++) {
+        h = &metrics->histograms[i];
+        fprintf(out, "%-20s count=%ju avg=%.3lfms p50<%.3lfms p99<%.3lfms max=%.3lfms\n",
+            metrics_histogram_names[i],
+            (uintmax_t) h->count,
+            h->count ? 1000 * h->sum / h->count : 0,
+            1000 * histogram_get_quantile(h, 0.5),
+            1000 * histogram_get_quantile(h, 0.99),
+            1000 * h->max
+        );
+    }
+}
+
+void metrics_fprintf_prometheus(FILE * out, const metrics_t * metrics, const char * prefix) {
+    size_t              i, j;
+    uint64_t            count;
+    const histogram_t * h;
+
+    for (i = 0; i < METRICS_NUM_COUNTERS; i++) {
+        fprintf(out, "# TYPE %s_%s_total counter\n", prefix, metrics_counter_names[i]);
+        fprintf(out, "%s_%s_total %ju\n", prefix, metrics_counter_names[i], (uintmax_t) metrics->counters[i]);
+    }
+
+    for (i = 0; i < METRICS_NUM_HISTOGRAMS; i++) {
+        h = &metrics->histograms[i];
+        fprintf(out, "# TYPE %s_%s_seconds histogram\n", prefix, metrics_histogram_names[i]);
+
+        // Prometheus buckets are cumulative. The last bucket is unbounded.
+        for (j = 0, count = 0; j < HISTOGRAM_NUM_BUCKETS - 1; j++) {
+            count += h->buckets[j];
+            fprintf(out, "%s_%s_seconds_bucket{le=\"%g\"} %ju\n",
+                prefix, metrics_histogram_names[i],
+                histogram_get_bucket_upper_bound(j), (uintmax_t) count
+            );
+        }
+        fprintf(out, "%s_%s_seconds_bucket{le=\"+Inf\"} %ju\n", prefix, metrics_histogram_names[i], (uintmax_t) h->count);
+        fprintf(out, "%s_%s_seconds_sum %.9f\n",   prefix, metrics_histogram_names[i], h->sum);
+        fprintf(out, "%s_%s_seconds_count %ju\n",  prefix, metrics_histogram_names[i], (uintmax_t) h->count);
+    }
+}
@@ -0,0 +1,172 @@
+#ifndef LIBPT_METRICS_H
+#define LIBPT_METRICS_H
+
+/**
+ * \file metrics.h
+ * \brief Counters and latency histograms related to the hot path of a
+ *    network layer (see network_t) and of its pt_loop_t.
+ *
+ * A metrics_t instance is owned by a network_t, and thus only updated by
+ * the thread running the corresponding pt_loop_t: no synchronization is
+ * required. Histograms have logarithmic buckets: bucket 0 counts the values
+ * lower than 1us, bucket i (i > 0) the values in [2^(i-1), 2^i) us.
+ *
+ * The metrics of a pt_loop_t can be retrieved thanks to pt_loop_get_metrics()
+ * and are dumped on stderr whenever the process receives SIGUSR1. They can
+ * also be exported in the Prometheus text format (see pt_loop_listen_metrics).
+ */
+
+#include <stdint.h>  // uint64_t
+#include <stdio.h>   // FILE
+
+#define HISTOGRAM_NUM_BUCKETS 32
+
+/**
+ * \enum metrics_counter_t
+ * \brief Counters stored in a metrics_t instance.
+ */
+
+typedef enum {
+    METRICS_PROBES_SENT,       /**< Probes sent */
+    METRICS_REPLIES_MATCHED,   /**< Replies matching a flying probe */
+    METRICS_REPLIES_UNMATCHED, /**< Replies discarded since they match no flying or archived probe */
+    METRICS_REPLIES_LATE,      /**< Replies to probes which have expired (PROBE_LATE_REPLY) */
+    METRICS_REPLIES_DUPLICATE, /**< Replies to probes already answered (PROBE_DUPLICATE) */
+    METRICS_PROBES_EXPIRED,    /**< Probes which have not been answered in time */
+    METRICS_PROBES_RETRANSMITTED, /**< Probes retransmitted by the network layer (see --retries) */
+    METRICS_SEND_ERRORS,       /**< Probes which could not be sent */
+    METRICS_SNIFFER_TRUNCATED, /**< Packets truncated by the sniffer */
+    METRICS_NUM_COUNTERS
+} metrics_counter_t;
+
+/**
+ * \enum metrics_histogram_t
+ * \brief Histograms stored in a metrics_t instance.
+ */
+
+typedef enum {
+    METRICS_SENDQ_WAIT,        /**< Time spent by a probe in the sendq */
+    METRICS_DISPATCH_LATENCY,  /**< Time between the reception of a reply and its dispatch to the algorithm */
+    METRICS_RTT,               /**< Round-trip time of the matched replies */
+    METRICS_NUM_HISTOGRAMS
+} metrics_histogram_t;
+
+/**
+ * \struct histogram_t
+ * \brief A histogram of durations.
+ */
+
+typedef struct {
+    uint64_t buckets[HISTOGRAM_NUM_BUCKETS]; /**< Number of values stored in each bucket */
+    uint64_t count;                          /**< Number of values */
+    double   sum;                            /**< Sum of the values (in seconds) */
+    double   max;                            /**< Highest value (in seconds) */
+} histogram_t;
+
+/**
+ * \struct metrics_t
+ * \brief Counters and histograms.
+ */
+
+typedef struct {
+    uint64_t    counters[METRICS_NUM_COUNTERS];     /**< Counters, indexed by metrics_counter_t */
+    histogram_t histograms[METRICS_NUM_HISTOGRAMS]; /**< Histograms, indexed by metrics_histogram_t */
+} metrics_t;
+
+/**
+ * \brief Reset every counter and histogram of a metrics_t instance.
+ * \param metrics A metrics_t instance.
+ */
+
+void metrics_clear(metrics_t * metrics);
+
+/**
+ * \brief Increment a counter.
+ * \param metrics A metrics_t instance.
+ * \param counter The counter.
+ */
+
+void metrics_increment(metrics_t * metrics, metrics_counter_t counter);
+
+/**
+ * \brief Store a duration in a histogram.
+ * \param metrics A metrics_t instance.
+ * \param histogram The histogram.
+ * \param duration The duration (in seconds). Negative values are
+ *    considered as 0.
+ */
+
+void metrics_observe(metrics_t * metrics, metrics_histogram_t histogram, double duration);
+
+/**
+ * \brief Retrieve the value of a counter.
+ * \param metrics A metrics_t instance.
+ * \param counter The counter.
+ * \return The value of the counter.
+ */
+
+uint64_t metrics_get_counter(const metrics_t * metrics, metrics_counter_t counter);
+
+/**
+ * \brief Retrieve a histogram.
+ * \param metrics A metrics_t instance.
+ * \param histogram The histogram.
+ * \return The corresponding histogram_t instance.
+ */
+
+const histogram_t * metrics_get_histogram(const metrics_t * metrics, metrics_histogram_t histogram);
+
+/**
+ * \brief Retrieve the name of a counter (e.g. "probes_sent").
+ * \param counter The counter.
+ * \return The corresponding name.
+ */
+
+const char * metrics_counter_get_name(metrics_counter_t counter);
+
+/**
+ * \brief Retrieve the name of a histogram (e.g. "rtt").
+ * \param histogram The histogram.
+ * \return The corresponding name.
+ */
+
+const char * metrics_histogram_get_name(metrics_histogram_t histogram);
+
+/**
+ * \brief Retrieve the upper bound of a bucket.
+ * \param i The index of the bucket.
+ * \return The upper bound (in seconds) of the bucket.
+ */
+
+double histogram_get_bucket_upper_bound(size_t i);
+
+/**
+ * \brief Estimate a quantile of a histogram.
+ * \param histogram A histogram_t instance.
+ * \param q The quantile (between 0 and 1).
+ * \return The upper bound (in seconds) of the bucket containing the
+ *    quantile, 0 if the histogram is empty.
+ */
+
+double histogram_get_quantile(const histogram_t * histogram, double q);
+
+/**
+ * \brief Print the counters and a summary of the histograms.
+ * \param out The output stream.
+ * \param metrics A metrics_t instance.
+ */
+
+void metrics_fprintf(FILE * out, const metrics_t * metrics);
+
+/**
+ * \brief Print the counters and the histograms in the Prometheus text
+ *    exposition format. Each metric is named "<prefix>_<name>" (counters
+ *    are suffixed by "_total", and histograms by "_seconds").
+ * \param out The output stream.
+ * \param metrics A metrics_t instance.
+ * \param prefix The prefix of the metric names (e.g. "paris_traceroute").
+ */
+
+void metrics_fprintf_prometheus(FILE * out, const metrics_t * metrics, const char * prefix);
+
+#endif // LIBPT_METRICS_H
@@ -2,13 +2,18 @@
 
 #include <stdlib.h>         // malloc ...
 #include <string.h>         // memset
+#include <errno.h>          // errno, EAGAIN
 #include <stdio.h>          // fprintf
 #include <stdbool.h>        // bool
 #include <time.h>           // time_t
 #include <unistd.h>         // close
 #include "os/sys/timerfd.h" // timerfd_create, timerfd_settime
 #include <arpa/inet.h>      // htons
+#include <netinet/in.h>     // IPPROTO_TCP, IPPROTO_UDP
+#include "os/netinet/ip_icmp.h" // ICMP_ECHOREPLY
+#include "os/netinet/icmp6.h"   // ICMP6_ECHO_REPLY
 #include <limits.h>         // INT_MAX
+#include <math.h>           // exp
 
 #include "protocol.h"       // struct probe_s
 #include "network.h"
@@ -27,11 +32,30 @@
 // Network options
 //---------------------------------------------------------------------------
 
-static double timeout[3] = OPTIONS_NETWORK_WAIT;
+static double          timeout[3] = OPTIONS_NETWORK_WAIT;
+static bool            use_dgram  = false;
+static bool            use_uring  = false;
+static int             retries[3] = OPTIONS_NETWORK_RETRIES;
+static int             sendq_size[3] = OPTIONS_NETWORK_SENDQ_SIZE;
+static int             max_dgram_sockets[3] = OPTIONS_NETWORK_MAX_DGRAM_SOCKETS;
+static struct opt_str  sources    = {NULL, 0};
+
+static const char * source_policy_names[] = {
+    "flow", // default value
+    "round-robin",
+    NULL
+};
 
 static option_t network_options[] = {
-    // action              short long          metavar         help    variable
-    {opt_store_double_lim, "w",  "--wait",     "TIMEOUT",      HELP_w, timeout},
+    // action              short      long              metavar         help                variable
+    {opt_store_double_lim, "w",       "--wait",         "TIMEOUT",      HELP_w,             timeout},
+    {opt_store_1,          OPT_NO_SF, "--dgram",        OPT_NO_METAVAR, HELP_dgram,         &use_dgram},
+    {opt_store_int_lim,    OPT_NO_SF, "--max-dgram-sockets", "NUM_SOCKETS", HELP_max_dgram_sockets, max_dgram_sockets},
+    {opt_store_1,          OPT_NO_SF, "--io-uring",     OPT_NO_METAVAR, HELP_io_uring,      &use_uring},
+    {opt_store_int_lim,    OPT_NO_SF, "--retries",      "NUM_RETRIES",  HELP_retries,       retries},
+    {opt_store_int_lim,    OPT_NO_SF, "--sendq-size",   "NUM_PROBES",   HELP_sendq_size,    sendq_size},
+    {opt_store_str,        OPT_NO_SF, "--sources",      "SOURCES",      HELP_sources,       &sources},
+    {opt_store_choice,     OPT_NO_SF, "--source-policy", "POLICY",      HELP_source_policy, source_policy_names},
     END_OPT_SPECS
 };
 
@@ -50,6 +74,9 @@ void network_set_is_verbose(network_t * network, bool verbose) {
 void options_network_init(network_t * network, bool verbose) {
     network_set_is_verbose(network, verbose);
     network_set_timeout(network, options_network_get_timeout());
+    network_set_max_retries(network, retries[0]);
+    network_set_sendq_size(network, sendq_size[0]);
+    if (network->dgrampool) dgrampool_set_max_sockets(network->dgrampool, max_dgram_sockets[0]);
 }
 
 //---------------------------------------------------------------------------
@@ -78,6 +105,47 @@ static inline bool reply_extract_tag(const probe_t * reply, uint16_t * ptag_repl
     return probe_extract_ext(reply, "checksum", 3, ptag_reply);
 }
 
+/**
+ * \brief Extract the probe ID (tag) from an ICMP echo reply. Such a reply
+ *    does not quote the probe, but only differs from the echo request by
+ *    its type, so the checksum of the echo request can be deduced from the
+ *    one of the reply (RFC 1624).
+ * \param reply The queried reply
+ * \param ptag_reply Address of the uint16_t in which the tag is written
+ * \return true iif successful
+ */
+
+static bool echo_reply_extract_tag(const probe_t * reply, uint16_t * ptag_reply) {
+    const char * protocol_name;
+    uint8_t      type;
+    uint16_t     checksum;
+    uint32_t     sum;
+
+    if (!(protocol_name = probe_get_protocol_name(reply, 1))
+    ||  !probe_extract_ext(reply, "type",     1, &type)
+    ||  !probe_extract_ext(reply, "checksum", 1, &checksum)
+    ) {
+        return false;
+    }
+
+    if (strcmp(protocol_name, "icmpv4") == 0 && type == ICMP_ECHOREPLY) {
+        // Type 8 (0x0800) became 0 in the first 16-bit word
+        sum = checksum + (uint16_t) ~0x0800;
+#ifdef USE_IPV6
+    } else if (strcmp(protocol_name, "icmpv6") == 0 && type == ICMP6_ECHO_REPLY) {
+        // Type 128 (0x8000) became 129 (0x8100) in the first 16-bit word
+        sum = checksum + 0x0100;
+#endif
+    } else {
+        return false;
+    }
+
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    *ptag_reply = sum;
+    return true;
+}
+
 /**
  * \brief Set the probe ID (tag) from a probe
  * \param probe The probe we want to update
@@ -86,15 +154,30 @@ static inline bool reply_extract_tag(const probe_t * reply, uint16_t * ptag_repl
  */
 
 static bool probe_set_tag(probe_t * probe, uint16_t tag_probe) {
-    bool      ret = false;
-    field_t * field;
+    return probe_set_field_ext(probe, 1, I16("checksum", tag_probe));
+}
 
-    if ((field = I16("checksum", tag_probe))) {
-        ret = probe_set_field_ext(probe, 1, field);
-        field_free(field);
+/**
+ * \brief Retrieve the two bytes of a tagged probe in which the checksum
+ *    computed before tagging is stored (see network_tag_probe).
+ * \param probe A tagged probe.
+ * \return The address of these bytes, NULL if not found.
+ */
+
+static uint8_t * probe_get_tag_bytes(const probe_t * probe) {
+    size_t                   num_layers = probe_get_num_layers(probe);
+    const layer_t          * last_layer;
+    const protocol_field_t * protocol_field;
+
+    if (num_layers < 2 || !(last_layer = probe_get_layer(probe, num_layers - 2))) {
+        return NULL;
     }
 
-    return ret;
+    if (last_layer->protocol && (protocol_field = protocol_get_field(last_layer->protocol, "body"))) {
+        return last_layer->segment + protocol_field->offset;
+    }
+
+    return probe_get_payload_size(probe) >= sizeof(uint16_t) ? probe_get_payload(probe) : NULL;
 }
 
 /**
@@ -108,6 +191,37 @@ static bool network_sniffer_callback(packet_t * packet, void * recvq) {
     return queue_push_element((queue_t *) recvq, packet);
 }
 
+/**
+ * \brief Widen (if needed) the range of destination ports accepted by
+ *    the TCP and UDP sockets of the sniffer so that replies sent by the
+ *    destination to this probe can be sniffed.
+ * \param network The network layer
+ * \param probe The probe about to be sent
+ * \return true iif successful
+ */
+
+static bool network_update_port_range(network_t * network, const probe_t * probe) {
+    uint16_t src_port;
+
+    // ICMP probes have no port, and datagram sockets are already demultiplexed
+    if (!network->sniffer || !probe_extract(probe, "src_port", &src_port)) return true;
+
+    if (network->src_port_min <= src_port && src_port <= network->src_port_max) {
+        return true;
+    }
+
+    if (network->src_port_min > network->src_port_max) {
+        // First TCP/UDP probe
+        network->src_port_min = network->src_port_max = src_port;
+    } else if (src_port < network->src_port_min) {
+        network->src_port_min = src_port;
+    } else {
+        network->src_port_max = src_port;
+    }
+
+    return sniffer_set_port_range(network->sniffer, network->src_port_min, network->src_port_max);
+}
+
 /**
  * \brief Retrieve a tag (probe ID) not yet used.
  * \return An available tag
@@ -117,6 +231,45 @@ static uint16_t network_get_available_tag(network_t * network) {
     return ++network->last_tag;
 }
 
+/**
+ * \brief Assign a new tag to a probe already tagged, without crafting
+ *    it again. The tag is stored in the checksum of the probe, while its
+ *    payload stores the checksum that the packet would have carried, so
+ *    both 16-bit words can be updated without altering their one's
+ *    complement sum, i.e. the validity of the packet (RFC 1624).
+ * \param network The network layer
+ * \param probe A tagged probe
+ * \return true iif successful
+ */
+
+static bool network_retag_probe(network_t * network, probe_t * probe) {
+    uint16_t   tag,         // Host-side endianness
+               new_tag,     // Host-side endianness
+               checksum;    // Network-side endianness
+    uint32_t   sum;
+    uint8_t  * tag_bytes;
+
+    // The packet previously sent may still be referenced (see uring_send_packet)
+    if (!probe_unshare_packet(probe)
+    ||  !(tag_bytes = probe_get_tag_bytes(probe))
+    ||  !probe_extract_tag(probe, &tag)
+    ) {
+        return false;
+    }
+
+    // checksum' = tag + checksum - tag'
+    new_tag = network_get_available_tag(network);
+    memcpy(&checksum, tag_bytes, sizeof(uint16_t));
+    sum = tag + ntohs(checksum) + (uint16_t) ~new_tag;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    checksum = htons(sum);
+
+    if (!probe_set_tag(probe, new_tag)) return false;
+    memcpy(tag_bytes, &checksum, sizeof(uint16_t));
+    return true;
+}
+
 /**
  * \brief Debug function. Dump tags of every flying probes
  * \param network The queried network layer
@@ -138,9 +291,9 @@ static void network_flying_probes_dump(network_t * network) {
 }
 
 /**
- * \brief Get the oldest probe in network
+ * \brief Get the next flying probe to expire
  * \param network Pointer to network instance
- * \return A pointer to oldest probe if any, NULL otherwise
+ * \return A pointer to this probe if any, NULL otherwise
  */
 
 static probe_t * network_get_oldest_probe(const network_t * network) {
@@ -150,14 +303,157 @@ static probe_t * network_get_oldest_probe(const network_t * network) {
 /**
  * \brief Compute when a probe expires
  * \param network The network layer
- * \param probe A probe instance. Its sending time must be set.
+ * \param probe A flying probe instance.
  * \return The timeout of the probe. This value may be negative. If so,
  *    it means that this probe has already expired and a PROBE_TIMEOUT
- *    should be raised.
+ *    should be raised (or the probe retransmitted).
  */
 
 static double network_get_probe_timeout(const network_t * network, const probe_t * probe) {
-    return network_get_timeout(network) - (get_timestamp() - probe_get_sending_time(probe));
+    return probe->expiration_time - get_timestamp();
+}
+
+/**
+ * \brief Compute how long the network layer waits for a reply to a probe
+ *    which has just been sent. If retransmissions are enabled, the wait of
+ *    a retransmitted probe is doubled at each retransmission and stretched
+ *    by a random factor in [1, 1.5).
+ * \param network The network layer
+ * \param probe The probe
+ * \return The corresponding delay (in seconds)
+ */
+
+static double network_get_probe_wait(network_t * network, const probe_t * probe) {
+    double wait = network_get_timeout(network);
+
+    if (probe->num_retransmissions) {
+        wait *= (double) ((size_t) 1 << probe->num_retransmissions);
+        wait *= 1 + 0.5 * rand_r(&network->seed) / ((double) RAND_MAX + 1);
+    }
+    return wait;
+}
+
+/**
+ * \brief Hash a hop.
+ * \param dst_ip Destination of the probes.
+ * \param ttl TTL of the probes.
+ * \return The index of the corresponding bucket in network->hops.
+ */
+
+static size_t network_hop_hash(const address_t * dst_ip, uint8_t ttl) {
+    const uint8_t * bytes = (const uint8_t *) &dst_ip->ip;
+    size_t          i, len = dst_ip->family == AF_INET ? 4 : sizeof(ip_t);
+    uint32_t        hash = 2166136261u ^ ttl; // FNV-1a
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash & (NETWORK_HOP_BUCKETS - 1);
+}
+
+/**
+ * \brief Decay the replies and losses observed for a hop.
+ * \param hop A network_hop_t instance.
+ * \param now The current time.
+ */
+
+static void network_hop_decay(network_hop_t * hop, double now) {
+    double factor = exp((hop->update_time - now) / NETWORK_HOP_WINDOW);
+
+    hop->num_replies *= factor;
+    hop->num_losses  *= factor;
+    hop->update_time = now;
+}
+
+/**
+ * \brief Release the hops of a bucket which have not been updated
+ *    for NETWORK_HOP_LIFETIME seconds.
+ * \param pnext Address of the head of the bucket.
+ * \param now The current time.
+ */
+
+static void network_hops_expire(network_hop_t ** pnext, double now) {
+    network_hop_t * hop;
+
+    while ((hop = *pnext)) {
+        if (now - hop->update_time > NETWORK_HOP_LIFETIME) {
+            *pnext = hop->next;
+            free(hop);
+        } else {
+            pnext = &hop->next;
+        }
+    }
+}
+
+/**
+ * \brief Retrieve the replies and losses recently observed for the hop
+ *    probed by a probe which has been sent. The hop is registered if
+ *    needed, and its counters are decayed up to now. Each call also sweeps
+ *    one more bucket for expired hops, so that the table only holds the
+ *    hops recently probed.
+ * \param network The network layer
+ * \param probe The probe
+ * \return The corresponding network_hop_t instance, NULL in case of failure.
+ */
+
+static network_hop_t * network_get_hop(network_t * network, const probe_t * probe) {
+    uint8_t          ttl;
+    double           now = get_timestamp();
+    network_hop_t  * hop,
+                  ** bucket;
+
+    if (!probe_extract(probe, "ttl", &ttl)) return NULL;
+
+    network_hops_expire(&network->hops[network->hops_cursor], now);
+    network->hops_cursor = (network->hops_cursor + 1) & (NETWORK_HOP_BUCKETS - 1);
+
+    bucket = &network->hops[network_hop_hash(probe->packet->dst_ip, ttl)];
+    for (hop = *bucket; hop; hop = hop->next) {
+        if (hop->ttl == ttl && address_compare(&hop->dst_ip, probe->packet->dst_ip) == 0) {
+            network_hop_decay(hop, now);
+            return hop;
+        }
+    }
+
+    if (!(hop = calloc(1, sizeof(network_hop_t)))) return NULL;
+    hop->dst_ip = *probe->packet->dst_ip;
+    hop->ttl = ttl;
+    hop->update_time = now;
+    hop->next = *bucket;
+    *bucket = hop;
+    return hop;
+}
+
+/**
+ * \brief Release the hops stored in network->hops.
+ * \param hops The hash table of hops.
+ */
+
+static void network_hops_free(network_hop_t ** hops) {
+    network_hop_t * hop;
+    size_t          i;
+
+    if (hops) {
+        for (i = 0; i < NETWORK_HOP_BUCKETS; i++) {
+            while ((hop = hops[i])) {
+                hops[i] = hop->next;
+                free(hop);
+            }
+        }
+        free(hops);
+    }
+}
+
+/**
+ * \brief Tests whether a hop seems to rate-limit its replies, i.e.
+ *    whether it has recently answered only some of the probes it received.
+ *    Retransmitting probes to such a hop would only make things worse.
+ * \param hop A network_hop_t instance, decayed up to now.
+ * \return true iif the hop seems to rate-limit its replies
+ */
+
+static inline bool network_hop_is_rate_limited(const network_hop_t * hop) {
+    return hop->num_replies >= NETWORK_RATE_LIMIT_REPLIES && hop->num_losses >= NETWORK_RATE_LIMIT_LOSSES;
 }
 
 /**
@@ -170,7 +466,7 @@ static void itimerspec_set_delay(struct itimerspec * timer, double delay) {
     time_t delay_sec = (time_t) delay;
 
     timer->it_value.tv_sec     = delay_sec;
-    timer->it_value.tv_nsec    = 1000000 * (delay - delay_sec);
+    timer->it_value.tv_nsec    = 1000000000 * (delay - delay_sec);
     timer->it_interval.tv_sec  = 0;
     timer->it_interval.tv_nsec = 0;
 }
@@ -212,7 +508,10 @@ static bool network_update_next_timeout(network_t * network)
     double    next_timeout;
 
     if ((probe = network_get_oldest_probe(network))) {
-        next_timeout = network_get_probe_timeout(network, probe);
+        // This probe may already have expired (e.g. if the timeout is shorter
+        // than the processing of the probes). If so, the timer must fire as
+        // soon as possible, while a null delay would disarm it.
+        next_timeout = MAX(network_get_probe_timeout(network, probe), 1e-6);
     } else {
         // The timer will be disarmed since there is no more flying probes
         next_timeout = 0;
@@ -220,6 +519,159 @@ static bool network_update_next_timeout(network_t * network)
     return update_timer(network->timerfd, next_timeout);
 }
 
+/**
+ * \brief Archive a probe which has just been answered or has expired.
+ * \param network The network layer
+ * \param probe The probe
+ * \param state What happened to the probe
+ */
+
+static void network_archive_probe(network_t * network, const probe_t * probe, probe_archive_state_t state)
+{
+    uint16_t tag_probe;
+
+    if (probe_extract_tag(probe, &tag_probe)) {
+        probe_archive_add(network->archive, tag_probe, state, probe->caller, probe_get_sending_time(probe), get_timestamp());
+    }
+}
+
+/**
+ * \brief Register a probe which has just been sent among the flying
+ *    probes, which are sorted by expiration time, and refresh
+ *    network->timerfd if this probe is the next one to expire.
+ * \param network The network layer
+ * \param probe The probe. Its sending time must be set.
+ * \return true iif successful. Otherwise, the probe is not registered.
+ */
+
+static bool network_register_flying_probe(network_t * network, probe_t * probe)
+{
+    void   ** probes;
+    size_t    i;
+
+    probe->expiration_time = probe_get_sending_time(probe) + network_get_probe_wait(network, probe);
+    if (!(dynarray_push_element(network->probes, probe))) return false;
+
+    // Move the probe before the probes expiring later (retransmitted
+    // probes wait longer than the other ones).
+    probes = dynarray_get_elements(network->probes);
+    for (i = dynarray_get_size(network->probes) - 1; i > 0; i--) {
+        if (((probe_t *) probes[i - 1])->expiration_time <= probe->expiration_time) break;
+        probes[i] = probes[i - 1];
+    }
+    probes[i] = probe;
+
+    if (i == 0 && !network_update_next_timeout(network)) {
+        // The probe would never expire
+        dynarray_del_ith_element(network->probes, 0, NULL);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * \brief Release the socket of the dgrampool held by a probe. If it becomes
+ *    idle, the oldest probe waiting for a socket is queued again.
+ * \param network The network layer
+ * \param probe The probe.
+ */
+
+static void network_release_socket(network_t * network, const probe_t * probe)
+{
+    probe_t * stalled_probe;
+
+    if (network->dgrampool
+    &&  dgrampool_release_probe(network->dgrampool, probe)
+    &&  (stalled_probe = dynarray_get_ith_element(network->stalled_probes, 0))
+    ) {
+        dynarray_del_ith_element(network->stalled_probes, 0, NULL);
+        if (!fair_queue_push_element(network->sendq, stalled_probe->caller, stalled_probe)) {
+            network->num_queued_probes--;
+            probe_free(stalled_probe);
+            metrics_increment(&network->metrics, METRICS_SEND_ERRORS);
+        }
+    }
+}
+
+/**
+ * \brief Remove a probe from the flying probes. If it releases a socket of
+ *    the dgrampool, the oldest probe waiting for a socket is queued again.
+ * \param network The network layer
+ * \param i The index of the probe in network->probes.
+ * \return The removed probe.
+ */
+
+static probe_t * network_unregister_flying_probe(network_t * network, size_t i)
+{
+    probe_t * probe = dynarray_get_ith_element(network->probes, i);
+
+    dynarray_del_ith_element(network->probes, i, NULL);
+    network_release_socket(network, probe);
+    return probe;
+}
+
+/**
+ * \brief Send the packet related to a probe. Its tag and its sending time
+ *    must be set.
+ * \param network The network layer
+ * \param probe The probe
+ * \return true iif successful
+ */
+
+static bool network_send_packet(network_t * network, probe_t * probe)
+{
+    if (network->dgrampool) {
+        return dgrampool_send_probe(network->dgrampool, probe);
+    } else if (network->uring) {
+        // Sent once network_flush is called, which stamps the sending time
+        if (!uring_send_packet(network->uring, probe->packet)) return false;
+        if (dynarray_push_element(network->unflushed_probes, probe)) probe_ref(probe);
+        return true;
+    }
+    return socketpool_send_packet(network->socketpool, probe->packet);
+}
+
+/**
+ * \brief Retransmit a probe which has not been answered in time. The
+ *    packet already crafted is sent again with a new tag.
+ * \param network The network layer
+ * \param probe The probe, which must have been removed from network->probes
+ *    and archived under its previous tag.
+ * \return true iif successful. If so, the probe is a flying probe again.
+ *    Otherwise, it is neither flying nor holding a socket of the dgrampool.
+ */
+
+static bool network_retransmit_probe(network_t * network, probe_t * probe)
+{
+    if (!network_retag_probe(network, probe)) {
+        fprintf(stderr, "Can't tag probe\n");
+        goto ERR_RETAG_PROBE;
+    }
+
+    probe_set_sending_time(probe, get_timestamp());
+    if (!network_send_packet(network, probe)) {
+        fprintf(stderr, "Can't send packet\n");
+        goto ERR_SEND_PACKET;
+    }
+    probe->num_retransmissions++;
+    metrics_increment(&network->metrics, METRICS_PROBES_RETRANSMITTED);
+
+    if (!network_register_flying_probe(network, probe)) {
+        fprintf(stderr, "Can't register probe\n");
+        goto ERR_REGISTER_PROBE;
+    }
+    return true;
+
+ERR_REGISTER_PROBE:
+    // The probe is about to be released along with its PROBE_TIMEOUT event
+    network_release_socket(network, probe);
+    return false;
+ERR_SEND_PACKET:
+ERR_RETAG_PROBE:
+    metrics_increment(&network->metrics, METRICS_SEND_ERRORS);
+    return false;
+}
+
 /**
  * \brief Matches a reply with a probe.
  * \param network The queried network layer
@@ -261,7 +713,66 @@ bool probe_match(const struct probe_s * probe, const struct probe_s * reply)
     return true;
 }
 
-static probe_t * network_get_matching_probe(network_t * network, const probe_t * reply)
+/**
+ * \brief Tests whether a reply has been directly sent by the destination
+ *    of a TCP or UDP probe (e.g. a TCP SYN-ACK or RST), instead of being an
+ *    ICMP error quoting the probe.
+ * \param reply The probe_t instance related to a sniffed packet
+ * \return true iif the reply is an IP/TCP or IP/UDP packet.
+ */
+
+static bool reply_is_transport(const probe_t * reply) {
+    const layer_t * layer;
+
+    if (probe_get_num_layers(reply) < 2) return false;
+    if (!(layer = probe_get_layer(reply, 1)) || !layer->protocol) return false;
+
+    switch (layer->protocol->protocol) {
+        case IPPROTO_TCP:
+        case IPPROTO_UDP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * \brief Find the flying probe corresponding to a reply sent by the
+ *    destination (see reply_is_transport). Such replies do not quote
+ *    the probe, thus they do not carry its tag. They are paired thanks to the
+ *    'matches' callback of each protocol (addresses and ports are swapped).
+ *    Every probe of a given flow has the same addresses and ports, but
+ *    the SYN-ACK or RST answering a TCP probe acknowledges its sequence
+ *    number, which carries its tag (see network_tag_probe). A SYN-ACK
+ *    acknowledges the SYN flag only, a RST also acknowledges the payload.
+ *    A UDP reply carries nothing similar, so the oldest matching probe is
+ *    returned.
+ * \param network The queried network layer
+ * \param reply The probe_t instance related to a sniffed packet
+ * \return The index of the matching probe in network->probes if any,
+ *    the number of flying probes otherwise.
+ */
+
+static size_t network_find_transport_probe(const network_t * network, const probe_t * reply)
+{
+    size_t    i, num_flying_probes = dynarray_get_size(network->probes);
+    probe_t * probe;
+    uint32_t  seq_num, ack_num;
+    bool      is_tcp = probe_get_layer(reply, 1)->protocol->protocol == IPPROTO_TCP;
+
+    if (is_tcp && !probe_extract(reply, "ack_num", &ack_num)) return num_flying_probes;
+
+    for (i = 0; i < num_flying_probes; i++) {
+        probe = dynarray_get_ith_element(network->probes, i);
+        if (!probe_match((const struct probe_s *) probe, (const struct probe_s *) reply)) continue;
+        if (!is_tcp) break;
+        if (probe_extract(probe, "seq_num", &seq_num)
+        && (uint32_t) (ack_num - seq_num - 1) <= probe_get_payload_size(probe)) break;
+    }
+    return i;
+}
+
+probe_t * network_get_matching_probe(network_t * network, const probe_t * reply)
 {
 
     // Suppose we perform a traceroute measurement thanks to IPv4/UDP packet
@@ -277,21 +788,29 @@ static probe_t * network_get_matching_probe(network_t * network, const probe_t *
 
     // XXX
 
-    // Fetch the tag from the reply. Its the 3rd checksum field.
-    if (!(reply_extract_tag(reply, &tag_reply))) {
-        // This is not an IP / ICMP / IP / * reply :(
-        if (network->is_verbose) fprintf(stderr, "Can't retrieve tag from reply\n");
-        return NULL;
-    }
-
     num_flying_probes = dynarray_get_size(network->probes);
-    for (i = 0; i < num_flying_probes; i++) {
-        probe = dynarray_get_ith_element(network->probes, i);
 
-        // Reply / probe comparison. In our probe packet, the probe ID
-        // is stored in the checksum of the (first) IP layer.
-        if (probe_extract_tag(probe, &tag_probe)) {
-            if (tag_reply == tag_probe) break;
+    if (reply_is_transport(reply)) {
+        // This is an IP / TCP or IP / UDP reply sent by the destination
+        tag_reply = 0;
+        i = network_find_transport_probe(network, reply);
+    } else {
+        // Fetch the tag from the reply. Its the 3rd checksum field (or it
+        // is deduced from the checksum of an echo reply).
+        if (!reply_extract_tag(reply, &tag_reply) && !echo_reply_extract_tag(reply, &tag_reply)) {
+            // This is not an IP / ICMP / IP / * reply :(
+            if (network->is_verbose) fprintf(stderr, "Can't retrieve tag from reply\n");
+            return NULL;
+        }
+
+        for (i = 0; i < num_flying_probes; i++) {
+            probe = dynarray_get_ith_element(network->probes, i);
+
+            // Reply / probe comparison. In our probe packet, the probe ID
+            // is stored in the checksum of the (first) IP layer.
+            if (probe_extract_tag(probe, &tag_probe)) {
+                if (tag_reply == tag_probe) break;
+            }
         }
     }
 
@@ -319,14 +838,15 @@ static probe_t * network_get_matching_probe(network_t * network, const probe_t *
         return NULL;
     }
 
-    // We delete the corresponding probe
+    // We delete the corresponding probe, and archive it to detect the
+    // duplicated replies.
+    probe = network_unregister_flying_probe(network, i);
+    network_archive_probe(network, probe, PROBE_ARCHIVE_ANSWERED);
 
-    // TODO: ... but it should be kept, for archive purposes, and to match for duplicates...
-    // But we cannot reenable it until we set the probe ID into the
-    // checksum, since probes with same flow_id and different TTL have the
-    // same checksum
-
-    dynarray_del_ith_element(network->probes, i, NULL);
+    if (network->max_retries) {
+        network_hop_t * hop = network_get_hop(network, probe);
+        if (hop) hop->num_replies++;
+    }
 
     // The matching probe is the oldest one and there are other probes, update
     // the timer according to the next unexpired probe timeout.
@@ -339,6 +859,91 @@ static probe_t * network_get_matching_probe(network_t * network, const probe_t *
     return probe;
 }
 
+/**
+ * \brief Classify a reply which matches no flying probe thanks to the
+ *    archive, and notify the algorithm instance which has sent the
+ *    corresponding probe by a PROBE_LATE_REPLY or PROBE_DUPLICATE event.
+ * \param network The network layer
+ * \param reply The probe_t instance related to a sniffed packet
+ * \return true iif the reply answers an archived probe. If so, the reply
+ *    is released along with the data of the event.
+ */
+
+static bool network_process_archived_reply(network_t * network, probe_t * reply)
+{
+    uint16_t                tag_reply;
+    probe_archive_entry_t * entry;
+    archived_reply_t      * archived_reply;
+    event_type_t            type;
+
+    if (reply_is_transport(reply)
+    || !(reply_extract_tag(reply, &tag_reply) || echo_reply_extract_tag(reply, &tag_reply))
+    || !(entry = probe_archive_find(network->archive, tag_reply, probe_get_recv_time(reply)))
+    ) {
+        return false;
+    }
+
+    if (entry->state == PROBE_ARCHIVE_EXPIRED) {
+        metrics_increment(&network->metrics, METRICS_REPLIES_LATE);
+        type = PROBE_LATE_REPLY;
+    } else {
+        metrics_increment(&network->metrics, METRICS_REPLIES_DUPLICATE);
+        type = PROBE_DUPLICATE;
+    }
+
+    // The algorithm instance may have been freed in the meantime
+    if (entry->caller && (archived_reply = archived_reply_create(entry, reply))) {
+        pt_throw(NULL, entry->caller, event_create(type, archived_reply, NULL, (ELEMENT_FREE) archived_reply_free));
+    } else {
+        probe_free(reply);
+    }
+
+    // Next replies to this probe are duplicates
+    entry->state = PROBE_ARCHIVE_ANSWERED;
+    return true;
+}
+
+/**
+ * \brief Remember that an algorithm instance could not send a probe because
+ *    the sendq was full (see network_send_probe).
+ * \param network The network layer.
+ * \param caller The algorithm instance (ignored if NULL).
+ */
+
+static void network_block_caller(network_t * network, void * caller) {
+    size_t i;
+
+    if (!caller) return;
+    for (i = 0; i < dynarray_get_size(network->blocked_callers); i++) {
+        if (dynarray_get_ith_element(network->blocked_callers, i) == caller) return;
+    }
+    if (!dynarray_push_element(network->blocked_callers, caller)) {
+        fprintf(stderr, "Can't register a blocked algorithm instance\n");
+    }
+}
+
+/**
+ * \brief Notify the blocked algorithm instances by a NETWORK_WRITABLE event
+ *    once half of the sendq has been drained. Waiting for this low-water
+ *    mark avoids waking them up for each probe sent.
+ * \param network The network layer.
+ */
+
+static void network_unblock_callers(network_t * network) {
+    size_t i;
+
+    if (dynarray_get_size(network->blocked_callers) == 0
+    ||  network->num_queued_probes > network->sendq_size / 2
+    ) {
+        return;
+    }
+
+    for (i = 0; i < dynarray_get_size(network->blocked_callers); i++) {
+        pt_throw(NULL, dynarray_get_ith_element(network->blocked_callers, i), event_create(NETWORK_WRITABLE, NULL, NULL, NULL));
+    }
+    dynarray_clear(network->blocked_callers, NULL);
+}
+
 //---------------------------------------------------------------------------
 // Public functions
 //---------------------------------------------------------------------------
@@ -348,8 +953,7 @@ network_t * network_create()
     network_t * network;
 
     if (!(network = malloc(sizeof(network_t))))          goto ERR_NETWORK;
-    if (!(network->socketpool   = socketpool_create()))  goto ERR_SOCKETPOOL;
-    if (!(network->sendq = queue_create(probe_free,  probe_fprintf)))  goto ERR_SENDQ;
+    if (!(network->sendq = fair_queue_create((ELEMENT_FREE) probe_free))) goto ERR_SENDQ;
     if (!(network->recvq = queue_create(packet_free, packet_fprintf))) goto ERR_RECVQ;
 
     if ((network->timerfd = timerfd_create(CLOCK_REALTIME, 0)) == -1) {
@@ -364,19 +968,73 @@ network_t * network_create()
         goto ERR_GROUP;
     }
 #endif
-    if (!(network->sniffer = sniffer_create(network->recvq, network_sniffer_callback))) {
-        goto ERR_SNIFFER;
+
+    // Raw sockets require privileges, otherwise fall back on datagram sockets
+    network->dgrampool = NULL;
+    network->socketpool = NULL;
+    network->uring = NULL;
+    if (use_dgram
+    ||  !(network->socketpool = socketpool_create())
+    ||  !(network->sniffer = sniffer_create(network->recvq, network_sniffer_callback))
+    ) {
+        socketpool_free(network->socketpool);
+        network->socketpool = NULL;
+        network->sniffer = NULL;
+        if (!(network->dgrampool = dgrampool_create(network->recvq, network_sniffer_callback))) {
+            goto ERR_SNIFFER;
+        }
+        if (!use_dgram) fprintf(stderr, "Raw sockets unavailable: only UDP probes and ICMP echo requests can be sent\n");
+    } else if (sources.s) {
+        if (!socketpool_add_sources_from_string(network->socketpool, sources.s)) goto ERR_SOURCES;
+        socketpool_set_policy(
+            network->socketpool,
+            strcmp(source_policy_names[0], "round-robin") == 0 ? SOCKETPOOL_POLICY_ROUND_ROBIN : SOCKETPOOL_POLICY_FLOW
+        );
     }
 
+    // The sockets of the sniffer are then read through io_uring
+    if (use_uring && network->sniffer) {
+        if (!(network->uring = uring_create(network->socketpool, network->sniffer))) {
+            fprintf(stderr, "io_uring unavailable: a system call is performed per packet\n");
+        }
+    }
+
+    if (!(network->unflushed_probes = dynarray_create())) goto ERR_UNFLUSHED_PROBES;
     if (!(network->probes = dynarray_create())) goto ERR_PROBES;
+    if (!(network->hops   = calloc(NETWORK_HOP_BUCKETS, sizeof(network_hop_t *)))) goto ERR_HOPS;
+    if (!(network->archive = probe_archive_create(NETWORK_ARCHIVE_SIZE, NETWORK_ARCHIVE_WINDOW))) goto ERR_ARCHIVE;
+    if (!(network->blocked_callers = dynarray_create())) goto ERR_BLOCKED_CALLERS;
+    if (!(network->stalled_probes = dynarray_create())) goto ERR_STALLED_PROBES;
 
     network->last_tag = 0;
+    network->max_retries = 0;
+    network->hops_cursor = 0;
+    network->sendq_size = NETWORK_DEFAULT_SENDQ_SIZE;
+    network->num_queued_probes = 0;
+    network->seed = time(NULL) ^ getpid();
+    metrics_clear(&network->metrics);
+    network->src_port_min = 1; // Empty range, see network_update_port_range
+    network->src_port_max = 0;
     network->timeout = NETWORK_DEFAULT_TIMEOUT;
     network->is_verbose = false;
     return network;
 
+ERR_STALLED_PROBES:
+    dynarray_free(network->blocked_callers, NULL);
+ERR_BLOCKED_CALLERS:
+    probe_archive_free(network->archive);
+ERR_ARCHIVE:
+    free(network->hops);
+ERR_HOPS:
+    dynarray_free(network->probes, NULL);
 ERR_PROBES:
+    dynarray_free(network->unflushed_probes, NULL);
+ERR_UNFLUSHED_PROBES:
+    uring_free(network->uring);
+ERR_SOURCES:
+    dgrampool_free(network->dgrampool);
     sniffer_free(network->sniffer);
+    socketpool_free(network->socketpool);
 ERR_SNIFFER:
 #ifdef USE_SCHEDULING
     probe_group_free(network->scheduled_probes);
@@ -389,11 +1047,8 @@ ERR_TIMERFD:
     //queue_free(network->recvq, (ELEMENT_FREE) packet_free);
     queue_free(network->recvq);
 ERR_RECVQ:
-    //queue_free(network->sendq, (ELEMENT_FREE) probe_free);
-    queue_free(network->sendq);
+    fair_queue_free(network->sendq);
 ERR_SENDQ:
-    socketpool_free(network->socketpool);
-ERR_SOCKETPOOL:
     free(network);
 ERR_NETWORK:
     return NULL;
@@ -403,9 +1058,16 @@ void network_free(network_t * network)
 {
     if (network) {
         dynarray_free(network->probes, (ELEMENT_FREE) probe_free);
+        network_hops_free(network->hops);
+        probe_archive_free(network->archive);
+        dynarray_free(network->blocked_callers, NULL);
+        dynarray_free(network->stalled_probes, (ELEMENT_FREE) probe_free);
         close(network->timerfd);
+        uring_free(network->uring);
+        dynarray_free(network->unflushed_probes, (ELEMENT_FREE) probe_free);
         sniffer_free(network->sniffer);
-        queue_free(network->sendq);// , (ELEMENT_FREE) probe_free);
+        dgrampool_free(network->dgrampool);
+        fair_queue_free(network->sendq);
         queue_free(network->recvq),//, (ELEMENT_FREE) probe_free);
         socketpool_free(network->socketpool);
 #ifdef USE_SCHEDULING
@@ -419,12 +1081,20 @@ void network_set_timeout(network_t * network, double new_timeout) {
     network->timeout = new_timeout;
 }
 
+void network_set_max_retries(network_t * network, size_t max_retries) {
+    network->max_retries = max_retries;
+}
+
+void network_set_sendq_size(network_t * network, size_t sendq_size) {
+    network->sendq_size = sendq_size;
+}
+
 double network_get_timeout(const network_t * network) {
     return network->timeout;
 }
 
 inline int network_get_sendq_fd(network_t * network) {
-    return queue_get_fd(network->sendq);
+    return fair_queue_get_fd(network->sendq);
 }
 
 inline int network_get_recvq_fd(network_t * network) {
@@ -433,16 +1103,40 @@ inline int network_get_recvq_fd(network_t * network) {
 
 #ifdef USE_IPV4
 inline int network_get_icmpv4_sockfd(network_t * network) {
-    return sniffer_get_icmpv4_sockfd(network->sniffer);
+    return network->sniffer ? sniffer_get_icmpv4_sockfd(network->sniffer) : -1;
+}
+
+inline int network_get_tcpv4_sockfd(network_t * network) {
+    return network->sniffer ? sniffer_get_tcpv4_sockfd(network->sniffer) : -1;
+}
+
+inline int network_get_udpv4_sockfd(network_t * network) {
+    return network->sniffer ? sniffer_get_udpv4_sockfd(network->sniffer) : -1;
 }
 #endif
 
 #ifdef USE_IPV6
 inline int network_get_icmpv6_sockfd(network_t * network) {
-    return sniffer_get_icmpv6_sockfd(network->sniffer);
+    return network->sniffer ? sniffer_get_icmpv6_sockfd(network->sniffer) : -1;
+}
+
+inline int network_get_tcpv6_sockfd(network_t * network) {
+    return network->sniffer ? sniffer_get_tcpv6_sockfd(network->sniffer) : -1;
+}
+
+inline int network_get_udpv6_sockfd(network_t * network) {
+    return network->sniffer ? sniffer_get_udpv6_sockfd(network->sniffer) : -1;
 }
 #endif
 
+inline int network_get_dgrampool_fd(network_t * network) {
+    return network->dgrampool ? dgrampool_get_fd(network->dgrampool) : -1;
+}
+
+inline int network_get_uring_fd(network_t * network) {
+    return network->uring ? uring_get_fd(network->uring) : -1;
+}
+
 inline int network_get_timerfd(network_t * network) {
     return network->timerfd;
 }
@@ -498,6 +1192,16 @@ bool network_tag_probe(network_t * network, probe_t * probe)
 
     tag = htons(network_get_available_tag(network));
 
+    // The destination does not quote a TCP probe in its reply, but
+    // acknowledges its sequence number (see network_find_transport_probe).
+    // Shifting the tag keeps the acknowledged ranges of two probes apart.
+    if (last_layer->protocol && last_layer->protocol->protocol == IPPROTO_TCP) {
+        if (!probe_set_field(probe, I32("seq_num", (uint32_t) ntohs(tag) << 16))) {
+            fprintf(stderr, "Can't set seq_num\n");
+            goto ERR_PROBE_SET_SEQ_NUM;
+        }
+    }
+
     // Write the tag at offset zero of the payload
     if (tag_in_body) {
         probe_write_field(probe, "body", &tag, tag_size);
@@ -553,12 +1257,24 @@ ERR_PROBE_EXTRACT_CHECKSUM:
 ERR_PROBE_UPDATE_FIELDS:
 ERR_PROBE_WRITE_PAYLOAD:
 ERR_INVALID_PAYLOAD:
+ERR_PROBE_SET_SEQ_NUM:
 ERR_GET_LAYER:
     return false;
 }
 
 bool network_send_probe(network_t * network, probe_t * probe)
 {
+    bool   ret;
+    size_t num_sendings = probe_get_left_to_send(probe);
+
+    // The sendq is full: the caller will be notified by a NETWORK_WRITABLE
+    // event once it has been drained (see network_process_sendq).
+    if (network->sendq_size && network->num_queued_probes >= network->sendq_size) {
+        network_block_caller(network, probe->caller);
+        errno = EAGAIN;
+        return false;
+    }
+
     // - Best effort probes are directly pushed in our sendq.
     // - Scheduled probes are scheduled, stored in the probe group, and
     // pushed in the sendq when the probe_group notify pt_loop.
@@ -567,12 +1283,16 @@ bool network_send_probe(network_t * network, probe_t * probe)
     if (probe_get_delay(probe) == DELAY_BEST_EFFORT) {
 #endif
         probe_set_queueing_time(probe, get_timestamp());
-        return queue_push_element(network->sendq, probe);
+        ret = fair_queue_push_element(network->sendq, probe->caller, probe);
 #ifdef USE_SCHEDULING
     } else {
-       return probe_group_add(network->scheduled_probes, probe);
+       ret = probe_group_add(network->scheduled_probes, probe);
     }
 #endif
+
+    // Each sending of the probe pops it once from the sendq
+    if (ret) network->num_queued_probes += num_sendings;
+    return ret;
 }
 
 // TODO This could be replaced by watchers: FD -> action
@@ -580,18 +1300,20 @@ bool network_process_sendq(network_t * network)
 {
     probe_t           * probe;
     packet_t          * packet;
-    size_t              num_flying_probes;
-    struct itimerspec   new_timeout;
 
-    // Probe skeleton when entering the network layer.
-    // We have to duplicate the probe since the same address of skeleton
-    // may have been passed to pt_send_probe.
-    // => We duplicate this probe in the
-    // network layer registry (network->probes) and then tagged.
+    // The reference to the probe held by the sendq is passed to
+    // network->probes, and then to the PROBE_REPLY or PROBE_TIMEOUT event.
+    if (!(probe = fair_queue_pop_element(network->sendq))) {
+        return false;
+    }
+    if (network->num_queued_probes) network->num_queued_probes--;
+    network_unblock_callers(network);
 
-    // Do not free probe at the end of this function.
-    // Its address will be saved in network->probes and freed later.
-    probe = queue_pop_element(network->sendq, NULL);
+    // Pick the source of the probe. Its tag depends on its source address.
+    if (network->socketpool && !socketpool_assign_source(network->socketpool, probe)) {
+        fprintf(stderr, "Can't assign a source to probe\n");
+        goto ERR_ASSIGN_SOURCE;
+    }
 
     // Tag the probe
     if (!network_tag_probe(network, probe)) {
@@ -604,48 +1326,73 @@ bool network_process_sendq(network_t * network)
         probe_dump(probe);
     }
 
+    // Make sure the sniffer will catch replies sent by the destination
+    if (!network_update_port_range(network, probe)) {
+        fprintf(stderr, "Can't update sniffer port range\n");
+    }
+
     // Make a packet from the probe structure
     if (!(packet = probe_create_packet(probe))) {
         fprintf(stderr, "Can't create packet\n");
     	goto ERR_CREATE_PACKET;
     }
 
-    // Send the packet
-    if (!(socketpool_send_packet(network->socketpool, packet))) {
+    // Update the sending time. This must be done before sending, since
+    // the reply may be timestamped by the kernel (see dgrampool.h). Probes
+    // sent through uring are stamped again once submitted (see network_flush).
+    probe_set_sending_time(probe, get_timestamp());
+
+    // Send the packet. If every socket of the dgrampool is busy, the probe
+    // waits until one of them is released (see network_unregister_flying_probe).
+    if (!network_send_packet(network, probe)) {
+        if (errno == EAGAIN && network->dgrampool) {
+            if (!dynarray_push_element(network->stalled_probes, probe)) goto ERR_STALL_PROBE;
+            network->num_queued_probes++;
+            return true;
+        }
         fprintf(stderr, "Can't send packet\n");
         goto ERR_SEND_PACKET;
     }
+    metrics_increment(&network->metrics, METRICS_PROBES_SENT);
+    metrics_observe(&network->metrics, METRICS_SENDQ_WAIT, probe_get_sending_time(probe) - probe_get_queueing_time(probe));
 
-    // Update the sending time
-    probe_set_sending_time(probe, get_timestamp());
-
-    // Register this probe in the list of flying probes
-    if (!(dynarray_push_element(network->probes, probe))) {
+    // Register this probe in the list of flying probes (and arm the timer
+    // if it is the next one to expire)
+    if (!network_register_flying_probe(network, probe)) {
         fprintf(stderr, "Can't register probe\n");
-        goto ERR_PUSH_PROBE;
-    }
-
-    // We've just sent a probe and currently, this is the only one in transit.
-    // So currently, there is no running timer, prepare timerfd.
-    num_flying_probes = dynarray_get_size(network->probes);
-    if (num_flying_probes == 1) {
-        itimerspec_set_delay(&new_timeout, network_get_timeout(network));
-        if (timerfd_settime(network->timerfd, 0, &new_timeout, NULL) == -1) {
-            fprintf(stderr, "Can't set timerfd\n");
-            goto ERR_TIMERFD;
-        }
+        goto ERR_REGISTER_PROBE;
     }
     return true;
 
-ERR_TIMERFD:
-ERR_PUSH_PROBE:
+ERR_REGISTER_PROBE:
+    // The replies of this probe can't be matched anymore
+    network_release_socket(network, probe);
+ERR_STALL_PROBE:
 ERR_SEND_PACKET:
-    packet_free(packet);
 ERR_CREATE_PACKET:
 ERR_TAG_PROBE:
+ERR_ASSIGN_SOURCE:
+    probe_free(probe);
+    metrics_increment(&network->metrics, METRICS_SEND_ERRORS);
     return false;
 }
 
+bool network_drain_sendq(network_t * network)
+{
+    size_t i, num_probes = 1;
+    bool   ret = true;
+
+    // If the submission ring is full, the first packet flushes it
+    if (network->uring) {
+        num_probes = MAX(uring_get_num_free_entries(network->uring), 1);
+    }
+
+    for (i = 0; i < num_probes && fair_queue_get_size(network->sendq); i++) {
+        ret &= network_process_sendq(network);
+    }
+    return ret;
+}
+
 bool network_process_recvq(network_t * network)
 {
     probe_t       * probe,
@@ -662,7 +1409,7 @@ bool network_process_recvq(network_t * network)
     if(!(reply = probe_wrap_packet(packet))) {
         goto ERR_PROBE_WRAP_PACKET;
     }
-    probe_set_recv_time(reply, get_timestamp());
+    probe_set_recv_time(reply, packet->recv_time ? packet->recv_time : get_timestamp());
 
     if (network->is_verbose) {
         printf("Got reply:\n");
@@ -672,32 +1419,35 @@ bool network_process_recvq(network_t * network)
     // Find the probe corresponding to this reply
     // The corresponding pointer (if any) is removed from network->probes
     if (!(probe = network_get_matching_probe(network, reply))) {
+        // This may be a late or a duplicated reply
+        if (network_process_archived_reply(network, reply)) return true;
+        metrics_increment(&network->metrics, METRICS_REPLIES_UNMATCHED);
         goto ERR_PROBE_DISCARDED;
     }
+    metrics_increment(&network->metrics, METRICS_REPLIES_MATCHED);
+    metrics_observe(&network->metrics, METRICS_RTT, probe_get_recv_time(reply) - probe_get_sending_time(probe));
 
     // Build a pair made of the probe and its corresponding reply
     if (!(probe_reply = probe_reply_create())) {
         goto ERR_PROBE_REPLY_CREATE;
     }
 
-    // We're pass to the upper layer the probe and the reply to the upper layer.
+    // We pass to the upper layer the probe and the reply. The references
+    // to both of them are released along with the event.
     probe_reply_set_probe(probe_reply, probe);
     probe_reply_set_reply(probe_reply, reply);
 
     // Notify the instance which has build the probe that we've got the corresponding reply
-
-    // TODO this provokes a double free:
-    //pt_throw(NULL, probe->caller, event_create(PROBE_REPLY, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
-    pt_throw(NULL, probe->caller, event_create(PROBE_REPLY, probe_reply, NULL, NULL));
-
-    // TODO probe_reply_free frees only the reply but probe_reply_deep_free cannot be used as other things may have references to its contents.
+    pt_throw(NULL, probe->caller, event_create(PROBE_REPLY, probe_reply, NULL, (ELEMENT_FREE) probe_reply_free));
     return true;
 
 ERR_PROBE_REPLY_CREATE:
+    probe_free(probe);
 ERR_PROBE_DISCARDED:
     probe_free(reply);
+    return false;
 ERR_PROBE_WRAP_PACKET:
-    //packet_free(packet); TODO provoke segfault in case of stars
+    packet_free(packet);
 ERR_PACKET_POP:
     return false;
 }
@@ -706,33 +1456,130 @@ void network_process_sniffer(network_t * network, uint8_t protocol_id) {
     sniffer_process_packets(network->sniffer, protocol_id);
 }
 
+void network_process_sniffer_ext(network_t * network, int family, uint8_t protocol_id) {
+    sniffer_process_packets_ext(network->sniffer, family, protocol_id);
+}
+
+void network_process_dgrampool(network_t * network) {
+    dgrampool_process_packets(network->dgrampool);
+}
+
+void network_process_uring(network_t * network) {
+    size_t num_send_errors = network->uring->num_send_errors;
+
+    uring_process_completions(network->uring);
+
+    // Sending errors are only known once the requests complete
+    for (; num_send_errors < network->uring->num_send_errors; num_send_errors++) {
+        metrics_increment(&network->metrics, METRICS_SEND_ERRORS);
+    }
+}
+
+bool network_flush(network_t * network)
+{
+    bool   ret;
+    double now;
+    size_t i;
+
+    if (!network->uring) return true;
+    ret = uring_flush(network->uring);
+
+    // RTTs are measured from the submission of the packets. The expiration
+    // time of these probes is left unchanged: their wait is at most
+    // shortened by the duration of the current iteration.
+    now = get_timestamp();
+    for (i = 0; i < dynarray_get_size(network->unflushed_probes); i++) {
+        probe_set_sending_time(dynarray_get_ith_element(network->unflushed_probes, i), now);
+    }
+    dynarray_clear(network->unflushed_probes, (ELEMENT_FREE) probe_free);
+    return ret;
+}
+
+bool network_set_caller_class(network_t * network, const void * caller, size_t weight, bool is_priority) {
+    return fair_queue_set_class(network->sendq, caller, weight, is_priority);
+}
+
+void network_forget_caller(network_t * network, const void * caller) {
+    size_t    i;
+    probe_t * probe;
+    bool      is_oldest_dropped = false;
+
+    probe_archive_forget_caller(network->archive, caller);
+    for (i = dynarray_get_size(network->stalled_probes); i > 0; i--) {
+        probe = dynarray_get_ith_element(network->stalled_probes, i - 1);
+        if (probe->caller == caller) {
+            dynarray_del_ith_element(network->stalled_probes, i - 1, (ELEMENT_FREE) probe_free);
+            network->num_queued_probes--;
+        }
+    }
+    for (i = 0; i < dynarray_get_size(network->blocked_callers); i++) {
+        if (dynarray_get_ith_element(network->blocked_callers, i) == caller) {
+            dynarray_del_ith_element(network->blocked_callers, i, NULL);
+            break;
+        }
+    }
+
+    // Its flying probes would otherwise be notified to a freed instance
+    // once answered or expired.
+    for (i = dynarray_get_size(network->probes); i > 0; i--) {
+        probe = dynarray_get_ith_element(network->probes, i - 1);
+        if (probe->caller == caller) {
+            probe_free(network_unregister_flying_probe(network, i - 1));
+            if (i == 1) is_oldest_dropped = true;
+        }
+    }
+
+    // Releasing its probes may have queued again some stalled probes
+    network->num_queued_probes -= fair_queue_forget_key(network->sendq, caller);
+    if (is_oldest_dropped) network_update_next_timeout(network);
+}
+
+const metrics_t * network_get_metrics(network_t * network) {
+    // The sniffer does not know the network layer, so its counter is
+    // collected here.
+    network->metrics.counters[METRICS_SNIFFER_TRUNCATED] = network->sniffer ? network->sniffer->num_truncated : 0;
+    return &network->metrics;
+}
+
 bool network_drop_expired_flying_probe(network_t * network)
 {
     // Drop every expired probes
-    size_t    i, num_flying_probes = dynarray_get_size(network->probes);
-    bool      ret = false;
-    probe_t * probe;
+    size_t          num_flying_probes = dynarray_get_size(network->probes);
+    bool            ret = false;
+    probe_t       * probe;
+    network_hop_t * hop;
 
     // Is there flying probe(s) ?
     if (num_flying_probes > 0) {
 
-        // Iterate on each expired probes (at least the oldest one has expired)
-        for (i = 0 ;i < num_flying_probes; i++) {
-            probe = dynarray_get_ith_element(network->probes, i);
+        // Iterate on each expired probes (at least the first one has expired)
+        while ((probe = network_get_oldest_probe(network))) {
 
             // Some probe may expires very soon and may expire before the next probe timeout
             // update. If so, the timer will be disarmed and libparistraceroute may freeze.
             // To avoid this kind of deadlock, we provoke a probe timeout for each probe
             // expiring in less that EXTRA_DELAY seconds.
             if (network_get_probe_timeout(network, probe) - EXTRA_DELAY > 0) break;
+            network_unregister_flying_probe(network, 0);
+
+            // A reply to its current tag will be a late reply, whether it is
+            // retransmitted under a new tag or not.
+            network_archive_probe(network, probe, PROBE_ARCHIVE_EXPIRED);
+
+            // Retransmit the probe, unless its hop seems to rate-limit its replies.
+            if (network->max_retries) {
+                if ((hop = network_get_hop(network, probe))) hop->num_losses++;
+                if (probe->num_retransmissions < network->max_retries
+                && !(hop && network_hop_is_rate_limited(hop))
+                && network_retransmit_probe(network, probe)
+                ) {
+                    continue;
+                }
+            }
 
             // This probe has expired, raise a PROBE_TIMEOUT event.
-            pt_throw(NULL, probe->caller, event_create(PROBE_TIMEOUT, probe, NULL, NULL)); //(ELEMENT_FREE) probe_free));
-        }
-
-        // Delete the i oldest probes, which have expired.
-        if (i != 0) {
-            dynarray_del_n_elements(network->probes, 0, i, NULL);
+            metrics_increment(&network->metrics, METRICS_PROBES_EXPIRED);
+            pt_throw(NULL, probe->caller, event_create(PROBE_TIMEOUT, probe, NULL, (ELEMENT_FREE) probe_free));
         }
 
         ret = network_update_next_timeout(network);
@@ -758,8 +1605,13 @@ static bool network_process_probe_node(network_t * network, tree_node_t * node,
     probe = (probe_t *) (tree_node_probe->data.probe);
     //TODO packet_from_probe must manage generator
 
+    // Each sending holds its own reference (see probe_get_left_to_send)
     probe_set_queueing_time(probe, get_timestamp());
-    if (!(queue_push_element(network->sendq, probe)))                   goto ERR_QUEUE_PUSH;
+    if (!(fair_queue_push_element(network->sendq, probe->caller, probe_ref(probe)))) {
+        probe_free(probe);
+        network->num_queued_probes--;
+        goto ERR_QUEUE_PUSH;
+    }
     /*
     probe_set_left_to_send(probe, probe_get_left_to_send(probe) - 1);
     num_probes_to_send = probe_get_left_to_send(probe);
@@ -768,6 +1620,9 @@ static bool network_process_probe_node(network_t * network, tree_node_t * node,
     */
     if (--(probe->left_to_send) == 0) {
         if (!(probe_group_del(network->scheduled_probes, node->parent, i)))  goto ERR_PROBE_GROUP_DEL;
+
+        // Release the reference held by the probe group
+        probe_free(probe);
     } else {
         get_node_next_delay(node);
         probe_group_update_delay(network->scheduled_probes, node);
@@ -11,20 +11,42 @@
  * further treatment.  A network also manages a pool of sockets that can be
  * used to send the probes.
  *
- * Currently packets are generated through a RAW socket only, and replies are
- * captured by a sniffer. We could envisage adding more types of sockets, and
- * the corresponding return channels if needed. Finally, this is also the
+ * Packets are generated through a RAW socket, and replies are captured by a
+ * sniffer. If raw sockets are not available (unprivileged user), IP/UDP
+ * probes are sent through datagram sockets instead, and ICMP errors are
+ * fetched from their error queue (see dgrampool.h). Finally, this is also the
  * place where a packet scheduler might be implemented (rate limits, etc.).
+ *
+ * Lost probes may be retransmitted by the network layer (see --retries).
+ * A retransmission reuses the packet already crafted: only its tag is
+ * changed, and its checksum is incrementally updated. The wait of the
+ * k-th retransmission is doubled k times and randomly stretched by up to
+ * 50%, so that probes lost together are not retransmitted together.
+ * Probes are not retransmitted to a hop which seems to rate-limit its
+ * replies. The algorithm only receives the final PROBE_REPLY or
+ * PROBE_TIMEOUT event.
+ *
+ * Answered and expired probes are archived for a while (see
+ * probe_archive.h), so that a reply received afterwards is notified to the
+ * algorithm by a PROBE_DUPLICATE or PROBE_LATE_REPLY event instead of being
+ * discarded. Replies sent by the destination of a TCP or UDP probe do not
+ * carry the tag of the probe, hence they cannot be classified this way.
  */
 
 #include <limits.h>      // INT_MAX
 
+#include "address.h"     // address_t
 #include "queue.h"       // queue_t
+#include "fair_queue.h"  // fair_queue_t
 #include "socketpool.h"  // socketpool_t
 #include "sniffer.h"     // sniffer_t
+#include "dgrampool.h"   // dgrampool_t
+#include "uring.h"       // uring_t
 #include "dynarray.h"    // dynarray_t
+#include "metrics.h"     // metrics_t
 #include "options.h"     // option_t
 #include "probe_group.h" // probe_group_t
+#include "probe_archive.h" // probe_archive_t
 #include "use.h"
 
 // If no matching reply has been sniffed in the next 3 sec, we
@@ -35,6 +57,49 @@
 #define NETWORK_DEFAULT_TIMEOUT 3
 #define OPTIONS_NETWORK_WAIT {NETWORK_DEFAULT_TIMEOUT, 0, INT_MAX}
 #define HELP_w "Set the number of seconds to wait for response to a probe (default is 5.0)"
+#define HELP_sources "Send probes from several sources: a comma-separated list of interfaces (eth0), addresses (192.0.2.1) or both (192.0.2.1@eth0)."
+#define HELP_source_policy "How probes are assigned to sources: 'flow' (every probe of a flow leaves from the same source, default) or 'round-robin'."
+#define HELP_dgram "Use unprivileged datagram sockets instead of raw sockets (UDP probes and ICMP echo requests only, Linux only)."
+#define OPTIONS_NETWORK_MAX_DGRAM_SOCKETS {DGRAMPOOL_DEFAULT_MAX_SOCKETS, 0, INT_MAX}
+#define HELP_max_dgram_sockets "Maximum number of datagram sockets opened at once, one per flow (see --dgram). Idle sockets are closed first (default is 256, 0 means unbounded)."
+#define OPTIONS_NETWORK_RETRIES {0, 0, 16}
+#define HELP_retries "Retransmit up to NUM_RETRIES times a probe which has not been answered in time, with an exponential backoff (default is 0)."
+#define NETWORK_DEFAULT_SENDQ_SIZE 65536
+#define OPTIONS_NETWORK_SENDQ_SIZE {NETWORK_DEFAULT_SENDQ_SIZE, 0, INT_MAX}
+#define HELP_sendq_size "Maximum number of probes waiting to be sent. Once reached, the algorithms are asked to wait before sending more probes (default is 65536, 0 means unbounded)."
+#define HELP_io_uring "Exchange packets through io_uring instead of a system call per packet (raw sockets only, Linux >= 6.0)."
+
+// Size and time window of the archive of answered and expired probes
+#define NETWORK_ARCHIVE_SIZE   4096
+#define NETWORK_ARCHIVE_WINDOW 60
+
+// Replies and losses observed for a hop are exponentially decayed with
+// this time constant (in seconds), and the hop is forgotten once nothing
+// has been observed for NETWORK_HOP_LIFETIME seconds.
+#define NETWORK_HOP_WINDOW   10
+#define NETWORK_HOP_LIFETIME 60
+#define NETWORK_HOP_BUCKETS  1024 // A power of 2
+
+// A hop is considered as rate-limiting its replies once it has recently
+// answered about one probe and ignored about two probes.
+#define NETWORK_RATE_LIMIT_REPLIES 0.5
+#define NETWORK_RATE_LIMIT_LOSSES  1.5
+
+/**
+ * \struct network_hop_t
+ * \brief Replies and losses recently observed for a given hop, i.e. a pair
+ *    (destination, TTL). Used to decide whether a lost probe may be
+ *    retransmitted.
+ */
+
+typedef struct network_hop_s {
+    address_t              dst_ip;      /**< Destination of the probes */
+    uint8_t                ttl;         /**< TTL of the probes */
+    double                 num_replies; /**< Number of probes answered (decayed, see NETWORK_HOP_WINDOW) */
+    double                 num_losses;  /**< Number of probes not answered in time (decayed) */
+    double                 update_time; /**< Time at which num_replies and num_losses have been decayed */
+    struct network_hop_s * next;        /**< Next hop of the same bucket */
+} network_hop_t;
 
 /**
  * \struct network_t
@@ -107,18 +172,33 @@
 
 typedef struct network_s {
     socketpool_t  * socketpool;        /**< Pool of sockets used by this network */
-    queue_t       * sendq;             /**< Queue containing packet to send  (probe_t instances) */
+    fair_queue_t  * sendq;             /**< Probes to send (probe_t instances), queued per algorithm instance */
     queue_t       * recvq;             /**< Queue containing received packet (packet_t instances) */
     sniffer_t     * sniffer;           /**< Sniffer to use on this network */
-    dynarray_t    * probes;            /**< Probes in transit, from the oldest probe_t instance to the youngest one. */
+    dgrampool_t   * dgrampool;         /**< Unprivileged backend, used instead of socketpool and sniffer if raw sockets are not available (NULL otherwise) */
+    dynarray_t    * stalled_probes;    /**< Probes waiting for a socket of the dgrampool (see dgrampool_release_probe) */
+    uring_t       * uring;             /**< io_uring engine exchanging the packets of socketpool and sniffer (NULL if unused, see --io-uring) */
+    dynarray_t    * unflushed_probes;  /**< Probes sent through uring and not yet submitted (referenced), see network_flush */
+    dynarray_t    * probes;            /**< Probes in transit, sorted by expiration time. */
+    probe_archive_t * archive;         /**< Probes recently answered or expired, used to classify the unmatched replies */
     int             timerfd;           /**< Used for probe timeouts. Linux specific. Activated when a probe timeout occurs */
     uint16_t        last_tag;          /**< Last probe ID used */
+    uint16_t        src_port_min;      /**< Lowest source port used by the probes sent so far */
+    uint16_t        src_port_max;      /**< Highest source port used by the probes sent so far */
     double          timeout;           /**< The timeout value used by this network (in seconds) */
+    size_t          max_retries;       /**< Maximum number of retransmissions of a probe (0 if disabled) */
+    network_hop_t ** hops;             /**< Hash table of the hops recently probed (NETWORK_HOP_BUCKETS chains), only maintained if max_retries > 0 */
+    size_t          hops_cursor;       /**< Next bucket of hops swept for expired hops */
+    unsigned int    seed;              /**< Seed of the jitter applied to the waits (see rand_r) */
+    size_t          sendq_size;        /**< Maximum number of probes waiting to be sent (0 if unbounded) */
+    size_t          num_queued_probes; /**< Number of probes waiting to be sent (in sendq, scheduled or stalled) */
+    dynarray_t    * blocked_callers;   /**< Algorithm instances which could not send a probe because the sendq was full */
 #ifdef USE_SCHEDULING
     int             scheduled_timerfd; /**< Used for probe delays. Activated when a probe delay occurs */
     probe_group_t * scheduled_probes;  /**< Scheduled probes */
 #endif
     bool            is_verbose;        /**< Print debug messages*/
+    metrics_t       metrics;           /**< Counters and histograms related to this network (see network_get_metrics) */
 } network_t;
 
 /**
@@ -174,6 +254,23 @@ double network_get_timeout(const network_t * network);
 
 void network_set_is_verbose(network_t * network, bool verbose);
 
+/**
+ * \brief Set the maximum number of retransmissions of a probe.
+ * \param network The network layer.
+ * \param max_retries The maximum number of retransmissions (0 disables
+ *    retransmissions).
+ */
+
+void network_set_max_retries(network_t * network, size_t max_retries);
+
+/**
+ * \brief Set the maximum number of probes waiting to be sent.
+ * \param network The network layer.
+ * \param sendq_size The maximum number of probes (0 if unbounded).
+ */
+
+void network_set_sendq_size(network_t * network, size_t sendq_size);
+
 /**
  * \brief Set a new timeout for the network structure.
  * \param network The network layer.
@@ -244,6 +341,17 @@ probe_group_t * network_get_group_probes(network_t * network);
 
 bool network_process_sendq(network_t * network);
 
+/**
+ * \brief Send the packets stored in network->sendq. With io_uring, the
+ *    sendq is drained up to the free space of the submission ring, so that
+ *    the whole burst is submitted at once by network_flush. Otherwise, a
+ *    single packet is sent.
+ * \param network The network layer.
+ * \return true iif successful
+ */
+
+bool network_drain_sendq(network_t * network);
+
 /**
  * \brief Process received packets: match them with a probe, or discard them.
  * In practice, the receive queue stores all the packets handled by the sniffer.
@@ -263,10 +371,48 @@ bool network_process_recvq(network_t * network);
 void network_process_sniffer(network_t * network, uint8_t protocol_id);
 
 /**
- * \brief Drop the oldest flying probe (if any) attached to a network_t
- *    instance. The oldest probe is removed from network->probes
- *    and network->timerfd is refreshed to manage the next timeout
- *    if there is still at least one flying probe.
+ * \brief Make the network layer query its embedded sniffer instance in order
+ *   to fetch a received packet.
+ * \param network The network layer.
+ * \param family The family of the packet to fetch (AF_INET, AF_INET6)
+ * \param protocol_id The protocol of the packet to fetch (IPPROTO_ICMP,
+ *   IPPROTO_ICMPV6, IPPROTO_TCP, IPPROTO_UDP)
+ */
+
+void network_process_sniffer_ext(network_t * network, int family, uint8_t protocol_id);
+
+/**
+ * \brief Make the network layer query its embedded dgrampool instance in
+ *   order to fetch the received errors and datagrams.
+ * \param network The network layer.
+ */
+
+void network_process_dgrampool(network_t * network);
+
+/**
+ * \brief Make the network layer process the requests completed by its
+ *   embedded uring instance (e.g. packets received).
+ * \param network The network layer.
+ */
+
+void network_process_uring(network_t * network);
+
+/**
+ * \brief Submit the pending requests of the embedded uring instance, if
+ *   any. pt_loop calls this function once per iteration. The sending time
+ *   of the probes sent since the last call is updated.
+ * \param network The network layer.
+ * \return true iif successful.
+ */
+
+bool network_flush(network_t * network);
+
+/**
+ * \brief Drop the expired flying probes (if any) attached to a network_t
+ *    instance. Each of them is either retransmitted (see --retries), or
+ *    removed from network->probes and notified by a PROBE_TIMEOUT event.
+ *    network->timerfd is refreshed to manage the next timeout if there
+ *    is still at least one flying probe.
  * \param network The network layer.
  * \return true iif successful
  */
@@ -274,12 +420,75 @@ void network_process_sniffer(network_t * network, uint8_t protocol_id);
 bool network_drop_expired_flying_probe(network_t * network);
 
 /**
- * \brief handle the scheduled probes when network->scheduled_timerfd is activated
+ * \brief Queue a probe for sending. The network layer takes over the
+ *    reference to the probe held by the caller if successful.
+ *
+ *    The number of probes waiting to be sent is bounded (see --sendq-size).
+ *    Once this bound is reached, the probe is rejected and errno is set to
+ *    EAGAIN. The algorithm instance which has sent it (see probe->caller)
+ *    then receives a NETWORK_WRITABLE event once half of the sendq has
+ *    been drained, and may send its pending probes again.
  * \param network The network layer.
+ * \param probe The probe to send.
+ * \return true iif successful. Otherwise, the caller keeps its reference.
  */
 
 bool network_send_probe(network_t * network, probe_t * probe);
 
+/**
+ * \brief Set the share of the sendq granted to an algorithm instance.
+ *    The probes of each instance are queued separately, and the queues
+ *    are drained by deficit round robin (see fair_queue.h), so that an
+ *    instance sending many probes does not delay the other ones.
+ * \param network The network layer.
+ * \param caller The algorithm instance.
+ * \param weight The number of probes sent in a row for this instance
+ *    (by default, FAIR_QUEUE_DEFAULT_WEIGHT).
+ * \param is_priority Pass true if the probes of this instance must be
+ *    sent before the other ones (e.g. latency-sensitive pings).
+ * \return true iif successful.
+ */
+
+bool network_set_caller_class(network_t * network, const void * caller, size_t weight, bool is_priority);
+
+/**
+ * \brief Forget an algorithm instance, which is about to be freed, so
+ *    that no more event is sent to it for the probes it has sent. Its
+ *    probes not sent yet and its flying probes are dropped.
+ * \param network The network layer.
+ * \param caller The algorithm instance.
+ */
+
+void network_forget_caller(network_t * network, const void * caller);
+
+/**
+ * \brief Retrieve the counters and histograms of a network layer.
+ * \param network The network layer.
+ * \return The corresponding metrics_t instance.
+ */
+
+const metrics_t * network_get_metrics(network_t * network);
+
+/**
+ * \brief Tag a probe, i.e. assign it an available tag and encode this tag
+ *    in the checksum of its first layer (see network_send_probe).
+ * \param network The network layer.
+ * \param probe The probe to tag.
+ * \return true iif successful.
+ */
+
+bool network_tag_probe(network_t * network, probe_t * probe);
+
+/**
+ * \brief Find the flying probe which has provoked a reply and remove it
+ *    from the flying probes (see network_process_recvq).
+ * \param network The network layer.
+ * \param reply The probe_t instance related to a sniffed packet.
+ * \return The matching probe, NULL if not found.
+ */
+
+probe_t * network_get_matching_probe(network_t * network, const probe_t * reply);
+
 #ifdef USE_SCHEDULING
 
 /**
@@ -323,10 +532,31 @@ bool update_timer(int timerfd, double delay);
  * \brief Retrieve the socket file descriptor related to the ICMPv4
  *    raw socket managed by network->sniffer.
  * \param network The network layer..
- * \return The corresponding socket file descriptor.
+ * \return The corresponding socket file descriptor, -1 if the network
+ *    layer relies on a dgrampool.
  */
 
 int network_get_icmpv4_sockfd(network_t * network);
+
+/**
+ * \brief Retrieve the socket file descriptor related to the IPv4/TCP
+ *    raw socket managed by network->sniffer.
+ * \param network The network layer.
+ * \return The corresponding socket file descriptor, -1 if the network
+ *    layer relies on a dgrampool.
+ */
+
+int network_get_tcpv4_sockfd(network_t * network);
+
+/**
+ * \brief Retrieve the socket file descriptor related to the IPv4/UDP
+ *    raw socket managed by network->sniffer.
+ * \param network The network layer.
+ * \return The corresponding socket file descriptor, -1 if the network
+ *    layer relies on a dgrampool.
+ */
+
+int network_get_udpv4_sockfd(network_t * network);
 #endif
 
 #ifdef USE_IPV6
@@ -334,10 +564,50 @@ int network_get_icmpv4_sockfd(network_t * network);
  * \brief Retrieve the socket file descriptor related to the ICMPv6
  *    raw socket managed by network->sniffer.
  * \param network The network layer..
- * \return The corresponding socket file descriptor.
+ * \return The corresponding socket file descriptor, -1 if the network
+ *    layer relies on a dgrampool.
  */
 
 int network_get_icmpv6_sockfd(network_t * network);
+
+/**
+ * \brief Retrieve the socket file descriptor related to the IPv6/TCP
+ *    raw socket managed by network->sniffer.
+ * \param network The network layer.
+ * \return The corresponding socket file descriptor, -1 if the network
+ *    layer relies on a dgrampool.
+ */
+
+int network_get_tcpv6_sockfd(network_t * network);
+
+/**
+ * \brief Retrieve the socket file descriptor related to the IPv6/UDP
+ *    raw socket managed by network->sniffer.
+ * \param network The network layer.
+ * \return The corresponding socket file descriptor, -1 if the network
+ *    layer relies on a dgrampool.
+ */
+
+int network_get_udpv6_sockfd(network_t * network);
 #endif
 
+/**
+ * \brief Retrieve the file descriptor related to the dgrampool
+ *    managed by the network layer.
+ * \param network The network layer.
+ * \return The corresponding file descriptor, -1 if the network layer
+ *    relies on raw sockets.
+ */
+
+int network_get_dgrampool_fd(network_t * network);
+
+/**
+ * \brief Retrieve the file descriptor related to the uring instance
+ *    managed by the network layer.
+ * \param network The network layer.
+ * \return The corresponding file descriptor, -1 if io_uring is not used.
+ */
+
+int network_get_uring_fd(network_t * network);
+
 #endif // LIBPT_NETWORK_H
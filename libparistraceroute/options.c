@@ -184,6 +184,16 @@ bool options_add_common(options_t * options, char * version)
 
 int options_parse(options_t * options, const char * usage, char ** args)
 {
+    option_t end = END_OPT_SPECS;
+    int      ret;
+
+    // opt_parse() expects an array terminated by END_OPT_SPECS. The vector
+    // only ends with a zeroed cell if it is not full, so a terminator is
+    // pushed while parsing and removed afterwards.
+    if (!vector_push_element(options->optspecs, &end)) return -1;
+
     opt_options1st();
-    return opt_parse(usage, (struct opt_spec *)(options->optspecs->cells), args);
+    ret = opt_parse(usage, (struct opt_spec *) vector_get_cells(options->optspecs), args);
+    vector_del_ith_element(options->optspecs, vector_get_num_cells(options->optspecs) - 1);
+    return ret;
 }
@@ -19,6 +19,7 @@ int timerfd_settime(
 );
 
 #  define CLOCK_REALTIME 0 // from <linux/time.h>
+#  define TFD_NONBLOCK 04000 // from <sys/timerfd.h>
 
 int timerfd_create(int clockid, int flags);
 
@@ -6,6 +6,7 @@
 #include <sys/socket.h> // AF_INET, AF_INET6
 
 #include "packet.h"
+#include "packet_pool.h" // packet_pool_put_packet
 
 packet_t * packet_create() {
     packet_t * packet;
@@ -13,6 +14,7 @@ packet_t * packet_create() {
     if (!(packet = calloc(1, sizeof(packet_t)))) goto ERR_CALLOC;
     if (!(packet->buffer = buffer_create()))     goto ERR_BUFFER_CREATE;
     if (!(packet->dst_ip = address_create()))    goto ERR_ADDRESS_CREATE;
+    packet->refcount = 1;
     return packet;
 
 ERR_ADDRESS_CREATE:
@@ -29,6 +31,7 @@ packet_t * packet_wrap_bytes(uint8_t * bytes, size_t num_bytes) {
     if ((packet = packet_create())) {
         packet->buffer->data = bytes;
         packet->buffer->size = num_bytes;
+        packet->buffer->capacity = num_bytes;
     }
     return packet;
 }
@@ -50,6 +53,9 @@ packet_t * packet_dup(const packet_t * packet) {
         if (packet->dst_ip) {
             if (!(ret->dst_ip = address_dup(packet->dst_ip))) goto ERR_DST_IP_DUP;
         } else ret->dst_ip = NULL;
+        ret->recv_time = packet->recv_time;
+        ret->refcount = 1;
+        ret->pool = NULL;
     }
 
     return ret;
@@ -57,11 +63,25 @@ packet_t * packet_dup(const packet_t * packet) {
 ERR_DST_IP_DUP:
     buffer_free(ret->buffer);
 ERR_BUFFER_DUP:
+    free(ret);
     return NULL;
 }
 
+packet_t * packet_ref(packet_t * packet) {
+    packet->refcount++;
+    return packet;
+}
+
+bool packet_is_shared(const packet_t * packet) {
+    return packet->refcount > 1;
+}
+
 void packet_free(packet_t * packet) {
-    if (packet) {
+    if (packet && --packet->refcount == 0) {
+        if (packet->pool) {
+            packet_pool_put_packet(packet->pool, packet);
+            return;
+        }
         if (packet->buffer) {
             buffer_free(packet->buffer);
         }
@@ -74,6 +94,10 @@ bool packet_resize(packet_t * packet, size_t new_size) {
     return buffer_resize(packet->buffer, new_size);
 }
 
+bool packet_reserve(packet_t * packet, size_t capacity) {
+    return buffer_reserve(packet->buffer, capacity);
+}
+
 uint8_t * packet_get_bytes(const packet_t * packet) {
     return buffer_get_data(packet->buffer);
 }
@@ -21,6 +21,14 @@ typedef struct packet_s {
     // to send the packet.
 
     address_t * dst_ip;   /**< Destination address (mandatory) */
+
+    // The following field is set when the packet is received.
+
+    double      recv_time; /**< Reception time provided by the kernel, 0 if unknown */
+
+    size_t      refcount;  /**< Number of references to this packet (see packet_ref) */
+
+    struct packet_pool_s * pool; /**< Pool to which the packet is given back once released (NULL if none, see packet_pool.h) */
 } packet_t;
 
 /**
@@ -40,8 +48,9 @@ packet_t * packet_create();
 packet_t * packet_create_from_bytes(uint8_t * bytes, size_t num_bytes);
 
 /**
- * \brief Create a new packet.
- * \param bytes The bytes carried by the packet.
+ * \brief Create a new packet around some bytes, without copying them.
+ * \param bytes The bytes carried by the packet. They must have been
+ *    allocated by malloc(), and are released along with the packet.
  * \param num_bytes The packet size (in bytes).
  * \return The newly allocated packet_t instance, NULL in case of failure.
  */
@@ -56,6 +65,16 @@ packet_t * packet_wrap_bytes(uint8_t * bytes, size_t num_bytes);
 
 bool packet_resize(packet_t * packet, size_t new_size);
 
+/**
+ * \brief Reserve memory so that a packet can grow up to a given size
+ *    without being reallocated (see buffer_reserve).
+ * \param packet A packet_t instance.
+ * \param capacity The minimal capacity of the packet (in bytes).
+ * \return true iif successful.
+ */
+
+bool packet_reserve(packet_t * packet, size_t capacity);
+
 /**
  * \brief Retrieve the size of a given packet.
  * \param packet The queried packet.
@@ -82,7 +101,25 @@ uint8_t * packet_get_bytes(const packet_t * packet);
 packet_t * packet_dup(const packet_t * packet);
 
 /**
- * \brief Delete a packet.
+ * \brief Take a new reference to a packet. A shared packet must not be
+ *    altered (see packet_is_shared).
+ * \param packet A packet_t instance.
+ * \return The packet.
+ */
+
+packet_t * packet_ref(packet_t * packet);
+
+/**
+ * \brief Test whether a packet is referenced several times.
+ * \param packet A packet_t instance.
+ * \return true iif the packet is shared.
+ */
+
+bool packet_is_shared(const packet_t * packet);
+
+/**
+ * \brief Release a reference to a packet. The packet is deleted (or
+ *    given back to its pool) once its last reference is released.
  * \param packet Pointer to the packet structure to delete.
  */
 
@@ -0,0 +1,86 @@
+#include "config.h"
+
+#include <stdlib.h>       // malloc, free
+
+#include "packet_pool.h"
+
+packet_pool_t * packet_pool_create(size_t packet_size, size_t max_free_packets) {
+    packet_pool_t * pool;
+
+    if (!(pool = malloc(sizeof(packet_pool_t))))                                    goto ERR_MALLOC;
+    if (!(pool->free_packets = malloc((max_free_packets + 1) * sizeof(packet_t *)))) goto ERR_FREE_PACKETS;
+
+    pool->num_free_packets = 0;
+    pool->max_free_packets = max_free_packets;
+    pool->packet_size = packet_size;
+    pool->refcount = 1;
+    return pool;
+
+ERR_FREE_PACKETS:
+    free(pool);
+ERR_MALLOC:
+    return NULL;
+}
+
+/**
+ * \brief Release a reference to a packet_pool_t instance, and free it
+ *    (along with the packets it stores) once no more referenced.
+ * \param pool A packet_pool_t instance.
+ */
+
+static void packet_pool_release(packet_pool_t * pool) {
+    packet_t * packet;
+
+    if (--pool->refcount == 0) {
+        while (pool->num_free_packets) {
+            packet = pool->free_packets[--pool->num_free_packets];
+            packet->pool = NULL;
+            packet->refcount = 1;
+            packet_free(packet);
+        }
+        free(pool->free_packets);
+        free(pool);
+    }
+}
+
+void packet_pool_free(packet_pool_t * pool) {
+    if (pool) packet_pool_release(pool);
+}
+
+packet_t * packet_pool_get_packet(packet_pool_t * pool) {
+    packet_t * packet;
+
+    if (pool->num_free_packets) {
+        packet = pool->free_packets[--pool->num_free_packets];
+    } else {
+        if (!(packet = packet_create()))                        goto ERR_PACKET_CREATE;
+        if (!buffer_resize(packet->buffer, pool->packet_size)) goto ERR_BUFFER_RESIZE;
+        packet->pool = pool;
+    }
+
+    // The buffer is never shrunk (see buffer_resize), so it can hold
+    // pool->packet_size bytes.
+    buffer_set_size(packet->buffer, pool->packet_size);
+    packet->recv_time = 0;
+    packet->refcount = 1;
+    pool->refcount++;
+    return packet;
+
+ERR_BUFFER_RESIZE:
+    packet_free(packet);
+ERR_PACKET_CREATE:
+    return NULL;
+}
+
+void packet_pool_put_packet(packet_pool_t * pool, packet_t * packet) {
+    if (pool->num_free_packets < pool->max_free_packets
+    &&  packet->buffer->capacity >= pool->packet_size
+    ) {
+        pool->free_packets[pool->num_free_packets++] = packet;
+    } else {
+        packet->pool = NULL;
+        packet->refcount = 1;
+        packet_free(packet);
+    }
+    packet_pool_release(pool);
+}
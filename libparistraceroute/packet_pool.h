@@ -0,0 +1,77 @@
+#ifndef LIBPT_PACKET_POOL_H
+#define LIBPT_PACKET_POOL_H
+
+/**
+ * \file packet_pool.h
+ * \brief Pool of packets used to receive replies.
+ *
+ * Each sniffed packet used to be received in a buffer on the stack, and
+ * then copied into a newly allocated packet_t. A packet_pool_t provides
+ * packets whose buffer is large enough to receive any reply, so that the
+ * sniffer receives the bytes directly into the packet. Once released (see
+ * packet_free), such a packet is given back to its pool and reused by the
+ * next reception, so that a reply costs neither an allocation nor a copy
+ * in steady state.
+ *
+ * The pool is referenced by each packet it has provided, so it may be
+ * released (see packet_pool_free) while some of its packets are still in
+ * use, e.g. by the user program.
+ */
+
+#include <stddef.h>     // size_t
+
+#include "packet.h"     // packet_t
+
+#define PACKET_POOL_MAX_FREE_PACKETS 256 /**< Default number of released packets kept by a pool */
+
+/**
+ * \struct packet_pool_t
+ * \brief A pool of packets having the same capacity.
+ */
+
+typedef struct packet_pool_s {
+    packet_t ** free_packets;     /**< Released packets, ready to be reused */
+    size_t      num_free_packets; /**< Number of packets stored in free_packets */
+    size_t      max_free_packets; /**< Maximum number of packets stored in free_packets */
+    size_t      packet_size;      /**< Capacity of the packets provided by the pool (in bytes) */
+    size_t      refcount;         /**< Number of references to this pool (its owner and the packets in use) */
+} packet_pool_t;
+
+/**
+ * \brief Create a packet_pool_t instance.
+ * \param packet_size The capacity of the packets provided by the pool.
+ * \param max_free_packets The maximum number of released packets kept by
+ *    the pool. The packets released once this bound is reached are freed.
+ * \return The newly created instance, NULL in case of failure.
+ */
+
+packet_pool_t * packet_pool_create(size_t packet_size, size_t max_free_packets);
+
+/**
+ * \brief Release a packet_pool_t instance. The pool is actually freed
+ *    once every packet it has provided has been released.
+ * \param pool A packet_pool_t instance.
+ */
+
+void packet_pool_free(packet_pool_t * pool);
+
+/**
+ * \brief Get a packet from a pool.
+ * \param pool A packet_pool_t instance.
+ * \return A packet whose size is equal to pool->packet_size (its bytes
+ *    are not initialized), NULL in case of failure. It must be released
+ *    by packet_free(), which gives it back to the pool.
+ */
+
+packet_t * packet_pool_get_packet(packet_pool_t * pool);
+
+/**
+ * \brief Give back a packet which is no more referenced to its pool.
+ *    This function is called by packet_free().
+ * \param pool The pool which has provided the packet.
+ * \param packet The released packet.
+ */
+
+void packet_pool_put_packet(packet_pool_t * pool, packet_t * packet);
+
+#endif // LIBPT_PACKET_POOL_H
@@ -9,7 +9,6 @@
 #include <sys/socket.h>     // AF_INET*
 
 #include "probe.h"          // probe_t
-#include "buffer.h"         // buffer_t
 #include "protocol.h"       // protocol_t
 #include "common.h"         // ELEMENT_FREE
 #include "generator.h"      // generator_*
@@ -40,6 +39,8 @@ static bool probe_update_protocol(probe_t * probe);
 /**
  * \brief Update for each layer of a probe its 'length' field
  *   (if any) in order to have a coherent sequence of layers.
+ *   This is done once the layers and the payload are set, rather
+ *   than each time the packet is resized.
  * \param probe The probe we're updating
  * \return true iif successfull
  */
@@ -53,11 +54,14 @@ static bool probe_update_length(probe_t * probe);
 /**
  * \brief Add a layer in the probe. Fields 'length', 'checksum' and
  *    so on are not recomputed.
- * \param layer The layer we're adding to the probe. It is not duplicated.
- * \return true iif successfull
+ * \param protocol The protocol of the layer (NULL for the payload).
+ * \param segment The first byte of the layer in the packet.
+ * \param segment_size The size of the layer (in bytes).
+ * \return The newly added layer, NULL in case of failure. It remains
+ *    valid until the next layer is added.
  */
 
-static bool probe_push_layer(probe_t * probe, layer_t * layer);
+static layer_t * probe_push_layer(probe_t * probe, const protocol_t * protocol, uint8_t * segment, size_t segment_size);
 
 /**
  * \brief Add a payload layer in the probe. Fields 'length', 'checksum' and
@@ -86,9 +90,20 @@ static void probe_layers_clear(probe_t * probe);
 // Other static functions
 //-----------------------------------------------------------
 
+/**
+ * \brief Move the segment of each layer of a probe, e.g. because its
+ *   packet has been reallocated. Each layer keeps its offset.
+ * \param probe The probe we're updating
+ * \param old_bytes The former address of the packet.
+ * \param new_bytes The new address of the packet.
+ */
+
+static void probe_move_layers(probe_t * probe, const uint8_t * old_bytes, uint8_t * new_bytes);
+
 /**
  * \brief Resize the packet managed by a probe instance.
- *   Update nested layer pointers and sizes consequently.
+ *   Update nested layer pointers consequently. The 'length' fields
+ *   and the size of the payload layer are left to probe_update_length.
  * \param probe The probe we're updating
  * \param size The new packet size
  * \return true iif successfull
@@ -118,16 +133,6 @@ static bool probe_finalize(probe_t * probe)
     return ret;
 }
 
-static bool layer_set_field_and_free(layer_t * layer, field_t * field) {
-    bool ret = false;
-
-    if (field) {
-        ret = layer_set_field(layer, field);
-        field_free(field);
-    }
-    return ret;
-}
-
 static bool probe_update_protocol(probe_t * probe)
 {
     size_t    i, num_layers = probe_get_num_layers(probe);
@@ -138,7 +143,7 @@ static bool probe_update_protocol(probe_t * probe)
         layer = probe_get_layer(probe, i);
         if (layer->protocol && prev_layer) {
             // Update 'protocol' field (if any)
-            layer_set_field_and_free(prev_layer, I8("protocol", layer->protocol->protocol));
+            layer_set_field(prev_layer, I8("protocol", layer->protocol->protocol));
         }
     }
     return true;
@@ -151,14 +156,21 @@ static bool probe_update_length(probe_t * probe)
               num_layers = probe_get_num_layers(probe),
               packet_size = probe_get_size(probe);
     layer_t * layer;
+    field_t   length = {
+        .key  = "length",
+        .type = TYPE_UINT16
+    };
 
     for (i = 0, offset = 0; i < num_layers; i++) {
         layer = probe_get_layer(probe, i);
         if (layer->protocol) {
-            // Update 'length' field (if any)
+            // Update 'length' field (if any). It concerns IPv* and UDP, but not TCP or ICMPv*
             // This protocol field must always corresponds to the size of the
             // header + its contents.
-            layer_set_field_and_free(layer, I16("length", packet_size - offset));
+            if (protocol_get_field(layer->protocol, "length")) {
+                length.value.int16 = packet_size - offset;
+                ret &= layer_set_field(layer, &length);
+            }
             offset += layer->protocol->get_header_size(layer->segment);
         } else {
             // Update payload size
@@ -171,10 +183,15 @@ static bool probe_update_length(probe_t * probe)
 
 bool probe_update_checksum(probe_t * probe)
 {
-    size_t     i, j, num_layers = probe_get_num_layers(probe);
-    layer_t  * layer,
-             * layer_prev;
-    buffer_t * pseudo_header;
+    size_t    i, j, psh_size, num_layers = probe_get_num_layers(probe);
+    layer_t * layer,
+            * layer_prev;
+    union {
+        uint8_t  bytes[PROTOCOL_PSEUDO_HEADER_MAX_SIZE];
+        uint32_t align;
+    } pseudo_header;
+
+    if (!probe_unshare_packet(probe)) return false;
 
     // Update each layers from the (last - 1) one to the first one.
     for (j = 0; j < num_layers; j++) {
@@ -186,7 +203,7 @@ bool probe_update_checksum(probe_t * probe)
 
             // Compute the checksum according to the layer's buffer and
             // the pseudo header (if any).
-            if (layer->protocol->create_pseudo_header) {
+            if (layer->protocol->write_pseudo_header) {
                 if (i == 0) {
                     // This layer has no previous layer which is required to compute its checksum.
                     fprintf(stderr, "No previous layer which is required to compute '%s' checksum\n", layer->protocol->name);
@@ -204,27 +221,27 @@ bool probe_update_checksum(probe_t * probe)
                         return false;
                     }
 
-                    if (!(pseudo_header = layer->protocol->create_pseudo_header(layer_prev->segment))) {
+                    // The pseudo header is built on the stack: probe_set_fields
+                    // must not allocate anything on the send path.
+                    if (!(psh_size = layer->protocol->write_pseudo_header(pseudo_header.bytes, layer_prev->segment))) {
+                        errno = EINVAL;
                         return false;
                     }
                 }
-            } else pseudo_header = NULL;
+            } else psh_size = 0;
 
             // Update the checksum of this layer
-            if (!layer->protocol->write_checksum(layer->segment, pseudo_header)) {
+            if (!layer->protocol->write_checksum(layer->segment, psh_size ? pseudo_header.bytes : NULL, psh_size)) {
                 fprintf(stderr, "Error while updating checksum (layer %s)\n", layer->protocol->name);
                 return false;
             }
-
-            // Release the pseudo header (if any) from the memory
-            if (pseudo_header) buffer_free(pseudo_header);
         }
     }
     return true;
 }
 
 layer_t * probe_get_layer(const probe_t * probe, size_t i) {
-    return dynarray_get_ith_element(probe->layers, i);
+    return i < probe->num_layers ? probe->layers + i : NULL;
 }
 
 layer_t * probe_get_layer_payload(const probe_t * probe) {
@@ -240,8 +257,45 @@ layer_t * probe_get_layer_payload(const probe_t * probe) {
     return last_layer && last_layer->protocol ? NULL : last_layer;
 }
 
-static bool probe_push_layer(probe_t * probe, layer_t * layer) {
-    return dynarray_push_element(probe->layers, layer);
+/**
+ * \brief Ensure that a probe can store a given number of layers. The
+ *    layers are moved from probe->inline_layers to the heap if needed.
+ * \param probe The probe we're updating
+ * \param num_layers The number of layers to store
+ * \return true iif successfull
+ */
+
+static bool probe_reserve_layers(probe_t * probe, size_t num_layers) {
+    layer_t * layers;
+    size_t    max_layers = probe->max_layers;
+
+    if (num_layers <= max_layers) return true;
+    while (max_layers < num_layers) max_layers *= 2;
+
+    if (probe->layers == probe->inline_layers) {
+        if (!(layers = malloc(max_layers * sizeof(layer_t)))) return false;
+        memcpy(layers, probe->inline_layers, probe->num_layers * sizeof(layer_t));
+    } else if (!(layers = realloc(probe->layers, max_layers * sizeof(layer_t)))) {
+        return false;
+    }
+
+    probe->layers = layers;
+    probe->max_layers = max_layers;
+    return true;
+}
+
+static layer_t * probe_push_layer(probe_t * probe, const protocol_t * protocol, uint8_t * segment, size_t segment_size) {
+    layer_t * layer;
+
+    if (!probe_reserve_layers(probe, probe->num_layers + 1)) return NULL;
+    metafield_program_clear(&probe->flow_id);
+
+    layer = probe->layers + probe->num_layers++;
+    layer->protocol     = protocol;
+    layer->segment      = segment;
+    layer->mask         = NULL;
+    layer->segment_size = segment_size;
+    return layer;
 }
 
 static bool probe_push_payload(probe_t * probe, size_t payload_size) {
@@ -267,12 +321,8 @@ static bool probe_push_payload(probe_t * probe, size_t payload_size) {
     packet_size = probe_get_size(probe) ;
     payload_bytes = packet_get_bytes(probe->packet) + packet_size - payload_size;
 
-    if (!(payload_layer = layer_create_from_segment(NULL, payload_bytes, payload_size))) {
-        goto ERR_LAYER_CREATE;
-    }
-
     // Add the payload layer in the probe
-    if (!(probe_push_layer(probe, payload_layer))) {
+    if (!(payload_layer = probe_push_layer(probe, NULL, payload_bytes, payload_size))) {
         fprintf(stderr, "Can't push payload layer\n");
         goto ERR_PUSH_LAYER;
     }
@@ -288,49 +338,47 @@ static bool probe_push_payload(probe_t * probe, size_t payload_size) {
     return true;
 
 ERR_PAYLOAD_RESIZE:
-    dynarray_del_ith_element(probe->layers, probe_get_num_layers(probe) - 1, NULL);
+    probe->num_layers--;
 ERR_PUSH_LAYER:
-    layer_free(payload_layer);
-ERR_LAYER_CREATE:
 ERR_NO_FIRST_LAYER:
 ERR_PAYLOAD_ALREADY_SET:
     return false;
 }
 
 static void probe_layers_free(probe_t * probe) {
-    dynarray_free(probe->layers, (ELEMENT_FREE) layer_free);
+    if (probe->layers != probe->inline_layers) {
+        free(probe->layers);
+    }
 }
 
 static void probe_layers_clear(probe_t * probe) {
-    dynarray_clear(probe->layers, (ELEMENT_FREE) layer_free);
+    metafield_program_clear(&probe->flow_id);
+    probe->num_layers = 0;
 }
 
-static bool probe_packet_resize(probe_t * probe, size_t size) {
-    size_t    offset = 0, // offset between the begining of the packet and the current position
-              i, num_layers = probe_get_num_layers(probe);
+static void probe_move_layers(probe_t * probe, const uint8_t * old_bytes, uint8_t * new_bytes) {
+    size_t    i, num_layers = probe_get_num_layers(probe);
     layer_t * layer;
-    uint8_t * segment;
-
-    if (!packet_resize(probe->packet, size)) {
-        return false;
-    }
 
-    // TODO update bitfield
+    if (old_bytes == new_bytes) return;
 
-    // Update each layer's segment
     for (i = 0; i < num_layers; i++) {
         layer = probe_get_layer(probe, i);
-        segment = packet_get_bytes(probe->packet) + offset;
-        layer_set_segment(layer, segment);
+        layer_set_segment(layer, new_bytes + (layer_get_segment(layer) - old_bytes));
+    }
+}
 
-        if (layer->protocol) {
-            // We're in a layer related to a protocol. Update "length" field (if any).
-            // It concerns: ipv4, ipv6, udp but not tcp, icmpv4, icmpv6
-            layer_set_field_and_free(layer, I16("length", size - offset));
-            offset += layer->segment_size;
-        }
+static bool probe_packet_resize(probe_t * probe, size_t size) {
+    uint8_t * old_bytes = packet_get_bytes(probe->packet);
+
+    // The packet is only reallocated if it exceeds its tailroom
+    if (!packet_resize(probe->packet, size)) {
+        return false;
     }
 
+    // TODO update bitfield
+
+    probe_move_layers(probe, old_bytes, packet_get_bytes(probe->packet));
     return true;
 }
 
@@ -338,30 +386,85 @@ static bool probe_packet_resize(probe_t * probe, size_t size) {
 // Allocation
 //-----------------------------------------------------------
 
-probe_t * probe_create()
+#ifdef USE_SCHEDULING
+/**
+ * \brief (Internal use) Copy a delay in a probe. A scalar delay is
+ *    copied by value, so that scheduling a probe does not allocate
+ *    anything. A generator is duplicated.
+ * \param probe The probe we're updating. Its previous delay is released.
+ * \param delay The delay to copy, or NULL to unschedule the probe.
+ * \return true iif successful
+ */
+
+static bool probe_copy_delay(probe_t * probe, const field_t * delay)
+{
+    generator_t * generator = NULL;
+
+    if (delay && delay->type == TYPE_GENERATOR) {
+        if (!(generator = generator_dup(delay->value.generator))) return false;
+    }
+
+    if (probe->delay.key && probe->delay.type == TYPE_GENERATOR) {
+        generator_free(probe->delay.value.generator);
+    }
+
+    if (delay) {
+        probe->delay.key   = "delay";
+        probe->delay.type  = delay->type;
+        probe->delay.value = delay->value;
+        if (generator) probe->delay.value.generator = generator;
+    } else {
+        probe->delay.key = NULL;
+    }
+    return true;
+}
+#endif
+
+/**
+ * \brief Create a probe_t instance without any layer around a packet.
+ * \param packet The packet of the probe. It is left to the caller
+ *    in case of failure.
+ * \return The newly created probe, NULL in case of failure.
+ */
+
+static probe_t * probe_create_from_packet(packet_t * packet)
 {
     probe_t * probe;
 
     // We calloc probe to set *_time and caller members to 0
     if (!(probe = calloc(1, sizeof(probe_t))))   goto ERR_PROBE;
-    if (!(probe->packet = packet_create())) {
-        fprintf(stderr, "Cannot create packet\n");
-        goto ERR_PACKET;
-    }
-    if (!(probe->layers = dynarray_create()))    goto ERR_LAYERS;
 //    if (!(probe->bitfield = bitfield_create(0))) goto ERR_BITFIELD;
+    probe->layers = probe->inline_layers;
+    probe->max_layers = PROBE_NUM_INLINE_LAYERS;
+    probe->packet = packet;
     probe_set_left_to_send(probe, 1);
+    probe->refcount = 1;
     return probe;
 
     /*
 ERR_BITFIELD:
     probe_layers_free(probe);
-    */
-ERR_LAYERS:
-    packet_free(probe->packet);
-ERR_PACKET:
     free(probe);
+    */
+ERR_PROBE:
+    return NULL;
+}
+
+probe_t * probe_create()
+{
+    probe_t  * probe;
+    packet_t * packet;
+
+    if (!(packet = packet_create())) {
+        fprintf(stderr, "Cannot create packet\n");
+        goto ERR_PACKET;
+    }
+    if (!(probe = probe_create_from_packet(packet))) goto ERR_PROBE;
+    return probe;
+
 ERR_PROBE:
+    packet_free(packet);
+ERR_PACKET:
     return NULL;
 }
 
@@ -369,33 +472,54 @@ probe_t * probe_dup(const probe_t * probe) {
     probe_t  * ret;
     packet_t * packet;
 
-    if (!(packet = packet_dup(probe->packet)))            goto ERR_PACKET_DUP;
-    if (!(ret = probe_wrap_packet(packet)))               goto ERR_PROBE_WRAP_PACKET;
+    // The packet is copied on write (see probe_unshare_packet), so the
+    // layers of the skeleton are valid as is and need not to be parsed again.
+    packet = packet_ref(probe->packet);
+    if (!(ret = probe_create_from_packet(packet)))        goto ERR_PROBE_CREATE;
+    if (!probe_reserve_layers(ret, probe->num_layers))    goto ERR_PROBE_RESERVE_LAYERS;
+    memcpy(ret->layers, probe->layers, probe->num_layers * sizeof(layer_t));
+    ret->num_layers = probe->num_layers;
 //    if (!(ret->bitfield = bitfield_dup(probe->bitfield))) goto ERR_BITFIELD_DUP;
 
     ret->sending_time  = probe->sending_time;
     ret->queueing_time = probe->queueing_time;
     ret->recv_time     = probe->recv_time;
     ret->caller        = probe->caller;
+    ret->flow_id       = probe->flow_id; // Same layers, same compiled metafields
 #ifdef USE_SCHEDULING
-    ret->delay         = probe->delay ? field_dup(probe->delay): NULL;
+    if (probe->delay.key && !probe_copy_delay(ret, &probe->delay)) goto ERR_PROBE_COPY_DELAY;
 #endif
     return ret;
 
+#ifdef USE_SCHEDULING
+ERR_PROBE_COPY_DELAY:
+#endif
+ERR_PROBE_RESERVE_LAYERS:
+    // The packet is released along with the probe
+    probe_free(ret);
+    return NULL;
+
     /*
 ERR_BITFIELD_DUP:
     probe_free(ret);
     packet = NULL;
     */
-ERR_PROBE_WRAP_PACKET:
-    if (packet) packet_free(packet);
-ERR_PACKET_DUP:
+ERR_PROBE_CREATE:
+    packet_free(packet);
     return NULL;
 }
 
+probe_t * probe_ref(probe_t * probe) {
+    probe->refcount++;
+    return probe;
+}
+
 void probe_free(probe_t * probe) {
-    if (probe) {
+    if (probe && --probe->refcount == 0) {
 //        bitfield_free(probe->bitfield);
+#ifdef USE_SCHEDULING
+        probe_copy_delay(probe, NULL);
+#endif
         probe_layers_free(probe);
         if (probe->packet) {
             packet_free(probe->packet);
@@ -410,9 +534,9 @@ void probe_fprintf(FILE * out, const probe_t * probe) {
 
     fprintf(out, "** PROBE **\n\n");
 
-    if (probe->delay) {
+    if (probe->delay.key) {
         fprintf(out, "probe delay \n\n");
-        field_dump(probe->delay);
+        field_dump(&probe->delay);
         fprintf(out, "number of probes left to send: (%d) \n\n", (int)probe->left_to_send);
         fprintf(out, "probe structure\n\n");
     }
@@ -484,15 +608,11 @@ probe_t * probe_wrap_packet(packet_t * packet)
     uint8_t          * segment;
     const protocol_t * protocol;
 
-    if (!(probe = probe_create())) {
+    // The packet is wrapped as is: neither copied nor replaced
+    if (!(probe = probe_create_from_packet(packet))) {
         goto ERR_PROBE_CREATE;
     }
 
-    // Clear the probe
-    packet_free(probe->packet);
-    probe->packet = packet;
-    probe_layers_clear(probe);
-
     // Prepare iteration
     segment = packet_get_bytes(probe->packet);
     remaining_size = packet_get_size(probe->packet);
@@ -506,11 +626,7 @@ probe_t * probe_wrap_packet(packet_t * packet)
             segment_size = protocol->get_header_size(segment);
         }
 
-        if (!(layer = layer_create_from_segment(protocol, segment, segment_size))) {
-            goto ERR_CREATE_LAYER;
-        }
-
-        if (!probe_push_layer(probe, layer)) {
+        if (!(layer = probe_push_layer(probe, protocol, segment, segment_size))) {
             goto ERR_PUSH_LAYER;
         }
 
@@ -528,8 +644,6 @@ probe_t * probe_wrap_packet(packet_t * packet)
 
 ERR_TRUNCATED_PACKET:
 ERR_PUSH_LAYER:
-        layer_free(layer);
-ERR_CREATE_LAYER:
         goto ERR_LAYER_DISCOVER_LAYER;
     }
 
@@ -540,17 +654,33 @@ ERR_CREATE_LAYER:
     return probe;
 
 ERR_LAYER_DISCOVER_LAYER:
+    // The packet is left to the caller
+    probe->packet = NULL;
     probe_free(probe);
 ERR_PROBE_CREATE:
     return NULL;
 }
 
+bool probe_unshare_packet(probe_t * probe)
+{
+    packet_t * packet;
+
+    if (!packet_is_shared(probe->packet)) return true;
+    if (!(packet = packet_dup(probe->packet))) return false;
+
+    // Each layer keeps its offset in the new packet
+    probe_move_layers(probe, packet_get_bytes(probe->packet), packet_get_bytes(packet));
+    packet_free(probe->packet);
+    probe->packet = packet;
+    return true;
+}
+
 //-----------------------------------------------------------
 // Layer management
 //-----------------------------------------------------------
 
 size_t probe_get_num_layers(const probe_t * probe) {
-    return dynarray_get_size(probe->layers);
+    return probe->num_layers;
 }
 
 uint8_t * probe_get_payload(const probe_t * probe) {
@@ -577,10 +707,13 @@ bool probe_set_protocols(probe_t * probe, const char * name1, ...)
     va_list            args, args2;
     size_t             packet_size, offset, segment_size;
     const char       * name;
-    layer_t          * layer = NULL,
+    layer_t          * layer,
                      * prev_layer;
     const protocol_t * protocol;
 
+    // The packet is rebuilt from scratch
+    if (!probe_unshare_packet(probe)) return false;
+
     // Remove the former layer structure
     probe_layers_clear(probe);
 
@@ -599,56 +732,51 @@ bool probe_set_protocols(probe_t * probe, const char * name1, ...)
         packet_size += protocol->write_default_header(NULL);
     }
     va_end(args2);
+
+    // Reserve some room for the payload, so that setting it does not
+    // reallocate the packet (and move the layers).
+    if (!(packet_reserve(probe->packet, packet_size + PROBE_DEFAULT_TAILROOM))) goto ERR_PACKET_RESIZE;
     if (!(packet_resize(probe->packet, packet_size))) goto ERR_PACKET_RESIZE;
 
     // Create each layer
     offset = 0;
-    prev_layer = NULL;
     for (name = name1; name; name = va_arg(args, char *)) {
         // Associate protocol to the layer
         if (!(protocol = protocol_search(name))) goto ERR_PROTOCOL_SEARCH2;
         segment_size = protocol->write_default_header(packet_get_bytes(probe->packet) + offset);
 
-        if (!(layer = layer_create_from_segment(protocol, packet_get_bytes(probe->packet) + offset, segment_size))) {
-            fprintf(stderr, "Can't create segment for %s header\n", layer->protocol->name);
-            goto ERR_LAYER_CREATE;
-        }
-        // TODO layer_set_mask(layer, bitfield_get_mask(probe->bitfield) + offset);
-
-        // Update 'length' field (if any). It concerns IPv* and UDP, but not TCP or ICMPv*
-        layer_set_field_and_free(layer, I16("length", packet_size - offset));
-
-        // Update 'protocol' field of the previous inserted layer (if any)
-        if (prev_layer) {
-            if (!layer_set_field_and_free(prev_layer, I8("protocol", layer->protocol->protocol))) {
-                fprintf(stderr, "Can't set 'protocol' in %s header\n", layer->protocol->name);
+        // Update 'protocol' field of the previous inserted layer (if any).
+        // It is retrieved before pushing the new layer, which may move the layers.
+        if (probe_get_num_layers(probe) > 0) {
+            prev_layer = probe_get_layer(probe, probe_get_num_layers(probe) - 1);
+            if (!layer_set_field(prev_layer, I8("protocol", protocol->protocol))) {
+                fprintf(stderr, "Can't set 'protocol' in %s header\n", protocol->name);
                 goto ERR_SET_PROTOCOL;
             }
         }
 
-        offset += layer->segment_size;
-        if (!probe_push_layer(probe, layer)) {
+        if (!(layer = probe_push_layer(probe, protocol, packet_get_bytes(probe->packet) + offset, segment_size))) {
             fprintf(stderr, "Can't add protocol layer\n");
             goto ERR_PUSH_LAYER;
         }
-        prev_layer = layer;
+        // TODO layer_set_mask(layer, bitfield_get_mask(probe->bitfield) + offset);
+        offset += layer->segment_size;
     }
     va_end(args);
-    layer = NULL;
 
     // Payload : initially empty
     if (!probe_push_payload(probe, 0)) {
         goto ERR_PUSH_PAYLOAD;
     }
 
-    // Size and checksum are pending, they depend on payload
+    // 'length' fields are set once every layer is known. Checksums are
+    // pending, they depend on payload.
+    probe_update_length(probe);
     return true;
 
 ERR_PUSH_PAYLOAD:
 ERR_PUSH_LAYER:
 ERR_SET_PROTOCOL:
-    if (layer) layer_free(layer);
-ERR_LAYER_CREATE:
 ERR_PROTOCOL_SEARCH2:
     probe_layers_clear(probe);
 ERR_PACKET_RESIZE:
@@ -681,6 +809,7 @@ bool probe_payload_resize(probe_t * probe, size_t payload_size)
         new_packet_size = old_packet_size - old_payload_size + payload_size;
 
         // Resize the buffer
+        if (!probe_unshare_packet(probe)) goto ERR_PACKET_RESIZE;
         if (!(probe_packet_resize(probe, new_packet_size))) goto ERR_PACKET_RESIZE;
 
         // Update 'checksum' and 'length' fields to remain the probe consistant
@@ -702,16 +831,17 @@ bool probe_write_payload_ext(probe_t * probe, const void * bytes, size_t num_byt
 {
     layer_t * payload_layer;
 
-    if (!(payload_layer = probe_get_layer_payload(probe))) {
-        goto ERR_PROBE_GET_LAYER_PAYLOAD;
-    }
-
     if (num_bytes > probe_get_payload_size(probe)) {
         if(!probe_payload_resize(probe, num_bytes)) {
             goto ERR_PROBE_PAYLOAD_RESIZE;
         }
     }
 
+    if (!probe_unshare_packet(probe)
+    || !(payload_layer = probe_get_layer_payload(probe))) {
+        goto ERR_PROBE_GET_LAYER_PAYLOAD;
+    }
+
     if (!layer_write_payload_ext(payload_layer, bytes, num_bytes, offset)) {
         goto ERR_LAYER_WRITE_PAYLOAD_EXT;
     }
@@ -729,7 +859,8 @@ ERR_PROBE_GET_LAYER_PAYLOAD:
 
 bool probe_update_fields(probe_t * probe)
 {
-    return probe_finalize(probe)
+    return probe_unshare_packet(probe)
+        && probe_finalize(probe)
         && probe_update_protocol(probe)
         && probe_update_length(probe)
         && probe_update_checksum(probe);
@@ -741,9 +872,11 @@ bool probe_set_field_ext(probe_t * probe, size_t depth, const field_t * field)
     size_t    i, num_layers = probe_get_num_layers(probe);
     layer_t * layer;
 
+    if (!probe_unshare_packet(probe)) return false;
+
     for (i = depth; i < num_layers; i++) {
         layer = probe_get_layer(probe, i);
-        if (layer_set_field(layer, field)) { // TODO: replace by layer_set_field_and_free
+        if (layer_set_field(layer, field)) {
             ret = true;
             break;
         }
@@ -760,6 +893,8 @@ bool probe_write_field_ext(probe_t * probe, size_t depth, const char * name, voi
     size_t    i, num_layers = probe_get_num_layers(probe);
     layer_t * layer;
 
+    if (!probe_unshare_packet(probe)) return false;
+
     for (i = depth; i < num_layers; i++) {
         layer = probe_get_layer(probe, i);
         if (layer_write_field(layer, name, bytes, num_bytes)) {
@@ -774,32 +909,103 @@ bool probe_write_field(probe_t * probe, const char * name, void * bytes, size_t
     return probe_write_field_ext(probe, 0, name, bytes, num_bytes);
 }
 
+// TODO: TEMP HACK IPv4 flow id is encoded in src_port
+// We add 24000 to use port to increase chances to traverse firewalls
+#define FLOW_ID_SRC_PORT_OFFSET 24000
+
+/**
+ * \brief (Internal use) Compile the 'flow_id' metafield of a probe.
+ *   The flow_id is currently hardcoded in the first 'src_port' field
+ *   found from a given layer.
+ * \param probe A probe_t instance.
+ * \param depth The index of the first layer to consider.
+ * \param program The metafield_program_t instance to fill.
+ * \return true iif successful
+ */
+
+static bool probe_compile_flow_id(const probe_t * probe, size_t depth, metafield_program_t * program)
+{
+    size_t                   i, num_layers = probe_get_num_layers(probe);
+    const layer_t          * layer;
+    const protocol_field_t * protocol_field;
+
+    metafield_program_clear(program);
+    for (i = depth; i < num_layers; i++) {
+        layer = probe_get_layer(probe, i);
+        if (!(protocol_field = layer_get_protocol_field(layer, "src_port"))) continue;
+        if (!metafield_program_push_field(program, packet_get_bytes(probe->packet), layer, protocol_field)) break;
+        program->is_compiled = true;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * \brief (Internal use) Retrieve the compiled 'flow_id' metafield of a probe.
+ *   The program is compiled at most once per layout and then cached in the probe
+ *   (and copied by probe_dup), so that reading or writing a flow_id only costs
+ *   a few masked loads or stores.
+ * \param probe A probe_t instance.
+ * \param depth The index of the first layer to consider.
+ * \param program A buffer used if depth != 0 (the cache only concerns depth 0).
+ * \return The corresponding program, NULL if this probe has no flow_id.
+ */
+
+static const metafield_program_t * probe_get_flow_id_program(const probe_t * probe, size_t depth, metafield_program_t * program)
+{
+    if (depth) {
+        return probe_compile_flow_id(probe, depth, program) ? program : NULL;
+    }
+
+    // The cache is logically const: it only depends on the layers of the probe.
+    if (!probe->flow_id.is_compiled) {
+        probe_compile_flow_id(probe, 0, (metafield_program_t *) &probe->flow_id);
+    }
+    return probe->flow_id.is_compiled ? &probe->flow_id : NULL;
+}
+
+/**
+ * \brief (Internal use) Read the flow_id of a probe.
+ * \param probe A probe_t instance.
+ * \param depth The index of the first layer to consider.
+ * \param flow_id The address where the flow_id is written.
+ * \return true iif successful
+ */
+
+static bool probe_read_flow_id(const probe_t * probe, size_t depth, uintmax_t * flow_id)
+{
+    metafield_program_t         buffer;
+    const metafield_program_t * program;
+    uintmax_t                   src_port;
+
+    if (!(program = probe_get_flow_id_program(probe, depth, &buffer))) return false;
+    if (!metafield_program_read(program, packet_get_bytes(probe->packet), packet_get_size(probe->packet), &src_port)) return false;
+
+    // We substract 24000 to the port (see probe_set_metafield_ext)
+    *flow_id = (uint16_t) (src_port - FLOW_ID_SRC_PORT_OFFSET);
+    return true;
+}
+
 bool probe_set_metafield_ext(probe_t * probe, size_t depth, field_t * field)
 {
-    bool          ret = true;
-    field_t     * hacked_field;
+    metafield_program_t         buffer;
+    const metafield_program_t * program;
 
-    // TODO: TEMP HACK IPv4 flow id is encoded in src_port
+    // TODO to generalize to any metafield
     if (strcmp(field->key, "flow_id") != 0) {
         fprintf(stderr, "probe_set_metafield_ext: cannot set %s\n", field->key);
         return false;
     }
 
-    // We add 24000 to use port to increase chances to traverse firewalls
-    if ((hacked_field = I16("src_port", 24000 + field->value.int16))) {
-        ret = probe_set_field(probe, hacked_field);
-        field_free(hacked_field);
-    }
-
-    return ret;
-
-    /*
-    metafield = metafield_search(field->key);
-    if (!metafield) return false; // Metafield not found
+    if (!(program = probe_get_flow_id_program(probe, depth, &buffer))) return false;
+    if (!probe_unshare_packet(probe)) return false;
 
-    // Does the probe verifies one metafield pattern ?
-    // Does the value conflict with a previously set field ?
-    */
+    return metafield_program_write(
+        program,
+        packet_get_bytes(probe->packet),
+        packet_get_size(probe->packet),
+        (uint16_t) (FLOW_ID_SRC_PORT_OFFSET + field->value.int16)
+    );
 }
 
 bool probe_set_metafield(probe_t * probe, field_t * field) {
@@ -809,16 +1015,15 @@ bool probe_set_metafield(probe_t * probe, field_t * field) {
 // Internal use
 static field_t * probe_create_metafield_ext(const probe_t * probe, const char * name, size_t depth)
 {
-    uint16_t src_port;
+    uintmax_t flow_id;
 
     // TODO to generalize to any metafield
     if (strcmp(name, "flow_id") != 0) return NULL;
 
     // TODO We've hardcoded the flow-id in the src_port and we only support the "flow_id" metafield
     // In IPv6, flow_id should be set thanks to probe_set_field
-    // We substract 24000 to the port (see probe_set_metafield_ext)
-    return probe_extract(probe, "src_port", &src_port) ?
-        IMAX("flow_id", src_port - 24000) :
+    return probe_read_flow_id(probe, depth, &flow_id) ?
+        field_create_uintmax("flow_id", flow_id) :
         NULL;
 }
 
@@ -881,24 +1086,17 @@ double probe_get_recv_time(const probe_t * probe) {
 }
 
 #ifdef USE_SCHEDULING
-bool probe_set_delay(probe_t * probe, field_t * delay)
+bool probe_set_delay(probe_t * probe, const field_t * delay)
 {
-    field_t * field;
-    if (probe->delay) field_free(probe->delay);
-    if (!(field = field_dup(delay))) goto ERR_DUP;
-    probe->delay = field;
-    return true;
-
-ERR_DUP:
-    return false;
+    return probe_copy_delay(probe, delay);
 }
 
 double probe_get_delay(const probe_t * probe)
 {
-    const field_t * field_delay = probe->delay;
+    const field_t * field_delay = &probe->delay;
     double          delay;
 
-    if (field_delay) {
+    if (field_delay->key) {
         switch (field_delay->type) {
             case TYPE_DOUBLE :
                 delay = field_delay->value.dbl;
@@ -919,10 +1117,10 @@ double probe_get_delay(const probe_t * probe)
 
 double probe_next_delay(probe_t * probe)
 {
-    field_t * field_delay = probe->delay;
+    field_t * field_delay = &probe->delay;
     double    delay       = DELAY_BEST_EFFORT;
 
-    if (field_delay) {
+    if (field_delay->key) {
         switch (field_delay->type) {
             case TYPE_DOUBLE :
                 field_delay->value.dbl += field_delay->value.dbl;
@@ -1034,13 +1232,14 @@ bool probe_extract_ext(const probe_t * probe, const char * name, size_t depth, v
 }
 
 bool probe_extract(const probe_t * probe, const char * name, void * dst) {
-    field_t * flow_id_field;
+    uintmax_t flow_id;
+    uint16_t  flow_id_u16;
 
     // TEMPORARY HACK TO MANAGE flow_id metafield
     if (!strcmp(name, "flow_id")) {
-        if ((flow_id_field = probe_create_metafield(probe, "flow_id")) != NULL) {
-            memcpy(dst, &flow_id_field->value.int16, sizeof(uint16_t));
-            field_free(flow_id_field);
+        if (probe_read_flow_id(probe, 0, &flow_id)) {
+            flow_id_u16 = flow_id;
+            memcpy(dst, &flow_id_u16, sizeof(uint16_t));
             return true;
         }
         return false;
@@ -1056,6 +1255,7 @@ packet_t * probe_create_packet(probe_t * probe) {
 
     // The destination IP is a mandatory field
 
+    if (!probe_unshare_packet(probe)) goto ERR_EXTRACT_DST_IP;
     if (!(probe_extract(probe, "dst_ip", probe->packet->dst_ip))) {
         fprintf(stderr, "probe_create_packet: This probe does not carry 'dst_ip' field!\n");
         goto ERR_EXTRACT_DST_IP;
@@ -1072,20 +1272,24 @@ ERR_EXTRACT_DST_IP:
 //---------------------------------------------------------------------------
 
 probe_reply_t * probe_reply_create() {
-    return calloc(1, sizeof(probe_reply_t));
-}
+    probe_reply_t * probe_reply;
 
-void probe_reply_free(probe_reply_t * probe_reply) {
-    if (probe_reply) {
-        free(probe_reply);
+    if ((probe_reply = calloc(1, sizeof(probe_reply_t)))) {
+        probe_reply->refcount = 1;
     }
+    return probe_reply;
+}
+
+probe_reply_t * probe_reply_ref(probe_reply_t * probe_reply) {
+    probe_reply->refcount++;
+    return probe_reply;
 }
 
-void probe_reply_deep_free(probe_reply_t * probe_reply) {
-    if (probe_reply) {
-        if (probe_reply->probe) probe_free(probe_reply->probe);
-        if (probe_reply->reply) probe_free(probe_reply->reply);
-        probe_reply_free(probe_reply);
+void probe_reply_free(probe_reply_t * probe_reply) {
+    if (probe_reply && --probe_reply->refcount == 0) {
+        probe_free(probe_reply->probe);
+        probe_free(probe_reply->reply);
+        free(probe_reply);
     }
 }
 
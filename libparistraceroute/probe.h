@@ -12,11 +12,19 @@
 #include "field.h"     // field_t
 #include "layer.h"     // layer_t
 //#include "bitfield.h"
-#include "dynarray.h"  // dynarray_t
 #include "packet.h"    // packet_t
+#include "metafield_program.h" // metafield_program_t
 #include "use.h"
 
 #define DELAY_BEST_EFFORT -1 // This MUST be < 0, see network_send_probe
+
+/**
+ * Number of bytes reserved after the headers of a probe by probe_set_protocols,
+ * so that its payload (tag, checksum...) can be set without reallocating it.
+ * The probes duplicated from a skeleton inherit its reserved bytes.
+ */
+
+#define PROBE_DEFAULT_TAILROOM 64
 /**
  * \struct probe_t
  * \brief Structure representing a probe
@@ -26,18 +34,27 @@
  * For instance a probe ipv4/udp/payload is made of 3 layers.
  */
 
+#define PROBE_NUM_INLINE_LAYERS 6 /**< Number of layers stored in a probe without allocation (e.g. IP/ICMP/IP/UDP/payload) */
+
 typedef struct {
-    dynarray_t * layers;        /**< List of layers forming the packet */
+    layer_t    * layers;        /**< Layers forming the packet (points to inline_layers unless the probe has more layers) */
+    size_t       num_layers;    /**< Number of layers stored in layers */
+    size_t       max_layers;    /**< Number of layers which can be stored in layers */
+    layer_t      inline_layers[PROBE_NUM_INLINE_LAYERS]; /**< Storage of the layers of a usual probe */
     packet_t   * packet;        /**< The packet we're crafting */
 //    bitfield_t * bitfield;      /**< Bitfield to keep track of modified fields (bits set to 1) vs. default ones (bits set to 0) */
     void       * caller;        /**< Algorithm instance which has created this probe */
     double       sending_time;  /**< Timestamp set by network layer just after sending the packet (0 if not set) (in micro seconds) */
     double       queueing_time; /**< Timestamp set by pt_loop just before sending the packet (0 if not set) (in micro seconds) */
     double       recv_time;     /**< Only set if this instance is related to a reply. Timestamp set by network layer just after sniffing the reply */
+    double       expiration_time;     /**< Set by the network layer when sending: timestamp at which this probe is considered as lost or retransmitted */
+    size_t       num_retransmissions; /**< Number of times the network layer has retransmitted this probe (see --retries) */
 #ifdef USE_SCHEDULING
-    field_t    * delay;         /**< The time to send this probe */
+    field_t      delay;         /**< The time to send this probe (see probe_set_delay), delay.key is NULL if not scheduled */
 #endif
     size_t       left_to_send;  /**< Number of times left to use this probe instance to send packets */
+    metafield_program_t flow_id; /**< Compiled 'flow_id' metafield, valid as long as the layers are not altered */
+    size_t       refcount;      /**< Number of references to this probe (see probe_ref) */
 } probe_t;
 
 /**
@@ -48,19 +65,43 @@ typedef struct {
 probe_t * probe_create();
 
 /**
- * \brief Duplicate a probe from probe skeleton
+ * \brief Duplicate a probe from probe skeleton. The packet of the
+ *    skeleton is shared until one of both probes is altered, and
+ *    copied at this moment (see probe_unshare_packet).
  * \return A pointer to a probe_t structure containing the probe
  */
 
 probe_t * probe_dup(const probe_t * probe_skel);
 
 /**
- * \brief Free a probe
+ * \brief Take a new reference to a probe, e.g. to keep it once the
+ *    event which carries it has been handled. Each reference must be
+ *    released by probe_free.
+ * \param probe A probe_t instance.
+ * \return The probe.
+ */
+
+probe_t * probe_ref(probe_t * probe);
+
+/**
+ * \brief Release a reference to a probe. The probe is freed once its
+ *    last reference is released.
  * \param probe A pointer to a probe_t structure containing the probe
  */
 
 void probe_free(probe_t * probe);
 
+/**
+ * \brief Make sure that a probe is the only one to reference its packet,
+ *    so that its bytes can be altered. Every probe_set_* and probe_write_*
+ *    function calls it, so it only has to be called before writing the
+ *    bytes of the packet directly.
+ * \param probe A probe_t instance.
+ * \return true iif successful.
+ */
+
+bool probe_unshare_packet(probe_t * probe);
+
 /**
  * \brief Retrieve the size of the packet wrapped by a probe_t instance.
  * \param probe A probe_t instance.
@@ -72,6 +113,8 @@ size_t probe_get_size(const probe_t * probe);
 /**
  * \brief Create a probe_t according to a packet_t instance.
  *   The previous value of probe->packet (if any) is not freed.
+ *   The probe takes over the reference to the packet passed by the
+ *   caller, unless it fails.
  * \return A pointer to a newly allocated probe_t instance if
  *   if successful, NULL otherwise.
  */
@@ -323,7 +366,16 @@ void probe_set_recv_time(probe_t * probe, double time);
 
 double probe_get_recv_time(const probe_t * probe);
 
-bool probe_set_delay(probe_t * probe, field_t * delay);
+/**
+ * \brief Set the delay related to a probe skeleton.
+ * \param probe The probe skeleton used to craft the probe packet.
+ * \param delay A TYPE_DOUBLE (e.g. DOUBLE("delay", 1.0)) or TYPE_GENERATOR
+ *    field. It is copied (a generator is duplicated), so it may be built
+ *    on the stack.
+ * \return true iif successful
+ */
+
+bool probe_set_delay(probe_t * probe, const field_t * delay);
 
 /**
  * \brief Retrieve the delay related to a probe skeleton.
@@ -370,16 +422,38 @@ packet_t * probe_create_packet(probe_t * probe);
 // probe_reply_t
 //---------------------------------------------------------------------------
 
+/**
+ * \struct probe_reply_t
+ * \brief A probe and its reply, carried by PROBE_REPLY events.
+ *   A probe_reply_t holds a reference to both probes, and is itself
+ *   reference-counted so that it can be forwarded by the algorithms.
+ */
+
 typedef struct {
-    probe_t * probe;
-    probe_t * reply;
+    probe_t * probe;    /**< The probe */
+    probe_t * reply;    /**< The reply */
+    size_t    refcount; /**< Number of references to this instance (see probe_reply_ref) */
 } probe_reply_t;
 
 probe_reply_t * probe_reply_create();
+
+/**
+ * \brief Take a new reference to a probe_reply_t instance.
+ * \param probe_reply A probe_reply_t instance.
+ * \return The probe_reply_t instance.
+ */
+
+probe_reply_t * probe_reply_ref(probe_reply_t * probe_reply);
+
+/**
+ * \brief Release a reference to a probe_reply_t instance. Once its last
+ *    reference is released, it releases its probe and its reply.
+ * \param probe_reply A probe_reply_t instance.
+ */
+
 void probe_reply_free(probe_reply_t * probe_reply);
-void probe_reply_deep_free(probe_reply_t * probe_reply);
 
-// Accessors
+// Accessors. The setters take over the reference passed by the caller.
 
 void probe_reply_set_probe(probe_reply_t * probe_reply, probe_t * probe);
 probe_t * probe_reply_get_probe(const probe_reply_t * probe_reply);
@@ -0,0 +1,118 @@
+#include "config.h"
+
+#include <stdlib.h>         // malloc, calloc, free
+
+#include "probe_archive.h"
+
+/**
+ * \brief Tests whether a sequence number refers to an entry still stored
+ *    in the ring buffer.
+ * \param archive A probe_archive_t instance.
+ * \param seq A sequence number.
+ * \return true iif this entry has not been overwritten.
+ */
+
+static inline bool probe_archive_contains(const probe_archive_t * archive, uint64_t seq) {
+    return seq != 0 && archive->last_seq - seq < archive->size;
+}
+
+static inline probe_archive_entry_t * probe_archive_get_entry(const probe_archive_t * archive, uint64_t seq) {
+    return &archive->entries[seq & (archive->size - 1)];
+}
+
+static inline uint64_t * probe_archive_get_bucket(const probe_archive_t * archive, uint16_t tag) {
+    return &archive->buckets[tag & (archive->size - 1)];
+}
+
+probe_archive_t * probe_archive_create(size_t size, double window) {
+    probe_archive_t * archive;
+    size_t            rounded_size;
+
+    for (rounded_size = 1; rounded_size < size; rounded_size <<= 1);
+
+    if (!(archive = malloc(sizeof(probe_archive_t))))                                 goto ERR_MALLOC;
+    if (!(archive->entries = calloc(rounded_size, sizeof(probe_archive_entry_t))))    goto ERR_ENTRIES;
+    if (!(archive->buckets = calloc(rounded_size, sizeof(uint64_t))))                 goto ERR_BUCKETS;
+
+    archive->size = rounded_size;
+    archive->last_seq = 0;
+    archive->window = window;
+    return archive;
+
+ERR_BUCKETS:
+    free(archive->entries);
+ERR_ENTRIES:
+    free(archive);
+ERR_MALLOC:
+    return NULL;
+}
+
+void probe_archive_free(probe_archive_t * archive) {
+    if (archive) {
+        free(archive->buckets);
+        free(archive->entries);
+        free(archive);
+    }
+}
+
+void probe_archive_add(
+    probe_archive_t       * archive,
+    uint16_t                tag,
+    probe_archive_state_t   state,
+    void                  * caller,
+    double                  sending_time,
+    double                  now
+) {
+    uint64_t              * bucket = probe_archive_get_bucket(archive, tag);
+    probe_archive_entry_t * entry  = probe_archive_get_entry(archive, ++archive->last_seq);
+
+    entry->tag          = tag;
+    entry->state        = state;
+    entry->caller       = caller;
+    entry->sending_time = sending_time;
+    entry->archive_time = now;
+    entry->seq          = archive->last_seq;
+    entry->prev_seq     = *bucket;
+    *bucket             = entry->seq;
+}
+
+probe_archive_entry_t * probe_archive_find(probe_archive_t * archive, uint16_t tag, double now) {
+    uint64_t                seq;
+    probe_archive_entry_t * entry;
+
+    // Entries are chained from the youngest to the oldest one, so we can
+    // stop as soon as an entry is out of the ring or of the window.
+    for (seq = *probe_archive_get_bucket(archive, tag); probe_archive_contains(archive, seq); seq = entry->prev_seq) {
+        entry = probe_archive_get_entry(archive, seq);
+        if (now - entry->archive_time > archive->window) break;
+        if (entry->tag == tag) return entry;
+    }
+    return NULL;
+}
+
+void probe_archive_forget_caller(probe_archive_t * archive, const void * caller) {
+    size_t i;
+
+    for (i = 0; i < archive->size; i++) {
+        if (archive->entries[i].caller == caller) {
+            archive->entries[i].caller = NULL;
+        }
+    }
+}
+
+archived_reply_t * archived_reply_create(const probe_archive_entry_t * entry, probe_t * reply) {
+    archived_reply_t * archived_reply;
+
+    if ((archived_reply = malloc(sizeof(archived_reply_t)))) {
+        archived_reply->probe = *entry;
+        archived_reply->reply = reply;
+    }
+    return archived_reply;
+}
+
+void archived_reply_free(archived_reply_t * archived_reply) {
+    if (archived_reply) {
+        probe_free(archived_reply->reply);
+        free(archived_reply);
+    }
+}
@@ -0,0 +1,151 @@
+#ifndef LIBPT_PROBE_ARCHIVE_H
+#define LIBPT_PROBE_ARCHIVE_H
+
+/**
+ * \file probe_archive.h
+ * \brief Archive of the probes recently answered or expired.
+ *
+ * Once a probe has been answered or has expired, the network layer hands it
+ * over to the algorithm which has sent it, and forgets it. A reply sniffed
+ * afterwards (e.g. a duplicated ICMP error, or a reply arrived after the
+ * timeout) could not be matched anymore. A probe_archive_t keeps a summary
+ * of each of these probes, so that such replies can be classified (see
+ * PROBE_LATE_REPLY and PROBE_DUPLICATE).
+ *
+ * The archive is bounded both in size and in time: entries are stored in a
+ * ring buffer (the oldest entry is overwritten once the ring is full), and
+ * entries older than a given window are ignored. Entries are retrieved by
+ * tag thanks to a hash table whose buckets chain the entries sharing the
+ * same hash, from the youngest one to the oldest one. Overwritten entries
+ * are detected thanks to their sequence number, so they never have to be
+ * unlinked.
+ */
+
+#include <stdbool.h>    // bool
+#include <stddef.h>     // size_t
+#include <stdint.h>     // uint*_t
+
+#include "probe.h"      // probe_t
+
+/**
+ * \enum probe_archive_state_t
+ * \brief What happened to an archived probe.
+ */
+
+typedef enum {
+    PROBE_ARCHIVE_ANSWERED, /**< The probe has been answered */
+    PROBE_ARCHIVE_EXPIRED   /**< The probe has not been answered in time (or has been retransmitted with another tag) */
+} probe_archive_state_t;
+
+/**
+ * \struct probe_archive_entry_t
+ * \brief Summary of an archived probe.
+ */
+
+typedef struct {
+    uint16_t              tag;           /**< Tag of the probe (see network_tag_probe) */
+    probe_archive_state_t state;         /**< What happened to the probe */
+    void                * caller;        /**< Algorithm instance which has sent the probe (NULL if it has been freed) */
+    double                sending_time;  /**< Sending time of the probe */
+    double                archive_time;  /**< Time at which the probe has been archived */
+    uint64_t              seq;           /**< Sequence number of this entry */
+    uint64_t              prev_seq;      /**< Sequence number of the previous entry having the same hash (0 if none) */
+} probe_archive_entry_t;
+
+/**
+ * \struct probe_archive_t
+ * \brief A bounded, time-windowed archive of probes.
+ */
+
+typedef struct {
+    probe_archive_entry_t * entries;  /**< Ring buffer of entries */
+    uint64_t              * buckets;  /**< Sequence number of the youngest entry of each bucket (0 if none) */
+    size_t                  size;     /**< Number of entries (and buckets), a power of 2 */
+    uint64_t                last_seq; /**< Sequence number of the last archived entry (the first one is 1) */
+    double                  window;   /**< Entries older than this delay (in seconds) are ignored */
+} probe_archive_t;
+
+/**
+ * \struct archived_reply_t
+ * \brief Data carried by PROBE_LATE_REPLY and PROBE_DUPLICATE events:
+ *    a reply and the summary of the archived probe it answers.
+ *    It is released along with the event (see archived_reply_free).
+ */
+
+typedef struct {
+    probe_archive_entry_t probe; /**< The archived probe */
+    probe_t             * reply; /**< The reply */
+} archived_reply_t;
+
+/**
+ * \brief Create a probe_archive_t instance.
+ * \param size The maximum number of entries. It is rounded up to a power of 2.
+ * \param window Entries older than this delay (in seconds) are ignored.
+ * \return The newly created instance, NULL in case of failure.
+ */
+
+probe_archive_t * probe_archive_create(size_t size, double window);
+
+/**
+ * \brief Release a probe_archive_t instance.
+ * \param archive A probe_archive_t instance.
+ */
+
+void probe_archive_free(probe_archive_t * archive);
+
+/**
+ * \brief Archive a probe. The oldest entry is overwritten if needed.
+ * \param archive A probe_archive_t instance.
+ * \param tag The tag of the probe.
+ * \param state What happened to the probe.
+ * \param caller The algorithm instance which has sent the probe.
+ * \param sending_time The sending time of the probe.
+ * \param now The current time.
+ */
+
+void probe_archive_add(
+    probe_archive_t       * archive,
+    uint16_t                tag,
+    probe_archive_state_t   state,
+    void                  * caller,
+    double                  sending_time,
+    double                  now
+);
+
+/**
+ * \brief Find the youngest entry related to a tag.
+ * \param archive A probe_archive_t instance.
+ * \param tag The tag.
+ * \param now The current time.
+ * \return The corresponding entry if it has been archived during the
+ *    last archive->window seconds, NULL otherwise.
+ */
+
+probe_archive_entry_t * probe_archive_find(probe_archive_t * archive, uint16_t tag, double now);
+
+/**
+ * \brief Forget the algorithm instance which has sent the archived probes,
+ *    e.g. because it is about to be freed.
+ * \param archive A probe_archive_t instance.
+ * \param caller The algorithm instance.
+ */
+
+void probe_archive_forget_caller(probe_archive_t * archive, const void * caller);
+
+/**
+ * \brief Create an archived_reply_t instance.
+ * \param entry The archived probe (copied).
+ * \param reply The reply. It is released along with the archived_reply_t.
+ * \return The newly created instance, NULL in case of failure.
+ */
+
+archived_reply_t * archived_reply_create(const probe_archive_entry_t * entry, probe_t * reply);
+
+/**
+ * \brief Release an archived_reply_t instance and its reply.
+ * \param archived_reply An archived_reply_t instance.
+ */
+
+void archived_reply_free(archived_reply_t * archived_reply);
+
+#endif // LIBPT_PROBE_ARCHIVE_H
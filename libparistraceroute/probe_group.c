@@ -56,7 +56,6 @@ double get_node_next_delay(const tree_node_t * node) {
 }
 
 static void set_node_delay(tree_node_t * node, double delay) {
-    field_t           * delay_field;
     tree_node_probe_t * data = get_node_data(node);
 
     switch (data->tag) {
@@ -64,9 +63,7 @@ static void set_node_delay(tree_node_t * node, double delay) {
             data->data.delay = delay;
             break;
         case PROBE:
-            delay_field = DOUBLE("delay", delay);
-            probe_set_delay((probe_t *)(data->data.probe), delay_field);
-            field_free(delay_field);
+            probe_set_delay((probe_t *)(data->data.probe), DOUBLE("delay", delay));
             break;
         default:
             fprintf(stderr, "Uknown type of data\n");
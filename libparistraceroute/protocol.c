@@ -88,10 +88,8 @@ void protocol_iter_fields(
     }
 }
 
-uint16_t csum(const uint16_t * bytes, size_t size) {
+static uint32_t csum_add(uint32_t sum, const uint16_t * bytes, size_t size) {
     // Adapted from http://www.netpatch.ru/windows-files/pingscan/raw_ping.c.html
-    uint32_t sum = 0;
-
     while (size > 1) {
         sum += *bytes++;
         size -= sizeof(uint16_t);
@@ -99,11 +97,24 @@ uint16_t csum(const uint16_t * bytes, size_t size) {
     if (size) {
         sum += * (const uint8_t *) bytes;
     }
+    return sum;
+}
+
+static inline uint16_t csum_fold(uint32_t sum) {
     sum  = (sum >> 16) + (sum & 0xffff);
     sum += (sum >> 16);
     return (uint16_t) ~sum;
 }
 
+uint16_t csum(const uint16_t * bytes, size_t size) {
+    return csum_fold(csum_add(0, bytes, size));
+}
+
+uint16_t csum_pseudo_header(const uint8_t * psh, size_t psh_size, const uint8_t * segment, size_t size) {
+    // Both parts are summed by 16-bit words, hence psh_size must be even
+    return csum_fold(csum_add(csum_add(0, (const uint16_t *) psh, psh_size), (const uint16_t *) segment, size));
+}
+
 static inline void callback_protocol_field_dump(const protocol_field_t * protocol_field, void * data) {
     protocol_field_dump(protocol_field);
 }
@@ -9,10 +9,12 @@
 #include <stdbool.h>
 
 #include "protocol_field.h"
-#include "buffer.h"
 
 #define END_PROTOCOL_FIELDS { .key = NULL }
 
+// Maximum size of a pseudo header (see ipv6_pseudo_header_t)
+#define PROTOCOL_PSEUDO_HEADER_MAX_SIZE 40
+
 struct layer_s;
 struct probe_s;
 
@@ -42,21 +44,23 @@ typedef struct protocol_s {
      *    this protocol.
      * \param buf Pointer to the protocol's segment
      * \param psh Pointer to the corresponding pseudo header (pass NULL if not needed)
+     * \param psh_size The size of the pseudo header (pass 0 if not needed)
      * \return true if success, false otherwise
      */
 
-    bool (*write_checksum)(uint8_t * buf, buffer_t * psh);
+    bool (*write_checksum)(uint8_t * buf, const uint8_t * psh, size_t psh_size);
 
     /**
-     * \brief Points to a callback which creates a buffer_t instance
-     *    containing the pseudo header needed to compute the checksum
-     *    of a segment of this protocol.
+     * \brief Points to a callback which writes the pseudo header needed to
+     *    compute the checksum of a segment of this protocol.
+     * \param psh The buffer where the pseudo header is written. It must be
+     *    at least PROTOCOL_PSEUDO_HEADER_MAX_SIZE bytes long.
      * \param segment The address of the segment. For instance if you compute
      *    the UDP of an IPv6/UDP packet, pass the address of the IPv6 segment.
-     * \return The corresponding buffer, NULL in case of failure.
+     * \return The size of the pseudo header, 0 in case of failure.
      */
 
-    buffer_t * (*create_pseudo_header)(const uint8_t * segment);
+    size_t (*write_pseudo_header)(uint8_t * psh, const uint8_t * segment);
 
     /**
      * Pointer to a protocol_field_t structure holding the header fields
@@ -133,7 +137,9 @@ const protocol_t * protocol_search(const char * name);
 const protocol_t * protocol_search_by_id(uint8_t id);
 
 /**
- * \brief Register a protocol
+ * \brief Register a protocol. This function is not thread-safe and is only
+ *    called at load time (see PROTOCOL_REGISTER). The registered protocols
+ *    are then only read (see protocol_search), possibly by several threads.
  * \param protocol Pointer to a protocol_t structure describing the protocol to register
  * \return None
  */
@@ -170,6 +176,18 @@ const protocol_field_t * protocol_get_field(const protocol_t * protocol, const c
 
 uint16_t csum(const uint16_t * buf, size_t size);
 
+/**
+ * \brief Calculate the Internet checksum of a segment preceded by its
+ *    pseudo header, without copying them in a same buffer.
+ * \param psh The pseudo header. Its size must be even.
+ * \param psh_size The size of the pseudo header.
+ * \param segment The segment. Its checksum must be set to 0.
+ * \param size The size of the segment.
+ * \return The corresponding checksum
+ */
+
+uint16_t csum_pseudo_header(const uint8_t * psh, size_t psh_size, const uint8_t * segment, size_t size);
+
 /**
  * \brief Print information stored in a protocol instance
  * \param protocol A protocol_t instance
@@ -103,11 +103,12 @@ size_t icmpv4_write_default_header(uint8_t * icmpv4_segment) {
  * \param icmpv4_segment A pre-allocated ICMP header. The ICMP checksum
  *    stored in this buffer is updated by this function.
  * \param ipv4_psh Pass NULL
+ * \param size_ipv4 Pass 0
  * \sa http://www.networksorcery.com/enp/protocol/icmp.htm#Checksum
  * \return true if everything is ok, false otherwise
  */
 
-bool icmpv4_write_checksum(uint8_t * icmpv4_segment, buffer_t * ipv4_psh)
+bool icmpv4_write_checksum(uint8_t * icmpv4_segment, const uint8_t * ipv4_psh, size_t size_ipv4)
 {
     struct icmphdr * icmpv4_header = (struct icmphdr *) icmpv4_segment;
 
@@ -2,7 +2,6 @@
 
 #ifdef USE_IPV6
 #include <stdio.h>
-#include <stdlib.h>             // malloc()
 #include <string.h>             // memcpy()
 #include <stdbool.h>            // bool
 #include <errno.h>              // ERRNO, EINVAL
@@ -86,16 +85,13 @@ size_t icmpv6_write_default_header(uint8_t * icmpv6_segment) {
  * \brief Compute and write the checksum related to an ICMPv6 header.
  * \param icmpv6_header A pre-allocated ICMPv6 header.
  * \param ipv6_psh The pseudo header.
+ * \param size_ipv6 The size of the pseudo header.
  * \return true iif successful.
  */
 
-bool icmpv6_write_checksum(uint8_t * icmpv6_segment, buffer_t * ipv6_psh)
+bool icmpv6_write_checksum(uint8_t * icmpv6_segment, const uint8_t * ipv6_psh, size_t size_ipv6)
 {
     struct icmp6_hdr * icmpv6_header = (struct icmp6_hdr *) icmpv6_segment;
-    size_t             size_ipv6     = buffer_get_size(ipv6_psh),
-                       size_icmpv6   = sizeof(struct icmp6_hdr),
-                       size_psh      = size_ipv6 + size_icmpv6;
-    uint8_t          * psh;
 
     // ICMPv6 checksum computation requires the IPv6 pseudoheader
     // http://en.wikipedia.org/wiki/ICMPv6#Message_checksum
@@ -104,22 +100,9 @@ bool icmpv6_write_checksum(uint8_t * icmpv6_segment, buffer_t * ipv6_psh)
         return false;
     }
 
-    // Allocate the buffer which will contains the pseudo header
-    if (!(psh = malloc(size_psh))) {
-        return false;
-    }
-
-    // Put the excerpt of the IP header into the pseudo header
-    memcpy(psh, buffer_get_data(ipv6_psh), size_ipv6);
-
-    // Put the ICMPv6 header and its content into the pseudo header
-    memcpy(psh + size_ipv6, icmpv6_header, size_icmpv6);
-
-    // Overrides the ICMPv6 checksum in psh with zeros
-    memset(psh + size_ipv6 + offsetof(struct icmp6_hdr, icmp6_cksum), 0, sizeof(uint16_t));
-
-    icmpv6_header->icmp6_cksum = csum((uint16_t *) psh, size_psh);
-    free(psh);
+    // The ICMPv6 checksum must be set to 0 before its calculation
+    icmpv6_header->icmp6_cksum = 0;
+    icmpv6_header->icmp6_cksum = csum_pseudo_header(ipv6_psh, size_ipv6, icmpv6_segment, sizeof(struct icmp6_hdr));
     return true;
 }
 
@@ -180,7 +163,7 @@ static protocol_t icmpv6 = {
     .name                 = "icmpv6",
     .protocol             = IPPROTO_ICMPV6,
     .write_checksum       = icmpv6_write_checksum,
-    .create_pseudo_header = ipv6_pseudo_header_create,
+    .write_pseudo_header  = ipv6_pseudo_header_write,
     .fields               = icmpv6_fields,
     .write_default_header = icmpv6_write_default_header, // TODO generic memcpy + header size
     .get_header_size      = icmpv6_get_header_size,
@@ -142,10 +142,11 @@ size_t ipv4_get_header_size(const uint8_t * ipv4_header) {
  * \param ipv4_header An initialized IPv4 header. Checksum may be
  *    not initialized, will be ignored, and overwritten
  * \param psh (Unused) You may pass NULL.
+ * \param psh_size (Unused) You may pass 0.
  * \return true iif successful
  */
 
-bool ipv4_write_checksum(uint8_t * ipv4_header, buffer_t * psh) {
+bool ipv4_write_checksum(uint8_t * ipv4_header, const uint8_t * psh, size_t psh_size) {
 	struct iphdr * iph = (struct iphdr *) ipv4_header;
 
     // The IPv4 checksum must be set to 0 before its calculation
@@ -299,7 +300,7 @@ static protocol_t ipv4 = {
     .name                 = "ipv4",
     .protocol             = IPPROTO_IPIP, // XXX only IP over IP (encapsulation). Beware probe.c, icmpv4_get_next_protocol_id
     .write_checksum       = ipv4_write_checksum,
-    .create_pseudo_header = NULL,
+    .write_pseudo_header  = NULL,
     .fields               = ipv4_fields,
     .write_default_header = ipv4_write_default_header, // TODO generic
     .get_header_size      = ipv4_get_header_size,
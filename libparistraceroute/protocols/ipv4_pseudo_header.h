@@ -4,7 +4,8 @@
 #include "use.h"
 #ifdef USE_IPV4
 
-#include "buffer.h"      // buffer_t
+#include <stddef.h>      // size_t
+#include <stdint.h>      // uint*_t
 
 /**
  * IPv4 pseudo header
@@ -19,13 +20,14 @@ typedef struct {
 } ipv4_pseudo_header_t;
 
 /**
- * \brief Create an IPv4 pseudo header
+ * \brief Write an IPv4 pseudo header
+ * \param psh The buffer where the pseudo header is written. It must be
+ *    at least sizeof(ipv4_pseudo_header_t) bytes long.
  * \param ipv4_segment Address of the IPv4 segment
- * \return The buffer containing the corresponding pseudo header,
- *    NULL in case of failure
+ * \return The size of the pseudo header
  */
 
-buffer_t * ipv4_pseudo_header_create(const uint8_t * ipv4_segment);
+size_t ipv4_pseudo_header_write(uint8_t * psh, const uint8_t * ipv4_segment);
 
 #endif // USE_IPV4
 
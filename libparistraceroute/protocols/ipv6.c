@@ -67,7 +67,7 @@
 
 static field_t * ipv6_get_length(const uint8_t * ipv6_segment) {
     const struct ip6_hdr * ipv6_header = (const struct ip6_hdr *) ipv6_segment;
-    return I16(IPV6_FIELD_LENGTH, ntohs(ipv6_header->ip6_plen) + sizeof(struct ip6_hdr));
+    return field_create_uint16(IPV6_FIELD_LENGTH, ntohs(ipv6_header->ip6_plen) + sizeof(struct ip6_hdr));
 }
 
 static bool ipv6_set_length(uint8_t * ipv6_segment, const field_t * field) {
@@ -365,7 +365,7 @@ static protocol_t ipv6 = {
     .name                 = "ipv6",
     .protocol             = IPPROTO_IPV6,
     .write_checksum       = NULL,
-    .create_pseudo_header = NULL,
+    .write_pseudo_header  = NULL,
     .fields               = ipv6_fields,
     .write_default_header = ipv6_write_default_header, // TODO generic with ipv4
     .get_header_size      = ipv6_get_header_size,
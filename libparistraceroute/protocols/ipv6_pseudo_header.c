@@ -8,24 +8,11 @@
 #include <arpa/inet.h>        // ntohs, htonl
 #include "os/netinet/ip6.h"   // ip6_hdr
 
-#include <stdio.h>
-#include "buffer.h"
-
-buffer_t * ipv6_pseudo_header_create(const uint8_t * ipv6_segment)
+size_t ipv6_pseudo_header_write(uint8_t * psh, const uint8_t * ipv6_segment)
 {
-    buffer_t             * psh;
-    const struct ip6_hdr * iph = (const struct ip6_hdr *) ipv6_segment;
-    ipv6_pseudo_header_t * data;
-
-    if (!(psh = buffer_create())) {
-        goto ERR_BUFFER_CREATE;
-    }
+    const struct ip6_hdr * iph  = (const struct ip6_hdr *) ipv6_segment;
+    ipv6_pseudo_header_t * data = (ipv6_pseudo_header_t *) psh;
 
-    if (!(buffer_resize(psh, sizeof(ipv6_pseudo_header_t)))) {
-        goto ERR_BUFFER_RESIZE;
-    }
-
-    data = (ipv6_pseudo_header_t *) buffer_get_data(psh);
     memcpy((uint8_t *) data + offsetof(ipv6_pseudo_header_t, ip_src), &iph->ip6_src, sizeof(ipv6_t));
     memcpy((uint8_t *) data + offsetof(ipv6_pseudo_header_t, ip_dst), &iph->ip6_dst, sizeof(ipv6_t));
 
@@ -36,12 +23,7 @@ buffer_t * ipv6_pseudo_header_create(const uint8_t * ipv6_segment)
     data->zero  = 0;
     data->protocol = iph->ip6_ctlun.ip6_un1.ip6_un1_nxt;
 
-    return psh;
-
-ERR_BUFFER_RESIZE:
-    buffer_free(psh);
-ERR_BUFFER_CREATE:
-    return NULL;
+    return sizeof(ipv6_pseudo_header_t);
 }
 
 #endif // USE_IPV6
@@ -4,7 +4,7 @@
 #include "use.h"
 #ifdef USE_IPV6
 
-#include "buffer.h"      // buffer_t
+#include <stddef.h>      // size_t
 #include "address.h"     // ipv6_t
 
 /**
@@ -21,13 +21,15 @@ typedef struct {
 } ipv6_pseudo_header_t;
 
 /**
- * \brief Create an IPv6 pseudo header
- * \param ipv6_segment Address of the IPv4 segment
- * \return The buffer containing the corresponding pseudo header,
- *    NULL in case of failure
+ * \brief Write an IPv6 pseudo header
+ * \param psh The buffer where the pseudo header is written. It must be
+ *    at least sizeof(ipv6_pseudo_header_t) bytes long (see
+ *    PROTOCOL_PSEUDO_HEADER_MAX_SIZE) and suitably aligned.
+ * \param ipv6_segment Address of the IPv6 segment
+ * \return The size of the pseudo header
  */
 
-buffer_t * ipv6_pseudo_header_create(const uint8_t * ipv6_segment);
+size_t ipv6_pseudo_header_write(uint8_t * psh, const uint8_t * ipv6_segment);
 
 #endif // USE_IPV6
 
@@ -1,7 +1,6 @@
 #include "use.h"
 
 #include <stdio.h>
-#include <stdlib.h>           // malloc()
 #include <string.h>           // memcpy()
 #include <stdbool.h>          // bool
 #include <stdint.h>           // uint*_t, UINT16_MAX
@@ -280,17 +279,15 @@ size_t tcp_write_default_header(uint8_t * tcp_segment) {
  * \param ip_psh The IP layer part of the pseudo header. This buffer should
  *    contain the content of an ipv4_pseudo_header_t or an ipv6_pseudo_header_t
  *    structure.
+ * \param size_ip The size of the pseudo header.
  * \sa http://www.networksorcery.com/enp/protocol/tcp.htm#Checksum
  * \return true if everything is fine, false otherwise
  */
 
-bool tcp_write_checksum(uint8_t * tcp_segment, buffer_t * ip_psh)
+bool tcp_write_checksum(uint8_t * tcp_segment, const uint8_t * ip_psh, size_t size_ip)
 {
     struct tcphdr * tcp_header = (struct tcphdr *) tcp_segment;
-    size_t          size_ip    = buffer_get_size(ip_psh),
-                    size_tcp   = tcp_get_header_size(tcp_segment) + 2, // hardcoded payload size
-                    size_psh   = size_ip + size_tcp;
-    uint8_t       * psh;
+    size_t          size_tcp   = tcp_get_header_size(tcp_segment) + 2; // hardcoded payload size
 
     // TCP checksum computation requires the IPv* header
     if (!ip_psh) {
@@ -298,48 +295,34 @@ bool tcp_write_checksum(uint8_t * tcp_segment, buffer_t * ip_psh)
         return false;
     }
 
-    // Allocate the buffer which will contains the pseudo header
-    if (!(psh = calloc(1, size_psh))) {
-        return false;
-    }
-
-    // Put the excerpt of the IP header into the pseudo header
-    memcpy(psh, buffer_get_data(ip_psh), size_ip);
-
-    // Put the TCP header and its content into the pseudo header
-    memcpy(psh + size_ip, tcp_segment, size_tcp);
-
-    // Overrides the TCP checksum in psh with zeros
-    memset(psh + size_ip + offsetof(struct tcphdr, CHECKSUM), 0, sizeof(uint16_t));
-
-    // Compute the checksum
-    tcp_header->CHECKSUM = csum((const uint16_t *) psh, size_psh);
-    free(psh);
+    // The TCP checksum must be set to 0 before its calculation
+    tcp_header->CHECKSUM = 0;
+    tcp_header->CHECKSUM = csum_pseudo_header(ip_psh, size_ip, tcp_segment, size_tcp);
     return true;
 }
 
-buffer_t * tcp_create_pseudo_header(const uint8_t * ip_segment)
+size_t tcp_write_pseudo_header(uint8_t * psh, const uint8_t * ip_segment)
 {
-    buffer_t * buffer = NULL;
+    size_t size = 0;
 
     // TODO Duplicated from packet.c (see packet_guess_address_family)
     // TODO we should use instanceof
     switch (ip_segment[0] >> 4) {
 #ifdef USE_IPV4
         case 4:
-            buffer = ipv4_pseudo_header_create(ip_segment);
+            size = ipv4_pseudo_header_write(psh, ip_segment);
             break;
 #endif
 #ifdef USE_IPV6
         case 6:
-            buffer = ipv6_pseudo_header_create(ip_segment);
+            size = ipv6_pseudo_header_write(psh, ip_segment);
             break;
 #endif
         default:
             break;
     }
 
-    return buffer;
+    return size;
 }
 
 /**
@@ -384,7 +367,7 @@ static protocol_t tcp = {
     .name                 = "tcp",
     .protocol             = IPPROTO_TCP,
     .write_checksum       = tcp_write_checksum,
-    .create_pseudo_header = tcp_create_pseudo_header,
+    .write_pseudo_header  = tcp_write_pseudo_header,
     .fields               = tcp_fields,
   //.defaults             = tcp_defaults,             // XXX used when generic
     .write_default_header = tcp_write_default_header, // TODO generic
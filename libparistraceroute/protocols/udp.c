@@ -1,7 +1,6 @@
 #include "use.h"
 
 #include <stdio.h>
-#include <stdlib.h>           // malloc()
 #include <string.h>           // memcpy()
 #include <stdbool.h>          // bool
 #include <errno.h>            // ERRNO, EINVAL
@@ -115,17 +114,14 @@ size_t udp_write_default_header(uint8_t * udp_segment) {
  * \param ip_psh The IP layer part of the pseudo header. This buffer should
  *    contain the content of an ipv4_pseudo_header_t or an ipv6_pseudo_header_t
  *    structure.
+ * \param size_ip The size of the pseudo header.
  * \sa http://www.networksorcery.com/enp/protocol/udp.htm#Checksum
  * \return true if everything is fine, false otherwise
  */
 
-bool udp_write_checksum(uint8_t * udp_segment, buffer_t * ip_psh)
+bool udp_write_checksum(uint8_t * udp_segment, const uint8_t * ip_psh, size_t size_ip)
 {
     struct udphdr * udp_header = (struct udphdr *) udp_segment;
-    size_t          size_ip    = buffer_get_size(ip_psh),
-                    size_udp   = ntohs(udp_header->LENGTH),
-                    size_psh   = size_ip + size_udp;
-    uint8_t       * psh;
 
     // UDP checksum computation requires the IPv* header
     if (!ip_psh) {
@@ -133,49 +129,35 @@ bool udp_write_checksum(uint8_t * udp_segment, buffer_t * ip_psh)
         return false;
     }
 
-    // Allocate the buffer which will contains the pseudo header
-    if (!(psh = malloc(size_psh))) {
-        return false;
-    }
-
-    // Put the excerpt of the IP header into the pseudo header
-    memcpy(psh, buffer_get_data(ip_psh), size_ip);
-
-    // Put the UDP header and its content into the pseudo header
-    memcpy(psh + size_ip, udp_header, size_udp);
-
-    // Overrides the UDP checksum in psh with zeros
+    // The UDP checksum must be set to 0 before its calculation
     // Checksum debug: http://www4.ncsu.edu/~mlsichit/Teaching/407/Resources/udpChecksum.html
-    memset(psh + size_ip + offsetof(struct udphdr, CHECKSUM), 0, sizeof(uint16_t));
-
-    // Compute the checksum
-    udp_header->CHECKSUM = csum((const uint16_t *) psh, size_psh);
-    free(psh);
+    udp_header->CHECKSUM = 0;
+    udp_header->CHECKSUM = csum_pseudo_header(ip_psh, size_ip, udp_segment, ntohs(udp_header->LENGTH));
     return true;
 }
 
-buffer_t * udp_create_pseudo_header(const uint8_t * ip_segment)
+size_t udp_write_pseudo_header(uint8_t * psh, const uint8_t * ip_segment)
 {
-    buffer_t * buffer = NULL;
+    size_t size = 0;
 
     // TODO Duplicated from packet.c (see packet_guess_address_family)
     // TODO we should use instanceof
     switch (ip_segment[0] >> 4) {
         case 4:
 #ifdef USE_IPV4
-            buffer = ipv4_pseudo_header_create(ip_segment);
+            size = ipv4_pseudo_header_write(psh, ip_segment);
 #endif
             break;
         case 6:
 #ifdef USE_IPV6
-            buffer = ipv6_pseudo_header_create(ip_segment);
+            size = ipv6_pseudo_header_write(psh, ip_segment);
 #endif
             break;
         default:
             break;
     }
 
-    return buffer;
+    return size;
 }
 
 /**
@@ -221,7 +203,7 @@ static protocol_t udp = {
     .name                 = "udp",
     .protocol             = IPPROTO_UDP,
     .write_checksum       = udp_write_checksum,
-    .create_pseudo_header = udp_create_pseudo_header,
+    .write_pseudo_header  = udp_write_pseudo_header,
     .fields               = udp_fields,
   //.defaults             = udp_defaults,             // XXX used when generic
     .write_default_header = udp_write_default_header, // TODO generic
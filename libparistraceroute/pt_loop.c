@@ -8,31 +8,43 @@
 #include <string.h>             // memset
 #include <errno.h>              // perror
 #include <unistd.h>             // close
-#include <signal.h>             // SIGINT, SIGQUIT
+#include <signal.h>             // SIGINT, SIGQUIT, SIGUSR1
+#include <pthread.h>            // pthread_sigmask
 #include <time.h>               // time_t, time()
+#include <sys/socket.h>         // AF_INET, AF_INET6, socket, accept4
+#include <sys/stat.h>           // stat, S_ISSOCK
+#include <sys/un.h>             // sockaddr_un
 
 #include "os/sys/epoll.h"       // epoll_ctl
 #include "os/sys/eventfd.h"     // eventfd
 #include "os/sys/signalfd.h"    // signalfd
-#include "os/netinet/in.h"      // IPPROTO_ICMP, IPPROTO_ICMPV6
+#include "os/sys/timerfd.h"     // timerfd_create, TFD_NONBLOCK
+#include "os/netinet/in.h"      // IPPROTO_ICMP, IPPROTO_ICMPV6, IPPROTO_TCP, IPPROTO_UDP
 #include "probe.h"              // probe_t
 #include "pt_loop.h"            // pt_loop.h
 #include "algorithm.h"
+#include "address.h"            // address_cache_get_stats
 
 #define MAXEVENTS 100
 
-static pt_loop_t * s_loop = NULL; // Needed while we use twalk.
+// Prefix of the metrics exported by pt_loop_fprintf_metrics
+#define METRICS_PREFIX "paris_traceroute"
+
+// Maximum number of clients of the metrics socket whose snapshot is not fully sent
+#define PT_LOOP_METRICS_MAX_CLIENTS 16
 
 //---------------------------------------------------------------------------
 // pt_loop options
 //---------------------------------------------------------------------------
 
 //static int    timeout[4]     = {180,    0,   UINT16_MAX, 1};
-static double timeout[3] = OPTIONS_PT_LOOP_TIMEOUT;
+static double         timeout[3]     = OPTIONS_PT_LOOP_TIMEOUT;
+static struct opt_str metrics_socket = {NULL, 0};
 
 static option_t pt_loop_options[] = {
-    // action              short long          metavar    help    variable
-    {opt_store_double_lim, "t",  "--timeout",  "TIMEOUT", HELP_t, timeout},
+    // action              short      long               metavar    help                 variable
+    {opt_store_double_lim, "t",       "--timeout",       "TIMEOUT", HELP_t,              timeout},
+    {opt_store_str,        OPT_NO_SF, "--metrics-socket", "PATH",   HELP_metrics_socket, &metrics_socket},
     END_OPT_SPECS
 };
 
@@ -44,8 +56,9 @@ double options_pt_loop_get_timeout() {
     return timeout[0];
 }
 
-void options_pt_loop_init(pt_loop_t * loop) {
+bool options_pt_loop_init(pt_loop_t * loop) {
     pt_loop_set_timeout(loop, options_pt_loop_get_timeout());
+    return !metrics_socket.s || pt_loop_listen_metrics(loop, metrics_socket.s);
 }
 
 void pt_loop_set_timeout(pt_loop_t * loop, double new_timeout) {
@@ -101,7 +114,7 @@ static void pt_instance_iter(
  */
 
 static inline void pt_loop_clear_user_events(pt_loop_t * loop) {
-    dynarray_clear(loop->events_user, NULL); //(ELEMENT_FREE) event_free); TODO this provoke a segfault in case of stars
+    dynarray_clear(loop->events_user, (ELEMENT_FREE) event_free);
 }
 
 /**
@@ -149,8 +162,10 @@ static inline int make_event_fd() {
 }
 
 /**
- * \brief Prepare a signal file descriptor used to handle SIGINT and
- *   SIGQUIT signals.
+ * \brief Prepare a signal file descriptor used to handle SIGINT,
+ *   SIGQUIT and SIGUSR1 signals. They are only blocked in the calling
+ *   thread, so that each thread may run its own loop (the other threads
+ *   of the process should block them as well).
  * \return The correspnding file descriptor, -1 in case of failure
  */
 
@@ -163,9 +178,11 @@ static int make_signal_fd() {
     sigemptyset(&mask);
     sigaddset(&mask, SIGINT);
     sigaddset(&mask, SIGQUIT);
+    sigaddset(&mask, SIGUSR1);
 
-    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
-        goto ERR_SIGPROCMASK;
+    if ((errno = pthread_sigmask(SIG_BLOCK, &mask, NULL)) != 0) {
+        perror("Error pthread_sigmask");
+        goto ERR_PTHREAD_SIGMASK;
     }
 
     if ((sfd = signalfd(-1, &mask, 0)) == -1) {
@@ -175,7 +192,7 @@ static int make_signal_fd() {
 
     return sfd;
 
-ERR_SIGPROCMASK:
+ERR_PTHREAD_SIGMASK:
 ERR_SIGNALFD:
     return -1;
 }
@@ -229,19 +246,175 @@ static int pt_loop_process_user_events(pt_loop_t * loop) {
 
 /**
  * \brief Called when pt_loop handles a SIGINT|SIGQUIT to notify algorithms
- *   they must terminate. Sends a ALGORITHM_TERM event to each running instance.
+ *   they must terminate. Sends a ALGORITHM_TERM event to each running instance
+ *   added by the user. The instances added by an algorithm are stopped by
+ *   their caller.
  * \param node The current algorithm_instance_t.
- * \param visit (unused).
+ * \param visit Position of the node in the tree.
  * \param level (unused).
  */
 
 static void pt_process_algorithms_terminate(const void * node, VISIT visit, int level) {
     algorithm_instance_t * instance = *((algorithm_instance_t * const *) node);
 
+    // twalk visits each internal node several times
+    if (visit != postorder && visit != leaf) return;
+    if (instance->caller) return;
+
     // The pt_loop_t must send a TERM event to the current instance
     pt_throw(NULL, instance, event_create(ALGORITHM_TERM, NULL, NULL, NULL));
 }
 
+/**
+ * \brief Print the progress of an algorithm instance in loop->metrics_out
+ *    (see pt_loop_fprintf_metrics).
+ * \param node The current algorithm_instance_t.
+ * \param visit Position of the node in the tree.
+ * \param level (unused).
+ */
+
+static void pt_fprintf_instance_metrics(const void * node, VISIT visit, int level) {
+    const algorithm_instance_t * instance = *((algorithm_instance_t * const *) node);
+    FILE                       * out = instance->loop->metrics_out;
+
+    // Each internal node is visited three times.
+    if (visit != postorder && visit != leaf) return;
+
+    fprintf(out, "%s_instance_progress_total{id=\"%u\",algorithm=\"%s\",kind=\"probes_sent\"} %zu\n",
+        METRICS_PREFIX, instance->id, instance->algorithm->name, instance->num_probes_sent
+    );
+    fprintf(out, "%s_instance_progress_total{id=\"%u\",algorithm=\"%s\",kind=\"replies\"} %zu\n",
+        METRICS_PREFIX, instance->id, instance->algorithm->name, instance->num_replies
+    );
+}
+
+/**
+ * \struct pt_metrics_client_t
+ * \brief A client of loop->metrics_fd whose snapshot is being sent.
+ */
+
+typedef struct {
+    int    fd;     /**< The connected socket */
+    char * buffer; /**< The snapshot of the metrics */
+    size_t size;   /**< Size of the snapshot (in bytes) */
+    size_t offset; /**< Number of bytes already sent */
+} pt_metrics_client_t;
+
+static void pt_metrics_client_free(pt_metrics_client_t * client) {
+    if (client) {
+        close(client->fd);
+        free(client->buffer);
+        free(client);
+    }
+}
+
+/**
+ * \brief Send to a client the part of its snapshot which fits in its
+ *    socket buffer.
+ * \param loop The main loop.
+ * \param client The client.
+ * \return true iif the client is done, i.e. its snapshot has been sent or
+ *    it cannot be sent anymore.
+ */
+
+static bool pt_metrics_client_send(pt_loop_t * loop, pt_metrics_client_t * client) {
+    ssize_t num_bytes;
+
+    while (client->offset < client->size) {
+        num_bytes = send(client->fd, client->buffer + client->offset, client->size - client->offset, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (num_bytes == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                errno = 0;
+                return false;
+            }
+            if (loop->network->is_verbose) perror("pt_loop: cannot send metrics");
+            return true;
+        }
+        client->offset += num_bytes;
+    }
+    return true;
+}
+
+/**
+ * \brief Send the metrics to every pending client of loop->metrics_fd.
+ *    Clients are not expected to send anything: they are disconnected
+ *    once the metrics have been sent. A snapshot which does not fit in
+ *    the socket buffer is kept until the client can read the rest of it
+ *    (see pt_loop_resume_metrics).
+ * \param loop The main loop.
+ */
+
+static void pt_loop_process_metrics(pt_loop_t * loop) {
+    int                   client_fd;
+    pt_metrics_client_t * client;
+    FILE                * out;
+    struct epoll_event    event;
+
+    while ((client_fd = accept4(loop->metrics_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1) {
+        // Clients which do not read their snapshot must not exhaust the memory
+        if (dynarray_get_size(loop->metrics_clients) >= PT_LOOP_METRICS_MAX_CLIENTS) {
+            close(client_fd);
+            continue;
+        }
+
+        if (!(client = calloc(1, sizeof(pt_metrics_client_t)))) {
+            close(client_fd);
+            continue;
+        }
+        client->fd = client_fd;
+
+        if (!(out = open_memstream(&client->buffer, &client->size))) {
+            pt_metrics_client_free(client);
+            continue;
+        }
+        pt_loop_fprintf_metrics(out, loop);
+        fclose(out);
+
+        if (pt_metrics_client_send(loop, client)) {
+            pt_metrics_client_free(client);
+            continue;
+        }
+
+        // The rest of the snapshot is sent once the client has read the beginning
+        memset(&event, 0, sizeof(struct epoll_event));
+        event.data.fd = client_fd;
+        event.events = EPOLLOUT;
+        if (epoll_ctl(loop->efd, EPOLL_CTL_ADD, client_fd, &event) == -1
+        ||  !dynarray_push_element(loop->metrics_clients, client)
+        ) {
+            perror("pt_loop: cannot wait for a metrics client");
+            pt_metrics_client_free(client);
+        }
+    }
+
+    // accept4 fails with EAGAIN once every client has been served.
+    if (errno == EAGAIN || errno == EWOULDBLOCK) errno = 0;
+}
+
+/**
+ * \brief Resume sending its snapshot to a client of loop->metrics_fd.
+ * \param loop The main loop.
+ * \param fd A file descriptor reported by epoll.
+ * \return true iif fd is a client of loop->metrics_fd.
+ */
+
+static bool pt_loop_resume_metrics(pt_loop_t * loop, int fd) {
+    size_t                i, num_clients = dynarray_get_size(loop->metrics_clients);
+    pt_metrics_client_t * client;
+
+    for (i = 0; i < num_clients; i++) {
+        client = dynarray_get_ith_element(loop->metrics_clients, i);
+        if (client->fd == fd) {
+            // Closing the socket also removes it from the epoll set
+            if (pt_metrics_client_send(loop, client)) {
+                dynarray_del_ith_element(loop->metrics_clients, i, (ELEMENT_FREE) pt_metrics_client_free);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
 //----------------------------------------------------------------
 // Non static functions
 //----------------------------------------------------------------
@@ -259,10 +432,24 @@ pt_loop_t * pt_loop_create(void (*handler_user)(pt_loop_t *, event_t *, void *),
         goto ERR_EPOLL;
     }
 
-    // Prepare algorithm events fd and register it in loop->efd
-    if ((loop->eventfd_algorithm = make_event_fd()) == -1) goto ERR_MAKE_EVENTFD_ALGORITHM;
+    // Prepare algorithm events fd and register it in loop->efd. It only wakes
+    // up the loop, which then processes every pending event: it is not a
+    // semaphore, so that a single read consumes all the notifications.
+    if ((loop->eventfd_algorithm = eventfd(0, 0)) == -1) {
+        perror("Error eventfd");
+        goto ERR_MAKE_EVENTFD_ALGORITHM;
+    }
     if (!register_efd(loop, loop->eventfd_algorithm))      goto ERR_EVENTFD_ALGORITHM;
 
+    // Prepare the timer of the algorithm instances (see pt_set_timer). It
+    // is non-blocking since disarming it discards an expiration which may
+    // have already been notified by epoll.
+    if ((loop->timerfd_algorithm = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK)) == -1) {
+        perror("Error timerfd_create");
+        goto ERR_MAKE_TIMERFD_ALGORITHM;
+    }
+    if (!register_efd(loop, loop->timerfd_algorithm))      goto ERR_TIMERFD_ALGORITHM;
+
     // Prepare user events fd and register it in loop->efd
     if ((loop->eventfd_user = make_event_fd()) == -1)      goto ERR_MAKE_EVENTFD_USER;
     if (!register_efd(loop, loop->eventfd_user))           goto ERR_EVENTFD_USER;
@@ -275,12 +462,24 @@ pt_loop_t * pt_loop_create(void (*handler_user)(pt_loop_t *, event_t *, void *),
     if (!(loop->network = network_create()))                           goto ERR_NETWORK_CREATE;
     if (!register_efd(loop, network_get_sendq_fd(loop->network)))      goto ERR_EVENTFD_SENDQ;
     if (!register_efd(loop, network_get_recvq_fd(loop->network)))      goto ERR_EVENTFD_RECVQ;
+    if (network_get_dgrampool_fd(loop->network) != -1) {
+        // Unprivileged mode (see network_create)
+        if (!register_efd(loop, network_get_dgrampool_fd(loop->network))) goto ERR_EVENTFD_DGRAMPOOL;
+    } else if (network_get_uring_fd(loop->network) != -1) {
+        // The sockets of the sniffer are read through io_uring (see uring.h)
+        if (!register_efd(loop, network_get_uring_fd(loop->network)))     goto ERR_EVENTFD_URING;
+    } else {
 #ifdef USE_IPV4
-    if (!register_efd(loop, network_get_icmpv4_sockfd(loop->network))) goto ERR_EVENTFD_SNIFFER_ICMPV4;
+        if (!register_efd(loop, network_get_icmpv4_sockfd(loop->network))) goto ERR_EVENTFD_SNIFFER_ICMPV4;
+        if (!register_efd(loop, network_get_tcpv4_sockfd(loop->network)))  goto ERR_EVENTFD_SNIFFER_TCPV4;
+        if (!register_efd(loop, network_get_udpv4_sockfd(loop->network)))  goto ERR_EVENTFD_SNIFFER_UDPV4;
 #endif
 #ifdef USE_IPV6
-    if (!register_efd(loop, network_get_icmpv6_sockfd(loop->network))) goto ERR_EVENTFD_SNIFFER_ICMPV6;
+        if (!register_efd(loop, network_get_icmpv6_sockfd(loop->network))) goto ERR_EVENTFD_SNIFFER_ICMPV6;
+        if (!register_efd(loop, network_get_tcpv6_sockfd(loop->network)))  goto ERR_EVENTFD_SNIFFER_TCPV6;
+        if (!register_efd(loop, network_get_udpv6_sockfd(loop->network)))  goto ERR_EVENTFD_SNIFFER_UDPV6;
 #endif
+    }
     if (!register_efd(loop, network_get_timerfd(loop->network)))       goto ERR_EVENTFD_TIMEOUT;
     if (!register_efd(loop, network_get_group_timerfd(loop->network))) goto ERR_EVENTFD_GROUP;
 
@@ -293,25 +492,60 @@ pt_loop_t * pt_loop_create(void (*handler_user)(pt_loop_t *, event_t *, void *),
         goto ERR_EVENTS_USER;
     }
 
+    if (!(loop->replies = dynarray_create())) {
+        goto ERR_REPLIES;
+    }
+
+    if (!(loop->added_instances = dynarray_create())) {
+        goto ERR_ADDED_INSTANCES;
+    }
+
+    if (!(loop->deleted_instances = dynarray_create())) {
+        goto ERR_DELETED_INSTANCES;
+    }
+
+    if (!(loop->timers = dynarray_create())) {
+        goto ERR_TIMERS;
+    }
+
     loop->user_data = user_data;
     loop->status = PT_LOOP_CONTINUE;
     loop->next_algorithm_id = 1; // 0 means unaffected ?
     loop->cur_instance = NULL;
     loop->algorithm_instances_root = NULL;
+    loop->num_algorithm_instances = 0;
+    loop->metrics_fd = -1;
+    loop->metrics_path = NULL;
+    loop->metrics_clients = NULL;
+    loop->metrics_out = NULL;
 
     return loop;
 
+ERR_TIMERS:
+    dynarray_free(loop->deleted_instances, NULL);
+ERR_DELETED_INSTANCES:
+    dynarray_free(loop->added_instances, NULL);
+ERR_ADDED_INSTANCES:
+    dynarray_free(loop->replies, NULL);
+ERR_REPLIES:
+    dynarray_free(loop->events_user, NULL);
 ERR_EVENTS_USER:
     free(loop->epoll_events);
 ERR_EVENTS:
 ERR_EVENTFD_GROUP:
 ERR_EVENTFD_TIMEOUT:
 #ifdef USE_IPV4
+ERR_EVENTFD_SNIFFER_UDPV4:
+ERR_EVENTFD_SNIFFER_TCPV4:
 ERR_EVENTFD_SNIFFER_ICMPV4:
 #endif
 #ifdef USE_IPV6
+ERR_EVENTFD_SNIFFER_UDPV6:
+ERR_EVENTFD_SNIFFER_TCPV6:
 ERR_EVENTFD_SNIFFER_ICMPV6:
 #endif
+ERR_EVENTFD_URING:
+ERR_EVENTFD_DGRAMPOOL:
 ERR_EVENTFD_RECVQ:
 ERR_EVENTFD_SENDQ:
     network_free(loop->network);
@@ -321,8 +555,11 @@ ERR_SIGNALFD:
 ERR_MAKE_SIGNALFD:
     close(loop->eventfd_user);
 ERR_EVENTFD_USER:
-    close(loop->eventfd_algorithm);
 ERR_MAKE_EVENTFD_USER:
+ERR_TIMERFD_ALGORITHM:
+    close(loop->timerfd_algorithm);
+ERR_MAKE_TIMERFD_ALGORITHM:
+    close(loop->eventfd_algorithm);
 ERR_EVENTFD_ALGORITHM:
     close(loop->efd);
 ERR_MAKE_EVENTFD_ALGORITHM:
@@ -336,10 +573,21 @@ void pt_loop_free(pt_loop_t * loop)
 {
     if (loop) {
         if (loop->events_user)  dynarray_free(loop->events_user, (ELEMENT_FREE) event_free);
+        if (loop->replies)      dynarray_free(loop->replies, NULL);
+        if (loop->added_instances) dynarray_free(loop->added_instances, (ELEMENT_FREE) algorithm_instance_free);
+        if (loop->deleted_instances) dynarray_free(loop->deleted_instances, NULL);
+        if (loop->timers)       dynarray_free(loop->timers, NULL);
         if (loop->epoll_events) free(loop->epoll_events);
         network_free(loop->network);
+        if (loop->metrics_fd != -1) {
+            close(loop->metrics_fd);
+            unlink(loop->metrics_path);
+            free(loop->metrics_path);
+            dynarray_free(loop->metrics_clients, (ELEMENT_FREE) pt_metrics_client_free);
+        }
         close(loop->sfd);
         close(loop->eventfd_user);
+        close(loop->timerfd_algorithm);
         close(loop->eventfd_algorithm);
         close(loop->efd);
 
@@ -361,6 +609,121 @@ inline size_t pt_loop_get_num_user_events(pt_loop_t * loop) {
     return loop->events_user->size;
 }
 
+const metrics_t * pt_loop_get_metrics(pt_loop_t * loop) {
+    return network_get_metrics(loop->network);
+}
+
+void pt_loop_fprintf_metrics(FILE * out, pt_loop_t * loop) {
+    size_t num_hits, num_misses;
+
+    metrics_fprintf_prometheus(out, pt_loop_get_metrics(loop), METRICS_PREFIX);
+
+    fprintf(out, "# TYPE %s_probes_in_flight gauge\n", METRICS_PREFIX);
+    fprintf(out, "%s_probes_in_flight %zu\n", METRICS_PREFIX, dynarray_get_size(loop->network->probes));
+    fprintf(out, "# TYPE %s_queue_length gauge\n", METRICS_PREFIX);
+    fprintf(out, "%s_queue_length{queue=\"sendq\"} %zu\n", METRICS_PREFIX, fair_queue_get_size(loop->network->sendq));
+    fprintf(out, "%s_queue_length{queue=\"recvq\"} %zu\n", METRICS_PREFIX, queue_get_size(loop->network->recvq));
+    fprintf(out, "# TYPE %s_algorithm_instances gauge\n", METRICS_PREFIX);
+    fprintf(out, "%s_algorithm_instances %zu\n", METRICS_PREFIX, loop->num_algorithm_instances);
+
+    fprintf(out, "# TYPE %s_instance_progress_total counter\n", METRICS_PREFIX);
+    loop->metrics_out = out;
+    pt_instance_iter(loop, pt_fprintf_instance_metrics);
+    loop->metrics_out = NULL;
+
+    if (address_cache_get_stats(&num_hits, &num_misses)) {
+        fprintf(out, "# TYPE %s_dns_cache_lookups_total counter\n", METRICS_PREFIX);
+        fprintf(out, "%s_dns_cache_lookups_total{result=\"hit\"} %zu\n",  METRICS_PREFIX, num_hits);
+        fprintf(out, "%s_dns_cache_lookups_total{result=\"miss\"} %zu\n", METRICS_PREFIX, num_misses);
+    }
+}
+
+/**
+ * \brief Check whether a Unix stream socket is served by a running process.
+ * \param addr The address of the socket.
+ * \return true iif a connection to this socket is not refused.
+ */
+
+static bool is_socket_in_use(const struct sockaddr_un * addr) {
+    int  fd;
+    bool ret = true;
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) return true;
+    if (connect(fd, (const struct sockaddr *) addr, sizeof(struct sockaddr_un)) == -1) {
+        ret = (errno != ECONNREFUSED);
+    }
+    close(fd);
+    return ret;
+}
+
+bool pt_loop_listen_metrics(pt_loop_t * loop, const char * path) {
+    struct sockaddr_un addr;
+    struct stat        st;
+    int                fd;
+
+    if (loop->metrics_fd != -1 || strlen(path) >= sizeof(addr.sun_path)) {
+        errno = EINVAL;
+        goto ERR_INVALID_PARAMETER;
+    }
+
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    // Only remove a socket left by a previous run, never a regular file
+    // nor a socket served by a running process.
+    if (stat(path, &st) == 0) {
+        if (S_ISSOCK(st.st_mode)) {
+            if (is_socket_in_use(&addr)) {
+                fprintf(stderr, "pt_loop_listen_metrics: %s is in use\n", path);
+                errno = EADDRINUSE;
+                goto ERR_IN_USE;
+            }
+            unlink(path);
+        }
+    } else {
+        // Nothing to remove (ENOENT must not be reported once the loop ends)
+        errno = 0;
+    }
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+        perror("pt_loop_listen_metrics: socket");
+        goto ERR_SOCKET;
+    }
+
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) == -1) {
+        perror("pt_loop_listen_metrics: bind");
+        goto ERR_BIND;
+    }
+
+    if (listen(fd, SOMAXCONN) == -1) {
+        perror("pt_loop_listen_metrics: listen");
+        goto ERR_LISTEN;
+    }
+
+    if (!(loop->metrics_path = strdup(path)))        goto ERR_STRDUP;
+    if (!(loop->metrics_clients = dynarray_create())) goto ERR_METRICS_CLIENTS;
+    if (!register_efd(loop, fd))                     goto ERR_REGISTER_EFD;
+    loop->metrics_fd = fd;
+    return true;
+
+ERR_REGISTER_EFD:
+    dynarray_free(loop->metrics_clients, NULL);
+    loop->metrics_clients = NULL;
+ERR_METRICS_CLIENTS:
+    free(loop->metrics_path);
+    loop->metrics_path = NULL;
+ERR_STRDUP:
+ERR_LISTEN:
+    unlink(path);
+ERR_BIND:
+    close(fd);
+ERR_SOCKET:
+ERR_IN_USE:
+ERR_INVALID_PARAMETER:
+    return false;
+}
+
 inline void pt_instance_iter(
     pt_loop_t * loop,
     void     (* action) (const void *, VISIT, int))
@@ -368,31 +731,99 @@ inline void pt_instance_iter(
     twalk(loop->algorithm_instances_root, action);
 }
 
+/**
+ * \brief Account a reply dispatched to an algorithm instance.
+ * \param instance The algorithm instance.
+ * \param probe_reply The dispatched reply.
+ */
+
+static void pt_observe_reply(algorithm_instance_t * instance, const probe_reply_t * probe_reply) {
+    instance->num_replies++;
+    metrics_observe(
+        &instance->loop->network->metrics,
+        METRICS_DISPATCH_LATENCY,
+        get_timestamp() - probe_get_recv_time(probe_reply->reply)
+    );
+}
+
+/**
+ * \brief Pass to the reply_handler of an algorithm instance the
+ *    consecutive PROBE_REPLY events starting at a given index.
+ * \param instance The algorithm instance.
+ * \param i The index of the first PROBE_REPLY event.
+ * \return The index of the first event which has not been dispatched
+ *    (i if the batch could not be built).
+ */
+
+static size_t pt_process_replies(algorithm_instance_t * instance, size_t i) {
+    pt_loop_t * loop = instance->loop;
+    event_t   * event;
+    size_t      num_events = dynarray_get_size(instance->events);
+
+    dynarray_clear(loop->replies, NULL);
+    for (; i < num_events; i++) {
+        event = dynarray_get_ith_element(instance->events, i);
+        if (event->type != PROBE_REPLY) break;
+
+        // If the batch cannot grow, the remaining replies are passed in the next one
+        if (!dynarray_push_element(loop->replies, event->data)) break;
+        pt_observe_reply(instance, event->data);
+    }
+
+    if (dynarray_get_size(loop->replies) == 0) return i;
+    instance->algorithm->reply_handler(
+        loop,
+        (probe_reply_t **) dynarray_get_elements(loop->replies),
+        dynarray_get_size(loop->replies),
+        &instance->data,
+        instance->probe_skel,
+        instance->options
+    );
+    return i;
+}
+
 void pt_process_instance(const void * node, VISIT visit, int level)
 {
     algorithm_instance_t * instance = *((algorithm_instance_t * const *) node);
-    size_t                 i, num_events;
-    uint64_t               ret;
-    ssize_t                count;
+    event_t              * event;
+    size_t                 i, j;
+
+    if (dynarray_get_size(instance->events) == 0) return;
+
+    // This instance has been unregistered by its caller (see pt_del_instance)
+    if (instance->is_deleted) {
+        algorithm_instance_clear_events(instance);
+        return;
+    }
 
     // Save temporarily this algorithm context.
     instance->loop->cur_instance = instance;
 
-    // Execute algorithm handler for each events.
-    num_events = dynarray_get_size(instance->events);
-    for (i = 0; i < num_events; i++) {
-        event_t * event;
+    // Execute algorithm handler for each events. The events thrown to this
+    // instance meanwhile are appended without notification (see pt_throw),
+    // so they are handled as well.
+    for (i = 0; i < dynarray_get_size(instance->events);) {
+        event = dynarray_get_ith_element(instance->events, i);
 
-        count = read(instance->loop->eventfd_algorithm, &ret, sizeof(ret));
-        if (count == -1) return;
+        // Consecutive replies are passed at once to the reply_handler (if any).
+        // If not even one of them can be batched, it is passed to the handler.
+        if (event->type == PROBE_REPLY && instance->algorithm->reply_handler) {
+            if ((j = pt_process_replies(instance, i)) > i) {
+                i = j;
+                continue;
+            }
+        }
 
-        event = dynarray_get_ith_element(instance->events, i);
+        if (event->type == PROBE_REPLY) {
+            pt_observe_reply(instance, event->data);
+        }
         instance->algorithm->handler(
             instance->loop, event,
             &instance->data,
             instance->probe_skel,
             instance->options
         );
+        i++;
 
         // Next events for this instance are ignored.
         if (event->type == ALGORITHM_TERM) {
@@ -428,13 +859,20 @@ int pt_loop(pt_loop_t * loop) {
     int network_recvq_fd      = network_get_recvq_fd(loop->network);
 #ifdef USE_IPV4
     int network_icmpv4_sockfd = network_get_icmpv4_sockfd(loop->network);
+    int network_tcpv4_sockfd  = network_get_tcpv4_sockfd(loop->network);
+    int network_udpv4_sockfd  = network_get_udpv4_sockfd(loop->network);
 #endif
 #ifdef USE_IPV6
     int network_icmpv6_sockfd = network_get_icmpv6_sockfd(loop->network);
+    int network_tcpv6_sockfd  = network_get_tcpv6_sockfd(loop->network);
+    int network_udpv6_sockfd  = network_get_udpv6_sockfd(loop->network);
 #endif
+    int network_dgrampool_fd  = network_get_dgrampool_fd(loop->network);
+    int network_uring_fd      = network_get_uring_fd(loop->network);
     int network_timerfd       = network_get_timerfd(loop->network);
     int network_group_timerfd = network_get_group_timerfd(loop->network);
     ssize_t s;
+    uint64_t num_notifications;
     struct signalfd_siginfo fdsi;
 
     // This boolean is used to avoid to terminate twice when --timeout is used.
@@ -455,6 +893,11 @@ int pt_loop(pt_loop_t * loop) {
 
         // Wait for events.
         n = epoll_wait(loop->efd, loop->epoll_events, MAXEVENTS, -1);
+        if (n == -1) {
+            // e.g. interrupted by the completion of an io_uring request
+            if (errno == EINTR) errno = 0;
+            else perror("pt_loop: error in epoll_wait");
+        }
 
         /* XXX What kind of events do we have
          * - sockets (packets received, timeouts, etc.)
@@ -467,6 +910,10 @@ int pt_loop(pt_loop_t * loop) {
             // the corresponding event.
             cur_fd = loop->epoll_events[i].data.fd;
 
+            // A metrics scraper has read the beginning of its snapshot (or
+            // has left, in which case it is released).
+            if (loop->metrics_clients && pt_loop_resume_metrics(loop, cur_fd)) continue;
+
             // Handle errors on fds
             if ((loop->epoll_events[i].events & EPOLLERR)
             ||  (loop->epoll_events[i].events & EPOLLHUP)
@@ -479,7 +926,7 @@ int pt_loop(pt_loop_t * loop) {
             }
 
             if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == network_sendq_fd) {
-                if (!network_process_sendq(loop->network)) {
+                if (!network_drain_sendq(loop->network)) {
                     if (loop->network->is_verbose) fprintf(stderr, "pt_loop: Can't send packet\n");
                 }
             } else if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == network_recvq_fd) {
@@ -492,23 +939,54 @@ int pt_loop(pt_loop_t * loop) {
 #ifdef USE_IPV4
             } else if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == network_icmpv4_sockfd) {
                 network_process_sniffer(loop->network, IPPROTO_ICMP);
+            } else if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == network_tcpv4_sockfd) {
+                network_process_sniffer_ext(loop->network, AF_INET, IPPROTO_TCP);
+            } else if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == network_udpv4_sockfd) {
+                network_process_sniffer_ext(loop->network, AF_INET, IPPROTO_UDP);
 #endif
 #ifdef USE_IPV6
             } else if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == network_icmpv6_sockfd) {
                 network_process_sniffer(loop->network, IPPROTO_ICMPV6);
+            } else if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == network_tcpv6_sockfd) {
+                network_process_sniffer_ext(loop->network, AF_INET6, IPPROTO_TCP);
+            } else if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == network_udpv6_sockfd) {
+                network_process_sniffer_ext(loop->network, AF_INET6, IPPROTO_UDP);
 #endif
+            } else if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == network_dgrampool_fd) {
+                network_process_dgrampool(loop->network);
+            } else if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == network_uring_fd) {
+                network_process_uring(loop->network);
             } else if (cur_fd == loop->eventfd_algorithm) {
 
+                // Consume every notification: each instance processes
+                // all its pending events at once.
+                if (read(loop->eventfd_algorithm, &num_notifications, sizeof(num_notifications)) == -1) {
+                    perror("pt_loop: cannot read eventfd_algorithm");
+                }
+
                 // There is one common queue shared by every instancied algorithms.
                 // We call pt_process_algorithms_iter() to find for which instance
                 // the event has been raised. Then we process this event thanks
                 // to pt_process_algorithms_instance() that calls the handler.
-
-                // << This must be thread safe!!
-                s_loop = loop;
+                // Each instance knows its loop (instance->loop), so no
+                // process-wide state is needed to walk through them.
                 pt_instance_iter(loop, pt_process_instance);
-                s_loop = NULL;
-                // >> This must be thread safe!!
+
+                // The tree of instances can now be altered. The instances
+                // added meanwhile are inserted first, since they may have
+                // been deleted as well.
+                pt_add_pending_instances(loop);
+                pt_free_deleted_instances(loop);
+
+            } else if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == loop->timerfd_algorithm) {
+
+                // The timer of at least one instance has expired
+                if (read(loop->timerfd_algorithm, &num_notifications, sizeof(num_notifications)) == -1) {
+                    if (errno != EAGAIN) perror("pt_loop: cannot read timerfd_algorithm");
+                    errno = 0;
+                } else {
+                    pt_process_timers(loop);
+                }
 
             } else if (cur_fd == loop->eventfd_user) {
 
@@ -518,6 +996,11 @@ int pt_loop(pt_loop_t * loop) {
                 // Flush the queue
                 pt_loop_clear_user_events(loop);
 
+            } else if (cur_fd == loop->metrics_fd) {
+
+                // Serve the metrics scrapers
+                pt_loop_process_metrics(loop);
+
             } else if (loop->status != PT_LOOP_INTERRUPTED && cur_fd == loop->sfd) {
 
                 // Handling signals (ctrl-c, etc.)
@@ -527,6 +1010,12 @@ int pt_loop(pt_loop_t * loop) {
                     continue;
                 }
 
+                if (fdsi.ssi_signo == SIGUSR1) {
+                    // Dump the metrics without interrupting the loop
+                    metrics_fprintf(stderr, pt_loop_get_metrics(loop));
+                    continue;
+                }
+
                 if (fdsi.ssi_signo == SIGINT || fdsi.ssi_signo == SIGQUIT) {
                     pt_instance_iter(loop, pt_process_algorithms_terminate);
                 } else {
@@ -544,6 +1033,11 @@ int pt_loop(pt_loop_t * loop) {
                 }
             }
         }
+
+        // Submit at once the packets sent during this iteration
+        if (!network_flush(loop->network)) {
+            fprintf(stderr, "pt_loop: Can't submit packets\n");
+        }
     } while (loop->status == PT_LOOP_CONTINUE || loop->status == PT_LOOP_INTERRUPTED);
 
     // Process internal events
@@ -551,11 +1045,26 @@ int pt_loop(pt_loop_t * loop) {
 }
 
 bool pt_send_probe(pt_loop_t * loop, probe_t * probe) {
+    algorithm_instance_t * instance = loop->cur_instance;
+
+    // The caller of this instance is notified once, when the quota is
+    // reached (see pt_set_instance_quota)
+    if (instance && instance->num_probes_sent >= instance->max_probes) {
+        if (!instance->is_quota_reached) {
+            instance->is_quota_reached = true;
+            pt_throw(loop, instance->caller, event_create(ALGORITHM_QUOTA_REACHED, NULL, instance, NULL));
+        }
+        errno = EAGAIN;
+        return false;
+    }
+
     // Annotate which algorithm has generated this probe
     probe_set_caller(probe, loop->cur_instance);
 
     // Tagging is achieved by network layer
-    return network_send_probe(loop->network, probe);
+    if (!network_send_probe(loop->network, probe)) return false;
+    if (loop->cur_instance) loop->cur_instance->num_probes_sent++;
+    return true;
 }
 
 void pt_loop_terminate(pt_loop_t * loop) {
@@ -16,6 +16,7 @@
  */
 
 #include <limits.h>      // INT_MAX
+#include <stdio.h>       // FILE
 
 // Do not include "algorithm.h" to avoid mutual inclusion
 #include "options.h"
@@ -32,6 +33,7 @@
 
 #define OPTIONS_PT_LOOP_TIMEOUT {PT_LOOP_DEFAULT_TIMEOUT, 0, INT_MAX}
 #define HELP_t "Set the timeout in seconds of the measurement (default is 180 seconds, pass 0 to set it to infinity)."
+#define HELP_metrics_socket "Serve live metrics in the Prometheus text format on this Unix socket (e.g. socat - UNIX-CONNECT:PATH)."
 
 /**
  * \brief Retrieve the timeout defined for the pt_loop.
@@ -63,8 +65,14 @@ typedef struct pt_loop_s {
 
     // Algorithms
     void                        * algorithm_instances_root;
+    size_t                        num_algorithm_instances;  /**< Number of instances stored in algorithm_instances_root */
     unsigned int                  next_algorithm_id;
-    int                           eventfd_algorithm;
+    int                           eventfd_algorithm;        /**< Notified once per batch of algorithm events (see pt_throw) */
+    dynarray_t                  * replies;                  /**< Batch of replies passed to algorithm_t::reply_handler (internal usage) */
+    dynarray_t                  * added_instances;          /**< Instances registered while the events are dispatched (see pt_add_instance) */
+    dynarray_t                  * deleted_instances;        /**< Instances unregistered while the events are dispatched (see pt_del_instance) */
+    int                           timerfd_algorithm;        /**< Expires when the timer of an instance expires (see pt_set_timer) */
+    dynarray_t                  * timers;                   /**< Instances whose timer is armed */
 
     // User
     int                           eventfd_user;             /**< User notification */
@@ -85,6 +93,12 @@ typedef struct pt_loop_s {
     // Signal data
     int                           sfd;                      // signalfd
 
+    // Metrics export
+    int                           metrics_fd;               /**< Listening Unix socket serving the metrics, -1 if unused (see pt_loop_listen_metrics) */
+    char                        * metrics_path;             /**< Path of metrics_fd */
+    dynarray_t                  * metrics_clients;          /**< Clients of metrics_fd whose snapshot is not fully sent yet (internal usage) */
+    FILE                        * metrics_out;              /**< Stream in which the metrics are being printed (internal usage) */
+
     // Epoll data
     int                           efd;
     struct epoll_event          * epoll_events;
@@ -97,9 +111,18 @@ typedef struct pt_loop_s {
  *    of an application and stopped once libparistraceroute is not anymore
  *    needed. The library raise some event to the application via its user
  *    handler.
+ *
+ *    Several loops may be created in a same process, and each one may be
+ *    run by its own thread: a loop only refers to its own network_t and
+ *    algorithm instances. The state shared between loops is either
+ *    read-only once main() is reached (registered protocols, algorithms,
+ *    generators and metafields, parsed options), or protected by a lock
+ *    (DNS cache, see address_resolv()).
  * \param handler_user A pointer to a function declared in the user's program
  *   called whenever a event concerning the user arises. This handler
  *   - receives a pointer to the libparistraceroute loop,
+ *   - must not release the event, which is released by the loop once
+ *     handled (see event_ref),
  *   - must return a value
  *     < 0: if the libparistraceroute loop has to be stopped (failure)
  *     = 0: if the libparistraceroute loop has to be stopped (success)
@@ -112,6 +135,42 @@ typedef struct pt_loop_s {
 
 pt_loop_t * pt_loop_create(void (*handler_user)(pt_loop_t *, event_t *, void *), void * user_data);
 
+/**
+ * \brief Retrieve the counters and histograms of a loop (see metrics.h).
+ *    They are also dumped on stderr whenever the process receives SIGUSR1.
+ * \param loop The libparistraceroute loop.
+ * \return The corresponding metrics_t instance.
+ */
+
+const metrics_t * pt_loop_get_metrics(pt_loop_t * loop);
+
+/**
+ * \brief Print the live state of a loop in the Prometheus text exposition
+ *    format: its metrics (see pt_loop_get_metrics), the number of probes in
+ *    flight, the length of the network queues, the number of running
+ *    algorithm instances and their progress, and the DNS cache statistics.
+ * \param out The output stream.
+ * \param loop The libparistraceroute loop.
+ */
+
+void pt_loop_fprintf_metrics(FILE * out, pt_loop_t * loop);
+
+/**
+ * \brief Serve the metrics of a loop (see pt_loop_fprintf_metrics) on a
+ *    Unix stream socket. The socket is handled by the loop itself: each
+ *    client is sent a snapshot of the metrics and disconnected, without
+ *    waiting for any request. Nothing blocks, so the measurements are not
+ *    delayed by the clients: a snapshot which does not fit in the socket
+ *    buffer is sent by the loop as the client reads it.
+ * \param loop The libparistraceroute loop.
+ * \param path The path of the socket. A stale socket at this path is
+ *    replaced, but not a socket served by a running process. It is
+ *    removed by pt_loop_free().
+ * \return true iif successful.
+ */
+
+bool pt_loop_listen_metrics(pt_loop_t * loop, const char * path);
+
 /**
  * \brief Close properly the paristraceroute loop
  * \param loop The libparistraceroute loop
@@ -143,9 +202,10 @@ int pt_loop(pt_loop_t * loop);
 /**
  * \brief Init the options related to pt_loop.
  * \param loop The libparistraceroute loop.
+ * \return true iif successful.
  */
 
-void options_pt_loop_init(pt_loop_t * loop);
+bool options_pt_loop_init(pt_loop_t * loop);
 
 /**
  * \brief Set a new timeout for the libparistraceroute loop.
@@ -175,10 +235,12 @@ size_t pt_loop_get_num_user_events(pt_loop_t * loop);
 /**
  * \brief Send a probe packet across a network
  * \param network Pointer to the network to use
- * \param probe Pointer to the probe to use
- * \param callback Function pointer to a callback function
- *     (Does not appear to be used currently)
- * \return true iif successful
+ * \param probe Pointer to the probe to use. The network layer takes over
+ *     the reference held by the caller if successful.
+ * \return true iif successful. If the sendq is full, or if the current
+ *     instance has reached its quota (see pt_set_instance_quota), errno is
+ *     set to EAGAIN and the current instance receives a NETWORK_WRITABLE
+ *     event once it can send probes again (see network_send_probe).
  */
 
 bool pt_send_probe(pt_loop_t * loop, probe_t * probe);
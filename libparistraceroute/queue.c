@@ -26,6 +26,7 @@ queue_t * queue_create_impl(
     if (!(queue->elements = list_create(element_free, element_fprintf))) {
         goto ERR_ELEMENTS;
     }
+    queue->size = 0;
     return queue;
 
 ERR_ELEMENTS:
@@ -47,18 +48,24 @@ void queue_free(queue_t * queue) {
 inline bool queue_push_element(queue_t *queue, void * element) {
     // Push an element in the queue
     // If successfull, write 1 in the file descriptor.
-    return list_push_element(queue->elements, element)
-        && (eventfd_write(queue->eventfd, 1) != -1);
+    if (!list_push_element(queue->elements, element)) return false;
+    queue->size++;
+    return eventfd_write(queue->eventfd, 1) != -1;
 }
 
 void * queue_pop_element(queue_t *queue, void (*element_free)(void * element)) {
     eventfd_t value;
-    return (read(queue->eventfd, &value, sizeof(value)) != -1) ?
-        list_pop_element(queue->elements, element_free) :
-        NULL;
+
+    if (read(queue->eventfd, &value, sizeof(value)) == -1) return NULL;
+    if (queue->elements->head) queue->size--;
+    return list_pop_element(queue->elements, element_free);
 }
 
 inline int queue_get_fd(const queue_t * queue) {
     return queue->eventfd;
 }
 
+size_t queue_get_size(const queue_t * queue) {
+    return queue->size;
+}
+
@@ -9,6 +9,7 @@
 typedef struct {
     list_t * elements; /**< Elements stored in the queue */
     int      eventfd;  /**< File descriptor notifying an update in the queue */
+    size_t   size;     /**< Number of elements stored in the queue */
 } queue_t;
 
 /**
@@ -60,4 +61,12 @@ void * queue_pop_element(queue_t * queue, void (*element_free)(void * element));
 
 int queue_get_fd(const queue_t * queue);
 
+/**
+ * \brief Retrieve the number of elements stored in a queue_t instance.
+ * \param queue A pointer to a queue instance.
+ * \return The corresponding number of elements.
+ */
+
+size_t queue_get_size(const queue_t * queue);
+
 #endif // LIBPT_QUEUE_H
@@ -15,6 +15,12 @@
 #  include <netinet/ip6.h> // ip6_hdr
 #endif
 
+#include "os/os.h"       // LINUX
+
+#ifdef LINUX
+#  include <linux/filter.h> // sock_filter, sock_fprog, BPF_*
+#endif
+
 #include "sniffer.h"
 
 #define BUFLEN 4096
@@ -147,32 +153,161 @@ ERR_SOCKET:
 }
 #endif
 
+/**
+ * \brief Attach to a TCP or UDP raw socket a BPF filter only accepting
+ *    packets whose destination port is in a given range.
+ * \param sockfd The raw socket.
+ * \param family The address family of the socket. IPv4 raw sockets
+ *    see the IP header, IPv6 raw sockets only see the transport header.
+ * \param port_min The lowest accepted destination port.
+ * \param port_max The highest accepted destination port. Pass
+ *    port_min > port_max to reject every packet.
+ * \return true iif successful
+ */
+
+static bool attach_port_range_filter(int sockfd, int family, uint16_t port_min, uint16_t port_max)
+{
+#ifdef LINUX
+    // In both TCP and UDP headers, the destination port is at offset 2.
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LDX | BPF_B   | BPF_MSH, 0),             // x = IPv4 header length
+        BPF_STMT(BPF_LD  | BPF_H   | BPF_IND, 2),             // a = destination port
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K,   port_min, 0, 2),
+        BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K,   port_max, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K,             0xffffffff),    // accept
+        BPF_STMT(BPF_RET | BPF_K,             0)              // reject
+    };
+    struct sock_fprog program = {
+        .len    = sizeof(code) / sizeof(struct sock_filter),
+        .filter = code
+    };
+
+    if (family == AF_INET6) {
+        // No IP header, skip the first instruction and load the port from offset 2.
+        code[1] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 2);
+        program.filter++;
+        program.len--;
+    }
+
+    if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) == -1) {
+        perror("attach_port_range_filter: error in setsockopt");
+        return false;
+    }
+#endif
+    return true;
+}
+
+/**
+ * \brief Discard the packets queued on a socket.
+ * \param sockfd The socket.
+ */
+
+static void drain_socket(int sockfd)
+{
+    uint8_t buffer[1];
+
+    // Datagrams are dequeued even if they are truncated
+    while (recv(sockfd, buffer, sizeof(buffer), MSG_DONTWAIT | MSG_TRUNC) >= 0);
+}
+
+/**
+ * \brief Create a raw socket sniffing TCP or UDP packets. No packet is
+ *    sniffed until sniffer_set_port_range is called.
+ * \param family The address family (AF_INET, AF_INET6).
+ * \param protocol_id The sniffed protocol (IPPROTO_TCP, IPPROTO_UDP).
+ * \return The socket file descriptor if successful, -1 otherwise.
+ */
+
+static int create_transport_socket(int family, uint8_t protocol_id)
+{
+    int sockfd;
+#ifdef USE_IPV6
+    int on = 1;
+#endif
+
+    if ((sockfd = socket(family, SOCK_RAW, protocol_id)) == -1) {
+        perror("create_transport_socket: error while creating socket");
+        goto ERR_SOCKET;
+    }
+
+    // Reject everything until the port range is known
+    if (!attach_port_range_filter(sockfd, family, 1, 0)) {
+        goto ERR_ATTACH_FILTER;
+    }
+
+    // The packets received before the filter was attached are not filtered
+    drain_socket(sockfd);
+
+    if (fcntl(sockfd, F_SETFL, O_NONBLOCK) == -1) {
+        goto ERR_FCNTL;
+    }
+
+#ifdef USE_IPV6
+    // Needed to rebuild the IPv6 header (see recv_ipv6)
+    if (family == AF_INET6) {
+        if ((setsockopt(sockfd, IPPROTO_IPV6, IPV6_RECVPKTINFO,  &on, sizeof(on)) == -1)
+        ||  (setsockopt(sockfd, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &on, sizeof(on)) == -1)
+        ||  (setsockopt(sockfd, IPPROTO_IPV6, IPV6_RECVTCLASS,   &on, sizeof(on)) == -1)
+        ) {
+            perror("create_transport_socket: error in setsockopt");
+            goto ERR_SETSOCKOPT;
+        }
+    }
+#endif
+
+    return sockfd;
+
+#ifdef USE_IPV6
+ERR_SETSOCKOPT:
+#endif
+ERR_FCNTL:
+ERR_ATTACH_FILTER:
+    close(sockfd);
+ERR_SOCKET:
+    return -1;
+}
+
 sniffer_t * sniffer_create(void * recv_param, bool (*recv_callback)(packet_t *, void *))
 {
     sniffer_t * sniffer;
 
-    // TODO: We currently only listen for ICMP thanks to raw sockets which
-    // requires root privileges
-	// Can we set port to 0 to capture all packets wheter ICMP, UDP or TCP?
+    // TODO: We currently listen thanks to raw sockets which requires root
+    // privileges
     if (!(sniffer = malloc(sizeof(sniffer_t)))) goto ERR_MALLOC;
+    if (!(sniffer->pool = packet_pool_create(BUFLEN, PACKET_POOL_MAX_FREE_PACKETS))) goto ERR_PACKET_POOL_CREATE;
 #ifdef USE_IPV4
     if (!create_icmpv4_socket(sniffer, 0))      goto ERR_CREATE_ICMPV4_SOCKET;
+    if ((sniffer->tcpv4_sockfd = create_transport_socket(AF_INET, IPPROTO_TCP)) == -1) goto ERR_CREATE_TCPV4_SOCKET;
+    if ((sniffer->udpv4_sockfd = create_transport_socket(AF_INET, IPPROTO_UDP)) == -1) goto ERR_CREATE_UDPV4_SOCKET;
 #endif
 #ifdef USE_IPV6
     if (!create_icmpv6_socket(sniffer, 0))      goto ERR_CREATE_ICMPV6_SOCKET;
+    if ((sniffer->tcpv6_sockfd = create_transport_socket(AF_INET6, IPPROTO_TCP)) == -1) goto ERR_CREATE_TCPV6_SOCKET;
+    if ((sniffer->udpv6_sockfd = create_transport_socket(AF_INET6, IPPROTO_UDP)) == -1) goto ERR_CREATE_UDPV6_SOCKET;
 #endif
     sniffer->recv_param = recv_param;
     sniffer->recv_callback = recv_callback;
+    sniffer->num_truncated = 0;
     return sniffer;
 #ifdef USE_IPV6
+ERR_CREATE_UDPV6_SOCKET:
+    close(sniffer->tcpv6_sockfd);
+ERR_CREATE_TCPV6_SOCKET:
+    close(sniffer->icmpv6_sockfd);
 ERR_CREATE_ICMPV6_SOCKET:
 #ifdef USE_IPV4
-    close(sniffer->icmpv4_sockfd);
+    close(sniffer->udpv4_sockfd);
 #endif
 #endif
 #ifdef USE_IPV4
+ERR_CREATE_UDPV4_SOCKET:
+    close(sniffer->tcpv4_sockfd);
+ERR_CREATE_TCPV4_SOCKET:
+    close(sniffer->icmpv4_sockfd);
 ERR_CREATE_ICMPV4_SOCKET:
 #endif
+    packet_pool_free(sniffer->pool);
+ERR_PACKET_POOL_CREATE:
     free(sniffer);
 ERR_MALLOC:
     return NULL;
@@ -183,18 +318,46 @@ void sniffer_free(sniffer_t * sniffer)
     if (sniffer) {
 #ifdef USE_IPV4
         close(sniffer->icmpv4_sockfd);
+        close(sniffer->tcpv4_sockfd);
+        close(sniffer->udpv4_sockfd);
 #endif
 #ifdef USE_IPV6
         close(sniffer->icmpv6_sockfd);
+        close(sniffer->tcpv6_sockfd);
+        close(sniffer->udpv6_sockfd);
 #endif
+        packet_pool_free(sniffer->pool);
         free(sniffer);
     }
 }
 
+bool sniffer_set_port_range(sniffer_t * sniffer, uint16_t port_min, uint16_t port_max)
+{
+    bool ret = true;
+
+#ifdef USE_IPV4
+    ret &= attach_port_range_filter(sniffer->tcpv4_sockfd, AF_INET, port_min, port_max);
+    ret &= attach_port_range_filter(sniffer->udpv4_sockfd, AF_INET, port_min, port_max);
+#endif
+#ifdef USE_IPV6
+    ret &= attach_port_range_filter(sniffer->tcpv6_sockfd, AF_INET6, port_min, port_max);
+    ret &= attach_port_range_filter(sniffer->udpv6_sockfd, AF_INET6, port_min, port_max);
+#endif
+    return ret;
+}
+
 #ifdef USE_IPV4
 int sniffer_get_icmpv4_sockfd(sniffer_t *sniffer) {
     return sniffer->icmpv4_sockfd;
 }
+
+int sniffer_get_tcpv4_sockfd(sniffer_t *sniffer) {
+    return sniffer->tcpv4_sockfd;
+}
+
+int sniffer_get_udpv4_sockfd(sniffer_t *sniffer) {
+    return sniffer->udpv4_sockfd;
+}
 #endif
 
 #ifdef USE_IPV6
@@ -202,12 +365,21 @@ int sniffer_get_icmpv6_sockfd(sniffer_t *sniffer) {
     return sniffer->icmpv6_sockfd;
 }
 
+int sniffer_get_tcpv6_sockfd(sniffer_t *sniffer) {
+    return sniffer->tcpv6_sockfd;
+}
+
+int sniffer_get_udpv6_sockfd(sniffer_t *sniffer) {
+    return sniffer->udpv6_sockfd;
+}
+
 /**
  * \brief Rebuild the missing parts of an IPv6 header.
  * \param ip6_header The IPv6 header we want to complete.
  * \param msghdr
  * \param from
  * \param num_bytes The size in bytes of the IPv6 header
+ * \param protocol_id The protocol nested in the IPv6 packet
  * \return true iif successful
  */
 
@@ -215,7 +387,8 @@ static bool rebuild_ipv6_header(
     struct ip6_hdr            * ip6_header,
     struct msghdr             * msg,
     const struct sockaddr_in6 * from,
-    ssize_t                     num_bytes
+    ssize_t                     num_bytes,
+    uint8_t                     protocol_id
 ) {
     bool                 ret = true;
     struct cmsghdr     * cmsg;
@@ -233,7 +406,7 @@ static bool rebuild_ipv6_header(
     memcpy(&ip6_header->ip6_src, &(from->sin6_addr), sizeof(struct in6_addr));
 
     // protocol
-    ip6_header-> ip6_ctlun.ip6_un1.ip6_un1_nxt = IPPROTO_ICMPV6;
+    ip6_header-> ip6_ctlun.ip6_un1.ip6_un1_nxt = protocol_id;
 
     // Fetch ancillary data (e.g last parts of the IPv6 header)
     for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
@@ -274,14 +447,19 @@ static bool rebuild_ipv6_header(
 }
 
 /**
- * \brief Fetch an IPv6/ICMPv6 packet from an IPv6 socket
- * \param ipv6_sockfd An IPv6 socket which is sniffing an ICMPv6 packet
+ * \brief Fetch an IPv6 packet from an IPv6 raw socket
+ * \param ipv6_sockfd An IPv6 socket which is sniffing a packet
+ * \param protocol_id The protocol sniffed by this socket (IPPROTO_ICMPV6,
+ *    IPPROTO_TCP, IPPROTO_UDP)
  * \param bytes A preallocated buffer in which we write the full IPv6 packet.
  * \param len The size of the preallocated buffer
- * \param flags
+ * \param flags Flags passed to recvmsg (e.g. MSG_TRUNC)
+ * \return The size of the IPv6 packet, 0 in case of failure. Like recv with
+ *    MSG_TRUNC, it is greater than len if the packet has been truncated: the
+ *    IPv6 header then describes the bytes written in the buffer.
  */
 
-static ssize_t recv_icmpv6(int ipv6_sockfd, void * bytes, size_t len, int flags) {
+static ssize_t recv_ipv6(int ipv6_sockfd, uint8_t protocol_id, void * bytes, size_t len, int flags) {
     ssize_t               num_bytes;
     char                  cmsg_buf[BUFLEN];
     struct sockaddr_in6   from;
@@ -313,17 +491,14 @@ static ssize_t recv_icmpv6(int ipv6_sockfd, void * bytes, size_t len, int flags)
         goto ERR_RECVMSG;
     }
 
-    if (msg.msg_flags & MSG_TRUNC) {
-        fprintf(stderr, "recv_ipv6_header: data truncated\n");
-        goto ERR_MSG_TRUNC;
-    }
-
     if (msg.msg_flags & MSG_CTRUNC) {
         fprintf(stderr, "recv_ipv6_header: ancillary data truncated\n");
         goto ERR_MSG_CTRUNK;
     }
 
-    if(!rebuild_ipv6_header(ip6_header, &msg, &from, num_bytes)) {
+    // A truncated packet is processed like the IPv4 ones: its first bytes
+    // are enough to match the probe it replies to.
+    if (!rebuild_ipv6_header(ip6_header, &msg, &from, (size_t) num_bytes < iov.iov_len ? (size_t) num_bytes : iov.iov_len, protocol_id)) {
         fprintf(stderr, "recv_ipv6_header: error in rebuild_ipv6_header\n");
         goto ERR_REBUILD_IPV6_HEADER;
     }
@@ -331,33 +506,128 @@ static ssize_t recv_icmpv6(int ipv6_sockfd, void * bytes, size_t len, int flags)
     return num_bytes + sizeof(struct ip6_hdr);
 ERR_REBUILD_IPV6_HEADER:
 ERR_MSG_CTRUNK:
-ERR_MSG_TRUNC:
 ERR_RECVMSG:
     return 0;
 }
 
 #endif // USE_IPV6
 
-void sniffer_process_packets(sniffer_t * sniffer, uint8_t protocol_id)
+static void sniffer_dispatch_packet(sniffer_t * sniffer, packet_t * packet, ssize_t num_bytes);
+
+void sniffer_process_packets(sniffer_t * sniffer, uint8_t protocol_id) {
+    sniffer_process_packets_ext(sniffer, protocol_id == IPPROTO_ICMPV6 ? AF_INET6 : AF_INET, protocol_id);
+}
+
+void sniffer_process_packets_ext(sniffer_t * sniffer, int family, uint8_t protocol_id)
 {
-    uint8_t    recv_bytes[BUFLEN];
-    ssize_t    num_bytes = 0;
     packet_t * packet;
+    uint8_t  * recv_bytes;
+    ssize_t    num_bytes = 0;
 
-    switch (protocol_id) {
+    // The packet is directly received in a packet_t instance
+    if (!(packet = packet_pool_get_packet(sniffer->pool))) {
+        fprintf(stderr, "sniffer_process_packets: cannot allocate a packet\n");
+        return;
+    }
+    recv_bytes = packet_get_bytes(packet);
+
+    switch (family) {
 #ifdef USE_IPV4
-        case IPPROTO_ICMP:
-            num_bytes = recv(sniffer->icmpv4_sockfd, recv_bytes, BUFLEN, 0);
+        case AF_INET:
+            switch (protocol_id) {
+                case IPPROTO_ICMP:
+                    num_bytes = recv(sniffer->icmpv4_sockfd, recv_bytes, BUFLEN, MSG_TRUNC);
+                    break;
+                case IPPROTO_TCP:
+                    num_bytes = recv(sniffer->tcpv4_sockfd, recv_bytes, BUFLEN, MSG_TRUNC);
+                    break;
+                case IPPROTO_UDP:
+                    num_bytes = recv(sniffer->udpv4_sockfd, recv_bytes, BUFLEN, MSG_TRUNC);
+                    break;
+            }
             break;
 #endif
 #ifdef USE_IPV6
-        case IPPROTO_ICMPV6:
-            num_bytes = recv_icmpv6(sniffer->icmpv6_sockfd, recv_bytes, BUFLEN, 0);
+        case AF_INET6:
+            switch (protocol_id) {
+                case IPPROTO_ICMPV6:
+                    num_bytes = recv_ipv6(sniffer->icmpv6_sockfd, protocol_id, recv_bytes, BUFLEN, MSG_TRUNC);
+                    break;
+                case IPPROTO_TCP:
+                    num_bytes = recv_ipv6(sniffer->tcpv6_sockfd, protocol_id, recv_bytes, BUFLEN, MSG_TRUNC);
+                    break;
+                case IPPROTO_UDP:
+                    num_bytes = recv_ipv6(sniffer->udpv6_sockfd, protocol_id, recv_bytes, BUFLEN, MSG_TRUNC);
+                    break;
+            }
             break;
 #endif
     }
 
-	if (num_bytes >= 4) {
+    // The packet did not fit in recv_bytes (see MSG_TRUNC and recv_ipv6)
+    if (num_bytes > BUFLEN) {
+        sniffer->num_truncated++;
+        num_bytes = BUFLEN;
+    }
+
+    sniffer_dispatch_packet(sniffer, packet, num_bytes);
+}
+
+void sniffer_process_message(sniffer_t * sniffer, int family, uint8_t protocol_id, struct msghdr * msg, const void * bytes, size_t num_bytes)
+{
+    packet_t * packet;
+    uint8_t  * recv_bytes;
+
+    if (msg->msg_flags & MSG_TRUNC) {
+        sniffer->num_truncated++;
+    }
+
+    // The bytes belong to a buffer which is given back to the kernel
+    // once processed, so they are copied.
+    if (!(packet = packet_pool_get_packet(sniffer->pool))) {
+        fprintf(stderr, "sniffer_process_message: cannot allocate a packet\n");
+        return;
+    }
+    recv_bytes = packet_get_bytes(packet);
+
+    switch (family) {
+#ifdef USE_IPV4
+        case AF_INET:
+            if (num_bytes > BUFLEN) num_bytes = BUFLEN;
+            memcpy(recv_bytes, bytes, num_bytes);
+            sniffer_dispatch_packet(sniffer, packet, num_bytes);
+            return;
+#endif
+#ifdef USE_IPV6
+        case AF_INET6:
+            if (num_bytes > BUFLEN - sizeof(struct ip6_hdr)) {
+                num_bytes = BUFLEN - sizeof(struct ip6_hdr);
+            }
+            memcpy(recv_bytes + sizeof(struct ip6_hdr), bytes, num_bytes);
+            if (!rebuild_ipv6_header((struct ip6_hdr *) recv_bytes, msg, msg->msg_name, num_bytes, protocol_id)) {
+                fprintf(stderr, "sniffer_process_message: error in rebuild_ipv6_header\n");
+                break;
+            }
+            sniffer_dispatch_packet(sniffer, packet, num_bytes + sizeof(struct ip6_hdr));
+            return;
+#endif
+    }
+    packet_free(packet);
+}
+
+/**
+ * \brief Pass a sniffed packet to the callback of a sniffer.
+ * \param sniffer Points to a sniffer_t instance.
+ * \param packet A packet of sniffer->pool in which the packet has been
+ *    received, starting with its IP header. It is passed to the callback,
+ *    or released.
+ * \param num_bytes The size of the packet. Packets shorter than 4 bytes
+ *    are ignored.
+ */
+
+static void sniffer_dispatch_packet(sniffer_t * sniffer, packet_t * packet, ssize_t num_bytes)
+{
+	if (num_bytes >= 4 && sniffer->recv_callback != NULL) {
 		// We have to make some modifications on the datagram
 		// received because the raw format varies between
 		// OSes:
@@ -372,13 +642,13 @@ void sniffer_process_packets(sniffer_t * sniffer, uint8_t protocol_id)
 		//writebe16(recv_bytes, 2, ip_len);
         printf("sniffer_process_packets: something unclear here\n");
 #endif
-		if (sniffer->recv_callback != NULL) {
-            packet = packet_create_from_bytes(recv_bytes, num_bytes);
-
-			if (!(sniffer->recv_callback(packet, sniffer->recv_param))) {
-                fprintf(stderr, "Error in sniffer's callback\n");
-            }
+        // The buffer is large enough, so this does not reallocate it
+        packet_resize(packet, num_bytes);
+        if (!(sniffer->recv_callback(packet, sniffer->recv_param))) {
+            fprintf(stderr, "Error in sniffer's callback\n");
         }
-	}
+	} else {
+        packet_free(packet);
+    }
 }
 
@@ -7,10 +7,19 @@
  *
  * The current implementation is based on raw sockets, but we could envisage a
  * libpcap implementation too
+ *
+ * ICMP packets are sniffed to catch replies sent by intermediate hops.
+ * TCP and UDP packets are sniffed to catch replies sent by the destination
+ * itself (e.g. SYN-ACK or RST in response to a TCP probe). Since every TCP
+ * and UDP packet reaching the host would be copied to these sockets, they are
+ * attached a BPF filter only accepting the packets sent to the source ports
+ * used by our probes (see sniffer_set_port_range).
  */
 
-#include <stdbool.h> // bool
-#include "packet.h"  // packet_t
+#include <stdbool.h>      // bool
+#include <sys/socket.h>   // msghdr
+#include "packet.h"       // packet_t
+#include "packet_pool.h"  // packet_pool_t
 #include "use.h"
 
 /**
@@ -25,12 +34,18 @@
 typedef struct {
 #ifdef USE_IPV4
     int     icmpv4_sockfd;  /**< Raw socket for sniffing ICMPv4 packets */
+    int     tcpv4_sockfd;   /**< Raw socket for sniffing IPv4/TCP packets */
+    int     udpv4_sockfd;   /**< Raw socket for sniffing IPv4/UDP packets */
 #endif
 #ifdef USE_IPV6
     int     icmpv6_sockfd;  /**< Raw socket for sniffing ICMPv6 packets */
+    int     tcpv6_sockfd;   /**< Raw socket for sniffing IPv6/TCP packets */
+    int     udpv6_sockfd;   /**< Raw socket for sniffing IPv6/UDP packets */
 #endif
     void  * recv_param;     /**< This pointer is passed whenever recv_callback is called */
     bool (* recv_callback)(packet_t * packet, void * recv_param); /**< Callback for received packets */
+    size_t  num_truncated;  /**< Number of packets that did not fit in the reception buffer */
+    packet_pool_t * pool;   /**< Packets in which the sniffed packets are received */
 } sniffer_t;
 
 /**
@@ -57,6 +72,24 @@ void sniffer_free(sniffer_t * sniffer);
  */
 
 int sniffer_get_icmpv4_sockfd(sniffer_t * sniffer);
+
+/**
+ * \brief Return the file descriptor related to the IPv4/TCP raw socket
+ *    managed by the sniffer.
+ * \param sniffer Points to a sniffer_t instance.
+ * \return The corresponding socket file descriptor.
+ */
+
+int sniffer_get_tcpv4_sockfd(sniffer_t * sniffer);
+
+/**
+ * \brief Return the file descriptor related to the IPv4/UDP raw socket
+ *    managed by the sniffer.
+ * \param sniffer Points to a sniffer_t instance.
+ * \return The corresponding socket file descriptor.
+ */
+
+int sniffer_get_udpv4_sockfd(sniffer_t * sniffer);
 #endif
 
 #ifdef USE_IPV6
@@ -68,8 +101,38 @@ int sniffer_get_icmpv4_sockfd(sniffer_t * sniffer);
  */
 
 int sniffer_get_icmpv6_sockfd(sniffer_t * sniffer);
+
+/**
+ * \brief Return the file descriptor related to the IPv6/TCP raw socket
+ *    managed by the sniffer.
+ * \param sniffer Points to a sniffer_t instance.
+ * \return The corresponding socket file descriptor.
+ */
+
+int sniffer_get_tcpv6_sockfd(sniffer_t * sniffer);
+
+/**
+ * \brief Return the file descriptor related to the IPv6/UDP raw socket
+ *    managed by the sniffer.
+ * \param sniffer Points to a sniffer_t instance.
+ * \return The corresponding socket file descriptor.
+ */
+
+int sniffer_get_udpv6_sockfd(sniffer_t * sniffer);
 #endif
 
+/**
+ * \brief Restrict the TCP and UDP packets sniffed to those whose destination
+ *    port is in a given range. No TCP nor UDP packet is sniffed until
+ *    this function is called.
+ * \param sniffer Points to a sniffer_t instance.
+ * \param port_min The lowest accepted destination port.
+ * \param port_max The highest accepted destination port.
+ * \return true iif successful
+ */
+
+bool sniffer_set_port_range(sniffer_t * sniffer, uint16_t port_min, uint16_t port_max);
+
 /**
  * \brief Fetch a packet from the listening socket. The sniffer then
  *   call recv_callback and pass to this function this packet and
@@ -81,4 +144,34 @@ int sniffer_get_icmpv6_sockfd(sniffer_t * sniffer);
 
 void sniffer_process_packets(sniffer_t * sniffer, uint8_t protocol_id);
 
+/**
+ * \brief Fetch a packet from one of the listening sockets. See also
+ *   sniffer_process_packets.
+ * \param sniffer Points to a sniffer_t instance.
+ * \param family The address family of the socket (AF_INET, AF_INET6)
+ * \param protocol_id The protocol of the socket (IPPROTO_ICMP, IPPROTO_ICMPV6,
+ *    IPPROTO_TCP, IPPROTO_UDP)
+ */
+
+void sniffer_process_packets_ext(sniffer_t * sniffer, int family, uint8_t protocol_id);
+
+/**
+ * \brief Process a packet received on one of the listening sockets by
+ *    another mean than sniffer_process_packets_ext (see uring.h), as if
+ *    it had been fetched by the sniffer.
+ * \param sniffer Points to a sniffer_t instance.
+ * \param family The address family of the socket (AF_INET, AF_INET6)
+ * \param protocol_id The protocol of the socket (IPPROTO_ICMP, IPPROTO_ICMPV6,
+ *    IPPROTO_TCP, IPPROTO_UDP)
+ * \param msg The header of the received message. msg->msg_flags must be
+ *    set. For IPv6, msg->msg_name and msg->msg_control must carry the
+ *    source address and the ancillary data needed to rebuild the IPv6
+ *    header (see sniffer_create).
+ * \param bytes The received bytes: the whole packet (IPv4), or the bytes
+ *    following the IPv6 header (IPv6).
+ * \param num_bytes The number of received bytes.
+ */
+
+void sniffer_process_message(sniffer_t * sniffer, int family, uint8_t protocol_id, struct msghdr * msg, const void * bytes, size_t num_bytes);
+
 #endif // LIBPT_SNIFFER_H
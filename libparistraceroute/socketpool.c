@@ -9,10 +9,14 @@
 #include <netdb.h>              // getaddrinfo
 #include <arpa/inet.h>          // inet_pton
 #include <string.h>             // memset
+#include <ifaddrs.h>            // getifaddrs
 
+#include "os/os.h"              // LINUX
 #include "socketpool.h"
 
 #include "address.h"            // address_guess_family
+#include "common.h"             // ELEMENT_FREE
+#include "field.h"              // ADDRESS
 
 /*
 If we send UDP packet, we could get a return error channel.
@@ -57,6 +61,63 @@ ERR_SOCKET:
     return false;
 }
 
+//---------------------------------------------------------------------------
+// socketpool_source_t
+//---------------------------------------------------------------------------
+
+/**
+ * \brief Create a source.
+ * \param ifname The outgoing interface, or NULL.
+ * \param src_ip The source address.
+ * \return The newly allocated source, NULL in case of failure.
+ */
+
+static socketpool_source_t * socketpool_source_create(const char * ifname, const address_t * src_ip) {
+    socketpool_source_t * source;
+
+    if (!(source = calloc(1, sizeof(socketpool_source_t))))   goto ERR_CALLOC;
+    if (!(create_raw_socket(src_ip->family, &source->sockfd))) goto ERR_CREATE_RAW_SOCKET;
+
+    if (ifname) {
+        if (strlen(ifname) >= IF_NAMESIZE) {
+            fprintf(stderr, "socketpool_source_create: Invalid interface name %s\n", ifname);
+            goto ERR_IFNAME;
+        }
+        strcpy(source->ifname, ifname);
+#ifdef LINUX
+        if (setsockopt(source->sockfd, SOL_SOCKET, SO_BINDTODEVICE, ifname, strlen(ifname) + 1) == -1) {
+            perror("socketpool_source_create: Can't bind socket to device");
+            goto ERR_SETSOCKOPT;
+        }
+#else
+        fprintf(stderr, "socketpool_source_create: Binding a socket to an interface is not supported\n");
+        goto ERR_SETSOCKOPT;
+#endif
+    }
+
+    memcpy(&source->src_ip, src_ip, sizeof(address_t));
+    return source;
+
+ERR_SETSOCKOPT:
+ERR_IFNAME:
+    close(source->sockfd);
+ERR_CREATE_RAW_SOCKET:
+    free(source);
+ERR_CALLOC:
+    return NULL;
+}
+
+static void socketpool_source_free(socketpool_source_t * source) {
+    if (source) {
+        close(source->sockfd);
+        free(source);
+    }
+}
+
+//---------------------------------------------------------------------------
+// socketpool_t
+//---------------------------------------------------------------------------
+
 socketpool_t * socketpool_create() {
     socketpool_t * socketpool;
     
@@ -67,8 +128,15 @@ socketpool_t * socketpool_create() {
 #ifdef USE_IPV6
     if (!(create_raw_socket(AF_INET6, &socketpool->ipv6_sockfd))) goto ERR_CREATE_RAW_SOCKET_IPV6;
 #endif
+    if (!(socketpool->sources = dynarray_create()))               goto ERR_SOURCES;
+    socketpool->policy = SOCKETPOOL_POLICY_FLOW;
+    socketpool->next_source = 0;
     return socketpool;
 
+ERR_SOURCES:
+#ifdef USE_IPV6
+    close(socketpool->ipv6_sockfd);
+#endif
 #ifdef USE_IPV6
 ERR_CREATE_RAW_SOCKET_IPV6:
 #ifdef USE_IPV4
@@ -95,47 +163,105 @@ void socketpool_free(socketpool_t * socketpool) {
             perror("socketpool_free: Error while closing IPv6 socket");
         }
 #endif
+        dynarray_free(socketpool->sources, (ELEMENT_FREE) socketpool_source_free);
         free(socketpool);
     }
 }
 
-bool socketpool_send_packet(const socketpool_t * socketpool, const packet_t * packet)
+/**
+ * \brief Retrieve the source related to the source address of a packet.
+ * \param socketpool A socketpool_t instance.
+ * \param packet A packet about to be sent.
+ * \return The corresponding source, NULL if none.
+ */
+
+static const socketpool_source_t * socketpool_find_source(const socketpool_t * socketpool, const packet_t * packet)
 {
-	sockaddr_u              sock;
-    int                     sockfd;
-    socklen_t               socklen;
-    const struct sockaddr * dst_addr;
-    
-    memset(&sock, 0, sizeof(sockaddr_u));
+    size_t                      i, num_sources = dynarray_get_size(socketpool->sources);
+    const socketpool_source_t * source;
+    const uint8_t             * bytes = packet_get_bytes(packet);
+    size_t                      size  = packet_get_size(packet);
+
+    for (i = 0; i < num_sources; i++) {
+        source = dynarray_get_ith_element(socketpool->sources, i);
+        if (source->src_ip.family != packet->dst_ip->family) continue;
+
+        switch (source->src_ip.family) {
+#ifdef USE_IPV4
+            case AF_INET:
+                // Source address: bytes 12 to 15 of the IPv4 header
+                if (size >= 16 && memcmp(bytes + 12, &source->src_ip.ip.ipv4, 4) == 0) return source;
+                break;
+#endif
+#ifdef USE_IPV6
+            case AF_INET6:
+                // Source address: bytes 8 to 23 of the IPv6 header
+                if (size >= 24 && memcmp(bytes + 8, &source->src_ip.ip.ipv6, 16) == 0) return source;
+                break;
+#endif
+            default:
+                break;
+        }
+    }
+    return NULL;
+}
+
+int socketpool_prepare_packet(
+    const socketpool_t      * socketpool,
+    const packet_t          * packet,
+    struct sockaddr_storage * dst_addr,
+    socklen_t               * psocklen
+) {
+    sockaddr_u                * sock = (sockaddr_u *) dst_addr;
+    int                         sockfd;
+    const socketpool_source_t * source;
+
+    memset(dst_addr, 0, sizeof(struct sockaddr_storage));
 
     // Prepare socket 
     // We don't care about the dst_port set in the packet
     switch (packet->dst_ip->family) {
 #ifdef USE_IPV4
         case AF_INET:
-            sock.sin.sin_family = AF_INET;
-            sock.sin.sin_addr   = packet->dst_ip->ip.ipv4;
+            sock->sin.sin_family = AF_INET;
+            sock->sin.sin_addr   = packet->dst_ip->ip.ipv4;
             sockfd = socketpool->ipv4_sockfd;
-            socklen = sizeof(struct sockaddr_in);
-            dst_addr = (struct sockaddr *) &sock.sin;
+            *psocklen = sizeof(struct sockaddr_in);
             break;
 #endif
 #ifdef USE_IPV6
         case AF_INET6:
-            sock.sin6.sin6_family = AF_INET6;
-            memcpy(&sock.sin6.sin6_addr, &packet->dst_ip->ip.ipv6, sizeof(ipv6_t));
+            sock->sin6.sin6_family = AF_INET6;
+            memcpy(&sock->sin6.sin6_addr, &packet->dst_ip->ip.ipv6, sizeof(ipv6_t));
             sockfd = socketpool->ipv6_sockfd;
-            socklen = sizeof(struct sockaddr_in6);
-            dst_addr = (struct sockaddr *) &sock.sin6;
+            *psocklen = sizeof(struct sockaddr_in6);
             break;
 #endif
         default:
-            fprintf(stderr, "socketpool_send_packet: Address family not supported\n");
-            goto ERR_INVALID_FAMILY;
+            fprintf(stderr, "socketpool_prepare_packet: Address family not supported\n");
+            return -1;
+    }
+
+    // Packets assigned to a registered source leave through its socket
+    if ((source = socketpool_find_source(socketpool, packet))) {
+        sockfd = source->sockfd;
+    }
+
+    return sockfd;
+}
+
+bool socketpool_send_packet(const socketpool_t * socketpool, const packet_t * packet)
+{
+    struct sockaddr_storage dst_addr;
+    socklen_t               socklen;
+    int                     sockfd;
+
+    if ((sockfd = socketpool_prepare_packet(socketpool, packet, &dst_addr, &socklen)) == -1) {
+        goto ERR_INVALID_FAMILY;
     }
 
     // Send the packet
-    if (sendto(sockfd, packet_get_bytes(packet), packet_get_size(packet), 0, dst_addr, socklen) == -1) {
+    if (sendto(sockfd, packet_get_bytes(packet), packet_get_size(packet), 0, (struct sockaddr *) &dst_addr, socklen) == -1) {
         perror("send_data: Sending error in queue");
         goto ERR_SEND_TO;
     }
@@ -146,3 +272,191 @@ ERR_SEND_TO:
 ERR_INVALID_FAMILY:
     return false;
 }
+
+bool socketpool_add_source(socketpool_t * socketpool, const char * ifname, const address_t * src_ip)
+{
+    socketpool_source_t * source;
+    struct ifaddrs       * ifaddrs, * ifa;
+    address_t              address;
+    bool                   has_ipv4 = false,
+                           has_ipv6 = false,
+                           ret = true;
+
+    if (src_ip) {
+        if (!(source = socketpool_source_create(ifname, src_ip))) goto ERR_SOURCE_CREATE;
+        if (!dynarray_push_element(socketpool->sources, source))  goto ERR_PUSH_ELEMENT;
+        return true;
+    }
+
+    if (!ifname) {
+        fprintf(stderr, "socketpool_add_source: Neither interface nor address\n");
+        return false;
+    }
+
+    // Retrieve the first address of each family configured on this interface
+    if (getifaddrs(&ifaddrs) == -1) {
+        perror("socketpool_add_source: Can't list interface addresses");
+        return false;
+    }
+
+    for (ifa = ifaddrs; ifa && ret; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || strcmp(ifa->ifa_name, ifname) != 0) continue;
+
+        memset(&address, 0, sizeof(address_t));
+        address.family = ifa->ifa_addr->sa_family;
+        switch (address.family) {
+#ifdef USE_IPV4
+            case AF_INET:
+                if (has_ipv4) continue;
+                address.ip.ipv4 = ((struct sockaddr_in *) ifa->ifa_addr)->sin_addr;
+                has_ipv4 = true;
+                break;
+#endif
+#ifdef USE_IPV6
+            case AF_INET6:
+                // Link-local addresses can't be used to reach remote hosts
+                if (has_ipv6 || IN6_IS_ADDR_LINKLOCAL(&((struct sockaddr_in6 *) ifa->ifa_addr)->sin6_addr)) continue;
+                memcpy(&address.ip.ipv6, &((struct sockaddr_in6 *) ifa->ifa_addr)->sin6_addr, sizeof(ipv6_t));
+                has_ipv6 = true;
+                break;
+#endif
+            default:
+                continue;
+        }
+        ret = socketpool_add_source(socketpool, ifname, &address);
+    }
+    freeifaddrs(ifaddrs);
+
+    if (ret && !has_ipv4 && !has_ipv6) {
+        fprintf(stderr, "socketpool_add_source: No address configured on %s\n", ifname);
+        ret = false;
+    }
+    return ret;
+
+ERR_PUSH_ELEMENT:
+    socketpool_source_free(source);
+ERR_SOURCE_CREATE:
+    return false;
+}
+
+bool socketpool_add_sources_from_string(socketpool_t * socketpool, const char * str)
+{
+    char       * buffer, * token, * saveptr, * at;
+    const char * ifname;
+    address_t    address;
+    bool         ret = true;
+
+    if (!(buffer = strdup(str))) return false;
+
+    for (token = strtok_r(buffer, ",", &saveptr); token && ret; token = strtok_r(NULL, ",", &saveptr)) {
+        ifname = NULL;
+        if ((at = strchr(token, '@'))) {
+            *at = '\0';
+            ifname = at + 1;
+        }
+
+        // Only numeric addresses are considered, to avoid resolving interface names
+        memset(&address, 0, sizeof(address_t));
+        if (inet_pton(AF_INET, token, &address.ip.ipv4) == 1) {
+            address.family = AF_INET;
+        } else if (inet_pton(AF_INET6, token, &address.ip.ipv6) == 1) {
+            address.family = AF_INET6;
+        }
+
+        if (address.family) {
+            // "address" or "address@interface"
+            ret = socketpool_add_source(socketpool, ifname, &address);
+        } else if (!ifname) {
+            // "interface"
+            ret = socketpool_add_source(socketpool, token, NULL);
+        } else {
+            fprintf(stderr, "socketpool_add_sources_from_string: Invalid address %s\n", token);
+            ret = false;
+        }
+    }
+
+    free(buffer);
+    return ret;
+}
+
+void socketpool_set_policy(socketpool_t * socketpool, socketpool_policy_t policy) {
+    socketpool->policy = policy;
+}
+
+/**
+ * \brief Hash the fields identifying the flow of a probe (i.e. every field
+ *    that routers may consider for load balancing, except the source address).
+ * \param probe A probe_t instance.
+ * \return The corresponding hash.
+ */
+
+static size_t probe_hash_flow(const probe_t * probe)
+{
+    address_t dst_ip;
+    uint16_t  src_port = 0, dst_port = 0;
+    uint8_t   protocol = 0;
+    size_t    i, hash = 5381;
+    uint8_t   bytes[sizeof(ipv6_t) + 2 * sizeof(uint16_t) + sizeof(uint8_t)];
+
+    memset(&dst_ip, 0, sizeof(address_t));
+    memset(bytes, 0, sizeof(bytes));
+    probe_extract(probe, "dst_ip",   &dst_ip);
+    probe_extract(probe, "protocol", &protocol);
+    probe_extract(probe, "src_port", &src_port);
+    probe_extract(probe, "dst_port", &dst_port);
+
+    memcpy(bytes, &dst_ip.ip, dst_ip.family == AF_INET6 ? sizeof(ipv6_t) : sizeof(ipv4_t));
+    memcpy(bytes + sizeof(ipv6_t),                        &src_port, sizeof(uint16_t));
+    memcpy(bytes + sizeof(ipv6_t) + sizeof(uint16_t),     &dst_port, sizeof(uint16_t));
+    memcpy(bytes + sizeof(ipv6_t) + 2 * sizeof(uint16_t), &protocol, sizeof(uint8_t));
+
+    // djb2
+    for (i = 0; i < sizeof(bytes); i++) {
+        hash = hash * 33 + bytes[i];
+    }
+    return hash;
+}
+
+bool socketpool_assign_source(socketpool_t * socketpool, probe_t * probe)
+{
+    size_t                      i, j, num_sources = dynarray_get_size(socketpool->sources),
+                                num_candidates = 0;
+    const socketpool_source_t * source;
+    address_t                   dst_ip;
+    bool                        ret = false;
+    field_t                   * field;
+
+    if (num_sources == 0) return true;
+    if (!probe_extract(probe, "dst_ip", &dst_ip)) return false;
+
+    // Count the sources having the same address family than the probe
+    for (i = 0; i < num_sources; i++) {
+        source = dynarray_get_ith_element(socketpool->sources, i);
+        if (source->src_ip.family == dst_ip.family) num_candidates++;
+    }
+    if (num_candidates == 0) return true;
+
+    switch (socketpool->policy) {
+        case SOCKETPOOL_POLICY_ROUND_ROBIN:
+            j = socketpool->next_source++ % num_candidates;
+            break;
+        case SOCKETPOOL_POLICY_FLOW:
+        default:
+            j = probe_hash_flow(probe) % num_candidates;
+            break;
+    }
+
+    // Retrieve the j-th candidate
+    for (i = 0; i < num_sources; i++) {
+        source = dynarray_get_ith_element(socketpool->sources, i);
+        if (source->src_ip.family == dst_ip.family && j-- == 0) break;
+    }
+
+    // Do not use probe_set_fields: ipv*_finalize would overwrite src_ip.
+    // Checksums are updated when the probe is tagged.
+    if ((field = ADDRESS("src_ip", &source->src_ip))) {
+        ret = probe_set_field(probe, field);
+        field_free(field);
+    }
+    return ret;
+}
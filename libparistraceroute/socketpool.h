@@ -1,9 +1,53 @@
 #ifndef LIBPT_SOCKETPOOL_H
 #define LIBPT_SOCKETPOOL_H
 
-#include "packet.h"
+/**
+ * \file socketpool.h
+ * \brief A socketpool_t sends the probes thanks to raw sockets.
+ *
+ * By default, a single raw socket is used per address family, and each
+ * probe leaves with the source address chosen by the kernel according to
+ * its destination (see ipv4_finalize and ipv6_finalize).
+ *
+ * Additional sources, made of a source address and/or an outgoing
+ * interface, can be registered to spread the probes across several
+ * addresses and uplinks. Each source owns a raw socket, bound to its
+ * interface (SO_BINDTODEVICE) if any. Before being tagged, each probe is
+ * assigned one of the sources of its address family according to the
+ * policy of the socketpool, and its source address is overwritten
+ * accordingly (see socketpool_assign_source).
+ */
+
+#include <net/if.h>     // IF_NAMESIZE
+#include <sys/socket.h> // sockaddr_storage, socklen_t
+
+#include "address.h"    // address_t
+#include "dynarray.h"   // dynarray_t
+#include "packet.h"     // packet_t
+#include "probe.h"      // probe_t
 #include "use.h"
 
+/**
+ * \enum socketpool_policy_t
+ * \brief How probes are assigned to the sources of a socketpool_t.
+ */
+
+typedef enum {
+    SOCKETPOOL_POLICY_FLOW,       /**< Every probe of a given flow leaves from the same source (default) */
+    SOCKETPOOL_POLICY_ROUND_ROBIN /**< Sources are used in turn, regardless of the flows */
+} socketpool_policy_t;
+
+/**
+ * \struct socketpool_source_t
+ * \brief A source from which probes may be sent.
+ */
+
+typedef struct {
+    char      ifname[IF_NAMESIZE]; /**< Outgoing interface, "" if unspecified */
+    address_t src_ip;              /**< Source address written in the probes */
+    int       sockfd;              /**< Raw socket used to send these probes */
+} socketpool_source_t;
+
 typedef struct {
 #ifdef USE_IPV4
     int ipv4_sockfd; /**< File descriptor of the IPv4 raw socket */
@@ -11,6 +55,9 @@ typedef struct {
 #ifdef USE_IPV6
     int ipv6_sockfd; /**< File descriptor of the IPv6 raw socket */
 #endif
+    dynarray_t          * sources;     /**< Additional sources (socketpool_source_t *) */
+    socketpool_policy_t   policy;      /**< How probes are assigned to sources */
+    size_t                next_source; /**< Next source to use (SOCKETPOOL_POLICY_ROUND_ROBIN) */
 } socketpool_t;
 
 /**
@@ -38,4 +85,66 @@ void socketpool_free(socketpool_t * socketpool);
 
 bool socketpool_send_packet(const socketpool_t * socketpool, const packet_t * packet);
 
+/**
+ * \brief Retrieve how a packet must be sent, without sending it (see uring.h).
+ * \param socketpool The socketpool to use
+ * \param packet The packet to send
+ * \param dst_addr Address of a sockaddr_storage in which the destination
+ *    of the packet is written.
+ * \param psocklen Address of a socklen_t in which the size of *dst_addr
+ *    is written.
+ * \return The socket through which the packet must be sent, -1 in case of failure.
+ */
+
+int socketpool_prepare_packet(
+    const socketpool_t      * socketpool,
+    const packet_t          * packet,
+    struct sockaddr_storage * dst_addr,
+    socklen_t               * psocklen
+);
+
+/**
+ * \brief Register a source in a socketpool.
+ * \param socketpool A socketpool_t instance.
+ * \param ifname The outgoing interface (e.g. "eth0"), or NULL.
+ * \param src_ip The source address, or NULL. If NULL, ifname must be set
+ *    and every address family configured on this interface gets a source
+ *    (the first address of each family is used).
+ * \return true iif successful.
+ */
+
+bool socketpool_add_source(socketpool_t * socketpool, const char * ifname, const address_t * src_ip);
+
+/**
+ * \brief Register the sources described by a string.
+ * \param socketpool A socketpool_t instance.
+ * \param str A comma-separated list of sources. Each of them is either
+ *    an interface ("eth0"), an address ("192.0.2.1"), or both
+ *    ("192.0.2.1@eth0").
+ * \return true iif successful.
+ */
+
+bool socketpool_add_sources_from_string(socketpool_t * socketpool, const char * str);
+
+/**
+ * \brief Set how probes are assigned to the sources of a socketpool.
+ * \param socketpool A socketpool_t instance.
+ * \param policy The new policy.
+ */
+
+void socketpool_set_policy(socketpool_t * socketpool, socketpool_policy_t policy);
+
+/**
+ * \brief Assign a source to a probe according to the policy of the socketpool,
+ *    and write the corresponding source address in the probe. Probes whose
+ *    address family has no registered source are left unchanged.
+ *    This must be done before tagging the probe, since the tag depends
+ *    on the source address (see network_tag_probe).
+ * \param socketpool A socketpool_t instance.
+ * \param probe The probe about to be sent.
+ * \return true iif successful.
+ */
+
+bool socketpool_assign_source(socketpool_t * socketpool, probe_t * probe);
+
 #endif // LIBPT_SOCKETPOOL_H
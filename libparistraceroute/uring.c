@@ -0,0 +1,537 @@
+#include "use.h"
+#include "config.h"
+
+#include <stdlib.h>             // malloc, free
+#include <stdio.h>              // perror
+#include <string.h>             // memset
+#include <errno.h>              // errno, ENOSYS, ENOBUFS, EINTR
+#include <unistd.h>             // close, syscall
+#include <netinet/in.h>         // IPPROTO_*, sockaddr_in6
+
+#include "os/os.h"              // LINUX
+
+#if defined(LINUX) && defined(HAVE_LINUX_IO_URING_H)
+#  include <sys/mman.h>         // mmap, munmap
+#  include <sys/syscall.h>      // __NR_io_uring_*
+#  include <linux/io_uring.h>   // io_uring_*
+#  ifdef IORING_RECV_MULTISHOT  // Linux >= 6.0
+#    define URING
+#  endif
+#endif
+
+#include "uring.h"
+
+#define URING_BGID       0    // Identifier of the group of reception buffers
+#define URING_CONTROLLEN 256  // Space reserved for the ancillary data (IPv6)
+#define URING_RECV       1    // Low bit of the user_data of the recvmsg requests
+
+#ifdef URING
+
+/**
+ * \struct uring_send_t
+ * \brief A packet being sent. Its address is the user_data of the
+ *    corresponding sendmsg request.
+ */
+
+typedef struct {
+    struct msghdr           msg;      /**< Message passed to sendmsg */
+    struct iovec            iov;      /**< Points to the bytes of the packet */
+    struct sockaddr_storage dst_addr; /**< Destination of the packet */
+    packet_t              * packet;   /**< Reference to the packet, released once it has been sent */
+} uring_send_t;
+
+static inline int sys_io_uring_setup(unsigned entries, struct io_uring_params * params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static inline int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static inline int sys_io_uring_register(int fd, unsigned opcode, void * arg, unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * \brief Map the rings shared with the kernel.
+ * \param uring A uring_t instance whose fd is set.
+ * \param params The parameters returned by io_uring_setup.
+ * \return true iif successful.
+ */
+
+static bool uring_map_rings(uring_t * uring, const struct io_uring_params * params)
+{
+    uring->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+    uring->cq_ring_size = params->cq_off.cqes  + params->cq_entries * sizeof(struct io_uring_cqe);
+
+    // Both rings may be mapped at once
+    if (params->features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring->cq_ring_size > uring->sq_ring_size) uring->sq_ring_size = uring->cq_ring_size;
+        uring->cq_ring_size = uring->sq_ring_size;
+    }
+
+    if ((uring->sq_ring = mmap(
+        NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        uring->fd, IORING_OFF_SQ_RING
+    )) == MAP_FAILED) {
+        goto ERR_MMAP_SQ_RING;
+    }
+
+    if (params->features & IORING_FEAT_SINGLE_MMAP) {
+        uring->cq_ring = uring->sq_ring;
+    } else if ((uring->cq_ring = mmap(
+        NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        uring->fd, IORING_OFF_CQ_RING
+    )) == MAP_FAILED) {
+        goto ERR_MMAP_CQ_RING;
+    }
+
+    uring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+    if ((uring->sqes = mmap(
+        NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        uring->fd, IORING_OFF_SQES
+    )) == MAP_FAILED) {
+        goto ERR_MMAP_SQES;
+    }
+
+    uring->sq_head     = (unsigned *) ((uint8_t *) uring->sq_ring + params->sq_off.head);
+    uring->sq_tail     = (unsigned *) ((uint8_t *) uring->sq_ring + params->sq_off.tail);
+    uring->sq_mask     = (unsigned *) ((uint8_t *) uring->sq_ring + params->sq_off.ring_mask);
+    uring->sq_array    = (unsigned *) ((uint8_t *) uring->sq_ring + params->sq_off.array);
+    uring->cq_head     = (unsigned *) ((uint8_t *) uring->cq_ring + params->cq_off.head);
+    uring->cq_tail     = (unsigned *) ((uint8_t *) uring->cq_ring + params->cq_off.tail);
+    uring->cq_mask     = (unsigned *) ((uint8_t *) uring->cq_ring + params->cq_off.ring_mask);
+    uring->cqes        = (uint8_t *) uring->cq_ring + params->cq_off.cqes;
+    uring->num_entries = params->sq_entries;
+    uring->sqe_tail    = *uring->sq_tail;
+    return true;
+
+ERR_MMAP_SQES:
+    if (uring->cq_ring != uring->sq_ring) munmap(uring->cq_ring, uring->cq_ring_size);
+ERR_MMAP_CQ_RING:
+    munmap(uring->sq_ring, uring->sq_ring_size);
+ERR_MMAP_SQ_RING:
+    perror("uring_map_rings: error in mmap");
+    return false;
+}
+
+/**
+ * \brief Give a reception buffer to the kernel. The buffer is only
+ *    visible to the kernel once uring_publish_buffers is called.
+ * \param uring A uring_t instance.
+ * \param bid The index of the buffer.
+ */
+
+static inline void uring_provide_buffer(uring_t * uring, uint16_t bid) {
+    struct io_uring_buf_ring * buf_ring = uring->buf_ring;
+    struct io_uring_buf      * buf = &buf_ring->bufs[uring->buf_tail & (URING_NUM_BUFFERS - 1)];
+
+    buf->addr = (uintptr_t) (uring->buffers + bid * URING_BUFFER_SIZE);
+    buf->len  = URING_BUFFER_SIZE;
+    buf->bid  = bid;
+    uring->buf_tail++;
+}
+
+static inline void uring_publish_buffers(uring_t * uring) {
+    struct io_uring_buf_ring * buf_ring = uring->buf_ring;
+    __atomic_store_n(&buf_ring->tail, uring->buf_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * \brief Allocate the reception buffers and register them in the kernel.
+ * \param uring A uring_t instance.
+ * \return true iif successful.
+ */
+
+static bool uring_setup_buffers(uring_t * uring)
+{
+    struct io_uring_buf_reg reg;
+    uint16_t                bid;
+
+    // The ring must be page-aligned
+    uring->buf_ring_size = URING_NUM_BUFFERS * sizeof(struct io_uring_buf);
+    if ((uring->buf_ring = mmap(
+        NULL, uring->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+    )) == MAP_FAILED) {
+        perror("uring_setup_buffers: error in mmap");
+        goto ERR_MMAP;
+    }
+
+    if (!(uring->buffers = malloc(URING_NUM_BUFFERS * URING_BUFFER_SIZE))) {
+        goto ERR_MALLOC;
+    }
+
+    memset(&reg, 0, sizeof(struct io_uring_buf_reg));
+    reg.ring_addr    = (uintptr_t) uring->buf_ring;
+    reg.ring_entries = URING_NUM_BUFFERS;
+    reg.bgid         = URING_BGID;
+    if (sys_io_uring_register(uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        perror("uring_setup_buffers: error in io_uring_register");
+        goto ERR_REGISTER;
+    }
+
+    uring->buf_tail = 0;
+    for (bid = 0; bid < URING_NUM_BUFFERS; bid++) {
+        uring_provide_buffer(uring, bid);
+    }
+    uring_publish_buffers(uring);
+    return true;
+
+ERR_REGISTER:
+    free(uring->buffers);
+ERR_MALLOC:
+    munmap(uring->buf_ring, uring->buf_ring_size);
+ERR_MMAP:
+    return false;
+}
+
+/**
+ * \brief Retrieve a free submission queue entry. If the submission
+ *    queue is full, the pending entries are submitted.
+ * \param uring A uring_t instance.
+ * \return The address of the entry, NULL in case of failure.
+ */
+
+static struct io_uring_sqe * uring_get_sqe(uring_t * uring)
+{
+    struct io_uring_sqe * sqe;
+    unsigned              index;
+
+    if (uring->sqe_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) >= uring->num_entries) {
+        if (!uring_flush(uring)) return NULL;
+    }
+
+    index = uring->sqe_tail & *uring->sq_mask;
+    sqe = (struct io_uring_sqe *) uring->sqes + index;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    uring->sq_array[index] = index;
+    uring->sqe_tail++;
+    return sqe;
+}
+
+/**
+ * \brief Prepare a multishot recvmsg request reading a socket of the sniffer.
+ * \param uring A uring_t instance.
+ * \param i The index of the socket in uring->sockets.
+ * \return true iif successful.
+ */
+
+static bool uring_arm_socket(uring_t * uring, size_t i)
+{
+    struct io_uring_sqe * sqe;
+
+    if (!(sqe = uring_get_sqe(uring))) return false;
+
+    sqe->opcode    = IORING_OP_RECVMSG;
+    sqe->fd        = uring->sockets[i].sockfd;
+    sqe->addr      = (uintptr_t) &uring->sockets[i].msg;
+    sqe->len       = 1;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = (i << 1) | URING_RECV;
+    return true;
+}
+
+/**
+ * \brief Register a socket of the sniffer in a uring_t instance.
+ * \param uring A uring_t instance.
+ * \param sockfd The socket.
+ * \param family The address family of the socket.
+ * \param protocol_id The protocol sniffed by the socket.
+ */
+
+static void uring_add_socket(uring_t * uring, int sockfd, int family, uint8_t protocol_id)
+{
+    uring_socket_t * socket = &uring->sockets[uring->num_sockets++];
+
+    memset(socket, 0, sizeof(uring_socket_t));
+    socket->sockfd      = sockfd;
+    socket->family      = family;
+    socket->protocol_id = protocol_id;
+
+    // IPv6 raw sockets do not provide the IPv6 header, which is rebuilt
+    // from the source address and the ancillary data (see sniffer.c)
+    if (family == AF_INET6) {
+        socket->msg.msg_namelen    = sizeof(struct sockaddr_in6);
+        socket->msg.msg_controllen = URING_CONTROLLEN;
+    }
+}
+
+/**
+ * \brief Process the completion of a multishot recvmsg request.
+ * \param uring A uring_t instance.
+ * \param cqe The completion queue entry.
+ */
+
+static void uring_process_recv(uring_t * uring, const struct io_uring_cqe * cqe)
+{
+    uring_socket_t              * socket = &uring->sockets[cqe->user_data >> 1];
+    struct io_uring_recvmsg_out * out;
+    struct msghdr                 msg;
+    uint8_t                     * buffer, * payload;
+    size_t                        num_bytes;
+    uint16_t                      bid;
+
+    if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        bid    = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        buffer = uring->buffers + bid * URING_BUFFER_SIZE;
+        out    = (struct io_uring_recvmsg_out *) buffer;
+
+        // Layout: header, source address, ancillary data, payload
+        payload = buffer + sizeof(struct io_uring_recvmsg_out) + socket->msg.msg_namelen + socket->msg.msg_controllen;
+        if ((size_t) cqe->res >= (size_t) (payload - buffer)) {
+            num_bytes = cqe->res - (payload - buffer);
+            memset(&msg, 0, sizeof(struct msghdr));
+            msg.msg_name       = out + 1;
+            msg.msg_namelen    = out->namelen;
+            msg.msg_control    = out->controllen ? (uint8_t *) (out + 1) + socket->msg.msg_namelen : NULL;
+            msg.msg_controllen = out->controllen;
+            msg.msg_flags      = out->flags;
+            if (out->payloadlen > num_bytes) msg.msg_flags |= MSG_TRUNC;
+
+            sniffer_process_message(uring->sniffer, socket->family, socket->protocol_id, &msg, payload, num_bytes);
+        }
+
+        // Give the buffer back to the kernel
+        uring_provide_buffer(uring, bid);
+        uring_publish_buffers(uring);
+    } else if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+        errno = -cqe->res;
+        perror("uring_process_recv: error in recvmsg");
+    }
+
+    // The request is over (e.g. every buffer was in use), arm it again.
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        uring_arm_socket(uring, cqe->user_data >> 1);
+    }
+}
+
+/**
+ * \brief Reap every completed request.
+ * \param uring A uring_t instance.
+ * \param dispatch Pass false to release the pending sends without
+ *    processing the received packets.
+ */
+
+static void uring_reap(uring_t * uring, bool dispatch)
+{
+    unsigned              head = *uring->cq_head,
+                          tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+    struct io_uring_cqe * cqe;
+    uring_send_t        * send;
+
+    for (; head != tail; head++) {
+        cqe = (struct io_uring_cqe *) uring->cqes + (head & *uring->cq_mask);
+
+        if (cqe->user_data & URING_RECV) {
+            if (dispatch) uring_process_recv(uring, cqe);
+        } else {
+            send = (uring_send_t *) (uintptr_t) cqe->user_data;
+            if (cqe->res < 0) {
+                errno = -cqe->res;
+                perror("uring: Sending error");
+                uring->num_send_errors++;
+            }
+            packet_free(send->packet);
+            free(send);
+            uring->num_sends--;
+        }
+    }
+
+    __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * \brief Drop the requests prepared since the last call to uring_flush.
+ *    The packets they would have sent are released.
+ * \param uring A uring_t instance.
+ */
+
+static void uring_drop_prepared(uring_t * uring)
+{
+    unsigned              index;
+    struct io_uring_sqe * sqe;
+    uring_send_t        * send;
+
+    for (index = *uring->sq_tail; index != uring->sqe_tail; index++) {
+        sqe = (struct io_uring_sqe *) uring->sqes + (index & *uring->sq_mask);
+        if (!(sqe->user_data & URING_RECV)) {
+            send = (uring_send_t *) (uintptr_t) sqe->user_data;
+            packet_free(send->packet);
+            free(send);
+            uring->num_sends--;
+        }
+    }
+    uring->sqe_tail = *uring->sq_tail;
+}
+
+#endif // URING
+
+uring_t * uring_create(socketpool_t * socketpool, sniffer_t * sniffer)
+{
+#ifdef URING
+    uring_t               * uring;
+    struct io_uring_params  params;
+    size_t                  i;
+
+    if (!(uring = malloc(sizeof(uring_t)))) goto ERR_MALLOC;
+
+    memset(&params, 0, sizeof(struct io_uring_params));
+    if ((uring->fd = sys_io_uring_setup(URING_NUM_ENTRIES, &params)) == -1) {
+        perror("uring_create: error in io_uring_setup");
+        goto ERR_SETUP;
+    }
+
+    if (!uring_map_rings(uring, &params)) goto ERR_MAP_RINGS;
+    if (!uring_setup_buffers(uring))      goto ERR_SETUP_BUFFERS;
+
+    uring->socketpool      = socketpool;
+    uring->sniffer         = sniffer;
+    uring->num_send_errors = 0;
+    uring->num_sends       = 0;
+    uring->num_sockets     = 0;
+#ifdef USE_IPV4
+    uring_add_socket(uring, sniffer_get_icmpv4_sockfd(sniffer), AF_INET, IPPROTO_ICMP);
+    uring_add_socket(uring, sniffer_get_tcpv4_sockfd(sniffer),  AF_INET, IPPROTO_TCP);
+    uring_add_socket(uring, sniffer_get_udpv4_sockfd(sniffer),  AF_INET, IPPROTO_UDP);
+#endif
+#ifdef USE_IPV6
+    uring_add_socket(uring, sniffer_get_icmpv6_sockfd(sniffer), AF_INET6, IPPROTO_ICMPV6);
+    uring_add_socket(uring, sniffer_get_tcpv6_sockfd(sniffer),  AF_INET6, IPPROTO_TCP);
+    uring_add_socket(uring, sniffer_get_udpv6_sockfd(sniffer),  AF_INET6, IPPROTO_UDP);
+#endif
+
+    for (i = 0; i < uring->num_sockets; i++) {
+        if (!uring_arm_socket(uring, i)) goto ERR_ARM_SOCKET;
+    }
+    if (!uring_flush(uring)) goto ERR_FLUSH;
+
+    return uring;
+
+ERR_FLUSH:
+ERR_ARM_SOCKET:
+    free(uring->buffers);
+    munmap(uring->buf_ring, uring->buf_ring_size);
+ERR_SETUP_BUFFERS:
+    munmap(uring->sqes, uring->sqes_size);
+    if (uring->cq_ring != uring->sq_ring) munmap(uring->cq_ring, uring->cq_ring_size);
+    munmap(uring->sq_ring, uring->sq_ring_size);
+ERR_MAP_RINGS:
+    close(uring->fd);
+ERR_SETUP:
+    free(uring);
+ERR_MALLOC:
+    return NULL;
+#else
+    errno = ENOSYS;
+    return NULL;
+#endif
+}
+
+void uring_free(uring_t * uring)
+{
+#ifdef URING
+    if (uring) {
+        uring_drop_prepared(uring);
+
+        // The kernel may still read the submitted messages: wait until
+        // their sending has completed before releasing them.
+        uring_reap(uring, false);
+        while (uring->num_sends) {
+            if (sys_io_uring_enter(uring->fd, 0, 1, IORING_ENTER_GETEVENTS) == -1 && errno != EINTR) {
+                perror("uring_free: error in io_uring_enter");
+                break;
+            }
+            uring_reap(uring, false);
+        }
+
+        // Closing the ring cancels the multishot recvmsg requests
+        close(uring->fd);
+        munmap(uring->sqes, uring->sqes_size);
+        if (uring->cq_ring != uring->sq_ring) munmap(uring->cq_ring, uring->cq_ring_size);
+        munmap(uring->sq_ring, uring->sq_ring_size);
+        munmap(uring->buf_ring, uring->buf_ring_size);
+        free(uring->buffers);
+        free(uring);
+    }
+#endif
+}
+
+int uring_get_fd(const uring_t * uring) {
+    return uring->fd;
+}
+
+size_t uring_get_num_free_entries(const uring_t * uring) {
+#ifdef URING
+    return uring->num_entries - (uring->sqe_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE));
+#else
+    return 0;
+#endif
+}
+
+bool uring_send_packet(uring_t * uring, packet_t * packet)
+{
+#ifdef URING
+    uring_send_t        * send;
+    struct io_uring_sqe * sqe;
+    int                   sockfd;
+
+    if (!(send = malloc(sizeof(uring_send_t)))) goto ERR_MALLOC;
+
+    memset(&send->msg, 0, sizeof(struct msghdr));
+    if ((sockfd = socketpool_prepare_packet(uring->socketpool, packet, &send->dst_addr, &send->msg.msg_namelen)) == -1) {
+        goto ERR_PREPARE_PACKET;
+    }
+
+    // The probe may be released or retransmitted before the request is
+    // completed: the packet is referenced until then, and the probe copies
+    // it before altering it (see probe_unshare_packet).
+    send->packet        = packet;
+    send->iov.iov_base  = packet_get_bytes(packet);
+    send->iov.iov_len   = packet_get_size(packet);
+    send->msg.msg_name  = &send->dst_addr;
+    send->msg.msg_iov   = &send->iov;
+    send->msg.msg_iovlen = 1;
+
+    if (!(sqe = uring_get_sqe(uring))) goto ERR_GET_SQE;
+    sqe->opcode    = IORING_OP_SENDMSG;
+    sqe->fd        = sockfd;
+    sqe->addr      = (uintptr_t) &send->msg;
+    sqe->len       = 1;
+    sqe->user_data = (uintptr_t) send;
+    packet_ref(packet);
+    uring->num_sends++;
+    return true;
+
+ERR_GET_SQE:
+ERR_PREPARE_PACKET:
+    free(send);
+ERR_MALLOC:
+#endif
+    return false;
+}
+
+bool uring_flush(uring_t * uring)
+{
+#ifdef URING
+    unsigned to_submit = uring->sqe_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+
+    if (!to_submit) return true;
+
+    __atomic_store_n(uring->sq_tail, uring->sqe_tail, __ATOMIC_RELEASE);
+    if (sys_io_uring_enter(uring->fd, to_submit, 0, 0) == -1) {
+        perror("uring_flush: error in io_uring_enter");
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+void uring_process_completions(uring_t * uring) {
+#ifdef URING
+    uring_reap(uring, true);
+#endif
+}
@@ -0,0 +1,159 @@
+#ifndef LIBPT_URING_H
+#define LIBPT_URING_H
+
+/**
+ * \file uring.h
+ * \brief io_uring engine (Linux >= 6.0).
+ *
+ * By default, the network layer performs a system call per packet: a
+ * sendto() per probe (see socketpool.h) and a recv() per reply (see
+ * sniffer.h). A uring_t exchanges the packets of a socketpool_t and of a
+ * sniffer_t through an io_uring instance instead:
+ * - each socket of the sniffer is read by a multishot recvmsg request.
+ *   Packets are written by the kernel in a ring of buffers provided by the
+ *   uring_t, and buffers are given back to the kernel through this ring,
+ *   so no system call is needed to receive a packet;
+ * - each probe is turned into a sendmsg request. Requests are only
+ *   submitted by uring_flush(), i.e. once per iteration of the pt_loop_t.
+ *
+ * Completions are notified through the file descriptor of the ring (see
+ * uring_get_fd), which is watched by pt_loop instead of the sockets of
+ * the sniffer. Received packets are passed to the callback of the
+ * sniffer (see sniffer_process_message).
+ */
+
+#include <stdbool.h>      // bool
+#include <stdint.h>       // uint*_t
+#include <sys/socket.h>   // msghdr
+
+#include "packet.h"       // packet_t
+#include "sniffer.h"      // sniffer_t
+#include "socketpool.h"   // socketpool_t
+#include "use.h"
+
+#define URING_NUM_ENTRIES  256         /**< Size of the submission queue */
+#define URING_NUM_BUFFERS  256         /**< Number of reception buffers (power of 2) */
+#define URING_BUFFER_SIZE  (4096 + 512) /**< Size of a reception buffer (packet, source address and ancillary data) */
+#define URING_MAX_SOCKETS  6           /**< Maximum number of sockets read by a uring_t */
+
+/**
+ * \struct uring_socket_t
+ * \brief A socket of the sniffer read by a multishot recvmsg request.
+ */
+
+typedef struct {
+    int           sockfd;      /**< Socket file descriptor */
+    int           family;      /**< Address family of the socket (AF_INET, AF_INET6) */
+    uint8_t       protocol_id; /**< Protocol sniffed by the socket */
+    struct msghdr msg;         /**< Space reserved in each buffer for the source address and the ancillary data */
+} uring_socket_t;
+
+/**
+ * \struct uring_t
+ * \brief An io_uring instance and the rings shared with the kernel.
+ */
+
+typedef struct {
+    int              fd;              /**< io_uring file descriptor */
+
+    // Submission queue
+    void           * sq_ring;         /**< Mapping of the submission ring */
+    size_t           sq_ring_size;    /**< Size of sq_ring */
+    unsigned       * sq_head;         /**< Head of the submission ring (updated by the kernel) */
+    unsigned       * sq_tail;         /**< Tail of the submission ring (updated by uring_flush) */
+    unsigned       * sq_mask;         /**< Mask applied to the indexes of the submission ring */
+    unsigned       * sq_array;        /**< Indexes of the submitted entries */
+    void           * sqes;            /**< Submission queue entries */
+    size_t           sqes_size;       /**< Size of sqes */
+    unsigned         sqe_tail;        /**< Tail of the entries prepared so far */
+    unsigned         num_entries;     /**< Size of the submission ring */
+
+    // Completion queue
+    void           * cq_ring;         /**< Mapping of the completion ring (may be equal to sq_ring) */
+    size_t           cq_ring_size;    /**< Size of cq_ring */
+    unsigned       * cq_head;         /**< Head of the completion ring (updated by uring_process_completions) */
+    unsigned       * cq_tail;         /**< Tail of the completion ring (updated by the kernel) */
+    unsigned       * cq_mask;         /**< Mask applied to the indexes of the completion ring */
+    void           * cqes;            /**< Completion queue entries */
+
+    // Reception buffers
+    void           * buf_ring;        /**< Ring through which the buffers are provided to the kernel */
+    size_t           buf_ring_size;   /**< Size of buf_ring */
+    uint8_t        * buffers;         /**< URING_NUM_BUFFERS buffers of URING_BUFFER_SIZE bytes */
+    uint16_t         buf_tail;        /**< Tail of buf_ring */
+
+    uring_socket_t   sockets[URING_MAX_SOCKETS]; /**< Sockets of the sniffer */
+    size_t           num_sockets;     /**< Number of sockets stored in sockets */
+    sniffer_t      * sniffer;         /**< Sniffer whose sockets are read */
+    socketpool_t   * socketpool;      /**< Socketpool whose sockets are used to send the probes */
+    size_t           num_send_errors; /**< Number of packets which could not be sent */
+    size_t           num_sends;       /**< Number of sendmsg requests prepared and not yet completed */
+} uring_t;
+
+/**
+ * \brief Create a uring_t instance.
+ * \param socketpool The socketpool used to send the packets.
+ * \param sniffer The sniffer whose sockets are read. They must not be
+ *    read by another mean afterwards.
+ * \return The newly created uring_t instance, NULL in case of failure
+ *    (e.g. if io_uring is not supported).
+ */
+
+uring_t * uring_create(socketpool_t * socketpool, sniffer_t * sniffer);
+
+/**
+ * \brief Release a uring_t instance. The socketpool and the sniffer
+ *    are not released. The packets not yet submitted are dropped, and
+ *    the ones being sent are released once their sending has completed.
+ * \param uring A uring_t instance.
+ */
+
+void uring_free(uring_t * uring);
+
+/**
+ * \brief Retrieve the file descriptor activated whenever a request
+ *    has been completed (e.g. a packet has been received).
+ * \param uring A uring_t instance.
+ * \return The corresponding file descriptor.
+ */
+
+int uring_get_fd(const uring_t * uring);
+
+/**
+ * \brief Retrieve the number of requests which can still be prepared
+ *    before the submission ring is full.
+ * \param uring A uring_t instance.
+ * \return The corresponding number of entries.
+ */
+
+size_t uring_get_num_free_entries(const uring_t * uring);
+
+/**
+ * \brief Prepare the sending of a packet. The packet is not copied: it is
+ *    referenced until it has been sent (see packet_ref), and sent by the
+ *    next call to uring_flush().
+ * \param uring A uring_t instance.
+ * \param packet The packet to send.
+ * \return true iif successful. Sending errors are reported later
+ *    (see uring->num_send_errors).
+ */
+
+bool uring_send_packet(uring_t * uring, packet_t * packet);
+
+/**
+ * \brief Submit to the kernel every request prepared since the last call.
+ * \param uring A uring_t instance.
+ * \return true iif successful.
+ */
+
+bool uring_flush(uring_t * uring);
+
+/**
+ * \brief Process the completed requests: received packets are passed to
+ *    the sniffer, and their buffers are given back to the kernel.
+ * \param uring A uring_t instance.
+ */
+
+void uring_process_completions(uring_t * uring);
+
+#endif // LIBPT_URING_H
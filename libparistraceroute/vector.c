@@ -115,6 +115,10 @@ size_t vector_get_num_cells(const vector_t * vector) {
     return vector ? vector->num_cells : 0;
 }
 
+void * vector_get_cells(const vector_t * vector) {
+    return vector ? vector->cells : NULL;
+}
+
 size_t vector_get_cell_size(const vector_t * vector) {
     return vector ? vector->cell_size : 0;
 }
@@ -269,7 +269,6 @@ void loop_handler(pt_loop_t * loop, event_t * event, void * user_data)
         default:
             break;
     }
-    event_free(event);
 }
 
 const char * get_ip_protocol_name(int family) {
@@ -478,7 +477,10 @@ int main(int argc, char ** argv)
 
     // Set network options (network and verbose)
     options_network_init(loop->network, false);
-    options_pt_loop_init(loop);
+    if (!options_pt_loop_init(loop)) {
+        fprintf(stderr, "E: Cannot initialize libparistraceroute loop");
+        goto ERR_LOOP_INIT;
+    }
 
     printf("paris-ping to %s (", dst_ip);
     address_dump(&dst_addr);
@@ -501,6 +503,7 @@ int main(int argc, char ** argv)
     // Leave the program
 ERR_PT_LOOP:
 ERR_INSTANCE:
+ERR_LOOP_INIT:
     // pt_loop_free() automatically removes algorithms instances,
     // probe_replies and events from the memory.
     // Options and probe must be manually removed.
@@ -511,7 +514,8 @@ ERR_INVALID_PACKET_SIZE:
 ERR_PROBE_CREATE:
 ERR_ADDRESS_IP_FROM_STRING:
 ERR_ADDRESS_GUESS_FAMILY:
-    if (errno) perror(gai_strerror(errno));
+    // errno may have been set by a recoverable error (e.g. EAGAIN)
+    if (exit_code != EXIT_SUCCESS && errno) perror(gai_strerror(errno));
 ERR_CHECK_OPTIONS:
 ERR_OPT_PARSE:
 ERR_INIT_OPTIONS:
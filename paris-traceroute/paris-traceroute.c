@@ -5,14 +5,14 @@
 #include <stdbool.h>                 // bool
 #include <errno.h>                   // errno
 #include <libgen.h>                  // basename
-#include <string.h>                  // strcmp
+#include <string.h>                  // strcmp, strdup, strcspn
 #include <stdint.h>                  // UINT16_MAX
 #include <float.h>                   // DBL_MAX
 #include <sys/types.h>               // gai_strerror
 #include <sys/socket.h>              // gai_strerror, AF_INET, AF_INET6
 #include <netdb.h>                   // gai_strerror
 
-#include "common.h"                  // ELEMENT_DUMP
+#include "common.h"                  // ELEMENT_DUMP, get_timestamp
 #include "optparse.h"                // opt_*()
 #include "pt_loop.h"                 // pt_loop_t
 #include "probe.h"                   // probe_t
@@ -20,8 +20,12 @@
 #include "algorithm.h"               // algorithm_instance_t
 #include "algorithms/mda.h"          // mda_*_t
 #include "algorithms/traceroute.h"   // traceroute_options_t
+#include "algorithms/retrace.h"      // retrace_options_t
+#include "algorithms/monitor.h"      // monitor_options_t
 #include "address.h"                 // address_to_string
 #include "options.h"                 // options_*
+#include "dynarray.h"                // dynarray_t
+#include "journal.h"                 // journal_t
 
 //---------------------------------------------------------------------------
 // Command line stuff
@@ -29,7 +33,7 @@
 
 #define TRACEROUTE_HELP_4  "Use IPv4."
 #define TRACEROUTE_HELP_6  "Use IPv6."
-#define TRACEROUTE_HELP_a  "Set the traceroute algorithm (default: 'paris-traceroute'). Valid values are 'paris-traceroute' and 'mda'."
+#define TRACEROUTE_HELP_a  "Set the traceroute algorithm (default: 'paris-traceroute'). Valid values are 'paris-traceroute', 'mda' and 'monitor'. 'monitor' maps the paths with mda, then reports their changes until the timeout expires (see -t)."
 #define TRACEROUTE_HELP_d  "Print libparistraceroute debug information."
 #define TRACEROUTE_HELP_p  "Set PORT as destination port (default: 33457)."
 #define TRACEROUTE_HELP_s  "Set PORT as source port (default: 33456)."
@@ -38,7 +42,12 @@
 #define TRACEROUTE_HELP_T  "Use TCP for tracerouting."
 #define TRACEROUTE_HELP_U  "Use UDP for tracerouting. The destination port is set by default to 53."
 #define TRACEROUTE_HELP_z  "Minimal time interval between probes (default 0).  If the value is more than 10, then it specifies a number in milliseconds, else it is a number of seconds (float point values allowed  too)"
-#define TEXT               "paris-traceroute - print the IP-level path toward a given IP host."
+#define TRACEROUTE_HELP_targets "Also trace the hosts listed in FILE (one per line, '#' starts a comment)."
+#define TRACEROUTE_HELP_journal "Record the progress of the campaign in FILE, so that it can be resumed after a crash."
+#define TRACEROUTE_HELP_resume  "Resume the campaign recorded in the journal: completed hosts are skipped, and partial paris-traceroute hosts are resumed from their first incomplete hop."
+#define TRACEROUTE_HELP_previous "Verify the paths recorded in the journal FILE of a previous campaign: send one probe per known hop, and only enumerate the hops which have changed. With 'monitor', these paths are not mapped again."
+#define TRACEROUTE_HELP_budget "Set the number of probes sent per second by 'monitor', mda included (default: 10)."
+#define TEXT               "paris-traceroute - print the IP-level path toward one or several IP hosts."
 #define TEXT_OPTIONS       "Options:"
 
 // Default values (based on modern traceroute for linux)
@@ -54,6 +63,7 @@
 const char * algorithm_names[] = {
     "paris-traceroute", // default value
     "mda",
+    "monitor",
     NULL
 };
 
@@ -63,6 +73,11 @@ static bool is_tcp   = false;
 static bool is_udp   = false;
 static bool is_icmp  = false;
 static bool is_debug = false;
+static bool do_resume = false;
+
+static struct opt_str targets_path = {NULL, 0};
+static struct opt_str journal_path = {NULL, 0};
+static struct opt_str previous_path = {NULL, 0};
 
 const char * protocol_names[] = {
     "udp", // default value
@@ -76,6 +91,7 @@ const char * protocol_names[] = {
 static int    dst_port[4]    = {33457,  0,   UINT16_MAX, 0};
 static int    src_port[4]    = {33456,  0,   UINT16_MAX, 0};
 static double send_time[4]   = {1,      1,   DBL_MAX,    0};
+static double budget[4]      = {MONITOR_DEFAULT_BUDGET, 0.001, DBL_MAX, 0};
 
 struct opt_spec runnable_options[] = {
     // action                 sf          lf                   metavar             help                     data
@@ -92,6 +108,11 @@ struct opt_spec runnable_options[] = {
     {opt_store_choice,        "P",        "--protocol",        "PROTOCOL",         TRACEROUTE_HELP_P,       protocol_names},
     {opt_store_1,             "T",        "--tcp",             OPT_NO_METAVAR,     TRACEROUTE_HELP_T,       &is_tcp},
     {opt_store_1,             "U",        "--udp",             OPT_NO_METAVAR,     TRACEROUTE_HELP_U,       &is_udp},
+    {opt_store_str,           OPT_NO_SF,  "--targets",         "FILE",             TRACEROUTE_HELP_targets, &targets_path},
+    {opt_store_str,           OPT_NO_SF,  "--journal",         "FILE",             TRACEROUTE_HELP_journal, &journal_path},
+    {opt_store_1,             OPT_NO_SF,  "--resume",          OPT_NO_METAVAR,     TRACEROUTE_HELP_resume,  &do_resume},
+    {opt_store_str,           OPT_NO_SF,  "--previous",        "FILE",             TRACEROUTE_HELP_previous, &previous_path},
+    {opt_store_double_lim_en, OPT_NO_SF,  "--budget",          "PPS",              TRACEROUTE_HELP_budget,  budget},
     END_OPT_SPECS
 };
 
@@ -164,8 +185,9 @@ static bool check_ports(bool is_icmp, int dst_port_enabled, int src_port_enabled
 
 static bool check_algorithm(const char * algorithm_name)
 {
+    // monitor remaps the paths with mda
     if (options_mda_get_is_set()) {
-        if (strcmp(algorithm_name, "mda") != 0) {
+        if (strcmp(algorithm_name, "mda") != 0 && strcmp(algorithm_name, "monitor") != 0) {
             fprintf(stderr, "You cannot pass options related to mda when using another algorithm\n");
             return false;
         }
@@ -173,6 +195,42 @@ static bool check_algorithm(const char * algorithm_name)
     return true;
 }
 
+static bool check_monitor(const char * algorithm_name, const char * journal_path, int budget_enabled)
+{
+    if (strcmp(algorithm_name, "monitor") == 0) {
+        if (journal_path) {
+            fprintf(stderr, "E: Cannot use --journal with monitor\n");
+            return false;
+        }
+    } else if (budget_enabled) {
+        fprintf(stderr, "E: Cannot use --budget with another algorithm than monitor\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool check_journal(const char * journal_path, bool do_resume)
+{
+    if (do_resume && !journal_path) {
+        fprintf(stderr, "E: Cannot use --resume without --journal\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool check_previous(const char * previous_path, const char * algorithm_name)
+{
+    // mda does not journal its probes, so its paths cannot be verified
+    if (previous_path && strcmp(algorithm_name, "paris-traceroute") != 0 && strcmp(algorithm_name, "monitor") != 0) {
+        fprintf(stderr, "E: Cannot use --previous with another algorithm than paris-traceroute or monitor\n");
+        return false;
+    }
+
+    return true;
+}
+
 static bool check_options(
     bool         is_icmp,
     bool         is_tcp,
@@ -187,78 +245,16 @@ static bool check_options(
     return check_ip_version(is_ipv4, is_ipv6)
         && check_protocol(is_icmp, is_tcp, is_udp, protocol_name)
         && check_ports(is_icmp, dst_port_enabled, src_port_enabled)
-        && check_algorithm(algorithm_name);
+        && check_algorithm(algorithm_name)
+        && check_journal(journal_path.s, do_resume)
+        && check_monitor(algorithm_name, journal_path.s, budget[3])
+        && check_previous(previous_path.s, algorithm_name);
 }
 
 //---------------------------------------------------------------------------
 // Command-line / libparistraceroute translation
 //---------------------------------------------------------------------------
 
-/**
- * \brief Handle events raised by libparistraceroute.
- * \param loop The main loop.
- * \param event The event raised by libparistraceroute.
- * \param user_data Points to user data, shared by
- *   all the algorithms instances running in this loop.
- */
-
-void loop_handler(pt_loop_t * loop, event_t * event, void * user_data)
-{
-    traceroute_event_t         * traceroute_event;
-    const traceroute_options_t * traceroute_options;
-    const traceroute_data_t    * traceroute_data;
-    mda_event_t                * mda_event;
-    mda_data_t                 * mda_data;
-    const char                 * algorithm_name;
-
-    switch (event->type) {
-        case ALGORITHM_HAS_TERMINATED:
-            algorithm_name = event->issuer->algorithm->name;
-            if (strcmp(algorithm_name, "mda") == 0) {
-                mda_data = event->issuer->data;
-                printf("Lattice:\n");
-                lattice_dump(mda_data->lattice, (ELEMENT_DUMP) mda_lattice_elt_dump);
-                printf("\n");
-                mda_data_free(mda_data);
-            }
-
-            // Tell to the algorithm it can free its data
-            pt_stop_instance(loop, event->issuer);
-
-            // Remove the application from the loop.
-            pt_del_instance(loop, event->issuer);
-
-            // Kill the loop
-            pt_loop_terminate(loop);
-            break;
-        case ALGORITHM_EVENT:
-            algorithm_name = event->issuer->algorithm->name;
-            if (strcmp(algorithm_name, "mda") == 0) {
-                mda_event = event->data;
-                traceroute_options = event->issuer->options; // mda_options inherits traceroute_options
-                switch (mda_event->type) {
-                    case MDA_NEW_LINK:
-                        mda_link_dump(mda_event->data, traceroute_options->do_resolv);
-                        break;
-                    default:
-                        break;
-                }
-            } else if (strcmp(algorithm_name, "traceroute") == 0) {
-                traceroute_event   = event->data;
-                traceroute_options = event->issuer->options;
-                traceroute_data    = event->issuer->data;
-
-                // Forward this event to the default traceroute handler
-                // See libparistraceroute/algorithms/traceroute.c
-                traceroute_handler(loop, traceroute_event, traceroute_options, traceroute_data);
-            }
-            break;
-        default:
-            break;
-    }
-    event_free(event);
-}
-
 const char * get_ip_protocol_name(int family) {
     switch (family) {
         case AF_INET:
@@ -294,75 +290,119 @@ const char * get_protocol_name(int family, bool use_icmp, bool use_tcp, bool use
 }
 
 //---------------------------------------------------------------------------
-// Main program
+// Campaign
 //---------------------------------------------------------------------------
 
-int main(int argc, char ** argv)
+/**
+ * \struct campaign_t
+ * \brief The hosts traced by paris-traceroute. They are traced one after
+ *    the other, by a single algorithm instance at a time.
+ */
+
+typedef struct {
+    dynarray_t             * targets;            /**< Hosts to trace (char *) */
+    size_t                   next_target;        /**< Index of the next host to trace */
+    const char             * target;             /**< Host being traced */
+    address_t                dst_addr;           /**< Address of the host being traced */
+    probe_t                * probe;              /**< Probe skeleton of the host being traced */
+    algorithm_instance_t   * instance;           /**< Instance tracing this host (NULL if none) */
+    bool                     is_stopping;        /**< true iif this instance is releasing its data */
+    journal_t              * journal;            /**< Journal of the campaign (NULL if none) */
+    journal_t              * previous;           /**< Journal of a previous campaign, whose paths are verified (NULL if none) */
+    retrace_options_t        retrace_options;    /**< Options passed to the instances verifying a previous path */
+    const char             * algorithm_name;     /**< Name of the algorithm ("traceroute", "mda" or "monitor") */
+    void                   * algorithm_options;  /**< Options passed to each instance */
+    traceroute_options_t   * traceroute_options; /**< Options common to traceroute and mda */
+    bool                     use_icmp, use_tcp, use_udp;
+    size_t                   num_failures;       /**< Number of hosts which could not be traced */
+    dynarray_t             * monitor_targets;    /**< Paths monitored by monitor (monitor_target_t *) */
+    size_t                   num_changes;        /**< Number of path changes reported by monitor */
+} campaign_t;
+
+/**
+ * \brief Load the hosts listed in a file.
+ * \param targets The dynarray_t instance where the hosts are appended.
+ * \param path Path of the file. Each line contains a host, and the
+ *    characters following a '#' are ignored.
+ * \return true iif successful.
+ */
+
+static bool targets_load(dynarray_t * targets, const char * path)
 {
-    int                       exit_code = EXIT_FAILURE;
-    char                    * version = strdup("version 1.0");
-    const char              * usage = "usage: %s [options] host\n";
-    void                    * algorithm_options;
-    traceroute_options_t      traceroute_options;
-    traceroute_options_t    * ptraceroute_options;
-    mda_options_t             mda_options;
-    probe_t                 * probe;
-    pt_loop_t               * loop;
-    int                       family;
-    address_t                 dst_addr;
-    options_t               * options;
-    char                    * dst_ip;
-    const char              * algorithm_name;
-    const char              * protocol_name;
-    bool                      use_icmp, use_udp, use_tcp;
+    FILE   * file;
+    char   * line = NULL, * target;
+    size_t   size = 0;
+    bool     ret = true;
 
-    // Prepare the commande line options
-    if (!(options = init_options(version))) {
-        fprintf(stderr, "E: Can't initialize options\n");
-        goto ERR_INIT_OPTIONS;
+    if (!(file = fopen(path, "r"))) {
+        perror(path);
+        return false;
     }
 
-    // Retrieve values passed in the command-line
-    if (options_parse(options, usage, argv) != 1) {
-        fprintf(stderr, "%s: destination required\n", basename(argv[0]));
-        goto ERR_OPT_PARSE;
+    while (ret && getline(&line, &size, file) != -1) {
+        line[strcspn(line, "#")] = '\0';
+        target = line + strspn(line, " \t\r\n");
+        target[strcspn(target, " \t\r\n")] = '\0';
+        if (!*target) continue;
+
+        if (!(target = strdup(target))) {
+            ret = false;
+        } else if (!dynarray_push_element(targets, target)) {
+            free(target);
+            ret = false;
+        }
     }
 
-    // We assume that the target IP address is always the last argument
-    dst_ip         = argv[argc - 1];
-    algorithm_name = algorithm_names[0];
-    protocol_name  = protocol_names[0];
-
-    // Checking if there is any conflicts between options passed in the commandline
-    if (!check_options(is_icmp, is_tcp, is_udp, is_ipv4, is_ipv6, dst_port[3], src_port[3], protocol_name, algorithm_name)) {
-        goto ERR_CHECK_OPTIONS;
-    }
+    free(line);
+    fclose(file);
+    return ret;
+}
 
-    use_icmp = is_icmp || strcmp(protocol_name, "icmp") == 0;
-    use_tcp  = is_tcp  || strcmp(protocol_name, "tcp")  == 0;
-    use_udp  = is_udp  || strcmp(protocol_name, "udp")  == 0;
+/**
+ * \brief Resolve a host.
+ * \param target The host (IP address or FQDN).
+ * \param pfamily Pointer to the address family of the host.
+ * \param dst_addr Pointer to the address of the host.
+ * \return true iif successful.
+ */
 
+static bool target_resolve(const char * target, int * pfamily, address_t * dst_addr)
+{
     // If not any ip version is set, call address_guess_family.
     // If only one is set to true, set family to AF_INET or AF_INET6
     if (is_ipv4) {
-        family = AF_INET;
+        *pfamily = AF_INET;
     } else if (is_ipv6) {
-        family = AF_INET6;
-    } else {
-        // Get address family if not defined by the user
-        if (!address_guess_family(dst_ip, &family)) goto ERR_ADDRESS_GUESS_FAMILY;
+        *pfamily = AF_INET6;
+    } else if (!address_guess_family(target, pfamily)) {
+        fprintf(stderr, "E: Cannot resolve %s\n", target);
+        return false;
     }
 
     // Translate the string IP / FQDN into an address_t * instance
-    if (address_from_string(family, dst_ip, &dst_addr) != 0) {
-        fprintf(stderr, "E: Invalid destination address %s\n", dst_ip);
-        goto ERR_ADDRESS_IP_FROM_STRING;
+    if (address_from_string(*pfamily, target, dst_addr) != 0) {
+        fprintf(stderr, "E: Invalid destination address %s\n", target);
+        return false;
     }
 
-    // Probe skeleton definition: IPv4/UDP probe targetting 'dst_ip'
+    return true;
+}
+
+/**
+ * \brief Prepare the probe skeleton related to a host.
+ * \param family The address family of the host.
+ * \param dst_addr The address of the host.
+ * \param use_icmp, use_tcp, use_udp The protocol used to trace the host.
+ * \return The newly created probe skeleton, NULL in case of failure.
+ */
+
+static probe_t * probe_skel_create(int family, const address_t * dst_addr, bool use_icmp, bool use_tcp, bool use_udp)
+{
+    probe_t * probe;
+
     if (!(probe = probe_create())) {
         fprintf(stderr,"E: Cannot create probe skeleton");
-        goto ERR_PROBE_CREATE;
+        return NULL;
     }
 
     // Prepare the probe skeleton
@@ -373,7 +413,7 @@ int main(int argc, char ** argv)
         NULL
     );
 
-    probe_set_field(probe, ADDRESS("dst_ip", &dst_addr));
+    probe_set_fields(probe, ADDRESS("dst_ip", dst_addr), NULL);
 
     if (send_time[3]) {
         if(send_time[0] <= 10) { // seconds
@@ -410,73 +450,570 @@ int main(int argc, char ** argv)
         probe_payload_resize(probe, 2);
     }
 
+    // Listening ports silently drop segments without flags, so TCP probes
+    // are SYN segments: the destination answers them with a SYN-ACK.
+    if (use_tcp) {
+        int bit_value = 1;
+        probe_set_fields(probe, BITS("syn", 1, &bit_value), NULL);
+    }
+
+    return probe;
+}
+
+/**
+ * \brief Print the hops of a host which have been completed before the
+ *    campaign was interrupted, and find where its traceroute resumes.
+ * \param campaign The campaign.
+ * \param journal_target What the journal has recorded about this host.
+ * \param pis_done Pointer to a boolean set to true if these hops already
+ *    reach the host, or if traceroute would have given up after them.
+ * \param pnum_undiscovered Pointer to the number of consecutive hops
+ *    without any reply which end these hops.
+ * \return The first TTL which has not been completed.
+ */
+
+static uint8_t campaign_replay(const campaign_t * campaign, const journal_target_t * journal_target, bool * pis_done, size_t * pnum_undiscovered)
+{
+    const traceroute_options_t * options = campaign->traceroute_options;
+    const journal_hop_t        * hop;
+    const address_t            * address;
+    size_t                       i, num_hops = dynarray_get_size(journal_target->hops), num_probes, num_stars;
+    uint8_t                      ttl;
+
+    *pis_done = false;
+    *pnum_undiscovered = 0;
+    for (ttl = options->min_ttl; ttl <= options->max_ttl && !*pis_done; ttl++) {
+        num_probes = num_stars = 0;
+        for (i = 0; i < num_hops; i++) {
+            hop = dynarray_get_ith_element(journal_target->hops, i);
+            if (hop->ttl == ttl) {
+                num_probes++;
+                if (hop->is_star) num_stars++;
+            }
+        }
+        if (num_probes < options->num_probes) break;
+
+        // Like traceroute_handler, only print the address of a hop when it changes
+        printf("%2d ", ttl);
+        for (i = 0, address = NULL; i < num_hops; i++) {
+            hop = dynarray_get_ith_element(journal_target->hops, i);
+            if (hop->ttl != ttl) continue;
+            if (hop->is_star) {
+                printf(" *");
+            } else {
+                if (!address || address_compare(address, &hop->address) != 0) {
+                    address = &hop->address;
+                    printf(" ");
+                    address_dump(address);
+                }
+                printf("  %-5.3lfms  ", hop->rtt);
+                *pis_done |= (address_compare(&hop->address, &campaign->dst_addr) == 0);
+            }
+        }
+        printf("\n");
+
+        // Like traceroute_handler, give up after max_undiscovered hops
+        // without any reply
+        *pnum_undiscovered = (num_stars == num_probes) ? *pnum_undiscovered + 1 : 0;
+        *pis_done |= (*pnum_undiscovered == options->max_undiscovered);
+    }
+
+    *pis_done |= (ttl > options->max_ttl);
+    return ttl;
+}
+
+/**
+ * \brief Start tracing the next host of a campaign. The hosts which are
+ *    completed in the journal, or which cannot be traced, are skipped.
+ * \param loop The main loop.
+ * \param campaign The campaign.
+ * \return true iif a host is being traced, false if there is no more host.
+ */
+
+static bool campaign_start_next_target(pt_loop_t * loop, campaign_t * campaign)
+{
+    const journal_target_t * journal_target;
+    const journal_target_t * previous_target;
+    const char             * algorithm_name;
+    void                   * algorithm_options;
+    int                      family;
+    uint8_t                  first_ttl;
+    size_t                   num_undiscovered;
+    bool                     is_done;
+
+    while (campaign->next_target < dynarray_get_size(campaign->targets)) {
+        campaign->target = dynarray_get_ith_element(campaign->targets, campaign->next_target++);
+        journal_target = campaign->journal ? journal_get_target(campaign->journal, campaign->target) : NULL;
+
+        if (journal_target && journal_target->is_done) {
+            printf("%s to %s: already completed\n", campaign->algorithm_name, campaign->target);
+            continue;
+        }
+
+        if (!target_resolve(campaign->target, &family, &campaign->dst_addr)) {
+            goto ERR_TARGET;
+        }
+
+        if (!(campaign->probe = probe_skel_create(family, &campaign->dst_addr, campaign->use_icmp, campaign->use_tcp, campaign->use_udp))) {
+            goto ERR_TARGET;
+        }
+
+        // Algorithm options (common options)
+        options_traceroute_init(campaign->traceroute_options, &campaign->dst_addr);
+
+        // A path discovered by a previous campaign is verified by retrace,
+        // which only enumerates the hops which have changed.
+        algorithm_name    = campaign->algorithm_name;
+        algorithm_options = campaign->algorithm_options;
+        previous_target   = campaign->previous ? journal_get_target(campaign->previous, campaign->target) : NULL;
+        if (previous_target && dynarray_get_size(previous_target->hops)) {
+            campaign->retrace_options.traceroute_options = *campaign->traceroute_options;
+            campaign->retrace_options.previous_hops      = previous_target->hops;
+            algorithm_name    = "retrace";
+            algorithm_options = &campaign->retrace_options;
+        }
+
+        printf("%s to %s (", algorithm_name, campaign->target);
+        address_dump(&campaign->dst_addr);
+        printf("), %u hops max, %u bytes packets\n",
+            campaign->traceroute_options->max_ttl,
+            (unsigned int) packet_get_size(campaign->probe->packet)
+        );
+
+        // A partial traceroute resumes from its first incomplete hop. Mda
+        // discovers the load-balanced paths hop by hop, so it starts over.
+        first_ttl = campaign->traceroute_options->min_ttl;
+        if (journal_target && strcmp(algorithm_name, "traceroute") == 0) {
+            first_ttl = campaign_replay(campaign, journal_target, &is_done, &num_undiscovered);
+            if (is_done) {
+                if (!journal_finish_target(campaign->journal, campaign->target)) perror(journal_path.s);
+                probe_free(campaign->probe);
+                campaign->probe = NULL;
+                continue;
+            }
+            campaign->traceroute_options->min_ttl = first_ttl;
+
+            // The resumed traceroute only counts its own undiscovered hops
+            campaign->traceroute_options->max_undiscovered -= num_undiscovered;
+        }
+
+        if (campaign->journal && !journal_start_target(campaign->journal, campaign->target, first_ttl)) {
+            perror(journal_path.s);
+        }
+
+        // Add an algorithm instance in the main loop
+        if (!(campaign->instance = pt_add_instance(loop, algorithm_name, algorithm_options, campaign->probe))) {
+            fprintf(stderr, "E: Cannot add the chosen algorithm");
+            probe_free(campaign->probe);
+            campaign->probe = NULL;
+            goto ERR_TARGET;
+        }
+        campaign->is_stopping = false;
+        return true;
+
+ERR_TARGET:
+        campaign->num_failures++;
+    }
+
+    return false;
+}
+
+/**
+ * \brief Start monitoring the paths toward every host of a campaign. The
+ *    hosts which cannot be resolved are skipped.
+ * \param loop The main loop.
+ * \param campaign The campaign.
+ * \return true iif the monitor instance has been started.
+ */
+
+static bool campaign_start_monitor(pt_loop_t * loop, campaign_t * campaign)
+{
+    monitor_options_t      * monitor_options = campaign->algorithm_options;
+    monitor_target_t       * monitor_target;
+    const journal_target_t * previous_target;
+    const char             * target;
+    int                      family;
+
+    options_traceroute_init(campaign->traceroute_options, NULL);
+
+    while (campaign->next_target < dynarray_get_size(campaign->targets)) {
+        target = dynarray_get_ith_element(campaign->targets, campaign->next_target++);
+
+        if (!(monitor_target = calloc(1, sizeof(monitor_target_t)))) goto ERR_CALLOC;
+        if (!target_resolve(target, &family, &monitor_target->dst_addr)) goto ERR_TARGET;
+        if (!(monitor_target->probe_skel = probe_skel_create(family, &monitor_target->dst_addr, campaign->use_icmp, campaign->use_tcp, campaign->use_udp))) {
+            goto ERR_TARGET;
+        }
+        if (!dynarray_push_element(campaign->monitor_targets, monitor_target)) goto ERR_PUSH_ELEMENT;
+
+        // A path discovered by a previous campaign is not mapped again
+        previous_target = campaign->previous ? journal_get_target(campaign->previous, target) : NULL;
+        if (previous_target) monitor_target->previous_hops = previous_target->hops;
+        continue;
+
+ERR_PUSH_ELEMENT:
+        probe_free(monitor_target->probe_skel);
+ERR_TARGET:
+        free(monitor_target);
+ERR_CALLOC:
+        campaign->num_failures++;
+    }
+
+    if (!dynarray_get_size(campaign->monitor_targets)) return false;
+    monitor_options->targets = campaign->monitor_targets;
+
+    printf("monitor to %zu hosts, %u hops max, %.3lf probes per second\n",
+        dynarray_get_size(campaign->monitor_targets),
+        campaign->traceroute_options->max_ttl,
+        monitor_options->budget
+    );
+
+    // Each path has its own probe skeleton
+    if (!(campaign->probe = probe_create())) return false;
+    if (!(campaign->instance = pt_add_instance(loop, "monitor", monitor_options, campaign->probe))) {
+        fprintf(stderr, "E: Cannot add the chosen algorithm");
+        probe_free(campaign->probe);
+        campaign->probe = NULL;
+        return false;
+    }
+    campaign->is_stopping = false;
+    return true;
+}
+
+/**
+ * \brief Print an event raised by monitor.
+ * \param campaign The campaign.
+ * \param monitor_event The event.
+ */
+
+static void monitor_event_dump(campaign_t * campaign, const event_t * monitor_event)
+{
+    const monitor_map_t    * map;
+    const monitor_change_t * change;
+    size_t                   i;
+
+    printf("[%.3lf] ", get_timestamp());
+    switch (monitor_event->type) {
+        case MONITOR_PATH_MAPPED:
+            map = monitor_event->data;
+            address_dump(&map->dst_addr);
+            if (map->num_probes) {
+                printf(" mapped with %zu probes\n", map->num_probes);
+            } else {
+                printf(" loaded from the previous campaign\n");
+            }
+            for (i = 0; i < map->num_hops; i++) {
+                if (!i || map->hops[i].ttl != map->hops[i - 1].ttl) {
+                    if (i) printf("\n");
+                    printf("%2u ", map->hops[i].ttl);
+                }
+                printf(" ");
+                address_dump(&map->hops[i].address);
+            }
+            if (map->num_hops) printf("\n");
+            break;
+        case MONITOR_PATH_CHANGED:
+            change = monitor_event->data;
+            address_dump(&change->dst_addr);
+            printf(" changed at hop %u: ", change->expected.ttl);
+            address_dump(&change->expected.address);
+            printf(" expected, ");
+            if (change->is_star) {
+                printf("*");
+            } else {
+                address_dump(&change->address);
+            }
+            printf(" replied\n");
+            campaign->num_changes++;
+            break;
+        default:
+            break;
+    }
+}
+
+/**
+ * \brief Record in the journal the outcome of a probe sent by traceroute.
+ * \param journal The journal of the campaign.
+ * \param target The host being traced.
+ * \param traceroute_event The event raised by traceroute.
+ */
+
+static void journal_add_traceroute_event(journal_t * journal, const char * target, const traceroute_event_t * traceroute_event)
+{
+    const probe_t * probe;
+    const probe_t * reply = NULL;
+    journal_hop_t   hop;
+
+    switch (traceroute_event->type) {
+        case TRACEROUTE_PROBE_REPLY:
+            probe = ((const probe_reply_t *) traceroute_event->data)->probe;
+            reply = ((const probe_reply_t *) traceroute_event->data)->reply;
+            if (!probe_extract(reply, "src_ip", &hop.address)) return;
+            hop.rtt = 1000 * (probe_get_recv_time(reply) - probe_get_sending_time(probe));
+            break;
+        case TRACEROUTE_STAR:
+            probe = (const probe_t *) traceroute_event->data;
+            break;
+        default:
+            return;
+    }
+
+    hop.is_star = !reply;
+    if (!probe_extract(probe, "ttl", &hop.ttl)) return;
+    if (!probe_extract(probe, "flow_id", &hop.flow_id)) hop.flow_id = 0;
+
+    if (!journal_add_hop(journal, target, &hop)) perror(journal_path.s);
+}
+
+/**
+ * \brief Handle events raised by libparistraceroute.
+ * \param loop The main loop.
+ * \param event The event raised by libparistraceroute.
+ * \param user_data Points to user data, shared by
+ *   all the algorithms instances running in this loop.
+ */
+
+void loop_handler(pt_loop_t * loop, event_t * event, void * user_data)
+{
+    campaign_t                 * campaign = user_data;
+    traceroute_event_t         * traceroute_event;
+    const traceroute_options_t * traceroute_options;
+    const traceroute_data_t    * traceroute_data;
+    mda_event_t                * mda_event;
+    mda_data_t                 * mda_data;
+    const char                 * algorithm_name;
+
+    switch (event->type) {
+        case ALGORITHM_HAS_TERMINATED:
+            algorithm_name = event->issuer->algorithm->name;
+            if (event->issuer->data) {
+                // The algorithm may notify its termination several times
+                // before releasing its data.
+                if (campaign->is_stopping) break;
+
+                if (strcmp(algorithm_name, "mda") == 0) {
+                    mda_data = event->issuer->data;
+                    printf("Lattice:\n");
+                    lattice_dump(mda_data->lattice, (ELEMENT_DUMP) mda_lattice_elt_dump);
+                    printf("\n");
+                } else if (strcmp(algorithm_name, "retrace") == 0) {
+                    retrace_data_dump(event->issuer->data, event->issuer->options);
+                }
+                if (campaign->journal && !journal_finish_target(campaign->journal, campaign->target)) {
+                    perror(journal_path.s);
+                }
+
+                // Tell to the algorithm it can free its data. It notifies
+                // its termination again once done.
+                campaign->is_stopping = true;
+                pt_stop_instance(loop, event->issuer);
+                break;
+            }
+
+            // Remove the application from the loop.
+            pt_del_instance(loop, event->issuer);
+            campaign->instance = NULL;
+            probe_free(campaign->probe);
+            campaign->probe = NULL;
+
+            // Kill the loop once every host has been traced (or if the
+            // user has interrupted the campaign)
+            if (loop->status == PT_LOOP_INTERRUPTED || !campaign_start_next_target(loop, campaign)) {
+                pt_loop_terminate(loop);
+            }
+            break;
+        case ALGORITHM_EVENT:
+            algorithm_name = event->issuer->algorithm->name;
+            if (strcmp(algorithm_name, "mda") == 0) {
+                mda_event = event->data;
+                traceroute_options = event->issuer->options; // mda_options inherits traceroute_options
+                switch (mda_event->type) {
+                    case MDA_NEW_LINK:
+                        mda_link_dump(mda_event->data, traceroute_options->do_resolv);
+                        break;
+                    default:
+                        break;
+                }
+            } else if (strcmp(algorithm_name, "monitor") == 0) {
+                monitor_event_dump(campaign, event->data);
+            } else if (strcmp(algorithm_name, "retrace") == 0) {
+                // The outcome of each hop is printed once retrace has terminated
+                if (campaign->journal) {
+                    journal_add_traceroute_event(campaign->journal, campaign->target, event->data);
+                }
+            } else if (strcmp(algorithm_name, "traceroute") == 0) {
+                traceroute_event   = event->data;
+                traceroute_options = event->issuer->options;
+                traceroute_data    = event->issuer->data;
+
+                if (campaign->journal) {
+                    journal_add_traceroute_event(campaign->journal, campaign->target, traceroute_event);
+                }
+
+                // Forward this event to the default traceroute handler
+                // See libparistraceroute/algorithms/traceroute.c
+                traceroute_handler(loop, traceroute_event, traceroute_options, traceroute_data);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+//---------------------------------------------------------------------------
+// Main program
+//---------------------------------------------------------------------------
+
+int main(int argc, char ** argv)
+{
+    int                       exit_code = EXIT_FAILURE;
+    char                    * version = strdup("version 1.0");
+    const char              * usage = "usage: %s [options] host [host ...]\n";
+    traceroute_options_t      traceroute_options;
+    mda_options_t             mda_options;
+    monitor_options_t         monitor_options;
+    pt_loop_t               * loop;
+    options_t               * options;
+    campaign_t                campaign;
+    const char              * algorithm_name;
+    const char              * protocol_name;
+    int                       i, num_hosts;
+
+    memset(&campaign, 0, sizeof(campaign_t));
+
+    // Prepare the commande line options
+    if (!(options = init_options(version))) {
+        fprintf(stderr, "E: Can't initialize options\n");
+        goto ERR_INIT_OPTIONS;
+    }
+
+    // Retrieve values passed in the command-line. The hosts are the last
+    // arguments.
+    num_hosts = options_parse(options, usage, argv);
+    if (num_hosts < 0 || (num_hosts == 0 && !targets_path.s)) {
+        fprintf(stderr, "%s: destination required\n", basename(argv[0]));
+        goto ERR_OPT_PARSE;
+    }
+
+    algorithm_name = algorithm_names[0];
+    protocol_name  = protocol_names[0];
+
+    // Checking if there is any conflicts between options passed in the commandline
+    if (!check_options(is_icmp, is_tcp, is_udp, is_ipv4, is_ipv6, dst_port[3], src_port[3], protocol_name, algorithm_name)) {
+        goto ERR_CHECK_OPTIONS;
+    }
+
+    campaign.use_icmp = is_icmp || strcmp(protocol_name, "icmp") == 0;
+    campaign.use_tcp  = is_tcp  || strcmp(protocol_name, "tcp")  == 0;
+    campaign.use_udp  = is_udp  || strcmp(protocol_name, "udp")  == 0;
+
+    // Hosts to trace
+    if (!(campaign.targets = dynarray_create())) {
+        goto ERR_TARGETS_CREATE;
+    }
+    for (i = argc - num_hosts; i < argc; i++) {
+        if (!dynarray_push_element(campaign.targets, argv[i])) goto ERR_TARGETS_LOAD;
+    }
+    if (targets_path.s && !targets_load(campaign.targets, targets_path.s)) {
+        goto ERR_TARGETS_LOAD;
+    }
+
+    if (previous_path.s && !(campaign.previous = journal_read(previous_path.s))) {
+        fprintf(stderr, "E: Cannot read journal %s\n", previous_path.s);
+        goto ERR_PREVIOUS_READ;
+    }
+
+    if (journal_path.s && !(campaign.journal = journal_open(journal_path.s, do_resume, JOURNAL_DEFAULT_SYNC_INTERVAL))) {
+        fprintf(stderr, "E: Cannot open journal %s\n", journal_path.s);
+        goto ERR_JOURNAL_OPEN;
+    }
+
     // Algorithm options (dedicated options)
     if (strcmp(algorithm_name, "paris-traceroute") == 0) {
-        traceroute_options  = traceroute_get_default_options();
-        ptraceroute_options = &traceroute_options;
-        algorithm_options   = &traceroute_options;
-        algorithm_name      = "traceroute";
+        traceroute_options           = traceroute_get_default_options();
+        campaign.traceroute_options  = &traceroute_options;
+        campaign.algorithm_options   = &traceroute_options;
+        campaign.algorithm_name      = "traceroute";
     } else if ((strcmp(algorithm_name, "mda") == 0) || options_mda_get_is_set()) {
-        mda_options         = mda_get_default_options();
-        ptraceroute_options = &mda_options.traceroute_options;
-        algorithm_options   = &mda_options;
+        mda_options                  = mda_get_default_options();
+        campaign.traceroute_options  = &mda_options.traceroute_options;
+        campaign.algorithm_options   = &mda_options;
+        campaign.algorithm_name      = "mda";
         options_mda_init(&mda_options);
+    } else if (strcmp(algorithm_name, "monitor") == 0) {
+        monitor_options              = monitor_get_default_options();
+        monitor_options.budget       = budget[0];
+        campaign.traceroute_options  = &monitor_options.mda_options.traceroute_options;
+        campaign.algorithm_options   = &monitor_options;
+        campaign.algorithm_name      = "monitor";
+        options_mda_init(&monitor_options.mda_options);
+        if (!(campaign.monitor_targets = dynarray_create())) goto ERR_UNKNOWN_ALGORITHM;
     } else {
         fprintf(stderr, "E: Unknown algorithm");
         goto ERR_UNKNOWN_ALGORITHM;
     }
 
-    // Algorithm options (common options)
-    options_traceroute_init(ptraceroute_options, &dst_addr);
-
     // Create libparistraceroute loop
-    if (!(loop = pt_loop_create(loop_handler, NULL))) {
+    if (!(loop = pt_loop_create(loop_handler, &campaign))) {
         fprintf(stderr, "E: Cannot create libparistraceroute loop");
         goto ERR_LOOP_CREATE;
     }
 
     // Set network options (network and verbose)
     options_network_init(loop->network, is_debug);
-    options_pt_loop_init(loop);
-
-    printf("%s to %s (", algorithm_name, dst_ip);
-    address_dump(&dst_addr);
-    printf("), %u hops max, %u bytes packets\n",
-        ptraceroute_options->max_ttl,
-        (unsigned int)packet_get_size(probe->packet)
-    );
-
-    // Add an algorithm instance in the main loop
-    if (!pt_add_instance(loop, algorithm_name, algorithm_options, probe)) {
-        fprintf(stderr, "E: Cannot add the chosen algorithm");
-        goto ERR_INSTANCE;
+    if (!options_pt_loop_init(loop)) {
+        fprintf(stderr, "E: Cannot initialize libparistraceroute loop");
+        goto ERR_LOOP_INIT;
     }
 
-    // Wait for events. They will be catched by handler_user()
-    if (pt_loop(loop) < 0) {
-        fprintf(stderr, "E: Main loop interrupted");
-        goto ERR_PT_LOOP;
+    // Start the first host (if any), the next ones are started by
+    // loop_handler() once the previous one is completed. monitor probes
+    // every host at once.
+    if (campaign.monitor_targets ? campaign_start_monitor(loop, &campaign) : campaign_start_next_target(loop, &campaign)) {
+        // Wait for events. They will be catched by handler_user()
+        if (pt_loop(loop) < 0) {
+            fprintf(stderr, "E: Main loop interrupted");
+            goto ERR_PT_LOOP;
+        }
+        if (campaign.monitor_targets) printf("%zu path changes detected\n", campaign.num_changes);
     }
-    exit_code = EXIT_SUCCESS;
+    if (campaign.num_failures == 0) exit_code = EXIT_SUCCESS;
 
     // Leave the program
 ERR_PT_LOOP:
-ERR_INSTANCE:
+ERR_LOOP_INIT:
     // pt_loop_free() automatically removes algorithms instances,
     // probe_replies and events from the memory.
     // Options and probe must be manually removed.
     pt_loop_free(loop);
+    probe_free(campaign.probe);
 ERR_LOOP_CREATE:
+    if (campaign.monitor_targets) {
+        for (i = 0; (size_t) i < dynarray_get_size(campaign.monitor_targets); i++) {
+            probe_free(((monitor_target_t *) dynarray_get_ith_element(campaign.monitor_targets, i))->probe_skel);
+        }
+        dynarray_free(campaign.monitor_targets, free);
+    }
 ERR_UNKNOWN_ALGORITHM:
-    probe_free(probe);
-ERR_PROBE_CREATE:
-ERR_ADDRESS_IP_FROM_STRING:
-ERR_ADDRESS_GUESS_FAMILY:
-    if (errno) perror(gai_strerror(errno));
+    journal_close(campaign.journal);
+ERR_JOURNAL_OPEN:
+    journal_close(campaign.previous);
+ERR_PREVIOUS_READ:
+ERR_TARGETS_LOAD:
+    // The hosts loaded from a file have been duplicated
+    for (i = num_hosts; (size_t) i < dynarray_get_size(campaign.targets); i++) {
+        free(dynarray_get_ith_element(campaign.targets, i));
+    }
+    dynarray_free(campaign.targets, NULL);
+ERR_TARGETS_CREATE:
+    // errno may have been set by a recoverable error (e.g. EAGAIN)
+    if (exit_code != EXIT_SUCCESS && errno) perror(gai_strerror(errno));
 ERR_CHECK_OPTIONS:
 ERR_OPT_PARSE:
 ERR_INIT_OPTIONS:
+    free(targets_path.s);
+    free(journal_path.s);
+    free(previous_path.s);
     free(version);
     exit(exit_code);
 }
-
@@ -42,8 +42,8 @@ void loop_handler(pt_loop_t * loop, event_t * event, void * user_data)
             break;
     }
 
-    // Release the event, its nested traceroute_event (if any), its attached probe and reply (if any)
-    //event_free(event); // TODO this may provoke seg fault in case of stars
+    // The event, its nested traceroute_event (if any), its attached probe
+    // and reply (if any) are released by the loop.
 }
 
 /**